@@ -0,0 +1,80 @@
+/*
+  AudioBufferPolicy
+  Start and rebuffer levels for a network stream buffer, from measured jitter
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AudioBufferPolicy.h"
+
+AudioBufferPolicy::AudioBufferPolicy()
+{
+  bufferSize = 0;
+  jitterMs = 0;
+  lastDecayMs = millis();
+  reset();
+}
+
+void AudioBufferPolicy::begin(uint32_t bufferSize)
+{
+  this->bufferSize = bufferSize;
+  reset();
+}
+
+void AudioBufferPolicy::reset()
+{
+  bitRate = DEFAULT_BITRATE;
+  arrived = false; // Connecting isn't a gap
+}
+
+void AudioBufferPolicy::arrival(uint32_t bytes, bool bufferFull)
+{
+  uint32_t now = millis();
+  if (bytes || bufferFull) {
+    if (arrived) {
+      uint32_t gap = now - lastArrivalMs;
+      if (gap > jitterMs) jitterMs = gap;
+    }
+    lastArrivalMs = now;
+    arrived = true;
+  }
+  // Halves in about 20s, so one bad minute doesn't cost latency for the rest of the day
+  if (now - lastDecayMs >= DECAY_MS) {
+    lastDecayMs = now;
+    jitterMs -= jitterMs / 32;
+  }
+}
+
+// Play time in bytes at the current bitrate, within what the buffer can take
+uint32_t AudioBufferPolicy::Level(uint32_t ms, uint32_t minBytes)
+{
+  if (ms > MAX_START_MS) ms = MAX_START_MS;
+  uint32_t bytes = (uint64_t)bitRate * ms / 8000;
+  if (bytes < minBytes) bytes = minBytes;
+  uint32_t most = bufferSize * 3 / 4; // Room for the producer to keep going
+  return (bytes < most) ? bytes : most;
+}
+
+uint32_t AudioBufferPolicy::getStartLevel()
+{
+  return Level(MIN_START_MS + jitterMs * 3 / 2, 2 * LOW_BYTES);
+}
+
+// Deeper than the start, whatever stalled will likely stall again
+uint32_t AudioBufferPolicy::getResumeLevel()
+{
+  uint32_t start = getStartLevel();
+  uint32_t resume = Level(2 * MIN_START_MS + jitterMs * 2, 2 * LOW_BYTES);
+  return (resume > start) ? resume : start;
+}
@@ -0,0 +1,66 @@
+/*
+  AudioBufferPolicy
+  Start and rebuffer levels for a network stream buffer, from measured jitter
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOBUFFERPOLICY_H
+#define _AUDIOBUFFERPOLICY_H
+
+#include <Arduino.h>
+
+// The producer reports what each fill brought in.  The longest gap between
+// arrivals, decaying slowly, is the stall the buffer has to ride out, and
+// the levels are that much play time at the stream's bitrate plus a margin.
+// A steady link starts after a quarter second, one that stalls for seconds
+// buffers seconds, never more than the buffer allows.  While playing,
+// decoding pauses below getLowLevel() and picks up again at
+// getResumeLevel(), instead of the decoder running dry.
+// arrival() may be called from another task than the getters.
+class AudioBufferPolicy
+{
+  public:
+    AudioBufferPolicy();
+
+    void begin(uint32_t bufferSize); // Keeps what was learnt about the link
+    void reset(); // A new stream: bitrate unknown, the link stays the same
+
+    // Producer side, a full buffer isn't a gap in the stream
+    void arrival(uint32_t bytes, bool bufferFull);
+
+    // Consumer side, 0 until the decoder knows
+    void setBitRate(uint32_t bitsPerSec) { if (bitsPerSec) bitRate = bitsPerSec; }
+
+    uint32_t getStartLevel();  // Bytes buffered before decoding starts
+    uint32_t getResumeLevel(); // Bytes buffered before it goes on after a stall
+    uint32_t getLowLevel() { return LOW_BYTES; } // Less than a decoder may ask for at once
+    uint32_t getJitterMs() { return jitterMs; }
+    uint32_t getBitRate() { return bitRate; }
+
+    enum { MIN_START_MS = 250, MAX_START_MS = 8000, LOW_BYTES = 4096 };
+    enum { DEFAULT_BITRATE = 128000, DECAY_MS = 1000 };
+
+  private:
+    uint32_t Level(uint32_t ms, uint32_t minBytes);
+
+    uint32_t bufferSize;
+    uint32_t bitRate;
+    volatile uint32_t jitterMs;
+    uint32_t lastArrivalMs;
+    uint32_t lastDecayMs;
+    bool arrived;
+};
+
+#endif
@@ -0,0 +1,307 @@
+/*
+  AudioDemuxMP4
+  Streaming MP4/M4A demuxer returning the raw AAC access units of the first audio track
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioDemuxMP4.h"
+
+static inline uint32_t BE32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint16_t BE16(const uint8_t *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+AudioDemuxMP4::AudioDemuxMP4()
+{
+  file = NULL;
+  sampleRate = 0;
+  channels = 0;
+  sampleCount = 0;
+  fixedSize = 0;
+  stszTable = 0;
+  chunkCount = 0;
+  stcoTable = 0;
+  co64 = false;
+  stscCount = 0;
+  stscTable = 0;
+  cacheFirst = 0;
+  cacheCount = 0;
+  rewind();
+}
+
+bool AudioDemuxMP4::IsMP4(const uint8_t *header)
+{
+  return !memcmp(header + 4, "ftyp", 4);
+}
+
+bool AudioDemuxMP4::ReadAt(uint32_t pos, void *dest, uint32_t len)
+{
+  return file->seek(pos, SEEK_SET) && file->read(dest, len) == len;
+}
+
+// Search the boxes in [start, end) for one of the given type
+bool AudioDemuxMP4::FindBox(uint32_t start, uint32_t end, const char *type, uint32_t *payload, uint32_t *boxEnd)
+{
+  uint32_t pos = start;
+  while (pos + 8 <= end) {
+    uint8_t hdr[16];
+    if (!ReadAt(pos, hdr, 8)) return false;
+    uint32_t size = BE32(hdr);
+    uint32_t hdrLen = 8;
+    if (size == 1) {
+      // 64-bit size, only the low word can be meaningful on an SD card file
+      if (!ReadAt(pos + 8, hdr + 8, 8) || BE32(hdr + 8)) return false;
+      size = BE32(hdr + 12);
+      hdrLen = 16;
+    } else if (size == 0) {
+      size = end - pos; // Runs to the end of the file
+    }
+    if (size < hdrLen || size > end - pos) return false;
+    if (!memcmp(hdr + 4, type, 4)) {
+      *payload = pos + hdrLen;
+      *boxEnd = pos + size;
+      return true;
+    }
+    pos += size;
+  }
+  return false;
+}
+
+// AudioSpecificConfig from the esds box, ISO 14496-3 1.6.2.1
+bool AudioDemuxMP4::ParseAudioConfig(const uint8_t *asc, int len)
+{
+  static const int rates[13] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+  uint32_t bits = 0;
+  int avail = 0;
+  int pos = 0;
+  auto get = [&](int n) -> uint32_t {
+    while (avail < n) {
+      bits = (bits << 8) | (pos < len ? asc[pos++] : 0);
+      avail += 8;
+    }
+    avail -= n;
+    return (bits >> avail) & ((1 << n) - 1);
+  };
+
+  int aot = get(5);
+  if (aot == 31) aot = 32 + get(6);
+  uint32_t freqIdx = get(4);
+  int rate = (freqIdx == 15) ? get(24) : (freqIdx < 13 ? rates[freqIdx] : 0);
+  int chanCfg = get(4);
+  if (aot == 5 || aot == 29) {
+    // Explicit SBR/PS signalling, the core config follows the extension rate
+    if (get(4) == 15) get(24);
+    aot = get(5);
+  }
+  if (aot != 2 || !rate) return false; // Helix only decodes AAC-LC cores
+  sampleRate = rate;
+  if (chanCfg == 1 || chanCfg == 2) channels = chanCfg;
+  return channels == 1 || channels == 2;
+}
+
+// stsd with a single mp4a entry whose esds carries the decoder config
+bool AudioDemuxMP4::ParseSampleEntry(uint32_t start, uint32_t end)
+{
+  uint8_t e[8 + 36];
+  if (!ReadAt(start, e, sizeof(e)) || memcmp(e + 12, "mp4a", 4)) return false;
+  uint32_t entryEnd = start + 8 + BE32(e + 8);
+  if (entryEnd > end) return false;
+  const uint8_t *entry = e + 8;
+  channels = BE16(entry + 24);
+  sampleRate = BE32(entry + 32) >> 16;
+
+  // QuickTime v1/v2 sound descriptions carry extra fields before the child boxes
+  uint16_t version = BE16(entry + 16);
+  uint32_t children = start + 8 + 36 + ((version == 1) ? 16 : (version == 2) ? 36 : 0);
+  uint32_t esds, esdsEnd;
+  if (!FindBox(children, entryEnd, "esds", &esds, &esdsEnd)) return false;
+
+  uint8_t d[64];
+  int n = esdsEnd - esds;
+  if (n > (int)sizeof(d)) n = sizeof(d);
+  if (!ReadAt(esds, d, n)) return false;
+
+  // ES_Descriptor -> DecoderConfigDescriptor -> DecoderSpecificInfo
+  int i = 4; // version/flags
+  while (i + 2 <= n) {
+    uint8_t tag = d[i++];
+    uint32_t len = 0;
+    for (int k = 0; k < 4 && i < n; k++) {
+      uint8_t b = d[i++];
+      len = (len << 7) | (b & 0x7f);
+      if (!(b & 0x80)) break;
+    }
+    if (tag == 0x03) {
+      if (i + 3 > n) return false;
+      uint8_t flags = d[i + 2];
+      i += 3;
+      if (flags & 0x80) i += 2;
+      if ((flags & 0x40) && i < n) i += 1 + d[i];
+      if (flags & 0x20) i += 2;
+    } else if (tag == 0x04) {
+      if (i + 13 > n || d[i] != 0x40) return false; // Not MPEG-4 audio
+      i += 13;
+    } else if (tag == 0x05) {
+      return (i + (int)len <= n) && ParseAudioConfig(d + i, len);
+    } else {
+      i += len;
+    }
+  }
+  return false;
+}
+
+bool AudioDemuxMP4::ParseTrack(uint32_t start, uint32_t end)
+{
+  uint32_t mdia, mdiaEnd, minf, minfEnd, stbl, stblEnd, p, e;
+  uint8_t b[12];
+  if (!FindBox(start, end, "mdia", &mdia, &mdiaEnd)) return false;
+  if (!FindBox(mdia, mdiaEnd, "hdlr", &p, &e) || !ReadAt(p + 8, b, 4) || memcmp(b, "soun", 4)) return false;
+  if (!FindBox(mdia, mdiaEnd, "minf", &minf, &minfEnd)) return false;
+  if (!FindBox(minf, minfEnd, "stbl", &stbl, &stblEnd)) return false;
+
+  if (!FindBox(stbl, stblEnd, "stsd", &p, &e) || !ParseSampleEntry(p, e)) return false;
+
+  if (!FindBox(stbl, stblEnd, "stsz", &p, &e) || !ReadAt(p + 4, b, 8)) return false;
+  fixedSize = BE32(b);
+  sampleCount = BE32(b + 4);
+  stszTable = p + 12;
+
+  if (FindBox(stbl, stblEnd, "stco", &p, &e)) {
+    co64 = false;
+  } else if (FindBox(stbl, stblEnd, "co64", &p, &e)) {
+    co64 = true;
+  } else {
+    return false;
+  }
+  if (!ReadAt(p + 4, b, 4)) return false;
+  chunkCount = BE32(b);
+  stcoTable = p + 8;
+
+  if (!FindBox(stbl, stblEnd, "stsc", &p, &e) || !ReadAt(p + 4, b, 4)) return false;
+  stscCount = BE32(b);
+  stscTable = p + 8;
+
+  return sampleCount && chunkCount && stscCount;
+}
+
+bool AudioDemuxMP4::open(AudioFileSource *source)
+{
+  file = source;
+  sampleCount = 0;
+  uint32_t end = file->getSize();
+  uint32_t moov, moovEnd, trak, trakEnd;
+  if (!FindBox(0, end, "moov", &moov, &moovEnd)) return false;
+  uint32_t pos = moov;
+  while (FindBox(pos, moovEnd, "trak", &trak, &trakEnd)) {
+    if (ParseTrack(trak, trakEnd)) {
+      rewind();
+      return true;
+    }
+    pos = trakEnd;
+  }
+  sampleCount = 0;
+  return false;
+}
+
+void AudioDemuxMP4::rewind()
+{
+  sampleIdx = 0;
+  chunkIdx = -1;
+  samplesLeftInChunk = 0;
+  stscIdx = 0;
+  samplesPerChunk = 0;
+  nextRunChunk = 0xffffffff;
+  sampleOffset = 0;
+  cacheCount = 0;
+  if (stscCount) LoadRun(0);
+}
+
+// stsc maps runs of chunks to a samples-per-chunk count
+bool AudioDemuxMP4::LoadRun(uint32_t idx)
+{
+  uint8_t b[24];
+  bool last = (idx + 1 >= stscCount);
+  if (idx >= stscCount || !ReadAt(stscTable + idx * 12, b, last ? 12 : 24)) return false;
+  samplesPerChunk = BE32(b + 4);
+  nextRunChunk = last ? 0xffffffff : BE32(b + 12);
+  return true;
+}
+
+uint32_t AudioDemuxMP4::SampleSize(uint32_t idx)
+{
+  if (fixedSize) return fixedSize;
+  if (idx < cacheFirst || idx >= cacheFirst + cacheCount) {
+    uint32_t n = sampleCount - idx;
+    if (n > SIZE_CACHE) n = SIZE_CACHE;
+    if (!ReadAt(stszTable + idx * 4, sizeCache, n * 4)) {
+      cacheCount = 0;
+      return 0;
+    }
+    const uint8_t *b = (const uint8_t *)sizeCache;
+    for (uint32_t i = 0; i < n; i++) sizeCache[i] = BE32(b + i * 4);
+    cacheFirst = idx;
+    cacheCount = n;
+  }
+  return sizeCache[idx - cacheFirst];
+}
+
+bool AudioDemuxMP4::NextSample(uint32_t *offset, uint32_t *size)
+{
+  if (sampleIdx >= sampleCount) return false;
+  if (!samplesLeftInChunk) {
+    do {
+      chunkIdx++;
+      if ((uint32_t)chunkIdx >= chunkCount) return false;
+      while ((uint32_t)chunkIdx + 1 >= nextRunChunk) {
+        if (!LoadRun(++stscIdx)) return false;
+      }
+    } while (!samplesPerChunk);
+    uint8_t b[8];
+    if (co64) {
+      if (!ReadAt(stcoTable + chunkIdx * 8, b, 8) || BE32(b)) return false;
+      sampleOffset = BE32(b + 4);
+    } else {
+      if (!ReadAt(stcoTable + chunkIdx * 4, b, 4)) return false;
+      sampleOffset = BE32(b);
+    }
+    samplesLeftInChunk = samplesPerChunk;
+  }
+  *size = SampleSize(sampleIdx);
+  *offset = sampleOffset;
+  sampleOffset += *size;
+  samplesLeftInChunk--;
+  sampleIdx++;
+  return true;
+}
+
+int AudioDemuxMP4::read(uint8_t *dest, uint32_t maxLen)
+{
+  uint32_t offset, size;
+  while (NextSample(&offset, &size)) {
+    if (!size) return 0; // Table read failed
+    // An access unit that doesn't fit can't be valid AAC, drop it rather than stall
+    if (size > maxLen) continue;
+    if (file->getPos() != offset && !file->seek(offset, SEEK_SET)) return 0;
+    if (file->read(dest, size) != size) return 0;
+    return size;
+  }
+  return 0;
+}
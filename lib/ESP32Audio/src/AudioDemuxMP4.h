@@ -0,0 +1,82 @@
+/*
+  AudioDemuxMP4
+  Streaming MP4/M4A demuxer returning the raw AAC access units of the first audio track
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIODEMUXMP4_H
+#define _AUDIODEMUXMP4_H
+
+#include "AudioFileSource.h"
+
+// Only the box headers are read when opening, the sample tables (stsz, stco,
+// stsc) stay in the file and are walked with a small cache while playing, so
+// memory use doesn't grow with the length of the track.  Needs a seekable
+// source, moov may come before or after mdat.
+class AudioDemuxMP4
+{
+  public:
+    AudioDemuxMP4();
+
+    static bool IsMP4(const uint8_t *header); // First 8 bytes of the file
+    bool open(AudioFileSource *source);
+    void rewind();
+    int read(uint8_t *dest, uint32_t maxLen); // Next access unit, 0 at the end of the track
+
+    int getSampleRate() { return sampleRate; } // Core (AAC-LC) rate, SBR doubles it in the decoder
+    int getChannels() { return channels; }
+    uint32_t getSampleCount() { return sampleCount; }
+
+  private:
+    enum { SIZE_CACHE = 64 };
+
+    AudioFileSource *file;
+    int sampleRate;
+    int channels;
+
+    // Sample tables, as file offsets of their first entry
+    uint32_t sampleCount;
+    uint32_t fixedSize;
+    uint32_t stszTable;
+    uint32_t chunkCount;
+    uint32_t stcoTable;
+    bool co64;
+    uint32_t stscCount;
+    uint32_t stscTable;
+
+    // Playback position
+    uint32_t sampleIdx;
+    int32_t chunkIdx;
+    uint32_t samplesLeftInChunk;
+    uint32_t stscIdx;
+    uint32_t samplesPerChunk;
+    uint32_t nextRunChunk; // 1-based first chunk of the next stsc run
+    uint32_t sampleOffset;
+
+    uint32_t sizeCache[SIZE_CACHE];
+    uint32_t cacheFirst;
+    uint32_t cacheCount;
+
+    bool ReadAt(uint32_t pos, void *dest, uint32_t len);
+    bool FindBox(uint32_t start, uint32_t end, const char *type, uint32_t *payload, uint32_t *boxEnd);
+    bool ParseTrack(uint32_t start, uint32_t end);
+    bool ParseSampleEntry(uint32_t start, uint32_t end);
+    bool ParseAudioConfig(const uint8_t *asc, int len);
+    bool LoadRun(uint32_t idx);
+    uint32_t SampleSize(uint32_t idx);
+    bool NextSample(uint32_t *offset, uint32_t *size);
+};
+
+#endif
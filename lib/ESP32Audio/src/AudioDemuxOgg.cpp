@@ -0,0 +1,247 @@
+/*
+  AudioDemuxOgg
+  Streaming Ogg demuxer returning the packets of one logical stream
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioDemuxOgg.h"
+
+// CRC-32 of polynomial 0x04c11db7, a nibble at a time
+static const uint32_t crcNibble[16] = {
+  0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+  0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd
+};
+
+static uint32_t Crc(uint32_t crc, const uint8_t *p, uint32_t len)
+{
+  while (len--) {
+    crc = (crc << 4) ^ crcNibble[(crc >> 28) ^ (*p >> 4)];
+    crc = (crc << 4) ^ crcNibble[(crc >> 28) ^ (*p & 15)];
+    p++;
+  }
+  return crc;
+}
+
+static inline uint32_t LE32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+AudioDemuxOgg::AudioDemuxOgg()
+{
+  begin(NULL, NULL, 0, NULL, 0);
+}
+
+bool AudioDemuxOgg::IsOgg(const uint8_t *header)
+{
+  return !memcmp(header, "OggS", 4);
+}
+
+void AudioDemuxOgg::begin(AudioFileSource *source, uint8_t *buffer, uint32_t bufferSize, const char *magic, int magicLen)
+{
+  file = source;
+  buff = buffer;
+  buffSize = bufferSize;
+  this->magic = magic;
+  this->magicLen = magicLen;
+  locked = false;
+  ended = false;
+  serial = 0;
+  segs = 0;
+  seg = 0;
+  lastEnd = -1;
+  keep = 0;
+  pos = 0;
+  packetStart = 0;
+  dropFirst = false;
+  firstCut = false;
+  granule = -1;
+  pageEOS = false;
+  streamStart = false;
+  newStream = false;
+  pktLast = false;
+  skipped = 0;
+}
+
+// Network sources hand out what has arrived, keep asking until it's all there
+bool AudioDemuxOgg::ReadFully(uint8_t *dest, uint32_t len)
+{
+  while (len) {
+    uint32_t n = file->read(dest, len);
+    if (!n) return false;
+    dest += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool AudioDemuxOgg::Skip(uint32_t len, uint32_t *crc)
+{
+  uint8_t tmp[128];
+  while (len) {
+    uint32_t n = (len < sizeof(tmp)) ? len : sizeof(tmp);
+    if (!ReadFully(tmp, n)) return false;
+    if (crc) *crc = Crc(*crc, tmp, n);
+    len -= n;
+  }
+  return true;
+}
+
+// Reads up to and including the next page header
+bool AudioDemuxOgg::Sync(uint8_t *hdr)
+{
+  uint32_t have = 0;
+  bool lost = false;
+  while (true) {
+    if (!ReadFully(hdr + have, HEADER_SIZE - have)) return false;
+    if (IsOgg(hdr) && !hdr[4]) {
+      if (lost) skipped++;
+      return true;
+    }
+    // Start again from the next 'O', it may be the capture pattern
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(memchr(hdr + 1, 'O', HEADER_SIZE - 1));
+    uint32_t drop = p ? p - hdr : (uint32_t)HEADER_SIZE;
+    memmove(hdr, hdr + drop, HEADER_SIZE - drop);
+    have = HEADER_SIZE - drop;
+    lost = true;
+  }
+}
+
+// Reads the packets of the page into buff from base, those that don't fit
+// are skipped and taken out of the lacing.  Normally that's none, but a
+// comment header with cover art can share a page with the setup header.
+bool AudioDemuxOgg::ReadPayload(uint32_t base, int n, uint32_t *crc)
+{
+  uint32_t at = base;
+  int out = 0;
+  firstCut = false;
+  for (int i = 0; i < n; ) {
+    int j = i;
+    uint32_t size = 0;
+    while (j < n) {
+      size += lacing[j];
+      if (lacing[j++] < 255) break;
+    }
+    if (at + size <= buffSize) {
+      if (!ReadFully(buff + at, size)) return false;
+      *crc = Crc(*crc, buff + at, size);
+      at += size;
+      memmove(lacing + out, lacing + i, j - i);
+      out += j - i;
+    } else {
+      if (!Skip(size, crc)) return false;
+      if (!i) {
+        // The rest of a packet from earlier pages, which goes too
+        firstCut = true;
+        at = 0;
+      }
+      skipped++;
+    }
+    i = j;
+  }
+  segs = out;
+  return true;
+}
+
+// Reads the next page of the followed stream, false at the end of the source
+bool AudioDemuxOgg::ReadPage()
+{
+  uint8_t hdr[HEADER_SIZE];
+  while (true) {
+    if (!Sync(hdr)) return false;
+    int n = hdr[26];
+    if (!ReadFully(lacing, n)) return false;
+    uint32_t len = 0;
+    for (int i = 0; i < n; i++) len += lacing[i];
+
+    // A new stream is a candidate unless we're in the middle of one
+    uint8_t flags = hdr[5];
+    uint32_t pageSerial = LE32(hdr + 14);
+    bool bos = flags & 2;
+    if (bos ? (locked && !ended) : (!locked || ended || (pageSerial != serial))) {
+      if (!Skip(len, NULL)) return false;
+      continue;
+    }
+
+    // Continues the packet in keep, if there is one
+    uint32_t base = ((flags & 1) && !bos) ? keep : 0;
+    uint32_t crc = LE32(hdr + 22);
+    memset(hdr + 22, 0, 4);
+    uint32_t sum = Crc(Crc(0, hdr, HEADER_SIZE), lacing, n);
+    if (!ReadPayload(base, n, &sum)) return false;
+    if (sum != crc) {
+      skipped++;
+      continue;
+    }
+    if (firstCut) base = 0;
+
+    if (bos) {
+      uint32_t first = 0;
+      for (int i = 0; i < segs; i++) {
+        first += lacing[i];
+        if (lacing[i] < 255) break;
+      }
+      if (first < (uint32_t)magicLen || memcmp(buff, magic, magicLen)) continue;
+      locked = true;
+      serial = pageSerial;
+      newStream = true;
+    }
+    ended = flags & 4;
+
+    // A continued page after a lost one starts with the end of a packet we don't have
+    dropFirst = (flags & 1) && !bos && !base && !firstCut;
+    keep = base;
+    seg = 0;
+    lastEnd = -1;
+    for (int i = 0; i < segs; i++) {
+      if (lacing[i] < 255) lastEnd = i;
+    }
+    pos = keep;
+    packetStart = 0;
+    granule = (int64_t)LE32(hdr + 6) | ((int64_t)LE32(hdr + 10) << 32);
+    pageEOS = flags & 4;
+    return true;
+  }
+}
+
+int AudioDemuxOgg::read(const uint8_t **packet)
+{
+  if (!file || !buff) return -1;
+  while (true) {
+    if (seg >= segs) {
+      // Whatever is open carries on in the next page
+      keep = pos - packetStart;
+      if (keep && packetStart) memmove(buff, buff + packetStart, keep);
+      if (!ReadPage()) return -1;
+    }
+    while (seg < segs) {
+      uint8_t l = lacing[seg++];
+      pos += l;
+      if (l == 255) continue;
+      uint32_t start = packetStart;
+      packetStart = pos;
+      if (dropFirst) {
+        dropFirst = false;
+        continue;
+      }
+      *packet = buff + start;
+      pktLast = (seg - 1 == lastEnd);
+      streamStart = newStream;
+      newStream = false;
+      return pos - start;
+    }
+  }
+}
@@ -0,0 +1,85 @@
+/*
+  AudioDemuxOgg
+  Streaming Ogg demuxer returning the packets of one logical stream
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIODEMUXOGG_H
+#define _AUDIODEMUXOGG_H
+
+#include "AudioFileSource.h"
+
+// Pages are read one at a time into the caller's buffer, after whatever part
+// of a packet the last page left unfinished, so packets are handed out in
+// place.  The first stream whose opening packet starts with the magic is
+// followed, and the next one like it once that ends, which is how internet
+// radio chains songs.  Pages of other streams, pages that fail their CRC
+// and packets too big for the buffer are skipped, so a source can be joined
+// in the middle.  Never seeks.
+class AudioDemuxOgg
+{
+  public:
+    AudioDemuxOgg();
+
+    static bool IsOgg(const uint8_t *header); // First 4 bytes
+    void begin(AudioFileSource *source, uint8_t *buffer, uint32_t bufferSize, const char *magic, int magicLen);
+    int read(const uint8_t **packet); // Next packet in the buffer, its length or -1 at the end of the source
+
+    // About the packet read() just returned
+    bool isStreamStart() { return streamStart; } // First packet of a (chained) stream
+    bool isStreamEnd() { return pktLast && pageEOS; } // Last packet of the stream
+    int64_t getGranule() { return pktLast ? granule : -1; } // Page granule, for the last packet ending on it
+    uint32_t getSkipped() { return skipped; } // Damaged pages and oversized packets dropped so far
+
+  private:
+    enum { HEADER_SIZE = 27 };
+
+    AudioFileSource *file;
+    uint8_t *buff;
+    uint32_t buffSize;
+    const char *magic;
+    int magicLen;
+
+    // Stream being followed
+    bool locked;
+    bool ended;
+    uint32_t serial;
+
+    // Current page, its payload from buff[keep]
+    uint8_t lacing[255];
+    int segs;
+    int seg;
+    int lastEnd; // Segment the last packet on the page finishes in
+    uint32_t keep; // Unfinished packet from earlier pages at the start of buff
+    uint32_t pos;
+    uint32_t packetStart;
+    bool dropFirst; // First packet continues one we don't have
+    bool firstCut;
+    int64_t granule;
+    bool pageEOS;
+
+    bool streamStart;
+    bool newStream;
+    bool pktLast;
+    uint32_t skipped;
+
+    bool ReadFully(uint8_t *dest, uint32_t len);
+    bool Skip(uint32_t len, uint32_t *crc);
+    bool Sync(uint8_t *hdr);
+    bool ReadPayload(uint32_t base, int n, uint32_t *crc);
+    bool ReadPage();
+};
+
+#endif
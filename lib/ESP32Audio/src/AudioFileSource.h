@@ -23,6 +23,7 @@
 
 #include <Arduino.h>
 #include "AudioStatus.h"
+#include "AudioStats.h"
 
 class AudioFileSource
 {
@@ -38,6 +39,7 @@ class AudioFileSource
     virtual uint32_t getSize() { return 0; };
     virtual uint32_t getPos() { return 0; };
     virtual bool loop() { return true; };
+    virtual void getStats(AudioStats *st) { (void)st; };
 
   public:
     virtual bool RegisterMetadataCB(AudioStatus::metadataCBFn fn, void *data) { return cb.RegisterMetadataCB(fn, data); }
@@ -90,6 +90,11 @@ uint32_t AudioFileSourceBuffer::getFillLevel()
   return length;
 }
 
+void AudioFileSourceBuffer::getStats(AudioStats *st)
+{
+  stats.get(st, length, buffSize);
+}
+
 uint32_t AudioFileSourceBuffer::read(void *data, uint32_t len)
 {
   if (!buffer) return src->read(data, len);
@@ -134,8 +139,10 @@ uint32_t AudioFileSourceBuffer::read(void *data, uint32_t len)
     writePtr = 0;
     length = 0;
     filled = false;
+    stats.underflow();
     cb.st(STATUS_UNDERFLOW, PSTR("Buffer underflow"));
   }
+  stats.sample(length, buffSize);
 
   fill();
 
@@ -38,6 +38,7 @@ class AudioFileSourceBuffer : public AudioFileSource
     virtual uint32_t getSize() override;
     virtual uint32_t getPos() override;
     virtual bool loop() override;
+    virtual void getStats(AudioStats *st) override;
 
     virtual uint32_t getFillLevel();
 
@@ -55,6 +56,7 @@ class AudioFileSourceBuffer : public AudioFileSource
     uint32_t readPtr;
     uint32_t length;
     bool filled;
+    AudioFillStats stats;
 };
 
 
@@ -1,7 +1,7 @@
 /*
   AudioFileSourceHTTPStream
   Streaming HTTP source
-  
+
   Copyright (C) 2017  Earle F. Philhower, III
 
   This program is free software: you can redistribute it and/or modify
@@ -19,41 +19,418 @@
 */
 
 #include "AudioFileSourceHTTPStream.h"
+#ifdef ESP32
+  #include <lwip/sockets.h>
+  #include <lwip/dns.h>
+#endif
 
 AudioFileSourceHTTPStream::AudioFileSourceHTTPStream()
 {
+  client = NULL;
+  state = STATE_IDLE;
+  dns = NULL;
+  sock = -1;
   pos = 0;
+  size = -1;
   reconnectTries = 0;
+  reconnectDelayMs = 1000;
   saveURL[0] = 0;
 }
 
 AudioFileSourceHTTPStream::AudioFileSourceHTTPStream(const char *url)
 {
-  saveURL[0] = 0;
+  client = NULL;
+  state = STATE_IDLE;
+  dns = NULL;
+  sock = -1;
+  pos = 0;
+  size = -1;
   reconnectTries = 0;
+  reconnectDelayMs = 1000;
+  saveURL[0] = 0;
   open(url);
 }
 
 bool AudioFileSourceHTTPStream::open(const char *url)
 {
+  close();
+  strncpy(saveURL, url, sizeof(saveURL));
+  saveURL[sizeof(saveURL)-1] = 0;
   pos = 0;
-  http.begin(url);
-  http.setReuse(true);
-  int code = http.GET();
-  if (code != HTTP_CODE_OK) {
-    http.end();
-    cb.st(STATUS_HTTPFAIL, PSTR("Can't open HTTP request"));
+  size = -1;
+  attempt = 0;
+  redirects = 0;
+  if (!ParseURL()) {
+    Fail(STATUS_HTTPFAIL, PSTR("Can't open HTTP request"));
     return false;
   }
-  size = http.getSize();
-  strncpy(saveURL, url, sizeof(saveURL));
-  saveURL[sizeof(saveURL)-1] = 0;
+  StartAttempt();
   return true;
 }
 
 AudioFileSourceHTTPStream::~AudioFileSourceHTTPStream()
 {
-  http.end();
+  Disconnect();
+}
+
+// http://host[:port][/path] or https://..., fills in host, port and path
+bool AudioFileSourceHTTPStream::ParseURL()
+{
+  const char *p = saveURL;
+  if (!strncmp(p, "http://", 7)) {
+    secure = false;
+    port = 80;
+    p += 7;
+  } else if (!strncmp(p, "https://", 8)) {
+    secure = true;
+    port = 443;
+    p += 8;
+  } else {
+    return false;
+  }
+  size_t hostLen = strcspn(p, ":/");
+  if (!hostLen || (hostLen >= sizeof(host))) return false;
+  memcpy(host, p, hostLen);
+  host[hostLen] = 0;
+  p += hostLen;
+  if (*p == ':') {
+    port = atoi(p + 1);
+    p += strcspn(p, "/");
+  }
+  path = *p ? p : "/";
+  return port != 0;
+}
+
+// Absolute or host relative, as servers send both in a Location header
+bool AudioFileSourceHTTPStream::SetLocation(const char *url)
+{
+  char newURL[sizeof(saveURL)];
+  if (!strncmp(url, "http://", 7) || !strncmp(url, "https://", 8)) {
+    snprintf(newURL, sizeof(newURL), "%s", url);
+  } else if (url[0] == '/') {
+    snprintf(newURL, sizeof(newURL), "%s://%s:%u%s", secure ? "https" : "http", host, port, url);
+  } else {
+    return false;
+  }
+  memcpy(saveURL, newURL, sizeof(saveURL));
+  return ParseURL();
+}
+
+void AudioFileSourceHTTPStream::Disconnect()
+{
+  if (dns) {
+    // Whoever of us and the lwIP callback comes second frees the query
+    if (dns->state.exchange(DNS_ABANDONED) == DNS_DONE) delete dns;
+    dns = NULL;
+  }
+#ifdef ESP32
+  if (sock >= 0) {
+    ::close(sock);
+    sock = -1;
+  }
+#endif
+  if (client) {
+    client->stop();
+    delete client;
+    client = NULL;
+  }
+}
+
+void AudioFileSourceHTTPStream::DNSFound(const char *name, const struct ip_addr *addr, void *arg)
+{
+  (void) name;
+  DNSQuery *q = reinterpret_cast<DNSQuery*>(arg);
+#ifdef ESP32
+  q->ip = addr ? ip4_addr_get_u32(ip_2_ip4(addr)) : 0;
+#else
+  (void) addr;
+  q->ip = 0;
+#endif
+  if (q->state.exchange(DNS_DONE) == DNS_ABANDONED) delete q;
+}
+
+void AudioFileSourceHTTPStream::StartAttempt()
+{
+  Disconnect();
+  stateStart = millis();
+#ifdef ESP32
+  // Plain HTTP connects on a non-blocking socket, TLS is left to WiFiClientSecure
+  if (!secure) {
+    cb.st(STATUS_RESOLVING, PSTR("Resolving host"));
+    dns = new DNSQuery;
+    dns->state = DNS_PENDING;
+    dns->ip = 0;
+    ip_addr_t addr;
+    err_t err = dns_gethostbyname(host, &addr, DNSFound, dns);
+    if (err == ERR_OK) {
+      dns->ip = ip4_addr_get_u32(ip_2_ip4(&addr));
+      dns->state = DNS_DONE;
+    } else if (err != ERR_INPROGRESS) {
+      delete dns;
+      dns = NULL;
+      Retry(STATUS_HTTPFAIL, PSTR("Can't resolve host"));
+      return;
+    }
+    state = STATE_RESOLVING;
+    return;
+  }
+#endif
+  cb.st(STATUS_CONNECTING, PSTR("Connecting"));
+  state = STATE_CONNECTING;
+}
+
+void AudioFileSourceHTTPStream::PollResolve()
+{
+#ifdef ESP32
+  if (dns->state.load() == DNS_PENDING) {
+    if (millis() - stateStart > CONNECT_TIMEOUT_MS) Retry(STATUS_HTTPFAIL, PSTR("Can't resolve host"));
+    return;
+  }
+  uint32_t ip = dns->ip;
+  delete dns;
+  dns = NULL;
+  if (!ip) {
+    Retry(STATUS_HTTPFAIL, PSTR("Can't resolve host"));
+    return;
+  }
+
+  sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock < 0) {
+    Retry(STATUS_HTTPFAIL, PSTR("Can't connect"));
+    return;
+  }
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = ip;
+  if ((connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) && (errno != EINPROGRESS)) {
+    Retry(STATUS_HTTPFAIL, PSTR("Can't connect"));
+    return;
+  }
+  cb.st(STATUS_CONNECTING, PSTR("Connecting"));
+  stateStart = millis();
+  state = STATE_CONNECTING;
+#endif
+}
+
+void AudioFileSourceHTTPStream::PollConnect()
+{
+#ifdef ESP32
+  if (sock >= 0) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    struct timeval tv = { 0, 0 };
+    int ready = select(sock + 1, NULL, &fds, NULL, &tv);
+    if (!ready) {
+      if (millis() - stateStart > CONNECT_TIMEOUT_MS) Retry(STATUS_HTTPFAIL, PSTR("Can't connect"));
+      return;
+    }
+    int err = 0;
+    socklen_t errLen = sizeof(err);
+    if ((ready < 0) || (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &errLen) < 0) || err) {
+      Retry(STATUS_HTTPFAIL, PSTR("Can't connect"));
+      return;
+    }
+    // WiFiClient takes over the socket, it expects a blocking one
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+    client = new WiFiClient(sock);
+    sock = -1;
+  } else
+#endif
+  {
+    if (secure) {
+      WiFiClientSecure *tls = new WiFiClientSecure();
+      tls->setInsecure(); // A radio stream isn't worth a certificate store
+      client = tls;
+    } else {
+      client = new WiFiClient();
+    }
+    if (!client->connect(host, port)) {
+      Retry(STATUS_HTTPFAIL, PSTR("Can't connect"));
+      return;
+    }
+  }
+  SendRequest();
+}
+
+void AudioFileSourceHTTPStream::SendRequest()
+{
+  // HTTP/1.0 so the server never answers chunked
+  char req[384];
+  int len;
+  if (port == (secure ? 443 : 80)) {
+    len = snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\nHost: %s\r\n", path, host);
+  } else {
+    len = snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\nHost: %s:%u\r\n", path, host, port);
+  }
+  len += snprintf(req + len, sizeof(req) - len, "User-Agent: ESP32Audio\r\nConnection: close\r\n%s\r\n", ExtraHeaders());
+  if ((len >= (int)sizeof(req)) || ((int)client->write(reinterpret_cast<const uint8_t*>(req), len) != len)) {
+    Retry(STATUS_HTTPFAIL, PSTR("Can't open HTTP request"));
+    return;
+  }
+  NewConnection();
+  httpCode = 0;
+  haveStatus = false;
+  redirect = false;
+  lineLen = 0;
+  stateStart = millis();
+  state = STATE_HEADERS;
+}
+
+void AudioFileSourceHTTPStream::PollHeaders()
+{
+  while (client->available() > 0) {
+    int c = client->read();
+    if (c < 0) break;
+    if (c == '\n') {
+      if (lineLen && (line[lineLen-1] == '\r')) lineLen--;
+      line[lineLen] = 0;
+      lineLen = 0;
+      if (!HeaderLine()) return; // Done with the headers, the rest is the body
+    } else if (lineLen < (int)sizeof(line) - 1) {
+      line[lineLen++] = c; // Overlong lines are cut, only their start matters
+    }
+  }
+  if (!client->connected()) {
+    Retry(STATUS_HTTPFAIL, PSTR("Can't open HTTP request"));
+  } else if (millis() - stateStart > CONNECT_TIMEOUT_MS) {
+    Retry(STATUS_NODATA, PSTR("No response from server"));
+  }
+}
+
+// One line of the response header, false once the state has moved on
+bool AudioFileSourceHTTPStream::HeaderLine()
+{
+  if (!haveStatus) {
+    // "HTTP/1.1 200 OK", or "ICY 200 OK" from an old Shoutcast server
+    const char *code = strchr(line, ' ');
+    if (!code || (strncmp(line, "HTTP/", 5) && strncmp(line, "ICY", 3))) {
+      Retry(STATUS_HTTPFAIL, PSTR("Can't open HTTP request"));
+      return false;
+    }
+    httpCode = atoi(code + 1);
+    haveStatus = true;
+    size = -1;
+    return true;
+  }
+
+  if (line[0]) {
+    char *value = strchr(line, ':');
+    if (!value) return true;
+    *(value++) = 0;
+    while ((*value == ' ') || (*value == '\t')) value++;
+    if (!strcasecmp(line, "content-length")) {
+      size = atoi(value);
+    } else if (!strcasecmp(line, "location") && (httpCode >= 300) && (httpCode < 400)) {
+      redirect = SetLocation(value);
+      if (!redirect) {
+        Fail(STATUS_HTTPFAIL, PSTR("Bad redirect"));
+        return false;
+      }
+    }
+    GotHeader(line, value);
+    return true;
+  }
+
+  // Blank line, end of the headers
+  if (httpCode == 200) {
+    if (attempt) cb.st(STATUS_RECONNECTED, PSTR("Stream reconnected"));
+    else cb.st(STATUS_CONNECTED, PSTR("Stream connected"));
+    lastData = millis();
+    stateStart = lastData;
+    state = STATE_STREAMING;
+  } else if (redirect) {
+    if (++redirects > MAX_REDIRECTS) {
+      Fail(STATUS_HTTPFAIL, PSTR("Too many redirects"));
+    } else {
+      cb.st(STATUS_REDIRECT, PSTR("Redirected"));
+      StartAttempt();
+    }
+  } else {
+    Retry(STATUS_HTTPFAIL, PSTR("Can't open HTTP request"));
+  }
+  return false;
+}
+
+void AudioFileSourceHTTPStream::Retry(int code, const char *why)
+{
+  Disconnect();
+  cb.st(code, why);
+  if (attempt >= reconnectTries) {
+    Fail(STATUS_DISCONNECTED, PSTR("Unable to reconnect"));
+    return;
+  }
+  // Exponential with jitter, so radios that lost the same server don't all come back at once
+  uint32_t ms = (attempt < 16) ? ((uint32_t)reconnectDelayMs << attempt) : MAX_BACKOFF_MS;
+  if (ms > MAX_BACKOFF_MS) ms = MAX_BACKOFF_MS;
+  ms = ms / 2 + random(ms / 2 + 1);
+  attempt++;
+  char buff[48];
+  sprintf_P(buff, PSTR("Reconnecting in %ums, try %d"), ms, attempt);
+  cb.st(STATUS_RECONNECTING, buff);
+  backoffMs = ms;
+  stateStart = millis();
+  state = STATE_BACKOFF;
+}
+
+void AudioFileSourceHTTPStream::Fail(int code, const char *why)
+{
+  Disconnect();
+  state = STATE_FAILED;
+  cb.st(code, why);
+}
+
+void AudioFileSourceHTTPStream::Poll()
+{
+  switch (state) {
+    case STATE_RESOLVING: PollResolve(); break;
+    case STATE_CONNECTING: PollConnect(); break;
+    case STATE_HEADERS: PollHeaders(); break;
+    case STATE_BACKOFF:
+      if (millis() - stateStart >= backoffMs) StartAttempt();
+      break;
+    case STATE_STREAMING:
+      if (client->available() > 0) {
+        lastData = millis();
+        // Streaming for longer than the longest backoff counts as recovered
+        if (attempt && (lastData - stateStart > MAX_BACKOFF_MS)) attempt = 0;
+      } else if ((size > 0) && (pos >= size)) {
+        // All there, the server closing now is no reason to reconnect
+      } else if (!client->connected()) {
+        Retry(STATUS_DISCONNECTED, PSTR("Stream disconnected"));
+      } else if (millis() - lastData > STALL_TIMEOUT_MS) {
+        Retry(STATUS_NODATA, PSTR("No stream data available"));
+      }
+      break;
+    default: break;
+  }
+}
+
+bool AudioFileSourceHTTPStream::loop()
+{
+  Poll();
+  return state != STATE_FAILED;
+}
+
+// Bytes that can be read right now.  A blocking caller waits here, through
+// any reconnects, until there are some or the stream gives up.
+uint32_t AudioFileSourceHTTPStream::WaitData(bool nonBlock)
+{
+  while (true) {
+    Poll();
+    if (state == STATE_STREAMING) {
+      int avail = client->available();
+      if (avail > 0) return avail;
+      if ((size > 0) && (pos >= size)) return 0;
+    } else if ((state == STATE_IDLE) || (state == STATE_FAILED)) {
+      return 0;
+    }
+    if (nonBlock) return 0;
+    delay(1);
+  }
 }
 
 uint32_t AudioFileSourceHTTPStream::read(void *data, uint32_t len)
@@ -76,47 +453,17 @@ uint32_t AudioFileSourceHTTPStream::readNonBlock(void *data, uint32_t len)
 
 uint32_t AudioFileSourceHTTPStream::readInternal(void *data, uint32_t len, bool nonBlock)
 {
-retry:
-  if (!http.connected()) {
-    cb.st(STATUS_DISCONNECTED, PSTR("Stream disconnected"));
-    http.end();
-    for (int i = 0; i < reconnectTries; i++) {
-      char buff[32];
-      sprintf_P(buff, PSTR("Attempting to reconnect, try %d"), i);
-      cb.st(STATUS_RECONNECTING, buff);
-      delay(reconnectDelayMs);
-      if (open(saveURL)) {
-        cb.st(STATUS_RECONNECTED, PSTR("Stream reconnected"));
-        break;
-      }
-    }
-    if (!http.connected()) {
-      cb.st(STATUS_DISCONNECTED, PSTR("Unable to reconnect"));
-      return 0;
-    }
-  }
   if ((size > 0) && (pos >= size)) return 0;
 
-  WiFiClient *stream = http.getStreamPtr();
+  uint32_t avail = WaitData(nonBlock);
+  if (!avail) return 0;
 
   // Can't read past EOF...
-  if ( (size > 0) && (len > (uint32_t)(pos - size)) ) len = pos - size;
-
-  if (!nonBlock) {
-    int start = millis();
-    while ((stream->available() < (int)len) && (millis() - start < 500)) yield();
-  }
-
-  size_t avail = stream->available();
-  if (!nonBlock && !avail) {
-    cb.st(STATUS_NODATA, PSTR("No stream data available"));
-    http.end();
-    goto retry;
-  }
-  if (avail == 0) return 0;
+  if ( (size > 0) && (len > (uint32_t)(size - pos)) ) len = size - pos;
   if (avail < len) len = avail;
 
-  int read = stream->read(reinterpret_cast<uint8_t*>(data), len);
+  int read = client->read(reinterpret_cast<uint8_t*>(data), len);
+  if (read <= 0) return 0;
   pos += read;
   return read;
 }
@@ -130,13 +477,14 @@ bool AudioFileSourceHTTPStream::seek(int32_t pos, int dir)
 
 bool AudioFileSourceHTTPStream::close()
 {
-  http.end();
+  Disconnect();
+  state = STATE_IDLE;
   return true;
 }
 
 bool AudioFileSourceHTTPStream::isOpen()
 {
-  return http.connected();
+  return (state != STATE_IDLE) && (state != STATE_FAILED);
 }
 
 uint32_t AudioFileSourceHTTPStream::getSize()
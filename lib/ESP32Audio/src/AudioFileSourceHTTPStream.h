@@ -1,7 +1,7 @@
 /*
   AudioFileSourceHTTPStream
   Connect to a HTTP based streaming service
-  
+
   Copyright (C) 2017  Earle F. Philhower, III
 
   This program is free software: you can redistribute it and/or modify
@@ -22,13 +22,25 @@
 #define _AUDIOFILESOURCEHTTPSTREAM_H
 
 #include <Arduino.h>
+#include <atomic>
 #ifdef ESP32
-  #include <HTTPClient.h>
+  #include <WiFi.h>
+  #include <WiFiClientSecure.h>
 #else
-  #include <ESP8266HTTPClient.h>
+  #include <ESP8266WiFi.h>
+  #include <WiFiClientSecure.h>
 #endif
 #include "AudioFileSource.h"
 
+struct ip_addr;
+
+// Connecting is a state machine advanced by loop() and the reads, so open()
+// returns at once and nothing waits on DNS, the TCP handshake or the server.
+// The same machine follows redirects and reconnects with an exponential
+// backoff when the stream drops or stalls.  Progress is reported through the
+// status callback.  readNonBlock() and loop() never block (except for the
+// TLS handshake of an https URL), read() waits until there is data or the
+// stream gives up for good.  Call loop() or readNonBlock() from one task only.
 class AudioFileSourceHTTPStream : public AudioFileSource
 {
   friend class AudioFileSourceICYStream;
@@ -37,27 +49,82 @@ class AudioFileSourceHTTPStream : public AudioFileSource
     AudioFileSourceHTTPStream();
     AudioFileSourceHTTPStream(const char *url);
     virtual ~AudioFileSourceHTTPStream() override;
-    
-    virtual bool open(const char *url) override;
+
+    virtual bool open(const char *url) override; // Only starts connecting, false for a bad URL
     virtual uint32_t read(void *data, uint32_t len) override;
     virtual uint32_t readNonBlock(void *data, uint32_t len) override;
     virtual bool seek(int32_t pos, int dir) override;
     virtual bool close() override;
-    virtual bool isOpen() override;
+    virtual bool isOpen() override; // Also while connecting, false once it gave up
     virtual uint32_t getSize() override;
     virtual uint32_t getPos() override;
+    virtual bool loop() override;
+
+    // Try n waits delayms << n, capped at MAX_BACKOFF_MS, randomly shortened by up to half
     bool SetReconnect(int tries, int delayms) { reconnectTries = tries; reconnectDelayMs = delayms; return true; }
+    bool isStreaming() { return state == STATE_STREAMING; }
+    bool isSecure() { return secure; } // https, after any redirects so far
+
+    enum { STATUS_HTTPFAIL=2, STATUS_DISCONNECTED, STATUS_RECONNECTING, STATUS_RECONNECTED, STATUS_NODATA,
+           STATUS_RESOLVING, STATUS_CONNECTING, STATUS_REDIRECT, STATUS_CONNECTED };
+    enum { CONNECT_TIMEOUT_MS = 5000, STALL_TIMEOUT_MS = 3000, MAX_BACKOFF_MS = 16000, MAX_REDIRECTS = 5 };
 
-    enum { STATUS_HTTPFAIL=2, STATUS_DISCONNECTED, STATUS_RECONNECTING, STATUS_RECONNECTED, STATUS_NODATA };
+  protected:
+    // Hooks for protocols on top of HTTP
+    virtual const char *ExtraHeaders() { return ""; } // Request lines, each ending in \r\n
+    virtual void NewConnection() {} // Before the response headers arrive
+    virtual void GotHeader(const char *name, const char *value) { (void) name; (void) value; }
+
+    uint32_t WaitData(bool nonBlock);
 
   private:
+    enum { STATE_IDLE, STATE_RESOLVING, STATE_CONNECTING, STATE_HEADERS, STATE_STREAMING, STATE_BACKOFF, STATE_FAILED };
+
+    // Shared with the lwIP thread, which may answer after we gave up on it
+    struct DNSQuery {
+      std::atomic<int> state; // DNS_PENDING, DNS_DONE or DNS_ABANDONED
+      uint32_t ip;
+    };
+    enum { DNS_PENDING, DNS_DONE, DNS_ABANDONED };
+    static void DNSFound(const char *name, const struct ip_addr *addr, void *arg);
+
     virtual uint32_t readInternal(void *data, uint32_t len, bool nonBlock);
-    HTTPClient http;
+    bool ParseURL();
+    void Poll();
+    void StartAttempt();
+    void PollResolve();
+    void PollConnect();
+    void PollHeaders();
+    bool HeaderLine();
+    bool SetLocation(const char *url);
+    void SendRequest();
+    void Retry(int code, const char *why);
+    void Fail(int code, const char *why);
+    void Disconnect();
+
+    WiFiClient *client;
+    int state;
+    uint32_t stateStart;
+    DNSQuery *dns;
+    int sock;
+    int attempt;
+    int redirects;
+    uint32_t backoffMs;
+    uint32_t lastData;
+    int httpCode;
+    bool haveStatus;
+    bool redirect;
+    char line[256];
+    int lineLen;
     int pos;
     int size;
     int reconnectTries;
     int reconnectDelayMs;
     char saveURL[128];
+    char host[64];
+    const char *path; // Into saveURL
+    uint16_t port;
+    bool secure;
 };
 
 
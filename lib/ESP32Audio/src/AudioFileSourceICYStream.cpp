@@ -22,48 +22,28 @@
 
 AudioFileSourceICYStream::AudioFileSourceICYStream()
 {
-  pos = 0;
-  reconnectTries = 0;
-  saveURL[0] = 0;
+  icyMetaInt = 0;
+  icyByteCount = 0;
+  mdWaitStart = 0;
+  mdQueue = NULL;
 }
 
 AudioFileSourceICYStream::AudioFileSourceICYStream(const char *url)
 {
-  saveURL[0] = 0;
-  reconnectTries = 0;
+  icyMetaInt = 0;
+  icyByteCount = 0;
+  mdWaitStart = 0;
+  mdQueue = NULL;
   open(url);
 }
 
-bool AudioFileSourceICYStream::open(const char *url)
+AudioFileSourceICYStream::~AudioFileSourceICYStream()
 {
-  static const char *hdr[] = { "icy-metaint" };
-  pos = 0;
-  http.begin(url);
-  http.addHeader("Icy-MetaData", "1");
-  http.collectHeaders( hdr, 1 );
-  http.setReuse(true);
-  int code = http.GET();
-  if (code != HTTP_CODE_OK) {
-    http.end();
-    cb.st(STATUS_HTTPFAIL, PSTR("Can't open HTTP request"));
-    return false;
-  }
-  if (http.hasHeader(hdr[0])) {
-    String ret = http.header(hdr[0]);
-    icyMetaInt = ret.toInt();
-  } else {
-    icyMetaInt = 0;
-  }
-  icyByteCount = 0;
-  size = http.getSize();
-  strncpy(saveURL, url, sizeof(saveURL));
-  saveURL[sizeof(saveURL)-1] = 0;
-  return true;
 }
 
-AudioFileSourceICYStream::~AudioFileSourceICYStream()
+void AudioFileSourceICYStream::GotHeader(const char *name, const char *value)
 {
-  http.end();
+  if (!strcasecmp(name, "icy-metaint")) icyMetaInt = atoi(value);
 }
 
 class ICYMDReader {
@@ -78,6 +58,9 @@ class ICYMDReader {
       // Get rid of any remaining bytes in the MD block
       char xxx[16];
       if (saved>=0) avail--; // Throw away any unread bytes
+      // Whatever is left in the bounce buffer was already taken from the stream
+      uint16_t buffered = (ptr < sizeof(buff)) ? sizeof(buff) - ptr : 0;
+      avail -= (buffered < avail) ? buffered : avail;
       while (avail > 16) {
         stream->read(reinterpret_cast<uint8_t*>(xxx), 16);
         avail -= 16;
@@ -121,43 +104,15 @@ class ICYMDReader {
 uint32_t AudioFileSourceICYStream::readInternal(void *data, uint32_t len, bool nonBlock)
 {
 retry:
-  if (!http.connected()) {
-    cb.st(STATUS_DISCONNECTED, PSTR("Stream disconnected"));
-    http.end();
-    for (int i = 0; i < reconnectTries; i++) {
-      char buff[32];
-      sprintf_P(buff, PSTR("Attempting to reconnect, try %d"), i);
-      cb.st(STATUS_RECONNECTING, buff);
-      delay(reconnectDelayMs);
-      if (open(saveURL)) {
-        cb.st(STATUS_RECONNECTED, PSTR("Stream reconnected"));
-        break;
-      }
-    }
-    if (!http.connected()) {
-      cb.st(STATUS_DISCONNECTED, PSTR("Unable to reconnect"));
-      return 0;
-    }
-  }
   if ((size > 0) && (pos >= size)) return 0;
 
-  WiFiClient *stream = http.getStreamPtr();
+  uint32_t avail = WaitData(nonBlock);
+  if (!avail) return 0;
 
-  // Can't read past EOF...
-  if ( (size > 0) && (len > (uint32_t)(pos - size)) ) len = pos - size;
+  WiFiClient *stream = client;
 
-  if (!nonBlock) {
-    int start = millis();
-    while ((stream->available() < (int)len) && (millis() - start < 500)) yield();
-  }
-
-  size_t avail = stream->available();
-  if (!nonBlock && !avail) {
-    cb.st(STATUS_NODATA, PSTR("No stream data available"));
-    http.end();
-    goto retry;
-  }
-  if (avail == 0) return 0;
+  // Can't read past EOF...
+  if ( (size > 0) && (len > (uint32_t)(size - pos)) ) len = size - pos;
   if (avail < len) len = avail;
 
   int read = 0;
@@ -165,6 +120,7 @@ retry:
   if (((int)(icyByteCount + len) > (int)icyMetaInt) && (icyMetaInt > 0)) {
     int beforeIcy = icyMetaInt - icyByteCount;
     int ret = stream->read(reinterpret_cast<uint8_t*>(data), beforeIcy);
+    if (ret < 0) ret = 0;
     read += ret;
     pos += ret;
     len -= ret;
@@ -172,6 +128,22 @@ retry:
     icyByteCount += ret;
     if (ret != beforeIcy) return read; // Partial read
 
+    // ICYMDReader can't wait for the rest of the block, so it all has to be here
+    int mdNext = stream->peek();
+    while ((mdNext < 0) || (stream->available() < 1 + mdNext * 16)) {
+      if (!mdWaitStart) mdWaitStart = millis() | 1;
+      if (millis() - mdWaitStart > STALL_TIMEOUT_MS) {
+        mdWaitStart = 0;
+        Retry(STATUS_NODATA, PSTR("No stream data available"));
+        if (nonBlock || read) return read;
+        goto retry;
+      }
+      if (nonBlock || read) return read;
+      delay(1);
+      mdNext = stream->peek();
+    }
+    mdWaitStart = 0;
+
     uint8_t mdSize;
     int mdret = stream->read(&mdSize, 1);
     if ((mdret == 1) && (mdSize > 0)) {
@@ -214,6 +186,7 @@ retry:
             // MD data was too long, read and throw away rest
             while ((c != '\'') && !mdr.eof()) mdr.read(&c, 1);
           }
+          if (mdQueue) mdQueue->post(type, value);
           cb.md(type, false, value);
           do {
             ret = mdr.read(&c, 1);
@@ -225,6 +198,7 @@ retry:
   }
 
   int ret = stream->read(reinterpret_cast<uint8_t*>(data), len);
+  if (ret < 0) ret = 0; // The metadata may have taken all there was
   read += ret;
   pos += ret;
   icyByteCount += ret;
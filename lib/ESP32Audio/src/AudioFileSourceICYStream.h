@@ -22,13 +22,8 @@
 #define _AUDIOFILESOURCEICYSTREAM_H
 
 #include <Arduino.h>
-#ifdef ESP32
-  #include <HTTPClient.h>
-#else
-  #include <ESP8266HTTPClient.h>
-#endif
-
 #include "AudioFileSourceHTTPStream.h"
+#include "AudioMetadataQueue.h"
 
 class AudioFileSourceICYStream : public AudioFileSourceHTTPStream
 {
@@ -36,13 +31,21 @@ class AudioFileSourceICYStream : public AudioFileSourceHTTPStream
     AudioFileSourceICYStream();
     AudioFileSourceICYStream(const char *url);
     virtual ~AudioFileSourceICYStream() override;
-    
-    virtual bool open(const char *url) override;
+
+    // Metadata also goes here, for a UI that shouldn't run inside the reader
+    bool SetMetadataQueue(AudioMetadataQueue *queue) { mdQueue = queue; return true; }
+
+  protected:
+    virtual const char *ExtraHeaders() override { return "Icy-MetaData: 1\r\n"; }
+    virtual void NewConnection() override { icyMetaInt = 0; icyByteCount = 0; mdWaitStart = 0; }
+    virtual void GotHeader(const char *name, const char *value) override;
 
   private:
     virtual uint32_t readInternal(void *data, uint32_t len, bool nonBlock) override;
     int icyMetaInt;
     int icyByteCount;
+    AudioMetadataQueue *mdQueue;
+    uint32_t mdWaitStart; // While a metadata block is only partly in
 };
 
 
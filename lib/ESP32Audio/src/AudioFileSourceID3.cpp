@@ -117,6 +117,35 @@ bool AudioFileSourceUnsync::eof()
 
 
 
+// Converts in place, whatever doesn't fit the 64 byte value buffer is dropped
+static void UTF16ToUTF8(char *value, int len, bool bigEndian)
+{
+  uint8_t in[64];
+  memcpy(in, value, len);
+  int i = 0;
+  if (len >= 2 && in[0] == 0xff && in[1] == 0xfe) { bigEndian = false; i = 2; }
+  else if (len >= 2 && in[0] == 0xfe && in[1] == 0xff) { bigEndian = true; i = 2; }
+  int o = 0;
+  for (; i + 1 < len; i += 2) {
+    uint16_t c = bigEndian ? ((in[i]<<8) | in[i+1]) : ((in[i+1]<<8) | in[i]);
+    if (!c) break;
+    if (c < 0x80) {
+      if (o + 1 > 63) break;
+      value[o++] = c;
+    } else if (c < 0x800) {
+      if (o + 2 > 63) break;
+      value[o++] = 0xc0 | (c >> 6);
+      value[o++] = 0x80 | (c & 0x3f);
+    } else {
+      if (o + 3 > 63) break;
+      value[o++] = 0xe0 | (c >> 12);
+      value[o++] = 0x80 | ((c >> 6) & 0x3f);
+      value[o++] = 0x80 | (c & 0x3f);
+    }
+  }
+  value[o] = 0;
+}
+
 AudioFileSourceID3::AudioFileSourceID3(AudioFileSource *src)
 {
   this->src = src;
@@ -213,12 +242,17 @@ uint32_t AudioFileSourceID3::read(void *data, uint32_t len)
       // Read the value and send to callback
       char value[64];
       uint16_t i;
-      bool isUnicode = (id3.getByte()==1) ? true : false;
+      int encoding = id3.getByte();
+      bool isUnicode = (encoding==1) || (encoding==2);
       for (i=0; i<framesize-1; i++) {
         if (i<sizeof(value)-1) value[i] = id3.getByte();
         else (void)id3.getByte();
       }
       value[i<sizeof(value)-1?i:sizeof(value)-1] = 0; // Terminate the string...
+      if (isUnicode) {
+        // UTF-16 has embedded zeros, hand the callback UTF-8 instead
+        UTF16ToUTF8(value, (i<sizeof(value)-1) ? i : sizeof(value)-1, encoding==2);
+      }
       if ( (frameid[0]=='T' && frameid[1]=='A' && frameid[2]=='L' && frameid[3] == 'B' ) ||
            (frameid[0]=='T' && frameid[1]=='A' && frameid[2]=='L' && rev==2) ) {
         cb.md("Album", isUnicode, value);
@@ -0,0 +1,235 @@
+/*
+  AudioFileSourceRingBuffer
+  Lock-free single-producer/single-consumer ring buffer input file
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioFileSourceRingBuffer.h"
+
+#pragma GCC optimize ("O3")
+
+static uint32_t RoundDownPow2(uint32_t v)
+{
+  uint32_t p = 1;
+  while (p <= (v >> 1)) p <<= 1;
+  return v ? p : 0;
+}
+
+AudioFileSourceRingBuffer::AudioFileSourceRingBuffer(AudioFileSource *source, uint32_t buffSizeBytes)
+{
+  buffSize = RoundDownPow2(buffSizeBytes);
+  mask = buffSize - 1;
+  buffer = (uint8_t*)malloc(sizeof(uint8_t) * buffSize);
+  if (!buffer) Serial.printf_P(PSTR("Unable to allocate AudioFileSourceRingBuffer::buffer[]\n"));
+  deallocateBuffer = true;
+  externalProducer = false;
+  primed = false;
+  underflowWaitMs = 500;
+  writeIdx = 0;
+  readIdx = 0;
+  src = source;
+}
+
+AudioFileSourceRingBuffer::AudioFileSourceRingBuffer(AudioFileSource *source, void *inBuff, uint32_t buffSizeBytes)
+{
+  buffSize = RoundDownPow2(buffSizeBytes);
+  mask = buffSize - 1;
+  buffer = (uint8_t*)inBuff;
+  deallocateBuffer = false;
+  externalProducer = false;
+  primed = false;
+  underflowWaitMs = 500;
+  writeIdx = 0;
+  readIdx = 0;
+  src = source;
+}
+
+AudioFileSourceRingBuffer::~AudioFileSourceRingBuffer()
+{
+  if (deallocateBuffer) free(buffer);
+  buffer = NULL;
+}
+
+bool AudioFileSourceRingBuffer::seek(int32_t pos, int dir)
+{
+  // Invalidate
+  readIdx.store(0, std::memory_order_relaxed);
+  writeIdx.store(0, std::memory_order_release);
+  primed = false;
+  return src->seek(pos, dir);
+}
+
+bool AudioFileSourceRingBuffer::close()
+{
+  if (deallocateBuffer) free(buffer);
+  buffer = NULL;
+  return src->close();
+}
+
+bool AudioFileSourceRingBuffer::isOpen()
+{
+  return src->isOpen();
+}
+
+uint32_t AudioFileSourceRingBuffer::getSize()
+{
+  return src->getSize();
+}
+
+uint32_t AudioFileSourceRingBuffer::getPos()
+{
+  return src->getPos();
+}
+
+uint32_t AudioFileSourceRingBuffer::getFillLevel()
+{
+  return writeIdx.load(std::memory_order_acquire) - readIdx.load(std::memory_order_acquire);
+}
+
+void AudioFileSourceRingBuffer::getStats(AudioStats *st)
+{
+  stats.get(st, getFillLevel(), buffSize);
+}
+
+uint32_t AudioFileSourceRingBuffer::getWriteSpan(uint8_t **span)
+{
+  uint32_t w = writeIdx.load(std::memory_order_relaxed);
+  uint32_t r = readIdx.load(std::memory_order_acquire);
+  uint32_t space = buffSize - (w - r);
+  uint32_t toEnd = buffSize - (w & mask);
+  *span = &buffer[w & mask];
+  return (space < toEnd) ? space : toEnd;
+}
+
+void AudioFileSourceRingBuffer::commit(uint32_t len)
+{
+  writeIdx.store(writeIdx.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+uint32_t AudioFileSourceRingBuffer::getReadSpan(const uint8_t **span)
+{
+  uint32_t r = readIdx.load(std::memory_order_relaxed);
+  uint32_t w = writeIdx.load(std::memory_order_acquire);
+  uint32_t used = w - r;
+  uint32_t toEnd = buffSize - (r & mask);
+  *span = &buffer[r & mask];
+  return (used < toEnd) ? used : toEnd;
+}
+
+void AudioFileSourceRingBuffer::consume(uint32_t len)
+{
+  readIdx.store(readIdx.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+uint32_t AudioFileSourceRingBuffer::fill()
+{
+  if (!buffer) return 0;
+
+  // At most two spans: up to the end of the buffer, then from its start
+  uint32_t total = 0;
+  for (int i = 0; i < 2; i++) {
+    uint8_t *span;
+    uint32_t space = getWriteSpan(&span);
+    if (!space) break;
+    uint32_t cnt = src->readNonBlock(span, space);
+    commit(cnt);
+    total += cnt;
+    if (cnt != space) break;
+  }
+  return total;
+}
+
+bool AudioFileSourceRingBuffer::waitForData(uint32_t want)
+{
+  if (primed) {
+    stats.underflow();
+    cb.st(STATUS_UNDERFLOW, PSTR("Buffer underflow"));
+  } else {
+    cb.st(STATUS_FILLING, PSTR("Filling buffer"));
+  }
+
+  if (externalProducer) {
+    uint32_t start = millis();
+    while (!getFillLevel()) {
+      if (millis() - start > underflowWaitMs) return false;
+      delay(1);
+    }
+    return true;
+  }
+
+  // Block only for what the caller asked for, straight into the ring
+  uint8_t *span;
+  uint32_t space = getWriteSpan(&span);
+  uint32_t cnt = src->read(span, (want < space) ? want : space);
+  commit(cnt);
+  return cnt > 0;
+}
+
+uint32_t AudioFileSourceRingBuffer::read(void *data, uint32_t len)
+{
+  if (!buffer) return src->read(data, len);
+
+  uint8_t *ptr = reinterpret_cast<uint8_t*>(data);
+  uint32_t bytes = 0;
+  while (len) {
+    const uint8_t *span;
+    uint32_t avail = getReadSpan(&span);
+    if (!avail) {
+      if (!waitForData(len)) break;
+      continue;
+    }
+    uint32_t cnt = (len < avail) ? len : avail;
+    memcpy(ptr, span, cnt);
+    consume(cnt);
+    ptr += cnt;
+    len -= cnt;
+    bytes += cnt;
+  }
+  primed = true;
+  stats.sample(getFillLevel(), buffSize);
+
+  if (!externalProducer) fill();
+
+  return bytes;
+}
+
+uint32_t AudioFileSourceRingBuffer::readNonBlock(void *data, uint32_t len)
+{
+  if (!buffer) return src->readNonBlock(data, len);
+
+  uint8_t *ptr = reinterpret_cast<uint8_t*>(data);
+  uint32_t bytes = 0;
+  for (int i = 0; (i < 2) && len; i++) {
+    const uint8_t *span;
+    uint32_t avail = getReadSpan(&span);
+    if (!avail) break;
+    uint32_t cnt = (len < avail) ? len : avail;
+    memcpy(ptr, span, cnt);
+    consume(cnt);
+    ptr += cnt;
+    len -= cnt;
+    bytes += cnt;
+  }
+  return bytes;
+}
+
+bool AudioFileSourceRingBuffer::loop()
+{
+  if (externalProducer) return true; // The producer task loops the source
+  if (!src->loop()) return false;
+  fill();
+  return true;
+}
@@ -0,0 +1,84 @@
+/*
+  AudioFileSourceRingBuffer
+  Lock-free single-producer/single-consumer ring buffer input file
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOFILESOURCERINGBUFFER_H
+#define _AUDIOFILESOURCERINGBUFFER_H
+
+#include <atomic>
+#include "AudioFileSource.h"
+
+// Unlike AudioFileSourceBuffer this never throws away buffered data on an
+// underflow.  The producer side (fill/getWriteSpan/commit) may run in its own
+// task as long as only one task produces and one task consumes.
+class AudioFileSourceRingBuffer : public AudioFileSource
+{
+  public:
+    // The buffer size is rounded down to a power of two
+    AudioFileSourceRingBuffer(AudioFileSource *in, uint32_t bufferBytes);
+    AudioFileSourceRingBuffer(AudioFileSource *in, void *buffer, uint32_t bufferBytes); // Pre-allocated buffer by app
+    virtual ~AudioFileSourceRingBuffer() override;
+
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual uint32_t readNonBlock(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override; // Not safe while an external producer runs
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override;
+    virtual uint32_t getPos() override;
+    virtual bool loop() override;
+    virtual void getStats(AudioStats *st) override;
+
+    uint32_t getFillLevel();
+    uint32_t getBufferSize() { return buffSize; }
+
+    // Producer side: pull whatever the source has without blocking
+    uint32_t fill();
+    uint32_t getWriteSpan(uint8_t **span);
+    void commit(uint32_t len);
+
+    // Consumer side: contiguous view of buffered data, no copy
+    uint32_t getReadSpan(const uint8_t **span);
+    void consume(uint32_t len);
+
+    // When another task calls fill(), read() only waits for it instead of touching the source.
+    // That task also calls the source's loop(), this loop() leaves it alone.
+    bool SetExternalProducer(bool external, uint32_t waitMs = 500) { externalProducer = external; underflowWaitMs = waitMs; return true; }
+
+    enum { STATUS_FILLING=2, STATUS_UNDERFLOW };
+
+  private:
+    bool waitForData(uint32_t want);
+
+  private:
+    AudioFileSource *src;
+    uint32_t buffSize;
+    uint32_t mask;
+    uint8_t *buffer;
+    bool deallocateBuffer;
+    bool externalProducer;
+    bool primed;
+    uint32_t underflowWaitMs;
+    AudioFillStats stats; // Consumer side only
+    // Free running indices, only the low bits select a byte in the buffer
+    std::atomic<uint32_t> writeIdx;
+    std::atomic<uint32_t> readIdx;
+};
+
+
+#endif
+
@@ -0,0 +1,278 @@
+/*
+  AudioFileSourceTee
+  Passes a source through while recording its raw bytes to a file
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioFileSourceTee.h"
+#include "AudioMemory.h"
+
+AudioFileSourceTee::AudioFileSourceTee(AudioFileSource *in, fs::FS &fs, const char *dir, const char *ext, uint32_t bufferBytes)
+{
+  src = in;
+  disk = &fs;
+  strncpy(this->dir, dir, sizeof(this->dir) - 1);
+  this->dir[sizeof(this->dir) - 1] = 0;
+  strncpy(this->ext, ext, sizeof(this->ext) - 1);
+  this->ext[sizeof(this->ext) - 1] = 0;
+  fileCount = 0;
+  readStart = 0;
+  splitOffset = -1;
+  title[0] = 0;
+  splitOnTitle = true;
+  ring = NULL;
+  ringSize = 2 * WRITE_CHUNK;
+  while (ringSize <= (bufferBytes >> 1)) ringSize <<= 1;
+  writeIdx = 0;
+  readIdx = 0;
+  markWrite = 0;
+  markRead = 0;
+  recording = false;
+  teeBusy = false;
+  taskDone = true;
+  recorded = 0;
+  dropped = 0;
+  src->RegisterMetadataCB(MDCallback, this);
+}
+
+void AudioFileSourceTee::SetExtension(const char *ext)
+{
+  strncpy(this->ext, ext, sizeof(this->ext) - 1);
+  this->ext[sizeof(this->ext) - 1] = 0;
+}
+
+AudioFileSourceTee::~AudioFileSourceTee()
+{
+  stopRecording();
+}
+
+// Called from inside src->read(), after the bytes before the metadata
+void AudioFileSourceTee::MDCallback(void *cbData, const char *type, bool isUnicode, const char *string)
+{
+  AudioFileSourceTee *t = reinterpret_cast<AudioFileSourceTee*>(cbData);
+  if (!strcmp(type, "StreamTitle") && strcmp(t->title, string)) {
+    strncpy(t->title, string, TITLE_LEN - 1);
+    t->title[TITLE_LEN - 1] = 0;
+    t->splitOffset = t->src->getPos() - t->readStart;
+  }
+  t->cb.md(type, isUnicode, string);
+}
+
+uint32_t AudioFileSourceTee::read(void *data, uint32_t len)
+{
+  readStart = src->getPos();
+  splitOffset = -1;
+  uint32_t cnt = src->read(data, len);
+  Tee(reinterpret_cast<uint8_t*>(data), cnt);
+  return cnt;
+}
+
+uint32_t AudioFileSourceTee::readNonBlock(void *data, uint32_t len)
+{
+  readStart = src->getPos();
+  splitOffset = -1;
+  uint32_t cnt = src->readNonBlock(data, len);
+  Tee(reinterpret_cast<uint8_t*>(data), cnt);
+  return cnt;
+}
+
+void AudioFileSourceTee::Tee(const uint8_t *data, uint32_t len)
+{
+  teeBusy = true;
+  if (recording && len) {
+    if (splitOnTitle && (splitOffset >= 0) && ((uint32_t)splitOffset <= len)) {
+      Append(data, splitOffset);
+      uint32_t m = markWrite.load(std::memory_order_relaxed);
+      if (m - markRead.load(std::memory_order_acquire) < MAX_MARKS) {
+        marks[m % MAX_MARKS].at = writeIdx.load(std::memory_order_relaxed);
+        memcpy(marks[m % MAX_MARKS].title, title, TITLE_LEN);
+        markWrite.store(m + 1, std::memory_order_release);
+      }
+      data += splitOffset;
+      len -= splitOffset;
+    }
+    Append(data, len);
+  }
+  splitOffset = -1;
+  teeBusy = false;
+}
+
+// Never waits, what doesn't fit is dropped
+void AudioFileSourceTee::Append(const uint8_t *data, uint32_t len)
+{
+  uint32_t w = writeIdx.load(std::memory_order_relaxed);
+  uint32_t space = ringSize - (w - readIdx.load(std::memory_order_acquire));
+  if (len > space) {
+    dropped += len - space;
+    len = space;
+  }
+  uint32_t at = w & (ringSize - 1);
+  uint32_t first = (len < ringSize - at) ? len : ringSize - at;
+  memcpy(ring + at, data, first);
+  memcpy(ring, data + first, len - first);
+  writeIdx.store(w + len, std::memory_order_release);
+}
+
+bool AudioFileSourceTee::startRecording(const char *name, int core, int priority)
+{
+  if (recording) return true;
+  ring = reinterpret_cast<uint8_t*>(AudioMemory::alloc(ringSize, AudioMemory::BULK, "recording ring"));
+  if (!ring) {
+    cb.st(STATUS_RECORDFAIL, PSTR("Out of memory for recording"));
+    return false;
+  }
+  writeIdx = 0;
+  readIdx = 0;
+  markWrite = 0;
+  markRead = 0;
+  recorded = 0;
+  dropped = 0;
+  disk->mkdir(dir);
+  if (!OpenFile(title[0] ? title : name)) {
+    AudioMemory::release(ring);
+    ring = NULL;
+    return false;
+  }
+  taskDone = false;
+  recording = true;
+  if (xTaskCreatePinnedToCore(WriterTask, "tee", 4096, this, priority, NULL, core) != pdPASS) {
+    recording = false;
+    taskDone = true;
+    file.close();
+    AudioMemory::release(ring);
+    ring = NULL;
+    cb.st(STATUS_RECORDFAIL, PSTR("Unable to start the writer task"));
+    return false;
+  }
+  return true;
+}
+
+bool AudioFileSourceTee::stopRecording()
+{
+  if (!ring) return true;
+  recording = false;
+  while (teeBusy || !taskDone) vTaskDelay(1);
+  AudioMemory::release(ring);
+  ring = NULL;
+  return true;
+}
+
+// Numbered so a title that comes round again doesn't overwrite an older file
+bool AudioFileSourceTee::OpenFile(const char *name)
+{
+  char clean[41];
+  int n = 0;
+  for (const char *p = name; *p && (n < (int)sizeof(clean) - 1); p++) {
+    clean[n++] = ((*p < ' ') || strchr("\\/:*?\"<>|", *p)) ? '_' : *p;
+  }
+  while (n && (clean[n - 1] == ' ')) n--;
+  clean[n] = 0;
+  if (!n) strcpy(clean, "stream");
+
+  char path[sizeof(dir) + sizeof(clean) + sizeof(ext) + 8];
+  do {
+    snprintf(path, sizeof(path), "%s/%03d %s%s", dir, ++fileCount, clean, ext);
+  } while (disk->exists(path));
+  file = disk->open(path, FILE_WRITE);
+  if (!file) {
+    cb.st(STATUS_RECORDFAIL, PSTR("Can't create the recording file"));
+    return false;
+  }
+  cb.st(STATUS_RECORDING, PSTR("Recording"));
+  return true;
+}
+
+void AudioFileSourceTee::WriteOut(uint32_t len)
+{
+  uint32_t r = readIdx.load(std::memory_order_relaxed);
+  uint32_t at = r & (ringSize - 1);
+  uint32_t first = (len < ringSize - at) ? len : ringSize - at;
+  if (file) {
+    bool ok = file.write(ring + at, first) == first;
+    if (ok && (len > first)) ok = file.write(ring, len - first) == len - first;
+    if (ok) {
+      recorded += len;
+    } else {
+      // Card full or gone, keep emptying the ring so the reader doesn't notice
+      file.close();
+      cb.st(STATUS_RECORDFAIL, PSTR("SD write failed"));
+    }
+  }
+  readIdx.store(r + len, std::memory_order_release);
+}
+
+// Writes whole chunks while recording, at a title change or the end it
+// writes out the rest of the file too
+void AudioFileSourceTee::WriterTask(void *arg)
+{
+  AudioFileSourceTee *t = reinterpret_cast<AudioFileSourceTee*>(arg);
+  while (true) {
+    bool stopping = !t->recording;
+    uint32_t r = t->readIdx.load(std::memory_order_relaxed);
+    uint32_t w = t->writeIdx.load(std::memory_order_acquire);
+    uint32_t m = t->markRead.load(std::memory_order_relaxed);
+    bool split = m != t->markWrite.load(std::memory_order_acquire);
+    uint32_t avail = (split ? t->marks[m % MAX_MARKS].at : w) - r;
+
+    if (avail >= WRITE_CHUNK) {
+      t->WriteOut(WRITE_CHUNK);
+    } else if (split) {
+      if (avail) t->WriteOut(avail);
+      t->file.close();
+      t->OpenFile(t->marks[m % MAX_MARKS].title);
+      t->markRead.store(m + 1, std::memory_order_release);
+    } else if (stopping) {
+      if (avail) t->WriteOut(avail);
+      break;
+    } else {
+      vTaskDelay(20 / portTICK_PERIOD_MS);
+    }
+  }
+  t->file.close();
+  t->taskDone = true;
+  vTaskDelete(NULL);
+}
+
+bool AudioFileSourceTee::seek(int32_t pos, int dir)
+{
+  return src->seek(pos, dir);
+}
+
+bool AudioFileSourceTee::close()
+{
+  stopRecording();
+  return src->close();
+}
+
+bool AudioFileSourceTee::isOpen()
+{
+  return src->isOpen();
+}
+
+uint32_t AudioFileSourceTee::getSize()
+{
+  return src->getSize();
+}
+
+uint32_t AudioFileSourceTee::getPos()
+{
+  return src->getPos();
+}
+
+bool AudioFileSourceTee::loop()
+{
+  return src->loop();
+}
@@ -0,0 +1,104 @@
+/*
+  AudioFileSourceTee
+  Passes a source through while recording its raw bytes to a file
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOFILESOURCETEE_H
+#define _AUDIOFILESOURCETEE_H
+
+#include <atomic>
+#include <FS.h>
+#include "AudioFileSource.h"
+
+// Whatever is read through the tee is also copied into a ring, which a
+// writer task empties to the file in WRITE_CHUNK blocks, so the file grows
+// a whole number of sectors at a time and the reader never waits on the
+// card.  If the card falls behind by more than the ring, bytes are dropped
+// and counted rather than stalling playback.  The stream is stored as it
+// came, no decoding or encoding.
+// With split on, every ICY title change starts a new file named after the
+// title, cut at the byte where the metadata was.  Recording may be started
+// and stopped from another task than the one reading.
+class AudioFileSourceTee : public AudioFileSource
+{
+  public:
+    AudioFileSourceTee(AudioFileSource *in, fs::FS &fs, const char *dir, const char *ext = ".mp3", uint32_t bufferBytes = 65536);
+    virtual ~AudioFileSourceTee() override;
+
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual uint32_t readNonBlock(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override;
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override;
+    virtual uint32_t getPos() override;
+    virtual bool loop() override;
+    virtual void getStats(AudioStats *st) override { src->getStats(st); }
+
+    // The file is called after the last title, or name if there was none yet
+    bool startRecording(const char *name, int core = 0, int priority = 1);
+    bool stopRecording(); // Writes out what is left first
+    bool isRecording() { return recording; }
+    void SetSplitOnTitle(bool split) { splitOnTitle = split; }
+    void SetExtension(const char *ext); // For files opened from now on
+    uint32_t getRecorded() { return recorded; } // Bytes in all files
+    uint32_t getDropped() { return dropped; }
+
+    enum { WRITE_CHUNK = 8192, MAX_MARKS = 4, TITLE_LEN = 64 };
+    enum { STATUS_RECORDING=2, STATUS_RECORDFAIL };
+
+  private:
+    static void MDCallback(void *cbData, const char *type, bool isUnicode, const char *string);
+    static void WriterTask(void *arg);
+    void Tee(const uint8_t *data, uint32_t len);
+    void Append(const uint8_t *data, uint32_t len);
+    bool OpenFile(const char *title);
+    void WriteOut(uint32_t len);
+
+    AudioFileSource *src;
+    fs::FS *disk;
+    char dir[32];
+    char ext[8];
+    File file;
+    int fileCount;
+
+    // Reader side
+    uint32_t readStart; // Source position when the current read began
+    int32_t splitOffset; // Into the current read, -1 for none
+    char title[TITLE_LEN];
+    bool splitOnTitle;
+
+    // Ring between the reader and the writer task
+    uint8_t *ring;
+    uint32_t ringSize; // Power of two
+    std::atomic<uint32_t> writeIdx;
+    std::atomic<uint32_t> readIdx;
+    struct {
+      uint32_t at; // Ring index the new file starts at
+      char title[TITLE_LEN];
+    } marks[MAX_MARKS];
+    std::atomic<uint32_t> markWrite;
+    std::atomic<uint32_t> markRead;
+
+    std::atomic<bool> recording;
+    std::atomic<bool> teeBusy; // Reader is inside Tee(), the ring must stay
+    std::atomic<bool> taskDone;
+    uint32_t recorded;
+    uint32_t dropped;
+};
+
+#endif
+
@@ -31,25 +31,31 @@ AudioGeneratorAAC::AudioGeneratorAAC()
   file = NULL;
   output = NULL;
 
-  buff = (uint8_t*)malloc(buffLen);
-  outSample = (int16_t*)malloc(1024 * 2 * sizeof(uint16_t));
+  buff = (uint8_t*)malloc(RING_SIZE + MIRROR_SIZE);
+  outSample = (int16_t*)malloc(MAX_OUT_SAMPLES * 2 * sizeof(int16_t));
   if (!buff || !outSample) {
     Serial.printf_P(PSTR("ERROR: Out of memory in AAC\n"));
     Serial.flush();
   }
 
+  decoderSpace = NULL;
+  decoderSpaceSize = 0;
+  decoderUsed = false;
   hAACDecoder = AACInitDecoder();
   if (!hAACDecoder) {
     Serial.printf_P(PSTR("Out of memory error! hAACDecoder==NULL\n"));
     Serial.flush();
   }
 
-  buffValid = 0;
-  lastFrameEnd = 0;
+  readPos = 0;
+  writePos = 0;
+  isMP4 = false;
   validSamples = 0;
   curSample = 0;
   lastRate = 0;
   lastChannels = 0;
+  coreOnly = false;
+  cpuBudget = 0;
 }
 
 AudioGeneratorAAC::AudioGeneratorAAC(void *preallocateData, int preallocateSz)
@@ -63,26 +69,32 @@ AudioGeneratorAAC::AudioGeneratorAAC(void *preallocateData, int preallocateSz)
 
   uint8_t *p = (uint8_t*)preallocateSpace;
   buff = (uint8_t*) p;
-  p += (buffLen + 7) & ~7;
+  p += (RING_SIZE + MIRROR_SIZE + 7) & ~7;
   outSample = (int16_t*) p;
-  p += (1024 * 2 * sizeof(int16_t) + 7) & ~7;
+  p += (MAX_OUT_SAMPLES * 2 * sizeof(int16_t) + 7) & ~7;
   int used = p - (uint8_t*)preallocateSpace;
   int availSpace = preallocateSize - used;
   if (availSpace < 0 ) {
     Serial.printf_P(PSTR("ERROR: Out of memory in AAC\n"));
   }
 
+  decoderSpace = p;
+  decoderSpaceSize = availSpace;
+  decoderUsed = false;
   hAACDecoder = AACInitDecoderPre(p, availSpace);
   if (!hAACDecoder) {
     Serial.printf_P(PSTR("Out of memory error! hAACDecoder==NULL\n"));
     Serial.flush();
   }
-  buffValid = 0;
-  lastFrameEnd = 0;
+  readPos = 0;
+  writePos = 0;
+  isMP4 = false;
   validSamples = 0;
   curSample = 0;
   lastRate = 0;
   lastChannels = 0;
+  coreOnly = false;
+  cpuBudget = 0;
 }
 
 
@@ -108,34 +120,115 @@ bool AudioGeneratorAAC::isRunning()
   return running;
 }
 
-bool AudioGeneratorAAC::FillBufferWithValidFrame()
+// Start from a clean decoder, a raw (MP4) session leaves Helix stuck in raw block mode
+void AudioGeneratorAAC::ResetDecoder()
 {
-  buff[0] = 0; // Destroy any existing sync word @ 0
-  int nextSync;
-  do {
-    nextSync = AACFindSyncWord(buff + lastFrameEnd, buffValid - lastFrameEnd);
-    if (nextSync >= 0) nextSync += lastFrameEnd;
-    lastFrameEnd = 0;
-    if (nextSync == -1) {
-      if (buffValid && buff[buffValid-1]==0xff) { // Could be 1st half of syncword, preserve it...
-        buff[0] = 0xff;
-        buffValid = file->read(buff+1, buffLen-1);
-        if (buffValid==0) return false; // No data available, EOF
-      } else { // Try a whole new buffer
-        buffValid = file->read(buff, buffLen-1);
-        if (buffValid==0) return false; // No data available, EOF
-      }
-    }
-  } while (nextSync == -1);
+  if (!decoderUsed) return;
+  if (preallocateSpace) {
+    hAACDecoder = AACInitDecoderPre(decoderSpace, decoderSpaceSize);
+  } else {
+    AACFreeDecoder(hAACDecoder);
+    hAACDecoder = AACInitDecoder();
+  }
+  decoderUsed = false;
+}
 
-  // Move the frame to start at offset 0 in the buffer
-  buffValid -= nextSync; // Throw out prior to nextSync
-  memmove(buff, buff+nextSync, buffValid);
+bool AudioGeneratorAAC::SetCoreOnly(bool enabled)
+{
+  coreOnly = enabled;
+  AACSetCoreOnly(hAACDecoder, enabled ? 1 : 0);
+  // Times from the other mode say nothing about this one
+  framesTimed = 0;
+  frameUsMax = 0;
+  return true;
+}
 
-  // We have a sync word at 0 now, try and fill remainder of buffer
-  buffValid += file->read(buff + buffValid, buffLen - buffValid);
+void AudioGeneratorAAC::RecordFrameTime(uint32_t us, const AACFrameInfo *fi)
+{
+  frameUs = us;
+  frameUsAvg = framesTimed ? (frameUsAvg * 15 + us) / 16 : us;
+  if (us > frameUsMax) frameUsMax = us;
+  framesTimed++;
+  frameBudgetUs = (uint64_t)(fi->outputSamps / fi->nChans) * 1000000 / fi->sampRateOut;
+
+  // Wait for the average to settle before judging it
+  if (cpuBudget && !coreOnly && (fi->sampRateOut != fi->sampRateCore) && (framesTimed >= 16) &&
+      (frameUsAvg * 100 > frameBudgetUs * cpuBudget)) {
+    SetCoreOnly(true);
+    cb.st(STATUS_COREONLY, PSTR("AAC over CPU budget, SBR off"));
+  }
+}
 
-  return true;
+void AudioGeneratorAAC::getStats(AudioStats *st)
+{
+  st->frames = framesTimed;
+  st->frameUs = frameUs;
+  st->frameUsAvg = frameUsAvg;
+  st->frameUsMax = frameUsMax;
+  st->frameBudgetUs = frameBudgetUs;
+  st->streamRate = lastRate;
+  if (bitRate) st->bitRate = bitRate;
+}
+
+bool AudioGeneratorAAC::FillRing()
+{
+  uint32_t space = RING_SIZE - (writePos - readPos);
+  bool gotData = false;
+  while (space) {
+    uint32_t off = writePos & (RING_SIZE - 1);
+    uint32_t span = RING_SIZE - off;
+    if (span > space) span = space;
+    uint32_t n = file->read(buff + off, span);
+    if (!n) break;
+    if (off < MIRROR_SIZE) {
+      // Keep the copy past the end in step with the start of the ring
+      uint32_t m = MIRROR_SIZE - off;
+      memcpy(buff + RING_SIZE + off, buff + off, (n < m) ? n : m);
+    }
+    writePos += n;
+    space -= n;
+    gotData = true;
+    if (n < span) break;
+  }
+  return gotData;
+}
+
+// Returns the next ADTS frame in place, or NULL at the end of the stream.
+// The frame stays valid until readPos is moved past it.
+uint8_t *AudioGeneratorAAC::NextADTSFrame(int *frameLen)
+{
+  while (true) {
+    uint32_t avail = writePos - readPos;
+    if (avail < 9) {
+      if (!FillRing()) return NULL;
+      continue;
+    }
+    uint32_t off = readPos & (RING_SIZE - 1);
+    uint8_t *p = buff + off;
+    uint32_t contig = RING_SIZE + MIRROR_SIZE - off;
+    if (contig > avail) contig = avail;
+
+    if (p[0] != 0xff || (p[1] & 0xf0) != 0xf0) {
+      // Lost sync, keep a trailing 0xff as it may be the first half of the next syncword
+      int sync = AACFindSyncWord(p, contig);
+      readPos += (sync < 0) ? contig - 1 : sync;
+      continue;
+    }
+    int len = ((p[3] & 3) << 11) | (p[4] << 3) | (p[5] >> 5);
+    if ((p[1] & 0x06) || len < 7 || len > MIRROR_SIZE - 2) {
+      readPos++; // Layer must be 0, and the frame has to fit the mirror
+      continue;
+    }
+    if ((uint32_t)len + 2 > avail) {
+      if (FillRing()) continue;
+      if ((uint32_t)len > avail) return NULL; // Truncated last frame
+    } else if (p[len] != 0xff || (p[len + 1] & 0xf0) != 0xf0) {
+      readPos++; // No syncword where the next frame should start, a false sync
+      continue;
+    }
+    *frameLen = len;
+    return p;
+  }
 }
 
 bool AudioGeneratorAAC::loop()
@@ -152,33 +245,48 @@ bool AudioGeneratorAAC::loop()
   }
 
   // No samples available, need to decode a new frame
-  if (FillBufferWithValidFrame()) {
-    // buff[0] start of frame, decode it...
-    unsigned char *inBuff = reinterpret_cast<unsigned char *>(buff);
-    int bytesLeft = buffValid;
-    int ret = AACDecode(hAACDecoder, &inBuff, &bytesLeft, outSample);
-    if (ret) {
-      // Error, skip the frame...
-      char buff[48];
-      sprintf_P(buff, PSTR("AAC decode error %d"), ret);
-      cb.st(ret, buff);
+  {
+    uint8_t *frame;
+    int frameLen = 0;
+    if (isMP4) {
+      frameLen = mp4.read(buff, RING_SIZE + MIRROR_SIZE);
+      frame = frameLen ? buff : NULL;
     } else {
-      lastFrameEnd = buffValid - bytesLeft;
-      AACFrameInfo fi;
-      AACGetLastFrameInfo(hAACDecoder, &fi);
-      if ((int)fi.sampRateOut != (int)lastRate) {
-        output->SetRate(fi.sampRateOut);
-        lastRate = fi.sampRateOut;
-      }
-      if (fi.nChans != lastChannels) {
-        output->SetChannels(fi.nChans);
-        lastChannels = fi.nChans;
+      frame = NextADTSFrame(&frameLen);
+    }
+    if (frame) {
+      unsigned char *inBuff = reinterpret_cast<unsigned char *>(frame);
+      int bytesLeft = frameLen;
+      uint32_t start = micros();
+      int ret = AACDecode(hAACDecoder, &inBuff, &bytesLeft, outSample);
+      uint32_t us = micros() - start;
+      decoderUsed = true;
+      if (ret) {
+        // Error, skip the frame...
+        if (!isMP4) readPos++;
+        char buff[48];
+        sprintf_P(buff, PSTR("AAC decode error %d"), ret);
+        cb.st(ret, buff);
+      } else {
+        if (!isMP4) readPos += frameLen;
+        AACFrameInfo fi;
+        AACGetLastFrameInfo(hAACDecoder, &fi);
+        if ((int)fi.sampRateOut != (int)lastRate) {
+          output->SetRate(fi.sampRateOut);
+          lastRate = fi.sampRateOut;
+        }
+        if (fi.nChans != lastChannels) {
+          output->SetChannels(fi.nChans);
+          lastChannels = fi.nChans;
+        }
+        curSample = 0;
+        validSamples = fi.outputSamps / lastChannels;
+        bitRate = isMP4 ? 0 : (uint64_t)frameLen * 8 * fi.sampRateOut / validSamples;
+        RecordFrameTime(us, &fi);
       }
-      curSample = 0;
-      validSamples = fi.outputSamps / lastChannels;
+    } else {
+      running = false; // No more data, we're done here...
     }
-  } else {
-    running = false; // No more data, we're done here...
   }
 
 done:
@@ -196,19 +304,50 @@ bool AudioGeneratorAAC::begin(AudioFileSource *source, AudioOutput *output)
   this->output = output;
   if (!file->isOpen()) return false; // Error
 
+  ResetDecoder();
+  readPos = 0;
+  writePos = 0;
+  validSamples = 0;
+  curSample = 0;
+  lastRate = 0;
+  lastChannels = 0;
+  memset(outSample, 0, MAX_OUT_SAMPLES*2*sizeof(int16_t));
+  framesTimed = 0;
+  frameUs = 0;
+  frameUsAvg = 0;
+  frameUsMax = 0;
+  frameBudgetUs = 0;
+  bitRate = 0;
+  AACSetCoreOnly(hAACDecoder, coreOnly);
+
+  // MP4/M4A files start with an ftyp box, anything else is taken as an ADTS stream
+  isMP4 = false;
+  if (FillRing() && writePos >= 8 && AudioDemuxMP4::IsMP4(buff)) {
+    if (!mp4.open(file)) {
+      Serial.printf_P(PSTR("AAC: no AAC-LC audio track in MP4 file\n"));
+      return false;
+    }
+    AACFrameInfo fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.nChans = mp4.getChannels();
+    fi.sampRateCore = mp4.getSampleRate();
+    fi.profile = AAC_PROFILE_LC;
+    decoderUsed = true;
+    if (AACSetRawBlockParams(hAACDecoder, 0, &fi)) {
+      Serial.printf_P(PSTR("AAC: unsupported MP4 audio config\n"));
+      return false;
+    }
+    isMP4 = true;
+    readPos = 0;
+    writePos = 0;
+  }
+
   output->begin();
   
   // AAC always comes out at 16 bits
   output->SetBitsPerSample(16);
- 
-
-  memset(buff, 0, buffLen);
-  memset(outSample, 0, 1024*2*sizeof(int16_t));
 
- 
   running = true;
   
   return true;
 }
-
-
@@ -22,6 +22,7 @@
 #define _AUDIOGENERATORAAC_H
 
 #include "AudioGenerator.h"
+#include "AudioDemuxMP4.h"
 #include "libhelix-aac/aacdec.h"
 
 class AudioGeneratorAAC : public AudioGenerator
@@ -34,6 +35,17 @@ class AudioGeneratorAAC : public AudioGenerator
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
+    virtual void getStats(AudioStats *st) override;
+
+    // HE-AAC without its SBR band: only the AAC-LC core is decoded, at half the
+    // output rate and for a fraction of the work.  SetCoreOnly() forces it,
+    // SetCpuBudget() switches to it once decoding averages more than percent of
+    // the play time (0, the default, never does).  Plain AAC-LC is unaffected.
+    bool SetCoreOnly(bool enabled);
+    bool SetCpuBudget(int percent) { cpuBudget = percent; return true; }
+    bool isCoreOnly() { return coreOnly; }
+
+    enum { STATUS_COREONLY = 1 };
 
   protected:
     void *preallocateSpace;
@@ -42,15 +54,28 @@ class AudioGeneratorAAC : public AudioGenerator
     // Helix AAC decoder
     HAACDecoder hAACDecoder;
 
-    // Input buffering
-    const int buffLen = 1600;
-    uint8_t *buff; //[1600]; // File buffer required to store at least a whole compressed frame
-    int16_t buffValid;
-    int16_t lastFrameEnd;
-    bool FillBufferWithValidFrame(); // Read until we get a valid syncword and min(feof, 2048) butes in the buffer
+    void *decoderSpace;
+    int decoderSpaceSize;
+    bool decoderUsed;
+    void ResetDecoder();
+
+    // Input buffering.  ADTS frames are parsed in place in a ring whose first
+    // MIRROR_SIZE bytes are duplicated past its end, so any frame can be handed
+    // to the decoder in one piece without moving the data around.
+    enum { RING_SIZE = 4096, MIRROR_SIZE = 2048 }; // Largest ADTS frame Helix takes is 2 * 768 bytes
+    uint8_t *buff; //[RING_SIZE + MIRROR_SIZE];
+    uint32_t readPos;
+    uint32_t writePos;
+    bool FillRing(); // false once the source has nothing more to give
+    uint8_t *NextADTSFrame(int *frameLen);
+
+    // MP4/M4A files are demuxed into raw access units, read straight into buff
+    AudioDemuxMP4 mp4;
+    bool isMP4;
 
     // Output buffering
-    int16_t *outSample; //[1024 * 2]; // Interleaved L/R
+    enum { MAX_OUT_SAMPLES = 2048 }; // Per channel, SBR doubles the 1024 of the core
+    int16_t *outSample; //[MAX_OUT_SAMPLES * 2]; // Interleaved L/R
     int16_t validSamples;
     int16_t curSample;
 
@@ -58,6 +83,17 @@ class AudioGeneratorAAC : public AudioGenerator
     unsigned int lastRate;
     int lastChannels;
 
+    // Decode time of each frame, in microseconds
+    bool coreOnly;
+    int cpuBudget;
+    uint32_t framesTimed;
+    uint32_t frameUs;
+    uint32_t frameUsAvg;
+    uint32_t frameUsMax;
+    uint32_t frameBudgetUs;
+    uint32_t bitRate;
+    void RecordFrameTime(uint32_t us, const AACFrameInfo *fi);
+
 };
 
 #endif
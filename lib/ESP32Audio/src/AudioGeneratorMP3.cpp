@@ -20,6 +20,7 @@
 
 
 #include "AudioGeneratorMP3.h"
+#include "AudioMemory.h"
 
 AudioGeneratorMP3::AudioGeneratorMP3()
 {
@@ -27,8 +28,21 @@ AudioGeneratorMP3::AudioGeneratorMP3()
   file = NULL;
   output = NULL;
   buff = NULL;
+  stream = NULL;
+  frame = NULL;
+  synth = NULL;
+  frameIndex = NULL;
+  indexAlloc = 0;
   nsCountMax = 1152/32;
   madInitted = false;
+  frameTiming = false;
+  frameTime = 0;
+  framesTimed = 0;
+  frameUs = 0;
+  frameUsAvg = 0;
+  frameUsMax = 0;
+  gapless = true;
+  decodeMode = DECODE_STEREO;
   preallocateSpace = NULL;
   preallocateSize = 0;
 }
@@ -39,8 +53,21 @@ AudioGeneratorMP3::AudioGeneratorMP3(void *space, int size)
   file = NULL;
   output = NULL;
   buff = NULL;
+  stream = NULL;
+  frame = NULL;
+  synth = NULL;
+  frameIndex = NULL;
+  indexAlloc = 0;
   nsCountMax = 1152/32;
   madInitted = false;
+  frameTiming = false;
+  frameTime = 0;
+  framesTimed = 0;
+  frameUs = 0;
+  frameUsAvg = 0;
+  frameUsMax = 0;
+  gapless = true;
+  decodeMode = DECODE_STEREO;
   preallocateSpace = space;
   preallocateSize = size;
 }
@@ -48,15 +75,23 @@ AudioGeneratorMP3::AudioGeneratorMP3(void *space, int size)
 AudioGeneratorMP3::~AudioGeneratorMP3()
 {
   if (!preallocateSpace) {
-    free(buff);
-    free(synth);
-    free(frame);
-    free(stream);
+    AudioMemory::release(buff);
+    AudioMemory::release(synth);
+    AudioMemory::release(frame);
+    AudioMemory::release(stream);
   } 
+  free(frameIndex);
 }
 
 
 bool AudioGeneratorMP3::stop()
+{
+  bool ret = release();
+  output->stop();
+  return ret;
+}
+
+bool AudioGeneratorMP3::release()
 {
   if (madInitted) {
     mad_synth_finish(synth);
@@ -66,10 +101,10 @@ bool AudioGeneratorMP3::stop()
   }
 
   if (!preallocateSpace) {
-    free(buff);
-    free(synth);
-    free(frame);
-    free(stream);
+    AudioMemory::release(buff);
+    AudioMemory::release(synth);
+    AudioMemory::release(frame);
+    AudioMemory::release(stream);
   }
 
   buff = NULL;
@@ -78,10 +113,22 @@ bool AudioGeneratorMP3::stop()
   stream = NULL;
 
   running = false;
-  output->stop();
   return file->close();
 }
 
+bool AudioGeneratorMP3::SetDecodeMode(int mode)
+{
+  decodeMode = mode;
+  if (stream) {
+    int opts = 0;
+    if (mode & DECODE_LEFT) opts |= MAD_OPTION_LEFTCHANNEL;
+    else if (mode & DECODE_DOWNMIX) opts |= MAD_OPTION_SINGLECHANNEL;
+    if (mode & DECODE_HALFRATE) opts |= MAD_OPTION_HALFSAMPLERATE;
+    mad_stream_options(stream, opts);
+  }
+  return true;
+}
+
 bool AudioGeneratorMP3::isRunning()
 {
   return running;
@@ -97,7 +144,7 @@ enum mad_flow AudioGeneratorMP3::ErrorToFlow()
 
   strcpy_P(err, mad_stream_errorstr(stream));
   snprintf_P(errLine, sizeof(errLine), PSTR("Decoding error '%s' at byte offset %d"),
-           err, (stream->this_frame - buff) + lastReadPos);
+           err, (int)((stream->this_frame - buff) + lastReadPos));
   yield(); // Something bad happened anyway, ensure WiFi gets some time, too
   cb.st(stream->error, errLine);
   return MAD_FLOW_CONTINUE;
@@ -106,9 +153,11 @@ enum mad_flow AudioGeneratorMP3::ErrorToFlow()
 enum mad_flow AudioGeneratorMP3::Input()
 {
   int unused = 0;
+  bool progress = true;
 
   if (stream->next_frame) {
-    unused = buffLen - (stream->next_frame - buff);
+    progress = (stream->next_frame != buff);
+    unused = stream->bufend - stream->next_frame;
     memmove(buff, stream->next_frame, unused);
     stream->next_frame = NULL;
   }
@@ -121,8 +170,16 @@ enum mad_flow AudioGeneratorMP3::Input()
   int len = buffLen - unused;
   len = file->read(buff + unused, len);
   if (len == 0) {
-    Serial.printf_P(PSTR("MP3 stop, len==0\n"));
-    return MAD_FLOW_STOP;
+    // At the end of the file the frames still buffered are played out.  libmad
+    // only decodes the last one with MAD_BUFFER_GUARD bytes behind it.
+    if (!eofPadded && progress && unused && (unused + MAD_BUFFER_GUARD <= buffLen)) {
+      memset(buff + unused, 0, MAD_BUFFER_GUARD);
+      unused += MAD_BUFFER_GUARD;
+      eofPadded = true;
+    } else if (!eofPadded || !progress || (unused <= MAD_BUFFER_GUARD)) {
+      Serial.printf_P(PSTR("MP3 stop, len==0\n"));
+      return MAD_FLOW_STOP;
+    }
   }
 
   mad_stream_buffer(stream, buff, len + unused);
@@ -131,16 +188,295 @@ enum mad_flow AudioGeneratorMP3::Input()
 }
 
 
+void AudioGeneratorMP3::RecordFrameTime()
+{
+  frameUs = frameTime;
+  frameUsAvg = framesTimed ? (frameUsAvg * 15 + frameUs) / 16 : frameUs;
+  if (frameUs > frameUsMax) frameUsMax = frameUs;
+  framesTimed++;
+  frameTime = 0;
+  frameTiming = false;
+}
+
+void AudioGeneratorMP3::getStats(AudioStats *st)
+{
+  st->frames = framesTimed;
+  st->frameUs = frameUs;
+  st->frameUsAvg = frameUsAvg;
+  st->frameUsMax = frameUsMax;
+  st->streamRate = sampleRate;
+  if (sampleRate) st->frameBudgetUs = (uint64_t)nsCountMax * 32 * 1000000 / sampleRate;
+  if (frame && headerChecked) st->bitRate = frame->header.bitrate;
+}
+
 bool AudioGeneratorMP3::DecodeNextFrame()
 {
-  if (mad_frame_decode(frame, stream) == -1) {
+  // The previous frame is fully synthesised by now.  Time spent on frames
+  // that fail to decode goes to the next good one.
+  if (frameTiming) RecordFrameTime();
+  uint32_t start = micros();
+  int ret = mad_frame_decode(frame, stream);
+  frameTime += micros() - start;
+  if (ret == -1) {
+    // Header was fine but the data wasn't (usually the bit reservoir after a seek), the
+    // frame still counts.  Errors from 0x0200 up are all past the header.
+    if (headerChecked && (stream->error >= MAD_ERROR_BADCRC)) RecordFrame(lastReadPos + (stream->this_frame - buff));
     ErrorToFlow(); // Always returns CONTINUE
     return false;
   }
   nsCountMax  = MAD_NSBSAMPLES(&frame->header);
+  uint32_t offset = lastReadPos + (stream->this_frame - buff);
+  if (!headerChecked) {
+    headerChecked = true;
+    sampleRate = frame->header.samplerate;
+    bitRate = frame->header.bitrate;
+    streamStart = offset;
+    audioStart = offset;
+    // The Xing/Info or VBRI frame carries no audio, don't play it
+    if (ParseXingHeader() || ParseVbriHeader()) {
+      audioStart = offset + (stream->next_frame - stream->this_frame);
+      return false;
+    }
+  }
+  RecordFrame(offset);
+  frameTiming = true;
+  return true;
+}
+
+void AudioGeneratorMP3::RecordFrame(uint32_t offset)
+{
+  if (indexExact && !(frameNo % INDEX_STRIDE) && (frameNo / INDEX_STRIDE == (uint32_t)indexCount)) {
+    if (indexCount == indexAlloc) {
+      uint32_t *grown = reinterpret_cast<uint32_t *>(realloc(frameIndex, (indexAlloc + 256) * sizeof(uint32_t)));
+      if (!grown) {
+        indexExact = false;
+        frameNo++;
+        return;
+      }
+      frameIndex = grown;
+      indexAlloc += 256;
+    }
+    frameIndex[indexCount++] = offset;
+  }
+  frameNo++;
+}
+
+bool AudioGeneratorMP3::setFrameIndex(const uint32_t *entries, int count)
+{
+  if (count <= indexCount) return true; // Ours is already as good
+  uint32_t *grown = reinterpret_cast<uint32_t *>(realloc(frameIndex, count * sizeof(uint32_t)));
+  if (!grown) return false;
+  frameIndex = grown;
+  indexAlloc = count;
+  memcpy(frameIndex, entries, count * sizeof(uint32_t));
+  indexCount = count;
+  return true;
+}
+
+uint32_t AudioGeneratorMP3::getPositionMs()
+{
+  if (!sampleRate) return 0;
+  return ((uint64_t)frameNo * 32 * nsCountMax * 1000) / sampleRate;
+}
+
+uint32_t AudioGeneratorMP3::getDurationMs()
+{
+  if (!sampleRate) return 0;
+  if (xingFrames) return ((uint64_t)xingFrames * 32 * nsCountMax * 1000) / sampleRate;
+  // No Xing header, assume CBR
+  if (bitRate && (file->getSize() > audioStart)) return ((uint64_t)(file->getSize() - audioStart) * 8000) / bitRate;
+  return 0;
+}
+
+bool AudioGeneratorMP3::seekMs(uint32_t ms)
+{
+  if (!running) return false;
+  if (!headerChecked && !prime()) return false;
+  if (!sampleRate) return false;
+
+  uint32_t target = ((uint64_t)ms * sampleRate / 1000) / (32 * nsCountMax);
+  if (xingFrames && (target >= xingFrames)) target = xingFrames - 1;
+  return SeekToFrame(target);
+}
+
+bool AudioGeneratorMP3::SeekToFrame(uint32_t target)
+{
+  // Walking headers costs one SD read per frame, past this many the TOC is used instead
+  const uint32_t maxWalk = 16 * INDEX_STRIDE;
+  uint32_t spf = 32 * nsCountMax;
+  uint32_t indexed = indexCount ? (indexCount - 1) * INDEX_STRIDE : 0;
+  uint32_t at, pos;
+  bool exact = true;
+
+  if (target / INDEX_STRIDE < (uint32_t)indexCount) {
+    at = (target / INDEX_STRIDE) * INDEX_STRIDE;
+    pos = frameIndex[target / INDEX_STRIDE];
+  } else if (xingHasToc && xingFrames && tocBytes && (target - indexed > maxWalk)) {
+    // TOC entries are 1/256ths of the stream at each percent, interpolate in between
+    uint32_t permille = ((uint64_t)target * 1000) / xingFrames;
+    int i = permille / 10;
+    int a = xingToc[i];
+    int b = (i < 99) ? xingToc[i + 1] : 256;
+    uint32_t frac = a * 10 + (b - a) * (int)(permille % 10);
+    at = target;
+    pos = tocStart + ((uint64_t)frac * tocBytes) / 2560;
+    exact = false;
+  } else if (indexCount) {
+    at = indexed;
+    pos = frameIndex[indexCount - 1];
+  } else {
+    at = 0;
+    pos = audioStart;
+  }
+
+  if (!file->seek(pos, SEEK_SET)) return false;
+  // Drop everything buffered, including the bit reservoir and the synth history
+  stream->next_frame = NULL;
+  stream->md_len = 0;
+  eofPadded = false;
+  mad_frame_mute(frame);
+  mad_synth_mute(synth);
+  frameNo = at;
+  indexExact = exact;
+
+  // Headers only, this also extends the index.  Not into frame->header, which
+  // mad_frame_decode() would then take for the next frame's.
+  struct mad_header header;
+  mad_header_init(&header);
+  while (frameNo < target) {
+    if (mad_header_decode(&header, stream) == -1) {
+      if ((stream->error == MAD_ERROR_BUFLEN) || (stream->error == MAD_ERROR_BUFPTR)) {
+        if (Input() == MAD_FLOW_STOP) return false;
+        continue;
+      }
+      if (MAD_RECOVERABLE(stream->error)) continue;
+      return false;
+    }
+    RecordFrame(lastReadPos + (stream->this_frame - buff));
+  }
+
+  samplePtr = 9999;
+  nsCount = 9999;
+  samplePending = false;
+  if (gapless && (encDelay || encPadding)) {
+    uint32_t trimStart = encDelay + 529;
+    uint32_t decoded = frameNo * spf;
+    skipSamples = (decoded < trimStart) ? trimStart - decoded : 0;
+    if (validSamples != SAMPLES_UNKNOWN) {
+      uint32_t validEnd = trimStart + validSamples;
+      uint32_t from = (decoded > trimStart) ? decoded : trimStart;
+      samplesLeft = (validEnd > from) ? validEnd - from : 0;
+    }
+  }
   return true;
 }
 
+bool AudioGeneratorMP3::ParseXingHeader()
+{
+  const unsigned char *p = stream->this_frame + 4;
+  const unsigned char *end = stream->next_frame;
+  bool mono = frame->header.mode == MAD_MODE_SINGLE_CHANNEL;
+  if (frame->header.flags & MAD_FLAG_PROTECTION) p += 2;
+  if (frame->header.flags & MAD_FLAG_LSF_EXT) p += mono ? 9 : 17;
+  else p += mono ? 17 : 32;
+
+  if (p + 8 > end) return false;
+  if (memcmp(p, "Xing", 4) && memcmp(p, "Info", 4)) return false;
+  uint32_t flags = (p[4]<<24) | (p[5]<<16) | (p[6]<<8) | p[7];
+  p += 8;
+  if ((flags & 1) && (p + 4 <= end)) {
+    xingFrames = (p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+    p += 4;
+  }
+  if ((flags & 2) && (p + 4 <= end)) {
+    tocStart = streamStart;
+    tocBytes = (p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+    p += 4;
+  }
+  if ((flags & 4) && (p + 100 <= end)) {
+    memcpy(xingToc, p, 100);
+    xingHasToc = true;
+    p += 100;
+  }
+  if (flags & 8) p += 4;
+
+  // LAME extension: 9 byte version string, delay and padding are two 12 bit fields 21 bytes in
+  if ((p + 24 <= end) && !memcmp(p, "LAME", 4)) {
+    encDelay = (p[21]<<4) | (p[22]>>4);
+    encPadding = ((p[22]&0x0f)<<8) | p[23];
+    if (gapless) {
+      // libmad adds 529 samples of its own delay on top of the encoder's
+      skipSamples = encDelay + 529;
+      if (xingFrames) {
+        uint32_t total = xingFrames * 32 * nsCountMax;
+        uint32_t trim = encDelay + encPadding;
+        samplesLeft = (total > trim) ? total - trim : 0;
+        validSamples = samplesLeft;
+      }
+    }
+  }
+  return true;
+}
+
+// Fraunhofer's VBRI header, always 32 bytes past the frame header.  Its TOC holds
+// the size of each run of framesPerEntry frames from the first audio frame on,
+// and is turned into a Xing style percent table so seeking has one path.
+bool AudioGeneratorMP3::ParseVbriHeader()
+{
+  const unsigned char *p = stream->this_frame + 4 + 32;
+  const unsigned char *end = stream->next_frame;
+  if ((p + 26 > end) || memcmp(p, "VBRI", 4)) return false;
+  uint32_t frames = (p[14]<<24) | (p[15]<<16) | (p[16]<<8) | p[17];
+  int entries = (p[18]<<8) | p[19];
+  uint32_t scale = (p[20]<<8) | p[21];
+  int entrySize = (p[22]<<8) | p[23];
+  uint32_t perEntry = (p[24]<<8) | p[25];
+  p += 26;
+  xingFrames = frames;
+  if (!frames || !entries || !scale || (entrySize < 1) || (entrySize > 4) || !perEntry) return true;
+  if (p + entries * entrySize > end) return true;
+
+  auto entry = [&](int e) {
+    uint32_t v = 0;
+    for (int i = 0; i < entrySize; i++) v = (v << 8) | p[e * entrySize + i];
+    return v * scale;
+  };
+  tocStart = streamStart + (end - stream->this_frame);
+  tocBytes = 0;
+  for (int e = 0; e < entries; e++) tocBytes += entry(e);
+  if (!tocBytes) return true;
+  // Walk the runs once, the percent points only move forward
+  uint32_t before = 0; // Bytes in the runs ahead of run e
+  int e = 0;
+  for (int i = 0; i < 100; i++) {
+    uint32_t want = ((uint64_t)i * frames) / 100;
+    while ((e < entries) && ((uint32_t)(e + 1) * perEntry <= want)) before += entry(e++);
+    uint32_t into = (e < entries) ? ((uint64_t)entry(e) * (want - e * perEntry)) / perEntry : 0;
+    uint32_t t = ((uint64_t)(before + into) * 256) / tocBytes;
+    xingToc[i] = (t > 255) ? 255 : t;
+  }
+  xingHasToc = true;
+  return true;
+}
+
+// True if the sample just produced is encoder delay or padding and must not be played.
+// The counts are in stream samples, at half rate each one produced stands for two.
+bool AudioGeneratorMP3::TrimSample()
+{
+  uint32_t step = (synth->pcm.samplerate < sampleRate) ? 2 : 1;
+  if (skipSamples) {
+    skipSamples = (skipSamples > step) ? skipSamples - step : 0;
+    return true;
+  }
+  if (samplesLeft == SAMPLES_UNKNOWN) return false;
+  if (!samplesLeft) {
+    running = false;
+    return true;
+  }
+  samplesLeft = (samplesLeft > step) ? samplesLeft - step : 0;
+  return false;
+}
+
 bool AudioGeneratorMP3::GetOneSample(int16_t sample[2])
 {
   if (synth->pcm.samplerate != lastRate) {
@@ -153,14 +489,19 @@ bool AudioGeneratorMP3::GetOneSample(int16_t sample[2])
   }
     
   // If we're here, we have one decoded frame and sent 0 or more samples out
+  // A single channel is only in samples[0]
+  int right = (synth->pcm.channels == 2) ? 1 : 0;
   if (samplePtr < synth->pcm.length) {
     sample[AudioOutput::LEFTCHANNEL ] = synth->pcm.samples[0][samplePtr];
-    sample[AudioOutput::RIGHTCHANNEL] = synth->pcm.samples[1][samplePtr];
+    sample[AudioOutput::RIGHTCHANNEL] = synth->pcm.samples[right][samplePtr];
     samplePtr++;
   } else {
     samplePtr = 0;
     
-    switch ( mad_synth_frame_onens(synth, frame, nsCount++) ) {
+    uint32_t start = micros();
+    enum mad_flow flow = mad_synth_frame_onens(synth, frame, nsCount++);
+    frameTime += micros() - start;
+    switch (flow) {
         case MAD_FLOW_STOP:
         case MAD_FLOW_BREAK: Serial.printf_P(PSTR("msf1ns failed\n"));
           return false; // Either way we're done
@@ -168,8 +509,9 @@ bool AudioGeneratorMP3::GetOneSample(int16_t sample[2])
           break; // Do nothing
     }
     // for IGNORE and CONTINUE, just play what we have now
+    right = (synth->pcm.channels == 2) ? 1 : 0;
     sample[AudioOutput::LEFTCHANNEL ] = synth->pcm.samples[0][samplePtr];
-    sample[AudioOutput::RIGHTCHANNEL] = synth->pcm.samples[1][samplePtr];
+    sample[AudioOutput::RIGHTCHANNEL] = synth->pcm.samples[right][samplePtr];
     samplePtr++;
   }
   return true;
@@ -181,10 +523,11 @@ bool AudioGeneratorMP3::loop()
   if (!running) goto done; // Nothing to do here!
 
   // First, try and push in the stored sample.  If we can't, then punt and try later
-  if (!output->ConsumeSample(lastSample)) goto done; // Can't send, but no error detected
+  if (samplePending && !output->ConsumeSample(lastSample)) goto done; // Can't send, but no error detected
+  samplePending = false;
 
   // Try and stuff the buffer one sample at a time
-  do
+  while (running)
   {
     // Decode next frame if we're beyond the existing generated data
     if ( (samplePtr >= synth->pcm.length) && (nsCount >= nsCountMax) ) {
@@ -205,7 +548,12 @@ retry:
       running = false;
       goto done;
     }
-  } while (running && output->ConsumeSample(lastSample));
+    if (TrimSample()) continue;
+    if (!output->ConsumeSample(lastSample)) {
+      samplePending = true;
+      break;
+    }
+  }
 
 done:
   file->loop();
@@ -214,6 +562,19 @@ done:
   return running;
 }
 
+bool AudioGeneratorMP3::prime()
+{
+  if (!running) return false;
+  if ( (samplePtr < synth->pcm.length) || (nsCount < nsCountMax) ) return true; // Already have a frame
+
+  do {
+    if (Input() == MAD_FLOW_STOP) return false;
+  } while (!DecodeNextFrame());
+  samplePtr = 9999;
+  nsCount = 0;
+  return true;
+}
+
 
 
 bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output)
@@ -238,6 +599,31 @@ bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output)
   lastRate = 0;
   lastChannels = 0;
   lastReadPos = 0;
+  eofPadded = false;
+  samplePending = false;
+  headerChecked = false;
+  xingFrames = 0;
+  xingHasToc = false;
+  tocStart = 0;
+  tocBytes = 0;
+  encDelay = 0;
+  encPadding = 0;
+  skipSamples = 0;
+  samplesLeft = SAMPLES_UNKNOWN;
+  validSamples = SAMPLES_UNKNOWN;
+  sampleRate = 0;
+  bitRate = 0;
+  streamStart = 0;
+  audioStart = 0;
+  frameNo = 0;
+  indexCount = 0;
+  indexExact = true;
+  frameTiming = false;
+  frameTime = 0;
+  framesTimed = 0;
+  frameUs = 0;
+  frameUsAvg = 0;
+  frameUsMax = 0;
 
   // Allocate all large memory chunks
   if (preallocateSpace) {
@@ -256,15 +642,16 @@ bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output)
       return false;
     }
   } else {
-    buff = reinterpret_cast<unsigned char *>(malloc(buffLen));
-    stream = reinterpret_cast<struct mad_stream *>(malloc(sizeof(struct mad_stream)));
-    frame = reinterpret_cast<struct mad_frame *>(malloc(sizeof(struct mad_frame)));
-    synth = reinterpret_cast<struct mad_synth *>(malloc(sizeof(struct mad_synth)));
+    // All of it is worked on for every frame, so in internal RAM if it fits
+    buff = reinterpret_cast<unsigned char *>(AudioMemory::alloc(buffLen, AudioMemory::FAST, "mp3 input"));
+    stream = reinterpret_cast<struct mad_stream *>(AudioMemory::alloc(sizeof(struct mad_stream), AudioMemory::FAST, "mp3 stream"));
+    frame = reinterpret_cast<struct mad_frame *>(AudioMemory::alloc(sizeof(struct mad_frame), AudioMemory::FAST, "mp3 frame"));
+    synth = reinterpret_cast<struct mad_synth *>(AudioMemory::alloc(sizeof(struct mad_synth), AudioMemory::FAST, "mp3 synth"));
     if (!buff || !stream || !frame || !synth) {
-      free(buff);
-      free(stream);
-      free(frame);
-      free(synth);
+      AudioMemory::release(buff);
+      AudioMemory::release(stream);
+      AudioMemory::release(frame);
+      AudioMemory::release(synth);
       buff = NULL;
       stream = NULL;
       frame = NULL;
@@ -277,8 +664,8 @@ bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output)
   mad_frame_init(frame);
   mad_synth_init(synth);
   synth->pcm.length = 0;
-  mad_stream_options(stream, 0); // TODO - add options support
   madInitted = true;
+  SetDecodeMode(decodeMode);
  
   running = true;
   return true;
@@ -35,7 +35,34 @@ class AudioGeneratorMP3 : public AudioGenerator
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
-    
+    virtual void getStats(AudioStats *st) override;
+
+    // Decode the first frame ahead of time so a following loop() can produce samples at once
+    bool prime();
+    // Free the decoder and close the file but leave the output playing, for gapless hand-over
+    bool release();
+    // Drop the LAME encoder delay and padding (on by default)
+    bool SetGapless(bool enabled) { gapless = enabled; return true; }
+
+    // Less decoding for a mono speaker.  DECODE_LEFT does the IMDCT and synthesis of
+    // the left channel only, DECODE_DOWNMIX mixes both channels before the synthesis,
+    // which sounds the same as mixing the output.  Either gives one channel out.
+    // DECODE_HALFRATE synthesises at half the sample rate, losing the top half of the
+    // band.  Flags, taking effect from the next frame.
+    enum { DECODE_STEREO = 0, DECODE_LEFT = 1, DECODE_DOWNMIX = 2, DECODE_HALFRATE = 4 };
+    bool SetDecodeMode(int mode);
+
+    // Time based seeking, needs a seekable source.  Uses the frame index where it reaches,
+    // else the Xing or VBRI TOC for long jumps, else walks frame headers from the end of the index.
+    bool seekMs(uint32_t ms);
+    uint32_t getPositionMs();
+    uint32_t getDurationMs();
+
+    // Sparse seek index, the file offset of every INDEX_STRIDE-th audio frame, so apps can cache it
+    int getFrameIndex(const uint32_t **entries) { *entries = frameIndex; return indexCount; }
+    bool setFrameIndex(const uint32_t *entries, int count);
+    enum { INDEX_STRIDE = 32 };
+
   protected:   
     void *preallocateSpace;
     int preallocateSize;
@@ -43,6 +70,7 @@ class AudioGeneratorMP3 : public AudioGenerator
     const int buffLen = 0x600; // Slightly larger than largest MP3 frame
     unsigned char *buff;
     int lastReadPos;
+    bool eofPadded; // The guard bytes libmad needs are behind the last frame
     unsigned int lastRate;
     int lastChannels;
     
@@ -54,12 +82,54 @@ class AudioGeneratorMP3 : public AudioGenerator
     int samplePtr;
     int nsCount;
     int nsCountMax;
+    bool samplePending;
+
+    // Xing/Info and LAME, or VBRI, header of the first frame, if any
+    bool headerChecked;
+    bool gapless;
+    int decodeMode;
+    uint32_t xingFrames;
+    bool xingHasToc;
+    uint8_t xingToc[100]; // Position at each percent, in 1/256ths of tocBytes from tocStart
+    uint32_t tocStart;
+    uint32_t tocBytes;
+    int encDelay;
+    int encPadding;
+    uint32_t skipSamples;
+    uint32_t samplesLeft;
+    uint32_t validSamples;
+
+    // Seeking
+    uint32_t sampleRate;
+    uint32_t bitRate;
+    uint32_t streamStart; // File offset of the first frame, Xing frame included
+    uint32_t audioStart; // File offset of the first audio frame
+    uint32_t frameNo; // Audio frames decoded so far
+    uint32_t *frameIndex;
+    int indexCount;
+    int indexAlloc;
+    bool indexExact; // frameNo is known exactly, so new index entries can be trusted
+    enum : uint32_t { SAMPLES_UNKNOWN = 0xffffffff };
+
+    // Decode plus synthesis time of each frame, in microseconds
+    uint32_t frameTime; // Of the frame being played, so far
+    bool frameTiming;
+    uint32_t framesTimed;
+    uint32_t frameUs;
+    uint32_t frameUsAvg;
+    uint32_t frameUsMax;
 
     // The internal helpers
     enum mad_flow ErrorToFlow();
     enum mad_flow Input();
     bool DecodeNextFrame();
     bool GetOneSample(int16_t sample[2]);
+    bool ParseXingHeader();
+    bool ParseVbriHeader();
+    bool TrimSample();
+    void RecordFrame(uint32_t offset);
+    void RecordFrameTime();
+    bool SeekToFrame(uint32_t target);
 
 };
 
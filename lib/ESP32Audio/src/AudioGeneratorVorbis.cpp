@@ -0,0 +1,293 @@
+/*
+  AudioGeneratorVorbis
+  Audio output generator for Ogg Vorbis, using the integer vorbisdec decoder
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma GCC optimize ("O3")
+
+#include "AudioGeneratorVorbis.h"
+#include "AudioMemory.h"
+
+AudioGeneratorVorbis::AudioGeneratorVorbis()
+{
+  preallocateSpace = NULL;
+  preallocateSize = 0;
+
+  running = false;
+  file = NULL;
+  output = NULL;
+
+  // Pages only stream through, the decoder's tables and buffers are worked on for every packet
+  pageBuff = reinterpret_cast<uint8_t *>(AudioMemory::alloc(PAGE_BUFFER_SIZE, AudioMemory::BULK, "ogg pages"));
+  decoderSpace = AudioMemory::alloc(VORBIS_DEFAULT_SPACE, AudioMemory::FAST, "vorbis decoder");
+  hVorbisDecoder = VorbisInitDecoderPre(decoderSpace, VORBIS_DEFAULT_SPACE);
+  if (!pageBuff || !hVorbisDecoder) {
+    Serial.printf_P(PSTR("ERROR: Out of memory in Vorbis\n"));
+    Serial.flush();
+  }
+
+  outSample = NULL;
+  validSamples = 0;
+  curSample = 0;
+  channels = 0;
+  lastRate = 0;
+  lastChannels = 0;
+  streamSamples = 0;
+}
+
+AudioGeneratorVorbis::AudioGeneratorVorbis(void *preallocateData, int preallocateSz)
+{
+  preallocateSpace = preallocateData;
+  preallocateSize = preallocateSz;
+
+  running = false;
+  file = NULL;
+  output = NULL;
+
+  uint8_t *p = reinterpret_cast<uint8_t *>(preallocateSpace);
+  pageBuff = p;
+  p += PAGE_BUFFER_SIZE;
+  int availSpace = preallocateSize - PAGE_BUFFER_SIZE;
+  decoderSpace = p;
+  hVorbisDecoder = (availSpace > 0) ? VorbisInitDecoderPre(p, availSpace) : NULL;
+  if (!hVorbisDecoder) {
+    Serial.printf_P(PSTR("ERROR: Out of memory in Vorbis\n"));
+    Serial.flush();
+  }
+
+  outSample = NULL;
+  validSamples = 0;
+  curSample = 0;
+  channels = 0;
+  lastRate = 0;
+  lastChannels = 0;
+  streamSamples = 0;
+}
+
+AudioGeneratorVorbis::~AudioGeneratorVorbis()
+{
+  if (!preallocateSpace) {
+    AudioMemory::release(pageBuff);
+    AudioMemory::release(decoderSpace);
+  }
+}
+
+bool AudioGeneratorVorbis::stop()
+{
+  running = false;
+  output->stop();
+  return file->close();
+}
+
+bool AudioGeneratorVorbis::isRunning()
+{
+  return running;
+}
+
+void AudioGeneratorVorbis::RecordFrameTime(uint32_t us, int samples)
+{
+  frameUs = us;
+  frameUsAvg = framesTimed ? (frameUsAvg * 15 + us) / 16 : us;
+  if (us > frameUsMax) frameUsMax = us;
+  framesTimed++;
+  frameBudgetUs = (uint64_t)samples * 1000000 / lastRate;
+}
+
+void AudioGeneratorVorbis::getStats(AudioStats *st)
+{
+  st->frames = framesTimed;
+  st->frameUs = frameUs;
+  st->frameUsAvg = frameUsAvg;
+  st->frameUsMax = frameUsMax;
+  st->frameBudgetUs = frameBudgetUs;
+  st->streamRate = lastRate;
+  if (bitRate) st->bitRate = bitRate;
+}
+
+static inline uint32_t LE32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Vorbis comments are FIELD=value, UTF-8, field names in any case
+void AudioGeneratorVorbis::ParseComments(const uint8_t *packet, int len)
+{
+  char title[96] = "";
+  char artist[96] = "";
+  char album[96] = "";
+  const uint8_t *p = packet + 7;
+  const uint8_t *end = packet + len;
+
+  if (end - p < 4) return;
+  uint32_t vendorLen = LE32(p);
+  p += 4;
+  if ((uint32_t)(end - p) < vendorLen + 4) return;
+  p += vendorLen;
+  uint32_t count = LE32(p);
+  p += 4;
+  while (count-- && end - p >= 4) {
+    uint32_t l = LE32(p);
+    p += 4;
+    if ((uint32_t)(end - p) < l) break;
+    const char *c = reinterpret_cast<const char *>(p);
+    char *dest = NULL;
+    int skip = 0;
+    if (l > 6 && !strncasecmp(c, "TITLE=", 6)) { dest = title; skip = 6; }
+    else if (l > 7 && !strncasecmp(c, "ARTIST=", 7)) { dest = artist; skip = 7; }
+    else if (l > 6 && !strncasecmp(c, "ALBUM=", 6)) { dest = album; skip = 6; }
+    if (dest && !dest[0]) {
+      uint32_t n = l - skip;
+      if (n > sizeof(title) - 1) n = sizeof(title) - 1;
+      memcpy(dest, c + skip, n);
+      dest[n] = 0;
+    }
+    p += l;
+  }
+
+  if (title[0]) cb.md("Title", false, title);
+  if (artist[0]) cb.md("Performer", false, artist);
+  if (album[0]) cb.md("Album", false, album);
+  if (title[0]) {
+    char streamTitle[sizeof(artist) + sizeof(title) + 3];
+    if (artist[0]) snprintf_P(streamTitle, sizeof(streamTitle), PSTR("%s - %s"), artist, title);
+    else strcpy(streamTitle, title);
+    cb.md("StreamTitle", false, streamTitle);
+  }
+}
+
+// The three headers start each stream, false if it can't be played
+bool AudioGeneratorVorbis::DecodeHeader(const uint8_t *packet, int len)
+{
+  int ret = VorbisDecodeHeader(hVorbisDecoder, packet, len);
+  if (ret) {
+    char buff[48];
+    sprintf_P(buff, PSTR("Vorbis header error %d"), ret);
+    cb.st(ret, buff);
+    return false;
+  }
+  if (packet[0] == 3) ParseComments(packet, len);
+  if (VorbisHeadersDone(hVorbisDecoder)) {
+    VorbisInfo vi;
+    VorbisGetInfo(hVorbisDecoder, &vi);
+    if (vi.sampRate != (int)lastRate) {
+      output->SetRate(vi.sampRate);
+      lastRate = vi.sampRate;
+    }
+    if (vi.nChans != lastChannels) {
+      output->SetChannels(vi.nChans);
+      lastChannels = vi.nChans;
+    }
+    channels = vi.nChans;
+    bitRate = vi.bitRateNominal;
+  }
+  return true;
+}
+
+bool AudioGeneratorVorbis::loop()
+{
+  if (!running) goto done; // Nothing to do here!
+
+  // If we've got data, try and pump it out...
+  while (validSamples) {
+    lastSample[0] = outSample[curSample * channels];
+    lastSample[1] = outSample[curSample * channels + channels - 1];
+    if (!output->ConsumeSample(lastSample)) goto done; // Can't send, but no error detected
+    validSamples--;
+    curSample++;
+  }
+
+  // No samples available, need to decode a new packet
+  {
+    const uint8_t *packet;
+    int len = ogg.read(&packet);
+    if (len < 0) {
+      running = false; // No more data, we're done here...
+      goto done;
+    }
+    if (ogg.isStreamStart()) {
+      // The next song of a chain, or the first, its headers follow
+      VorbisReset(hVorbisDecoder);
+      streamSamples = 0;
+    }
+    if (!VorbisHeadersDone(hVorbisDecoder)) {
+      if (!DecodeHeader(packet, len)) running = false;
+      goto done;
+    }
+
+    int16_t *pcm;
+    uint32_t start = micros();
+    int ret = VorbisDecode(hVorbisDecoder, packet, len, &pcm);
+    uint32_t us = micros() - start;
+    if (ret < 0) {
+      // Error, skip the packet, the next one starts the overlap afresh
+      VorbisRestart(hVorbisDecoder);
+      char buff[48];
+      sprintf_P(buff, PSTR("Vorbis decode error %d"), ret);
+      cb.st(ret, buff);
+    } else if (ret) {
+      // The last page's granule says how much of the last packet is real
+      int64_t granule = ogg.getGranule();
+      if (ogg.isStreamEnd() && (granule >= 0) && (streamSamples + ret > (uint64_t)granule)) {
+        ret = ((uint64_t)granule > streamSamples) ? granule - streamSamples : 0;
+      }
+      streamSamples += ret;
+      outSample = pcm;
+      curSample = 0;
+      validSamples = ret;
+      RecordFrameTime(us, ret);
+    }
+  }
+
+done:
+  file->loop();
+  output->loop();
+
+  return running;
+}
+
+bool AudioGeneratorVorbis::begin(AudioFileSource *source, AudioOutput *output)
+{
+  if (!source) return false;
+  file = source;
+  if (!output) return false;
+  this->output = output;
+  if (!file->isOpen()) return false; // Error
+  if (!pageBuff || !hVorbisDecoder) return false;
+
+  VorbisReset(hVorbisDecoder);
+  ogg.begin(file, pageBuff, PAGE_BUFFER_SIZE, "\x01vorbis", 7);
+  validSamples = 0;
+  curSample = 0;
+  channels = 0;
+  lastRate = 0;
+  lastChannels = 0;
+  streamSamples = 0;
+  framesTimed = 0;
+  frameUs = 0;
+  frameUsAvg = 0;
+  frameUsMax = 0;
+  frameBudgetUs = 0;
+  bitRate = 0;
+
+  output->begin();
+
+  // Vorbis always comes out at 16 bits
+  output->SetBitsPerSample(16);
+
+  running = true;
+
+  return true;
+}
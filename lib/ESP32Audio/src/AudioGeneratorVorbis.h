@@ -0,0 +1,82 @@
+/*
+  AudioGeneratorVorbis
+  Audio output generator for Ogg Vorbis, using the integer vorbisdec decoder
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOGENERATORVORBIS_H
+#define _AUDIOGENERATORVORBIS_H
+
+#include "AudioGenerator.h"
+#include "AudioDemuxOgg.h"
+#include "libvorbis-int/vorbisdec.h"
+
+// Plays Ogg Vorbis files and streams, mono or stereo, floor 1 (everything
+// encoded since 2001).  Chained streams, as internet radio sends, play one
+// after the other, each song's comments are passed on as metadata: "Title",
+// "Performer" and "Album" like ID3, and "StreamTitle" as "Artist - Title"
+// like ICY.
+class AudioGeneratorVorbis : public AudioGenerator
+{
+  public:
+    AudioGeneratorVorbis();
+    AudioGeneratorVorbis(void *preallocateData, int preallocateSize);
+    virtual ~AudioGeneratorVorbis() override;
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+    virtual bool loop() override;
+    virtual bool stop() override;
+    virtual bool isRunning() override;
+    virtual void getStats(AudioStats *st) override;
+
+    // A page and the unfinished packet before it.  libvorbis pages stay
+    // under 8 KB and its setup header under 5 KB, a comment header carrying
+    // cover art doesn't fit and is skipped
+    enum { PAGE_BUFFER_SIZE = 16384 };
+    enum { PREALLOCATE_SIZE = PAGE_BUFFER_SIZE + VORBIS_DEFAULT_SPACE };
+
+  protected:
+    void *preallocateSpace;
+    int preallocateSize;
+
+    HVorbisDecoder hVorbisDecoder;
+    void *decoderSpace;
+
+    uint8_t *pageBuff; //[PAGE_BUFFER_SIZE]
+    AudioDemuxOgg ogg;
+
+    // Output buffering, in the decoder
+    int16_t *outSample;
+    int validSamples;
+    int curSample;
+    int channels;
+
+    unsigned int lastRate;
+    int lastChannels;
+    uint64_t streamSamples; // Played of the current stream, for the granule at its end
+
+    bool DecodeHeader(const uint8_t *packet, int len);
+    void ParseComments(const uint8_t *packet, int len);
+
+    // Decode time of each packet, in microseconds
+    uint32_t framesTimed;
+    uint32_t frameUs;
+    uint32_t frameUsAvg;
+    uint32_t frameUsMax;
+    uint32_t frameBudgetUs;
+    uint32_t bitRate;
+    void RecordFrameTime(uint32_t us, int samples);
+};
+
+#endif
@@ -26,10 +26,13 @@ AudioGeneratorWAV::AudioGeneratorWAV()
   running = false;
   file = NULL;
   output = NULL;
-  buffSize = 128;
+  buffSize = 2048;
   buff = NULL;
-  buffPtr = 0;
-  buffLen = 0;
+  passThrough = false;
+  rawLen = 0;
+  rawUsed = 0;
+  blockFrames = 0;
+  blockPtr = 0;
 }
 
 AudioGeneratorWAV::~AudioGeneratorWAV()
@@ -38,6 +41,13 @@ AudioGeneratorWAV::~AudioGeneratorWAV()
   buff = NULL;
 }
 
+void AudioGeneratorWAV::SetBufferSize(int sz)
+{
+  if (sz < MIN_BUFFER_SIZE) sz = MIN_BUFFER_SIZE;
+  if (sz > MAX_BUFFER_SIZE) sz = MAX_BUFFER_SIZE;
+  buffSize = sz & ~511;
+}
+
 bool AudioGeneratorWAV::stop()
 {
   if (!running) return true;
@@ -53,22 +63,56 @@ bool AudioGeneratorWAV::isRunning()
 }
 
 
-// Handle buffered reading, reload each time we run out of data
-bool AudioGeneratorWAV::GetBufferedData(int bytes, void *dest)
+// Read the next block and leave it in buff as 16 bit stereo frames
+bool AudioGeneratorWAV::FillBlock()
 {
-  if (!running) return false; // Nothing to do here!
-  uint8_t *p = reinterpret_cast<uint8_t*>(dest);
-  while (bytes--) {
-    // Potentially load next batch of data...
-    if (buffPtr >= buffLen) {
-      buffPtr = 0;
-      uint32_t toRead = availBytes > buffSize ? buffSize : availBytes;
-      buffLen = file->read( buff, toRead );
-      availBytes -= buffLen;
+  uint32_t frameBytes = channels * (bitsPerSample / 8);
+  uint32_t cap = passThrough ? buffSize : (buffSize / 4) * frameBytes;
+  uint8_t *raw = buff + buffSize - cap;
+
+  // A partial frame left from the last read goes to the front
+  uint32_t carry = rawLen - rawUsed;
+  memmove(raw, raw + rawUsed, carry);
+
+  // End the read on a sector boundary so the following ones are aligned
+  uint32_t pos = file->getPos();
+  uint32_t want = cap - carry;
+  uint32_t end = (pos + want) & ~511;
+  if (end > pos) want = end - pos;
+  if (want > availBytes) want = availBytes;
+  uint32_t got = want ? file->read(raw + carry, want) : 0;
+  availBytes -= got;
+
+  rawLen = carry + got;
+  blockFrames = rawLen / frameBytes;
+  rawUsed = blockFrames * frameBytes;
+  blockPtr = 0;
+  if (!blockFrames) return false; // No data left!
+  if (passThrough) return true;
+
+  // Widen to 16 bit stereo, one output word per frame.  The raw data sits far
+  // enough into the buffer that frame i is read before word i overwrites it.
+  uint32_t *out = reinterpret_cast<uint32_t*>(buff);
+  uint16_t n = blockFrames;
+  if (bitsPerSample == 8) {
+    if (channels == 1) {
+      for (uint16_t i = 0; i < n; i++) {
+        uint32_t s = (uint16_t)((raw[i] - 128) << 8);
+        out[i] = s | (s << 16);
+      }
+    } else {
+      for (uint16_t i = 0; i < n; i++) {
+        uint32_t l = (uint16_t)((raw[i*2] - 128) << 8);
+        uint32_t r = (uint16_t)((raw[i*2 + 1] - 128) << 8);
+        out[i] = l | (r << 16);
+      }
+    }
+  } else {
+    const uint16_t *in = reinterpret_cast<const uint16_t*>(raw);
+    for (uint16_t i = 0; i < n; i++) {
+      uint32_t s = in[i];
+      out[i] = s | (s << 16);
     }
-    if (buffPtr >= buffLen)
-      return false; // No data left!
-    *(p++) = buff[buffPtr++];
   }
   return true;
 }
@@ -77,31 +121,18 @@ bool AudioGeneratorWAV::loop()
 {
   if (!running) goto done; // Nothing to do here!
 
-  // First, try and push in the stored sample.  If we can't, then punt and try later
-  if (!output->ConsumeSample(lastSample)) goto done; // Can't send, but no error detected
-
-  // Try and stuff the buffer one sample at a time
-  do
-  {
-    if (bitsPerSample == 8) {
-      uint8_t l, r;
-      if (!GetBufferedData(1, &l)) stop();
-      if (channels == 2) {
-        if (!GetBufferedData(1, &r)) stop();
-      } else {
-        r = 0;
-      }
-      lastSample[AudioOutput::LEFTCHANNEL] = l;
-      lastSample[AudioOutput::RIGHTCHANNEL] = r;
-    } else if (bitsPerSample == 16) {
-      if (!GetBufferedData(2, &lastSample[AudioOutput::LEFTCHANNEL])) stop();
-      if (channels == 2) {
-        if (!GetBufferedData(2, &lastSample[AudioOutput::RIGHTCHANNEL])) stop();
-      } else {
-        lastSample[AudioOutput::RIGHTCHANNEL] = 0;
+  // Push out whole blocks until the output is full
+  while (running) {
+    if (blockPtr >= blockFrames) {
+      if (!FillBlock()) {
+        stop();
+        break;
       }
     }
-  } while (running && output->ConsumeSample(lastSample));
+    int16_t *samples = reinterpret_cast<int16_t*>(buff) + blockPtr * 2;
+    blockPtr += output->ConsumeSamples(samples, blockFrames - blockPtr);
+    if (blockPtr < blockFrames) break; // Can't send, but no error detected
+  }
 
 done:
   file->loop();
@@ -176,8 +207,11 @@ bool AudioGeneratorWAV::ReadWAVInfo()
   // Now set up the buffer or fail
   buff = reinterpret_cast<uint8_t *>(malloc(buffSize));
   if (!buff) return false;
-  buffPtr = 0;
-  buffLen = 0;
+  passThrough = (bitsPerSample == 16) && (channels == 2);
+  rawLen = 0;
+  rawUsed = 0;
+  blockFrames = 0;
+  blockPtr = 0;
 
   return true;
 }
@@ -193,8 +227,9 @@ bool AudioGeneratorWAV::begin(AudioFileSource *source, AudioOutput *output)
   if (!ReadWAVInfo()) return false;
 
   if (!output->SetRate( sampleRate )) return false;
-  if (!output->SetBitsPerSample( bitsPerSample )) return false;
-  if (!output->SetChannels( channels )) return false;
+  // FillBlock() converts everything to 16 bit stereo
+  if (!output->SetBitsPerSample( 16 )) return false;
+  if (!output->SetChannels( 2 )) return false;
   if (!output->begin()) return false;
 
   running = true;
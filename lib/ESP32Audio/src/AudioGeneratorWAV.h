@@ -32,13 +32,16 @@ class AudioGeneratorWAV : public AudioGenerator
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
-    void SetBufferSize(int sz) { buffSize = sz; }
+    void SetBufferSize(int sz); // Rounded down to a multiple of 512, so the reads stay sector aligned
+
+    // A block is at most buffSize / 4 frames, counted in 16 bits
+    enum { MIN_BUFFER_SIZE = 512, MAX_BUFFER_SIZE = 511 * 512 };
 
   private:
     bool ReadU32(uint32_t *dest) { return file->read(reinterpret_cast<uint8_t*>(dest), 4); }
     bool ReadU16(uint16_t *dest) { return file->read(reinterpret_cast<uint8_t*>(dest), 2); }
     bool ReadU8(uint8_t *dest) { return file->read(reinterpret_cast<uint8_t*>(dest), 1); }
-    bool GetBufferedData(int bytes, void *dest);
+    bool FillBlock();
     bool ReadWAVInfo();
 
     
@@ -50,11 +53,17 @@ class AudioGeneratorWAV : public AudioGenerator
     
     uint32_t availBytes;
 
-    // We need to buffer some data in-RAM to avoid doing 1000s of small reads
+    // Data is read in large blocks and always leaves as 16 bit stereo through
+    // ConsumeSamples.  16 bit stereo files are handed over straight from the
+    // read buffer, other formats are read into the tail of the buffer and
+    // widened in place.
     uint32_t buffSize;
     uint8_t *buff;
-    uint16_t buffPtr;
-    uint16_t buffLen;
+    bool passThrough;
+    uint32_t rawLen;  // Bytes in the raw block, including a trailing partial frame
+    uint32_t rawUsed; // Bytes of whole frames in the raw block
+    uint16_t blockFrames;
+    uint16_t blockPtr;
 };
 
 #endif
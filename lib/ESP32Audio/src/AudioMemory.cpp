@@ -0,0 +1,83 @@
+/*
+  AudioMemory
+  Places audio buffers in internal RAM or PSRAM and reports where they went
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AudioMemory.h"
+
+AudioMemory::Record AudioMemory::records[MAX_RECORDS];
+static portMUX_TYPE memMux = portMUX_INITIALIZER_UNLOCKED;
+
+void *AudioMemory::alloc(size_t bytes, int where, const char *name)
+{
+  const uint32_t internalCaps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+  const uint32_t psramCaps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+  bool internal = (where == FAST);
+  void *ptr = heap_caps_malloc(bytes, internal ? internalCaps : psramCaps);
+  if (!ptr) {
+    internal = !internal;
+    ptr = heap_caps_malloc(bytes, internal ? internalCaps : psramCaps);
+  }
+  if (!ptr) {
+    Serial.printf_P(PSTR("ERROR: Out of memory for %s (%u bytes)\n"), name, (unsigned)bytes);
+    return NULL;
+  }
+
+  // Untracked when the table is full, it still works
+  portENTER_CRITICAL(&memMux);
+  for (int i = 0; i < MAX_RECORDS; i++) {
+    if (!records[i].ptr) {
+      records[i].ptr = ptr;
+      records[i].name = name;
+      records[i].bytes = bytes;
+      records[i].internal = internal;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&memMux);
+  return ptr;
+}
+
+void AudioMemory::release(void *ptr)
+{
+  if (!ptr) return;
+  portENTER_CRITICAL(&memMux);
+  for (int i = 0; i < MAX_RECORDS; i++) {
+    if (records[i].ptr == ptr) {
+      records[i].ptr = NULL;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&memMux);
+  heap_caps_free(ptr);
+}
+
+void AudioMemory::report()
+{
+  Serial.printf_P(PSTR("Audio memory:\n"));
+  for (int i = 0; i < MAX_RECORDS; i++) {
+    Record r = records[i];
+    if (r.ptr) {
+      Serial.printf_P(PSTR("  %-20s %7u  %s\n"), r.name, (unsigned)r.bytes, r.internal ? "internal" : "PSRAM");
+    }
+  }
+  Serial.printf_P(PSTR("  internal free %u, largest %u\n"),
+                  (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+                  (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+  Serial.printf_P(PSTR("  PSRAM free %u, largest %u\n"),
+                  (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+                  (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+}
@@ -0,0 +1,51 @@
+/*
+  AudioMemory
+  Places audio buffers in internal RAM or PSRAM and reports where they went
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOMEMORY_H
+#define _AUDIOMEMORY_H
+
+#include <Arduino.h>
+
+// FAST is internal RAM, for decoder state touched on every sample.  BULK is
+// PSRAM, for buffers the data only streams through, which the cache copes
+// with.  Each falls back to the other rather than fail.  Plain malloc() on
+// a PSRAM board puts anything over a few KB in PSRAM, hot state included.
+// Allocations are recorded under their name for report(), the constant
+// tables are placed at build time instead (see HOT_TABLE in libmad/config.h
+// and libhelix-aac/aaccommon.h).
+class AudioMemory
+{
+  public:
+    enum { FAST, BULK };
+    enum { MAX_RECORDS = 16 };
+
+    static void *alloc(size_t bytes, int where, const char *name);
+    static void release(void *ptr); // NULL is fine
+    static void report(); // To serial, with what is left of each heap
+
+  private:
+    struct Record {
+      const void *ptr;
+      const char *name;
+      uint32_t bytes;
+      bool internal;
+    };
+    static Record records[MAX_RECORDS];
+};
+
+#endif
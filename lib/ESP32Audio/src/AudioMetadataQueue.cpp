@@ -0,0 +1,71 @@
+/*
+  AudioMetadataQueue
+  Hands metadata from the stream reader to the UI without callbacks
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AudioMetadataQueue.h"
+
+AudioMetadataQueue::AudioMetadataQueue()
+{
+  writeIdx = 0;
+  readIdx = 0;
+  dropped = 0;
+}
+
+bool AudioMetadataQueue::post(const char *type, const char *text)
+{
+  uint32_t w = writeIdx.load(std::memory_order_relaxed);
+  if (w - readIdx.load(std::memory_order_acquire) >= SLOTS) {
+    dropped++;
+    return false;
+  }
+  Event *ev = &events[w % SLOTS];
+  strncpy(ev->type, type, TYPE_LEN - 1);
+  ev->type[TYPE_LEN - 1] = 0;
+  strncpy(ev->text, text, TEXT_LEN - 1);
+  ev->text[TEXT_LEN - 1] = 0;
+  ev->ms = millis();
+  writeIdx.store(w + 1, std::memory_order_release);
+  return true;
+}
+
+bool AudioMetadataQueue::get(Event *ev)
+{
+  uint32_t r = readIdx.load(std::memory_order_relaxed);
+  uint32_t w = writeIdx.load(std::memory_order_acquire);
+  for (; r != w; r++) {
+    const Event *e = &events[r % SLOTS];
+    bool superseded = false;
+    for (uint32_t n = r + 1; n != w; n++) {
+      if (!strcmp(events[n % SLOTS].type, e->type)) {
+        superseded = true;
+        break;
+      }
+    }
+    if (!superseded) {
+      memcpy(ev, e, sizeof(*ev));
+      readIdx.store(r + 1, std::memory_order_release);
+      return true;
+    }
+  }
+  readIdx.store(r, std::memory_order_release);
+  return false;
+}
+
+void AudioMetadataQueue::clear()
+{
+  readIdx.store(writeIdx.load(std::memory_order_acquire), std::memory_order_release);
+}
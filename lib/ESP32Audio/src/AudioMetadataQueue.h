@@ -0,0 +1,55 @@
+/*
+  AudioMetadataQueue
+  Hands metadata from the stream reader to the UI without callbacks
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOMETADATAQUEUE_H
+#define _AUDIOMETADATAQUEUE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// The source posts a copy of each event into a fixed ring, the UI takes
+// them whenever it gets around to it.  Posting is a bounded copy and never
+// waits, so it can run on the audio data path.  An event with a newer one
+// of the same type queued behind it is skipped, so a burst of title changes
+// costs one redraw.  One task posts, one task gets.
+class AudioMetadataQueue
+{
+  public:
+    enum { SLOTS = 8, TYPE_LEN = 16, TEXT_LEN = 96 };
+
+    struct Event {
+      char type[TYPE_LEN]; // "StreamTitle", "StreamUrl", ...
+      char text[TEXT_LEN]; // Cut to fit
+      uint32_t ms;         // millis() when posted
+    };
+
+    AudioMetadataQueue();
+
+    bool post(const char *type, const char *text); // False when full, the event is dropped
+    bool get(Event *ev); // Oldest event not superseded, false when there is none
+    void clear(); // Consumer side, e.g. on a station change
+    uint32_t getDropped() { return dropped; }
+
+  private:
+    Event events[SLOTS];
+    std::atomic<uint32_t> writeIdx;
+    std::atomic<uint32_t> readIdx;
+    uint32_t dropped;
+};
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <Arduino.h>
 #include "AudioStatus.h"
+#include "AudioStats.h"
 
 class AudioOutput
 {
@@ -46,6 +47,7 @@ class AudioOutput
     }
     virtual bool stop() { return false; }
     virtual bool loop() { return true; }
+    virtual void getStats(AudioStats *st) { (void)st; }
 
   public:
     virtual bool RegisterMetadataCB(AudioStatus::metadataCBFn fn, void *data) { return cb.RegisterMetadataCB(fn, data); }
@@ -0,0 +1,395 @@
+/*
+  AudioOutputEQ
+  Parametric equalizer, a cascade of fixed-point biquads in front of another output
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioOutputEQ.h"
+
+#pragma GCC optimize ("O3")
+
+struct EQPreset
+{
+  const char *name;
+  float preampDb;
+  struct { uint8_t type; float freq, gainDb, q; } band[3];
+};
+
+static const EQPreset presets[AudioOutputEQ::PRESET_COUNT] = {
+  { "Flat", 0.0f, { { AudioOutputEQ::BAND_OFF, 0, 0, 0 } } },
+  { "Speaker", -5.0f, {
+    { AudioOutputEQ::BAND_HIGHPASS, 150.0f, 0.0f, 0.707f },
+    { AudioOutputEQ::BAND_PEAK, 350.0f, -3.0f, 1.0f },
+    { AudioOutputEQ::BAND_PEAK, 2800.0f, 5.0f, 0.9f } } },
+  { "Voice", -6.0f, {
+    { AudioOutputEQ::BAND_HIGHPASS, 250.0f, 0.0f, 0.707f },
+    { AudioOutputEQ::BAND_PEAK, 3000.0f, 6.0f, 0.8f },
+    { AudioOutputEQ::BAND_LOWPASS, 7000.0f, 0.0f, 0.707f } } },
+  { "Bass", -6.0f, {
+    { AudioOutputEQ::BAND_LOWSHELF, 100.0f, 6.0f, 0.707f } } },
+};
+
+AudioOutputEQ::AudioOutputEQ(AudioOutput *dest)
+{
+  sink = dest;
+  hertz = 44100;
+  bps = 16;
+  channels = 2;
+  preampQ15 = 32767;
+  preset = PRESET_FLAT;
+  activeBands = 0;
+  for (int i = 0; i < MAX_BANDS; i++) bands[i].type = BAND_OFF;
+  blocks = 0;
+  cyclesAvg = 0;
+  Reset();
+  sink->SetBitsPerSample(16);
+  sink->SetChannels(2);
+}
+
+AudioOutputEQ::~AudioOutputEQ()
+{
+}
+
+void AudioOutputEQ::Reset()
+{
+  for (int i = 0; i < MAX_BANDS; i++) {
+    memset(biquad[i].s1, 0, sizeof(biquad[i].s1));
+    memset(biquad[i].s2, 0, sizeof(biquad[i].s2));
+  }
+  inCount = 0;
+  outCount = 0;
+  outPos = 0;
+  delayed = false;
+  limitGain = 1 << 15;
+  holdGain = 1 << 15;
+  holdLeft = 0;
+  memset(delay, 0, sizeof(delay));
+  delayPos = 0;
+}
+
+// RBJ cookbook.  Only done when a band or the rate changes, so the float maths doesn't matter.
+void AudioOutputEQ::MakeBiquad(int band)
+{
+  Band *bd = &bands[band];
+  Biquad *bq = &biquad[band];
+  float freq = bd->freq;
+  if (freq < 10.0f) freq = 10.0f;
+  if (freq > 0.45f * hertz) freq = 0.45f * hertz; // A station at a lower rate than the bands were set for
+  float w0 = 2.0f * PI * freq / hertz;
+  float cw = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * bd->q);
+  float A = powf(10.0f, bd->gainDb / 40.0f);
+  float sa = 2.0f * sqrtf(A) * alpha;
+  float b0, b1, b2, a0, a1, a2;
+  switch (bd->type) {
+    case BAND_LOWPASS:
+      b0 = (1.0f - cw) / 2.0f; b1 = 1.0f - cw; b2 = b0;
+      a0 = 1.0f + alpha; a1 = -2.0f * cw; a2 = 1.0f - alpha;
+      break;
+    case BAND_HIGHPASS:
+      b0 = (1.0f + cw) / 2.0f; b1 = -(1.0f + cw); b2 = b0;
+      a0 = 1.0f + alpha; a1 = -2.0f * cw; a2 = 1.0f - alpha;
+      break;
+    case BAND_PEAK:
+      b0 = 1.0f + alpha * A; b1 = -2.0f * cw; b2 = 1.0f - alpha * A;
+      a0 = 1.0f + alpha / A; a1 = -2.0f * cw; a2 = 1.0f - alpha / A;
+      break;
+    case BAND_LOWSHELF:
+      b0 = A * ((A + 1.0f) - (A - 1.0f) * cw + sa);
+      b1 = 2.0f * A * ((A - 1.0f) - (A + 1.0f) * cw);
+      b2 = A * ((A + 1.0f) - (A - 1.0f) * cw - sa);
+      a0 = (A + 1.0f) + (A - 1.0f) * cw + sa;
+      a1 = -2.0f * ((A - 1.0f) + (A + 1.0f) * cw);
+      a2 = (A + 1.0f) + (A - 1.0f) * cw - sa;
+      break;
+    case BAND_HIGHSHELF:
+    default:
+      b0 = A * ((A + 1.0f) + (A - 1.0f) * cw + sa);
+      b1 = -2.0f * A * ((A - 1.0f) + (A + 1.0f) * cw);
+      b2 = A * ((A + 1.0f) + (A - 1.0f) * cw - sa);
+      a0 = (A + 1.0f) - (A - 1.0f) * cw + sa;
+      a1 = 2.0f * ((A - 1.0f) - (A + 1.0f) * cw);
+      a2 = (A + 1.0f) - (A - 1.0f) * cw - sa;
+      break;
+  }
+  b0 /= a0; b1 /= a0; b2 /= a0; a1 /= a0; a2 /= a0;
+
+  bq->shift = 0;
+  float most = fmaxf(fabsf(b0), fmaxf(fabsf(b1), fabsf(b2)));
+  while (most >= 1.999f) {
+    most /= 2.0f; b0 /= 2.0f; b1 /= 2.0f; b2 /= 2.0f;
+    bq->shift++;
+  }
+  const float one = (float)(1 << COEF_SHIFT);
+  bq->b0 = (int32_t)lrintf(b0 * one);
+  bq->b1 = (int32_t)lrintf(b1 * one);
+  bq->b2 = (int32_t)lrintf(b2 * one);
+  bq->a1 = (int32_t)lrintf(a1 * one);
+  bq->a2 = (int32_t)lrintf(a2 * one);
+}
+
+bool AudioOutputEQ::SetBand(int band, int type, float freq, float gainDb, float q)
+{
+  if (band < 0 || band >= MAX_BANDS || type < BAND_OFF || type > BAND_HIGHSHELF) return false;
+  if (q < 0.1f) q = 0.1f;
+  if (gainDb > 12.0f) gainDb = 12.0f;
+  if (gainDb < -12.0f) gainDb = -12.0f;
+  if (bands[band].type == BAND_OFF) {
+    // The state of an old band would come out as a click
+    memset(biquad[band].s1, 0, sizeof(biquad[band].s1));
+    memset(biquad[band].s2, 0, sizeof(biquad[band].s2));
+  }
+  bands[band].type = type;
+  bands[band].freq = freq;
+  bands[band].gainDb = gainDb;
+  bands[band].q = q;
+  if (type != BAND_OFF) MakeBiquad(band);
+  activeBands = 0;
+  for (int i = 0; i < MAX_BANDS; i++) {
+    if (bands[i].type != BAND_OFF) activeBands++;
+  }
+  preset = -1;
+  return true;
+}
+
+void AudioOutputEQ::ClearBands()
+{
+  for (int i = 0; i < MAX_BANDS; i++) bands[i].type = BAND_OFF;
+  activeBands = 0;
+  preset = -1;
+}
+
+void AudioOutputEQ::SetPreamp(float db)
+{
+  if (db > 0.0f) db = 0.0f;
+  preampQ15 = (int16_t)lrintf(32767.0f * powf(10.0f, db / 20.0f));
+}
+
+bool AudioOutputEQ::SetPreset(int preset)
+{
+  if (preset < 0 || preset >= PRESET_COUNT) return false;
+  const EQPreset *p = &presets[preset];
+  ClearBands();
+  for (int i = 0; i < 3; i++) {
+    if (p->band[i].type != BAND_OFF) SetBand(i, p->band[i].type, p->band[i].freq, p->band[i].gainDb, p->band[i].q);
+  }
+  SetPreamp(p->preampDb);
+  this->preset = preset;
+  return true;
+}
+
+const char *AudioOutputEQ::PresetName(int preset)
+{
+  if (preset < 0 || preset >= PRESET_COUNT) return "Custom";
+  return presets[preset].name;
+}
+
+bool AudioOutputEQ::SetRate(int hz)
+{
+  if (hz == hertz) return sink->SetRate(hz);
+  hertz = hz;
+  for (int i = 0; i < MAX_BANDS; i++) {
+    if (bands[i].type != BAND_OFF) MakeBiquad(i);
+  }
+  return sink->SetRate(hz);
+}
+
+bool AudioOutputEQ::SetBitsPerSample(int bits)
+{
+  if ( (bits != 16) && (bits != 8) ) return false;
+  bps = bits;
+  return true;
+}
+
+bool AudioOutputEQ::SetChannels(int channels)
+{
+  if ( (channels < 1) || (channels > 2) ) return false;
+  this->channels = channels;
+  return true;
+}
+
+bool AudioOutputEQ::SetGain(float f)
+{
+  return sink->SetGain(f);
+}
+
+bool AudioOutputEQ::begin()
+{
+  Reset();
+  sink->SetRate(hertz);
+  sink->SetBitsPerSample(16);
+  sink->SetChannels(2);
+  return sink->begin();
+}
+
+static inline int32_t Clamp(int64_t v, int32_t lim)
+{
+  return (v > lim) ? lim : (v < -lim) ? -lim : (int32_t)v;
+}
+
+// Direct form II transposed, one biquad over the whole block at a time
+void AudioOutputEQ::Process()
+{
+  uint32_t start = ESP.getCycleCount();
+  int n = inCount;
+  int chans = (channels == 1) ? 1 : 2; // A mono source is the same on both sides
+  for (int c = 0; c < chans; c++) {
+    int32_t *w = work[c];
+    for (int i = 0; i < n; i++) {
+      w[i] = ((int32_t)block[i * 2 + c] * preampQ15) >> (15 - SIGNAL_SHIFT);
+    }
+  }
+
+  const int32_t round = 1 << (COEF_SHIFT - 1);
+  const int32_t lim = 1 << (15 + SIGNAL_SHIFT + 3); // 18 dB over full scale
+  for (int b = 0; b < MAX_BANDS; b++) {
+    if (bands[b].type == BAND_OFF) continue;
+    Biquad *bq = &biquad[b];
+    const int32_t b0 = bq->b0, b1 = bq->b1, b2 = bq->b2, a1 = bq->a1, a2 = bq->a2;
+    const int outShift = COEF_SHIFT - bq->shift;
+    for (int c = 0; c < chans; c++) {
+      int32_t *w = work[c];
+      int64_t s1 = bq->s1[c];
+      int64_t s2 = bq->s2[c];
+      for (int i = 0; i < n; i++) {
+        int32_t x = w[i];
+        int64_t acc = (int64_t)b0 * x + s1;
+        int32_t y = (int32_t)((acc + round) >> COEF_SHIFT); // Scaled down with b
+        // What rounding y lost goes into the next sample, else poles near
+        // DC hold the output a fraction of an LSB off zero for good
+        int64_t err = acc - ((int64_t)y << COEF_SHIFT);
+        s1 = (int64_t)b1 * x - (int64_t)a1 * y + s2 + err;
+        s2 = (int64_t)b2 * x - (int64_t)a2 * y;
+        w[i] = Clamp((acc + ((int64_t)1 << (outShift - 1))) >> outShift, lim);
+      }
+      bq->s1[c] = s1;
+      bq->s2[c] = s2;
+    }
+  }
+
+  Limit(n, chans);
+  outPos = 0;
+  outCount = n;
+  inCount = 0;
+
+  uint32_t cycles = ESP.getCycleCount() - start;
+  cyclesAvg = blocks ? (cyclesAvg * 15 + cycles) / 16 : cycles;
+  blocks++;
+}
+
+// Gain each frame needs, held for as long as it is in the delay, so the gain
+// is already down by the time the frame comes out.  Both channels get the
+// same gain, so the stereo image doesn't move.
+void AudioOutputEQ::Limit(int n, int chans)
+{
+  const int32_t half = 1 << (SIGNAL_SHIFT - 1);
+  delayed = true;
+  for (int i = 0; i < n; i++) {
+    int32_t l = (work[0][i] + half) >> SIGNAL_SHIFT;
+    int32_t r = (chans == 2) ? (work[1][i] + half) >> SIGNAL_SHIFT : l;
+    int32_t al = (l < 0) ? -l : l;
+    int32_t ar = (r < 0) ? -r : r;
+    int32_t peak = (al > ar) ? al : ar;
+    if (peak > LIMIT_LEVEL) {
+      int32_t need = (LIMIT_LEVEL << 15) / peak;
+      if (need < holdGain) holdGain = need;
+      holdLeft = LOOKAHEAD + 1;
+    }
+    if (holdLeft && !--holdLeft) holdGain = 1 << 15;
+    // Rounded up, so the gain gets all the way to where it is going
+    if (holdGain < limitGain) {
+      limitGain -= (limitGain - holdGain + 7) >> 3; // Attack, settles well within the look-ahead
+    } else {
+      limitGain += (holdGain - limitGain + 1023) >> 10; // Release over about 20 ms
+    }
+    int32_t dl = delay[0][delayPos];
+    int32_t dr = delay[1][delayPos];
+    delay[0][delayPos] = l;
+    delay[1][delayPos] = r;
+    delayPos = (delayPos + 1) & (LOOKAHEAD - 1);
+    // Up to 18 dB over full scale can come out of the cascade
+    l = ((int64_t)dl * limitGain) >> 15;
+    r = ((int64_t)dr * limitGain) >> 15;
+    // What the attack didn't quite catch is clipped
+    block[i * 2 + LEFTCHANNEL] = (l > 32767) ? 32767 : (l < -32768) ? -32768 : l;
+    block[i * 2 + RIGHTCHANNEL] = (r > 32767) ? 32767 : (r < -32768) ? -32768 : r;
+  }
+}
+
+// Hands the filtered block on, false while the sink still has some to take
+bool AudioOutputEQ::Flush()
+{
+  if (!outCount) return true;
+  uint16_t done = sink->ConsumeSamples(&block[outPos * 2], outCount);
+  outPos += done;
+  outCount -= done;
+  return !outCount;
+}
+
+bool AudioOutputEQ::ConsumeSample(int16_t sample[2])
+{
+  int16_t ms[2];
+  ms[0] = sample[0];
+  ms[1] = sample[1];
+  MakeSampleStereo16(ms);
+
+  if (!activeBands && !delayed && !inCount && !outCount) return sink->ConsumeSample(ms);
+
+  if (!Flush()) return false;
+  block[inCount * 2 + LEFTCHANNEL] = ms[LEFTCHANNEL];
+  block[inCount * 2 + RIGHTCHANNEL] = ms[RIGHTCHANNEL];
+  if (++inCount == BLOCK) {
+    Process();
+    Flush(); // The sample is taken either way
+  }
+  return true;
+}
+
+uint16_t AudioOutputEQ::ConsumeSamples(int16_t *samples, uint16_t count)
+{
+  if (bps != 16 || channels != 2) return AudioOutput::ConsumeSamples(samples, count);
+  if (!activeBands && !delayed && !inCount && !outCount) return sink->ConsumeSamples(samples, count);
+
+  uint16_t done = 0;
+  while (done < count && Flush()) {
+    uint16_t n = BLOCK - inCount;
+    if (n > count - done) n = count - done;
+    memcpy(&block[inCount * 2], &samples[done * 2], n * 2 * sizeof(int16_t));
+    inCount += n;
+    done += n;
+    if (inCount == BLOCK) Process();
+  }
+  Flush();
+  return done;
+}
+
+bool AudioOutputEQ::stop()
+{
+  Reset();
+  return sink->stop();
+}
+
+bool AudioOutputEQ::loop()
+{
+  Flush();
+  return sink->loop();
+}
+
+void AudioOutputEQ::getStats(AudioStats *st)
+{
+  sink->getStats(st);
+  st->eqCycles = cyclesAvg / BLOCK;
+}
@@ -0,0 +1,113 @@
+/*
+  AudioOutputEQ
+  Parametric equalizer, a cascade of fixed-point biquads in front of another output
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOOUTPUTEQ_H
+#define _AUDIOOUTPUTEQ_H
+
+#include "AudioOutput.h"
+
+// Samples are collected into blocks of BLOCK frames and each biquad runs
+// over a whole block before the next, so its coefficients and state stay in
+// registers.  The sink gets the block in one ConsumeSamples() call.  With no
+// bands set, or PRESET_FLAT, samples pass straight through.
+//
+// Bands follow the RBJ cookbook.  Gains are clamped to +-12 dB, freq is the
+// corner or centre in Hz, q the resonance (0.707 for a Butterworth pass
+// filter or shelf).  SetPreamp() takes the level down ahead of the boosts,
+// and what still goes past LIMIT_LEVEL is pulled down smoothly by a
+// look-ahead limiter on the way out instead of being clipped.  Block and
+// look-ahead together add BLOCK + LOOKAHEAD frames (2.2 ms) of latency.
+class AudioOutputEQ : public AudioOutput
+{
+  public:
+    enum { BAND_OFF = 0, BAND_LOWPASS, BAND_HIGHPASS, BAND_PEAK, BAND_LOWSHELF, BAND_HIGHSHELF };
+    // SPEAKER suits the ODROID-GO's own speaker: what it can't play is cut
+    // so it doesn't take headroom, and the voice range is brought forward.
+    // VOICE goes further for talk radio, BASS is for headphones.
+    enum { PRESET_FLAT = 0, PRESET_SPEAKER, PRESET_VOICE, PRESET_BASS, PRESET_COUNT };
+    enum { MAX_BANDS = 6, BLOCK = 64 };
+
+    AudioOutputEQ(AudioOutput *dest);
+    virtual ~AudioOutputEQ() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int channels) override;
+    virtual bool SetGain(float f) override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual bool stop() override;
+    virtual bool loop() override;
+    virtual void getStats(AudioStats *st) override;
+
+    bool SetBand(int band, int type, float freq, float gainDb = 0.0f, float q = 0.707f);
+    void ClearBands();
+    void SetPreamp(float db); // 0 dB or less
+    bool SetPreset(int preset);
+    int GetPreset() { return preset; } // -1 once a band was set by hand
+    static const char *PresetName(int preset);
+
+  protected:
+    enum { COEF_SHIFT = 30, SIGNAL_SHIFT = 12 };
+    enum { LOOKAHEAD = 32, LIMIT_LEVEL = 31129 }; // Limit at 0.95 of full scale
+
+    // Q1.30, a0 normalised to 1.  b is scaled down by 2^shift when a boost
+    // takes it past 2, the output is scaled back up.  State is 64 bits so
+    // the rounding doesn't grow into noise near poles at low frequencies.
+    struct Biquad
+    {
+      int32_t b0, b1, b2, a1, a2;
+      int shift;
+      int64_t s1[2], s2[2]; // Per channel
+    };
+    struct Band
+    {
+      int type;
+      float freq, gainDb, q;
+    };
+
+    void MakeBiquad(int band);
+    void Process();
+    void Limit(int n, int chans);
+    bool Flush();
+    void Reset();
+
+    AudioOutput *sink;
+    Band bands[MAX_BANDS];
+    Biquad biquad[MAX_BANDS];
+    int activeBands;
+    int preset;
+    int16_t preampQ15;
+    int16_t block[BLOCK * 2] __attribute__((aligned(4))); // Interleaved, 16 bit stereo as the sink wants it
+    int32_t work[2][BLOCK]; // One channel after the other, SIGNAL_SHIFT extra bits
+    uint16_t inCount;  // Frames collected in block
+    uint16_t outCount; // Frames filtered and not yet taken by the sink, starting at outPos
+    uint16_t outPos;
+
+    bool delayed;      // The look-ahead holds audio, it stays in the chain until stop()
+    int32_t limitGain; // Q15, applied to the frames leaving the delay
+    int32_t holdGain;  // Q15, lowest gain needed by a frame still in the delay
+    uint16_t holdLeft;
+    int32_t delay[2][LOOKAHEAD];
+    uint16_t delayPos;
+
+    uint32_t blocks;
+    uint32_t cyclesAvg; // Per block, a running average
+};
+
+#endif
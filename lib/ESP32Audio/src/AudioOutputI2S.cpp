@@ -30,11 +30,18 @@ AudioOutputI2S::AudioOutputI2S(int port, int output_mode, int dma_buf_count, int
 {
   this->portNo = port;
   this->i2sOn = false;
+  this->hertz = 0;
   if (output_mode != EXTERNAL_I2S && output_mode != INTERNAL_DAC && output_mode != INTERNAL_PDM) {
     output_mode = EXTERNAL_I2S;
   }
   this->output_mode = output_mode;
+  dmaBufCount = dma_buf_count;
+  framesWritten = 0;
+  framesPlayed = 0;
+  dmaUnderruns = 0;
+  dmaStarved = true;
 #ifdef ESP32
+  dmaEvents = NULL;
   if (!i2sOn) {
     if (use_apll == APLL_AUTO) {
       // don't use audio pll on buggy rev0 chips
@@ -66,11 +73,11 @@ AudioOutputI2S::AudioOutputI2S(int port, int output_mode, int dma_buf_count, int
       .communication_format = comm_fmt,
       .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1, // lowest interrupt priority
       .dma_buf_count = dma_buf_count,
-      .dma_buf_len = 64,
+      .dma_buf_len = DMA_BUF_LEN,
       .use_apll = use_apll // Use audio PLL
     };
     Serial.printf("+%d %p\n", portNo, &i2s_config_dac);
-    if (i2s_driver_install((i2s_port_t)portNo, &i2s_config_dac, 0, NULL) != ESP_OK) {
+    if (i2s_driver_install((i2s_port_t)portNo, &i2s_config_dac, dma_buf_count * 2, &dmaEvents) != ESP_OK) {
       Serial.println("ERROR: Unable to install I2S drives\n");
     }
     if (output_mode == INTERNAL_DAC || output_mode == INTERNAL_PDM) {
@@ -79,7 +86,7 @@ AudioOutputI2S::AudioOutputI2S(int port, int output_mode, int dma_buf_count, int
     } else {
       SetPinout(26, 25, 22);
     }
-    i2s_zero_dma_buffer((i2s_port_t)portNo);
+    if (output_mode != INTERNAL_DAC) i2s_zero_dma_buffer((i2s_port_t)portNo);
   } 
 #else
   (void) use_apll;
@@ -91,8 +98,23 @@ AudioOutputI2S::AudioOutputI2S(int port, int output_mode, int dma_buf_count, int
   mono = false;
   bps = 16;
   channels = 2;
+  gainCur = 0;
   SetGain(1.0);
+  gainCur = gainTarget; // No ramp up from nothing on the first SetGain()
+  rampLeft = 0;
+  fadeMs = DEFAULT_FADE_MS;
+  fadeCur = 0;
+  fadeStep = 0;
+  lastL = 0;
+  lastR = 0;
+  idle = true;
+  ResetDSP();
   SetRate(44100); // Default
+  FadeIn(); // The first sound too
+#ifdef ESP32
+  // The DAC starts from 0 V, it is brought up to mid-scale slowly
+  if (output_mode == INTERNAL_DAC) Settle(-32768, -32768);
+#endif
 }
 
 AudioOutputI2S::~AudioOutputI2S()
@@ -101,6 +123,12 @@ AudioOutputI2S::~AudioOutputI2S()
   if (i2sOn) {
     Serial.printf("UNINSTALL I2S\n");
     i2s_driver_uninstall((i2s_port_t)portNo); //stop & destroy i2s driver
+    if (output_mode == INTERNAL_DAC) {
+      // Uninstalling powers the DAC down, it is brought straight back to
+      // the idle level rather than left to fall to 0 V
+      dacWrite(25, 128);
+      dacWrite(26, 128);
+    }
   }
 #else
   if (i2sOn) i2s_end();
@@ -132,6 +160,8 @@ bool AudioOutputI2S::SetPinout(int bclk, int wclk, int dout)
 bool AudioOutputI2S::SetRate(int hz)
 {
   // TODO - have a list of allowable rates from constructor, check them
+  // Reprogramming the clocks restarts the DMA, so don't do it for the rate we already have
+  if (hz == this->hertz) return true;
   this->hertz = hz;
 #ifdef ESP32
   i2s_set_sample_rates((i2s_port_t)portNo, AdjustI2SRate(hz)); 
@@ -161,44 +191,254 @@ bool AudioOutputI2S::SetOutputModeMono(bool mono)
   return true;
 }
 
+bool AudioOutputI2S::SetGain(float f)
+{
+  AudioOutput::SetGain(f); // Keeps gainF2P6 for the subclasses
+  if (f > 4.0) f = 4.0;
+  if (f < 0.0) f = 0.0;
+  gainTarget = (int32_t)(f * (1 << 20));
+  gainStep = (gainTarget - gainCur) / RAMP_FRAMES;
+  rampLeft = RAMP_FRAMES;
+  return true;
+}
+
+bool AudioOutputI2S::SetFadeTime(int ms)
+{
+  if (ms < 0 || ms > 5000) return false;
+  fadeMs = ms;
+  return true;
+}
+
+void AudioOutputI2S::FadeOut()
+{
+  uint32_t frames = (uint32_t)fadeMs * hertz / 1000;
+  if (frames < 2) {
+    fadeCur = 0;
+    fadeStep = 0;
+    return;
+  }
+  fadeStep = -(int32_t)(FADE_ONE / frames) - 1;
+}
+
+void AudioOutputI2S::FadeIn()
+{
+  uint32_t frames = (uint32_t)fadeMs * hertz / 1000;
+  if (frames < 2) {
+    fadeCur = FADE_ONE;
+    fadeStep = 0;
+    return;
+  }
+  fadeStep = FADE_ONE / frames + 1;
+}
+
+void AudioOutputI2S::ResetDSP()
+{
+  pendingPos = 0;
+  pendingLen = 0;
+}
+
 bool AudioOutputI2S::begin()
 {
   return true;
 }
 
+inline uint32_t AudioOutputI2S::ProcessFrame(int32_t l, int32_t r)
+{
+  if (mono) {
+    // Both channels on the one speaker channel, the other one held silent
+    r = (l + r) >> 1;
+    l = 0;
+  }
+  if (rampLeft) {
+    gainCur = (--rampLeft) ? gainCur + gainStep : gainTarget;
+  }
+  if (fadeStep) {
+    fadeCur += fadeStep;
+    if (fadeCur <= 0) {
+      fadeCur = 0;
+      fadeStep = 0;
+    } else if (fadeCur >= FADE_ONE) {
+      fadeCur = FADE_ONE;
+      fadeStep = 0;
+    }
+  }
+  int32_t g = gainCur >> 8; // Q12, a full scale sample times 4.0 still fits
+  if (fadeCur != FADE_ONE) g = (g * (fadeCur >> 15)) >> 15;
+  l = (l * g) >> 12;
+  r = (r * g) >> 12;
+
+  // A gain above 1.0 can take it past full scale
+  l = (l > 32767) ? 32767 : (l < -32767) ? -32767 : l;
+  r = (r > 32767) ? 32767 : (r < -32767) ? -32767 : r;
+  lastL = l;
+  lastR = r;
+  if (output_mode == INTERNAL_DAC) {
+    l += 0x8000;
+    r += 0x8000;
+  }
+  return ((uint32_t)r << 16) | (l & 0xffff);
+}
+
+uint16_t AudioOutputI2S::WriteWords(const uint32_t *words, uint16_t count)
+{
+#ifdef ESP32
+  PollDMA();
+  int written = i2s_write_bytes((i2s_port_t)portNo, (const char*)words, count * sizeof(uint32_t), 0);
+  uint16_t n = (written > 0) ? written / sizeof(uint32_t) : 0;
+#else
+  uint16_t n = 0;
+  while (n < count && i2s_write_sample_nb(words[n])) n++;
+#endif
+  if (n) {
+    framesWritten += n;
+    dmaStarved = false;
+  }
+  return n;
+}
+
+// Blocks until the DMA took all of it, only for stop() and start-up
+void AudioOutputI2S::WriteAll(const uint32_t *words, uint16_t count)
+{
+  uint32_t start = millis();
+  while (count && (millis() - start < 500)) {
+    uint16_t n = WriteWords(words, count);
+    words += n;
+    count -= n;
+    if (count) delay(1);
+  }
+}
+
+// A straight line from the given frame to silence, then silence through
+// every DMA buffer
+void AudioOutputI2S::Settle(int32_t fromL, int32_t fromR)
+{
+  uint32_t frames = (uint32_t)fadeMs * hertz / 1000;
+  if (frames < CHUNK) frames = CHUNK; // Even with fades off, a step is a click
+  uint32_t offset = (output_mode == INTERNAL_DAC) ? 0x8000 : 0;
+  uint32_t words[CHUNK];
+  for (uint32_t i = 0; i < frames; ) {
+    uint16_t n = (frames - i < (uint32_t)CHUNK) ? frames - i : (uint32_t)CHUNK;
+    for (uint16_t k = 0; k < n; k++) {
+      uint32_t left = frames - (i + k) - 1;
+      int32_t l = (int64_t)fromL * left / frames;
+      int32_t r = (int64_t)fromR * left / frames;
+      words[k] = ((uint32_t)(r + offset) << 16) | ((l + offset) & 0xffff);
+    }
+    WriteAll(words, n);
+    i += n;
+  }
+  for (uint16_t k = 0; k < CHUNK; k++) words[k] = (offset << 16) | offset;
+  for (int i = 0; i < dmaBufCount * DMA_BUF_LEN; i += CHUNK) WriteAll(words, CHUNK);
+  lastL = 0;
+  lastR = 0;
+  idle = true;
+}
+
+void AudioOutputI2S::PollDMA()
+{
+#ifdef ESP32
+  if (!dmaEvents) return;
+  i2s_event_t evt;
+  while (xQueueReceive(dmaEvents, &evt, 0) == pdTRUE) {
+    if (evt.type != I2S_EVENT_TX_DONE) continue;
+    framesPlayed += DMA_BUF_LEN;
+    if ((int32_t)(framesWritten - framesPlayed) < 0) {
+      // The DMA came round to a buffer with nothing new in it
+      if (!dmaStarved) dmaUnderruns++;
+      dmaStarved = true;
+      framesPlayed = framesWritten;
+    }
+  }
+  // Events lost to a full queue would leave the count high for good
+  uint32_t dmaSize = dmaBufCount * DMA_BUF_LEN;
+  if (framesWritten - framesPlayed > dmaSize) framesPlayed = framesWritten - dmaSize;
+#endif
+}
+
+void AudioOutputI2S::getStats(AudioStats *st)
+{
+  PollDMA();
+  st->outputRate = hertz;
+  st->dmaSize = dmaBufCount * DMA_BUF_LEN;
+  // Frames held back here are queued as far as the listener is concerned
+  st->dmaQueued = (framesWritten - framesPlayed) + (pendingLen - pendingPos);
+  st->dmaUnderruns = dmaUnderruns;
+}
+
+// Processed words have already moved the DSP state on, so they are never
+// processed again, only retried
+bool AudioOutputI2S::DrainPending()
+{
+  if (pendingPos < pendingLen) {
+    pendingPos += WriteWords(&pending[pendingPos], pendingLen - pendingPos);
+  }
+  return pendingPos == pendingLen;
+}
+
 bool AudioOutputI2S::ConsumeSample(int16_t sample[2])
 {
-  int16_t ms[2];
+  if (!DrainPending()) return false; // If we can't store it, return false.  OTW true
 
+  int16_t ms[2];
   ms[0] = sample[0];
   ms[1] = sample[1];
   MakeSampleStereo16( ms );
 
-  if (this->mono) {
-    // Set the output to one channel and zero the other channel
-    ms[LEFTCHANNEL] = 0;
+  idle = false;
+  pending[0] = ProcessFrame(ms[LEFTCHANNEL], ms[RIGHTCHANNEL]);
+  pendingPos = 0;
+  pendingLen = 1;
+  DrainPending();
+  return true;
+}
+
+// Blocks of 16 bit stereo go to the DMA in one call instead of one call per sample
+uint16_t AudioOutputI2S::ConsumeSamples(int16_t *samples, uint16_t count)
+{
+  // Frames are read as whole words, which Xtensa can't do unaligned
+  if (bps != 16 || channels != 2 || ((uintptr_t)samples & 3)) return AudioOutput::ConsumeSamples(samples, count);
+  if (!DrainPending()) return 0;
+
+  const uint32_t *in = (const uint32_t*)samples;
+  idle = false;
+  if (!mono && !rampLeft && !fadeStep && fadeCur == FADE_ONE && output_mode == EXTERNAL_I2S && gainCur == (1 << 20)) {
+    // Already in the DMA layout, no conversion at all
+    uint16_t n = WriteWords(in, count);
+    if (n) {
+      lastL = (int16_t)(in[n - 1] & 0xffff);
+      lastR = (int16_t)(in[n - 1] >> 16);
+    }
+    return n;
   }
-#ifdef ESP32
-  uint32_t s32;
-  if (output_mode == INTERNAL_DAC) {
-    int16_t l = Amplify(ms[LEFTCHANNEL]) + 0x8000;
-    int16_t r = Amplify(ms[RIGHTCHANNEL]) + 0x8000;
-    s32 = (r<<16) | (l&0xffff);
-  } else {
-    s32 = ((Amplify(ms[RIGHTCHANNEL]))<<16) | (Amplify(ms[LEFTCHANNEL]) & 0xffff);
+
+  uint16_t done = 0;
+  while (done < count) {
+    uint16_t n = count - done;
+    if (n > CHUNK) n = CHUNK;
+    for (uint16_t i = 0; i < n; i++) {
+      uint32_t w = in[done + i];
+      pending[i] = ProcessFrame((int16_t)(w & 0xffff), (int16_t)(w >> 16));
+    }
+    pendingPos = 0;
+    pendingLen = n;
+    done += n;
+    if (!DrainPending()) break; // DMA is full, the rest goes first next time
   }
-  return i2s_write_bytes((i2s_port_t)portNo, (const char*)&s32, sizeof(uint32_t), 0);
-#else
-  uint32_t s32 = ((Amplify(ms[RIGHTCHANNEL]))<<16) | (Amplify(ms[LEFTCHANNEL]) & 0xffff);
-  return i2s_write_sample_nb(s32); // If we can't store it, return false.  OTW true
-#endif
+  return done;
 }
 
 bool AudioOutputI2S::stop()
 {
-#ifdef ESP32
-  i2s_zero_dma_buffer((i2s_port_t)portNo);
-#endif
+  if (!idle) {
+    // What is queued plays out and then ramps down.  Cutting it off at
+    // whatever level it was is the click.
+    WriteAll(&pending[pendingPos], pendingLen - pendingPos);
+    Settle(lastL, lastR);
+  }
+  ResetDSP();
+  dmaStarved = true; // Going quiet on purpose isn't an underrun
+  fadeCur = 0; // Whatever plays next fades in
+  FadeIn();
   return true;
 }
 
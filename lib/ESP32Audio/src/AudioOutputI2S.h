@@ -23,6 +23,18 @@
 
 #include "AudioOutput.h"
 
+// Everything sent to the DMA goes through one block stage, a 32 bit word
+// (one stereo frame) at a time: L+R downmix in mono mode, then gain ramped
+// over RAMP_FRAMES so volume steps don't zipper.  Gains above 1.0 clip, the
+// soft limiter is in AudioOutputEQ, where the boosts are.  Unprocessed stereo
+// blocks at unity gain go to the DMA as they are.
+//
+// Transitions go through the same stage.  FadeOut() takes the sound down to
+// silence over the fade time while samples keep coming, stop() lets what is
+// queued play and then ramps from its last frame to the idle level (mid-scale
+// on the internal DAC, where the speaker rests) instead of stepping there,
+// and whatever plays after a stop() fades in.  The DMA is left full of the
+// idle level, so an underrun doesn't replay old audio.
 class AudioOutputI2S : public AudioOutput
 {
   public:
@@ -32,21 +44,63 @@ class AudioOutputI2S : public AudioOutput
     virtual bool SetRate(int hz) override;
     virtual bool SetBitsPerSample(int bits) override;
     virtual bool SetChannels(int channels) override;
+    virtual bool SetGain(float f) override; // Ramped to, not jumped to
     virtual bool begin() override;
     virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
     virtual bool stop() override;
+    virtual void getStats(AudioStats *st) override;
     
     bool SetOutputModeMono(bool mono);  // Force mono output no matter the input
+    bool SetFadeTime(int ms);           // 0 for hard cuts, DEFAULT_FADE_MS to start with
+    void FadeOut();
+    void FadeIn();
+    bool isFadedOut() { return !fadeCur && (fadeStep <= 0); }
+
+    enum { DEFAULT_FADE_MS = 30 };
 
     enum : int { APLL_AUTO = -1, APLL_ENABLE = 1, APLL_DISABLE = 0 };
     enum : int { EXTERNAL_I2S = 0, INTERNAL_DAC = 1, INTERNAL_PDM = 2 };
 
   protected:
     virtual int AdjustI2SRate(int hz) { return hz; }
+    enum { CHUNK = 64, DMA_BUF_LEN = 64, RAMP_FRAMES = 256 };
+
+    enum { FADE_ONE = 1 << 30 };
+
+    inline uint32_t ProcessFrame(int32_t l, int32_t r); // 16 bit stereo frame to DMA word
+    uint16_t WriteWords(const uint32_t *words, uint16_t count);
+    void WriteAll(const uint32_t *words, uint16_t count);
+    void Settle(int32_t fromL, int32_t fromR);
+    bool DrainPending();
+    void ResetDSP();
+    void PollDMA();
     uint8_t portNo;
     int output_mode;
     bool mono;
     bool i2sOn;
+    int32_t gainCur;    // Q20
+    int32_t gainTarget; // Q20
+    int32_t gainStep;
+    uint16_t rampLeft;
+    int fadeMs;
+    int32_t fadeCur;    // Q30
+    int32_t fadeStep;   // Per frame, down for a fade out, up for a fade in
+    int32_t lastL;      // Last frame written, before the DAC offset
+    int32_t lastR;
+    bool idle;          // Settled at the idle level, nothing written since
+    uint32_t pending[CHUNK]; // Processed words the DMA hasn't taken yet
+    uint16_t pendingPos;
+    uint16_t pendingLen;
+    // DMA queue depth, counted from the driver's buffer done events
+#ifdef ESP32
+    QueueHandle_t dmaEvents;
+#endif
+    int dmaBufCount;
+    uint32_t framesWritten;
+    uint32_t framesPlayed;
+    uint32_t dmaUnderruns;
+    bool dmaStarved; // Ran dry, or nothing was written since begin or stop
 };
 
 #endif
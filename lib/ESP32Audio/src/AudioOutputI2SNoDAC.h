@@ -29,6 +29,8 @@ class AudioOutputI2SNoDAC : public AudioOutputI2S
     AudioOutputI2SNoDAC(int port = 0);
     virtual ~AudioOutputI2SNoDAC() override;
     virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override { return AudioOutput::ConsumeSamples(samples, count); }
+    virtual bool stop() override; // A pulse stream has no idle level to ramp to
     
     bool SetOversampling(int os);
     
@@ -0,0 +1,310 @@
+/*
+  AudioOutputMixer
+  Mixes several virtual outputs into one real one
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioOutputMixer.h"
+
+#pragma GCC optimize ("O3")
+
+AudioOutputMixerStub::AudioOutputMixerStub(AudioOutputMixer *mixer, int id)
+{
+  this->mixer = mixer;
+  this->id = id;
+  hertz = 44100;
+  bps = 16;
+  channels = 2;
+  SetGain(1.0);
+}
+
+AudioOutputMixerStub::~AudioOutputMixerStub()
+{
+}
+
+bool AudioOutputMixerStub::SetRate(int hz)
+{
+  // Inputs can't change the shared rate, see the header
+  hertz = hz;
+  return true;
+}
+
+bool AudioOutputMixerStub::SetBitsPerSample(int bits)
+{
+  if ( (bits != 16) && (bits != 8) ) return false;
+  bps = bits;
+  return true;
+}
+
+bool AudioOutputMixerStub::SetChannels(int channels)
+{
+  if ( (channels < 1) || (channels > 2) ) return false;
+  this->channels = channels;
+  return true;
+}
+
+bool AudioOutputMixerStub::begin()
+{
+  mixer->StartInput(id);
+  return true;
+}
+
+bool AudioOutputMixerStub::ConsumeSample(int16_t sample[2])
+{
+  int16_t ms[2];
+  ms[0] = sample[0];
+  ms[1] = sample[1];
+  MakeSampleStereo16(ms);
+  return mixer->Mix(id, ms, 1, gainF2P6) == 1;
+}
+
+uint16_t AudioOutputMixerStub::ConsumeSamples(int16_t *samples, uint16_t count)
+{
+  if (bps != 16 || channels != 2) return AudioOutput::ConsumeSamples(samples, count);
+  return mixer->Mix(id, samples, count, gainF2P6);
+}
+
+bool AudioOutputMixerStub::stop()
+{
+  mixer->StopInput(id);
+  return true;
+}
+
+bool AudioOutputMixerStub::loop()
+{
+  return mixer->loop();
+}
+
+
+static uint32_t RoundDownPow2(uint32_t v)
+{
+  uint32_t p = 1;
+  while (p <= (v >> 1)) p <<= 1;
+  return v ? p : 0;
+}
+
+AudioOutputMixer::AudioOutputMixer(int bufferFrames, AudioOutput *dest)
+{
+  lock = xSemaphoreCreateMutex();
+  sink = dest;
+  sinkStarted = false;
+  size = RoundDownPow2(bufferFrames < BLOCK_FRAMES ? BLOCK_FRAMES : bufferFrames);
+  acc = (int32_t*)calloc(size * 2, sizeof(int32_t));
+  if (!acc) {
+    Serial.printf_P(PSTR("ERROR: Out of memory in mixer\n"));
+    size = 0;
+  }
+  readPtr = 0;
+  for (int i = 0; i < MAX_INPUTS; i++) {
+    inputs[i].stub = NULL;
+    inputs[i].writePtr = 0;
+    inputs[i].active = false;
+  }
+  outPtr = 0;
+  outLen = 0;
+  hertz = 44100;
+  bps = 16;
+  channels = 2;
+}
+
+AudioOutputMixer::~AudioOutputMixer()
+{
+  for (int i = 0; i < MAX_INPUTS; i++) {
+    delete inputs[i].stub;
+  }
+  free(acc);
+  vSemaphoreDelete(lock);
+}
+
+bool AudioOutputMixer::SetRate(int hz)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  hertz = hz;
+  bool ret = sink->SetRate(hz);
+  xSemaphoreGive(lock);
+  return ret;
+}
+
+bool AudioOutputMixer::SetBitsPerSample(int bits)
+{
+  return bits == 16;
+}
+
+bool AudioOutputMixer::SetChannels(int channels)
+{
+  return channels == 2;
+}
+
+bool AudioOutputMixer::SetGain(float f)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool ret = sink->SetGain(f);
+  xSemaphoreGive(lock);
+  return ret;
+}
+
+bool AudioOutputMixer::begin()
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool ret = BeginSink();
+  xSemaphoreGive(lock);
+  return ret;
+}
+
+bool AudioOutputMixer::BeginSink()
+{
+  if (sinkStarted) return true;
+  sink->SetRate(hertz);
+  sink->SetBitsPerSample(16);
+  sink->SetChannels(2);
+  sinkStarted = sink->begin();
+  return sinkStarted;
+}
+
+bool AudioOutputMixer::ConsumeSample(int16_t sample[2])
+{
+  (void) sample;
+  return false;
+}
+
+bool AudioOutputMixer::stop()
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (int i = 0; i < MAX_INPUTS; i++) {
+    inputs[i].active = false;
+  }
+  if (acc) memset(acc, 0, size * 2 * sizeof(int32_t));
+  outPtr = 0;
+  outLen = 0;
+  sinkStarted = false;
+  bool ret = sink->stop();
+  xSemaphoreGive(lock);
+  return ret;
+}
+
+AudioOutputMixerStub *AudioOutputMixer::NewInput()
+{
+  AudioOutputMixerStub *stub = NULL;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (int i = 0; i < MAX_INPUTS; i++) {
+    if (!inputs[i].stub) {
+      stub = new AudioOutputMixerStub(this, i);
+      inputs[i].stub = stub;
+      inputs[i].active = false;
+      break;
+    }
+  }
+  xSemaphoreGive(lock);
+  return stub;
+}
+
+void AudioOutputMixer::RemoveInput(AudioOutputMixerStub *input)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (int i = 0; i < MAX_INPUTS; i++) {
+    if (input && inputs[i].stub == input) {
+      inputs[i].stub = NULL;
+      inputs[i].active = false;
+      delete input;
+      break;
+    }
+  }
+  xSemaphoreGive(lock);
+}
+
+void AudioOutputMixer::StartInput(int id)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  Start(id);
+  xSemaphoreGive(lock);
+}
+
+void AudioOutputMixer::Start(int id)
+{
+  BeginSink();
+  inputs[id].writePtr = readPtr;
+  inputs[id].active = true;
+}
+
+void AudioOutputMixer::StopInput(int id)
+{
+  // What it already wrote still plays out
+  xSemaphoreTake(lock, portMAX_DELAY);
+  inputs[id].active = false;
+  xSemaphoreGive(lock);
+}
+
+uint16_t AudioOutputMixer::Mix(int id, const int16_t *samples, uint16_t count, uint8_t gain)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (!inputs[id].active) Start(id);
+  uint32_t w = inputs[id].writePtr;
+  uint32_t space = size - (w - readPtr);
+  if (count > space) count = space;
+  uint32_t mask = size - 1;
+  for (uint16_t i = 0; i < count; i++) {
+    int32_t *a = &acc[((w + i) & mask) * 2];
+    a[0] += (samples[i * 2] * gain) >> 6;
+    a[1] += (samples[i * 2 + 1] * gain) >> 6;
+  }
+  inputs[id].writePtr = w + count;
+  xSemaphoreGive(lock);
+  return count;
+}
+
+bool AudioOutputMixer::loop()
+{
+  uint32_t mask = size - 1;
+  uint32_t budget = size; // Bounds the silence written in one call
+  xSemaphoreTake(lock, portMAX_DELAY);
+  while (size) {
+    if (outPtr < outLen) {
+      outPtr += sink->ConsumeSamples(&outBlock[outPtr * 2], outLen - outPtr);
+      if (outPtr < outLen) break; // Sink is full
+    }
+
+    // Next block, as far as every playing input has written
+    uint32_t ready = 0;
+    bool any = false;
+    for (int i = 0; i < MAX_INPUTS; i++) {
+      if (inputs[i].active) {
+        uint32_t w = inputs[i].writePtr - readPtr;
+        ready = any ? ((w < ready) ? w : ready) : w;
+        any = true;
+      }
+    }
+    if (!any) ready = budget; // Whatever stopped inputs left, then silence
+    if (ready > BLOCK_FRAMES) ready = BLOCK_FRAMES;
+    if (!ready) break;
+
+    for (uint32_t i = 0; i < ready; i++) {
+      int32_t *a = &acc[((readPtr + i) & mask) * 2];
+      int32_t l = a[0];
+      int32_t r = a[1];
+      a[0] = 0;
+      a[1] = 0;
+      outBlock[i * 2] = (l > 32767) ? 32767 : (l < -32768) ? -32768 : l;
+      outBlock[i * 2 + 1] = (r > 32767) ? 32767 : (r < -32768) ? -32768 : r;
+    }
+    readPtr += ready;
+    outPtr = 0;
+    outLen = ready;
+    if (!any) budget -= ready;
+  }
+  bool ret = sink->loop();
+  xSemaphoreGive(lock);
+  return ret;
+}
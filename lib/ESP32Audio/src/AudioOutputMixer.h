@@ -0,0 +1,101 @@
+/*
+  AudioOutputMixer
+  Mixes several virtual outputs into one real one
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOOUTPUTMIXER_H
+#define _AUDIOOUTPUTMIXER_H
+
+#include "AudioOutput.h"
+
+class AudioOutputMixer;
+
+// One input of the mixer, hand it to a generator like any other output.
+// SetGain() sets the level of this input only.  All inputs run at the
+// mixer's rate, put an AudioOutputResample in front of one that doesn't.
+// A started input holds the mix until it writes, so stop() it when done.
+class AudioOutputMixerStub : public AudioOutput
+{
+  public:
+    AudioOutputMixerStub(AudioOutputMixer *mixer, int id);
+    virtual ~AudioOutputMixerStub() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int channels) override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual bool stop() override;
+    virtual bool loop() override;
+
+  protected:
+    AudioOutputMixer *mixer;
+    int id;
+};
+
+// Inputs add their samples, scaled by their gain, straight into a shared
+// 32 bit accumulator, each from its own write position.  How far an input
+// may run ahead of the output is its buffer.  The output side then costs the
+// same per block however many inputs are playing: saturate, pack, clear.
+// Output goes as far as every started input has written.  With no input
+// started the sink is kept fed with silence, so a new input starts with only
+// the sink's own buffering as latency.  Inputs may be fed from different
+// tasks, every call into the mixer holds its lock.
+class AudioOutputMixer : public AudioOutput
+{
+  public:
+    AudioOutputMixer(int bufferFrames, AudioOutput *dest); // Rounded down to a power of two
+    virtual ~AudioOutputMixer() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int channels) override;
+    virtual bool SetGain(float f) override; // Master gain, applied by the sink
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override; // Use an input instead
+    virtual bool stop() override;
+    virtual bool loop() override;
+    virtual void getStats(AudioStats *st) override { sink->getStats(st); }
+
+    AudioOutputMixerStub *NewInput(); // NULL if all MAX_INPUTS are in use
+    void RemoveInput(AudioOutputMixerStub *input); // Deletes the stub
+
+    enum { MAX_INPUTS = 8, BLOCK_FRAMES = 64 };
+
+  protected:
+    friend class AudioOutputMixerStub;
+    uint16_t Mix(int id, const int16_t *samples, uint16_t count, uint8_t gain); // 16 bit stereo
+    void StartInput(int id);
+    void StopInput(int id);
+    void Start(int id); // With the lock held
+    bool BeginSink();
+
+    SemaphoreHandle_t lock;
+    AudioOutput *sink;
+    bool sinkStarted;
+    int32_t *acc; // Interleaved L/R
+    uint32_t size;
+    uint32_t readPtr; // Frames taken from the accumulator, free running
+    struct {
+      AudioOutputMixerStub *stub;
+      uint32_t writePtr;
+      bool active;
+    } inputs[MAX_INPUTS];
+    int16_t outBlock[BLOCK_FRAMES * 2]; // Packed block the sink hasn't taken all of yet
+    uint16_t outPtr;
+    uint16_t outLen;
+};
+
+#endif
@@ -0,0 +1,250 @@
+/*
+  AudioOutputResample
+  Fixed-point polyphase sample rate converter in front of another output
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioOutputResample.h"
+
+#pragma GCC optimize ("O3")
+
+AudioOutputResample::AudioOutputResample(AudioOutput *dest, int outputRate, int quality)
+{
+  sink = dest;
+  outRate = outputRate;
+  hertz = outputRate;
+  bps = 16;
+  channels = 2;
+  coef = NULL;
+  this->quality = -1;
+  step = 1 << 16;
+  SetQuality(quality);
+  Reset();
+  sink->SetRate(outRate);
+  sink->SetBitsPerSample(16);
+  sink->SetChannels(2);
+}
+
+AudioOutputResample::~AudioOutputResample()
+{
+  free(coef);
+}
+
+bool AudioOutputResample::SetQuality(int quality)
+{
+  if (quality < QUALITY_LOW || quality > QUALITY_HIGH) return false;
+  if (quality == this->quality) return true;
+  free(coef);
+  coef = NULL;
+  if (quality == QUALITY_HIGH) {
+    baseTaps = 32;
+    phaseBits = 7;
+  } else if (quality == QUALITY_MEDIUM) {
+    baseTaps = 16;
+    phaseBits = 6;
+  } else {
+    baseTaps = 2;
+    phaseBits = 0;
+  }
+  taps = baseTaps;
+  if (phaseBits) {
+    coef = (int16_t*)malloc((taps << phaseBits) * sizeof(int16_t));
+    if (!coef) {
+      // Out of memory, fall back to linear interpolation
+      Serial.printf_P(PSTR("ERROR: Out of memory in resampler\n"));
+      baseTaps = taps = 2;
+      phaseBits = 0;
+      quality = QUALITY_LOW;
+    }
+  }
+  this->quality = quality;
+  MakeFilter();
+  Reset();
+  return true;
+}
+
+// Blackman windowed sinc.  When decimating the cutoff follows the output rate
+// so nothing above its Nyquist frequency folds back, and the filter gets twice
+// the taps, as the transition band has to fit between the top of the passband
+// and the output's Nyquist frequency.  Only done on a rate or quality change,
+// so the float maths doesn't matter.
+void AudioOutputResample::MakeFilter()
+{
+  if (!phaseBits) return;
+  int want = (hertz > outRate) ? baseTaps * 2 : baseTaps;
+  if (want != taps) {
+    int16_t *c = (int16_t*)realloc(coef, (want << phaseBits) * sizeof(int16_t));
+    if (c) {
+      coef = c;
+      taps = want;
+      // The history is laid out by the number of taps
+      memset(histL, 0, sizeof(histL));
+      memset(histR, 0, sizeof(histR));
+      histPos = 0;
+    }
+  }
+  int phases = 1 << phaseBits;
+  int half = taps / 2;
+  // Leave room for the transition band
+  float fc = (hertz > outRate) ? 0.88f * outRate / hertz : 0.91f;
+  float h[MAX_TAPS];
+  for (int p = 0; p < phases; p++) {
+    float frac = (float)p / phases;
+    float sum = 0;
+    for (int j = 0; j < taps; j++) {
+      float t = j - (half - 1) - frac; // Distance from the interpolation point
+      float x = PI * fc * t;
+      float s = (x == 0.0f) ? 1.0f : sinf(x) / x;
+      float w = 0.42f + 0.5f * cosf(PI * t / half) + 0.08f * cosf(2.0f * PI * t / half);
+      h[j] = s * w;
+      sum += h[j];
+    }
+    for (int j = 0; j < taps; j++) {
+      coef[p * taps + j] = (int16_t)lrintf(h[j] / sum * (1 << COEF_SHIFT));
+    }
+  }
+}
+
+void AudioOutputResample::Reset()
+{
+  memset(histL, 0, sizeof(histL));
+  memset(histR, 0, sizeof(histR));
+  histPos = 0;
+  pos = 0;
+  pending = false;
+}
+
+bool AudioOutputResample::SetRate(int hz)
+{
+  if (hz == hertz) return true;
+  hertz = hz;
+  step = ((uint64_t)hz << 16) / outRate;
+  // The history is kept, so a change mid-stream doesn't click
+  MakeFilter();
+  return true;
+}
+
+bool AudioOutputResample::SetBitsPerSample(int bits)
+{
+  if ( (bits != 16) && (bits != 8) ) return false;
+  bps = bits;
+  return true;
+}
+
+bool AudioOutputResample::SetChannels(int channels)
+{
+  if ( (channels < 1) || (channels > 2) ) return false;
+  this->channels = channels;
+  return true;
+}
+
+bool AudioOutputResample::SetGain(float f)
+{
+  return sink->SetGain(f);
+}
+
+bool AudioOutputResample::begin()
+{
+  Reset();
+  sink->SetRate(outRate);
+  sink->SetBitsPerSample(16);
+  sink->SetChannels(2);
+  return sink->begin();
+}
+
+inline void AudioOutputResample::Push(const int16_t sample[2])
+{
+  histL[histPos] = histL[histPos + taps] = sample[LEFTCHANNEL];
+  histR[histPos] = histR[histPos + taps] = sample[RIGHTCHANNEL];
+  histPos = (histPos + 1) & (taps - 1);
+}
+
+void AudioOutputResample::Interpolate(int16_t out[2])
+{
+  const int16_t *l = &histL[histPos];
+  const int16_t *r = &histR[histPos];
+  if (!phaseBits) {
+    int32_t frac = pos >> 1; // Q15, so the product of a full scale step can't overflow
+    out[LEFTCHANNEL] = l[0] + (((l[1] - l[0]) * frac) >> 15);
+    out[RIGHTCHANNEL] = r[0] + (((r[1] - r[0]) * frac) >> 15);
+    return;
+  }
+  const int16_t *c = &coef[(pos >> (16 - phaseBits)) * taps];
+  int32_t accL = 1 << (COEF_SHIFT - 1);
+  int32_t accR = 1 << (COEF_SHIFT - 1);
+  for (int j = 0; j < taps; j++) {
+    accL += c[j] * l[j];
+    accR += c[j] * r[j];
+  }
+  accL >>= COEF_SHIFT;
+  accR >>= COEF_SHIFT;
+  out[LEFTCHANNEL] = (accL > 32767) ? 32767 : (accL < -32768) ? -32768 : accL;
+  out[RIGHTCHANNEL] = (accR > 32767) ? 32767 : (accR < -32768) ? -32768 : accR;
+}
+
+bool AudioOutputResample::ConsumeSample(int16_t sample[2])
+{
+  int16_t ms[2];
+  ms[0] = sample[0];
+  ms[1] = sample[1];
+  MakeSampleStereo16(ms);
+
+  if (hertz == outRate && !pending) {
+    if (!sink->ConsumeSample(ms)) return false;
+    Push(ms);
+    return true;
+  }
+
+  // Every output that falls before the newest input is owed first.  If the
+  // sink is full the input isn't taken, and the same output is retried.
+  while (pos < (1 << 16)) {
+    if (!pending) {
+      Interpolate(pendingSample);
+      pending = true;
+    }
+    if (!sink->ConsumeSample(pendingSample)) return false;
+    pending = false;
+    pos += step;
+  }
+  pos -= 1 << 16;
+  Push(ms);
+  return true;
+}
+
+uint16_t AudioOutputResample::ConsumeSamples(int16_t *samples, uint16_t count)
+{
+  // Keep the sink's block path when there is nothing to convert
+  if (hertz == outRate && !pending && bps == 16 && channels == 2) {
+    uint16_t done = sink->ConsumeSamples(samples, count);
+    // Only the tail is needed to pick up from if the rate changes
+    for (uint16_t i = (done > taps) ? done - taps : 0; i < done; i++) {
+      Push(&samples[i * 2]);
+    }
+    return done;
+  }
+  return AudioOutput::ConsumeSamples(samples, count);
+}
+
+bool AudioOutputResample::stop()
+{
+  Reset();
+  return sink->stop();
+}
+
+bool AudioOutputResample::loop()
+{
+  return sink->loop();
+}
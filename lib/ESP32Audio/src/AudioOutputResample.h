@@ -0,0 +1,76 @@
+/*
+  AudioOutputResample
+  Fixed-point polyphase sample rate converter in front of another output
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOOUTPUTRESAMPLE_H
+#define _AUDIOOUTPUTRESAMPLE_H
+
+#include "AudioOutput.h"
+
+// The sink is set up once for outputRate, 16 bit stereo, and never sees a
+// SetRate() again, so rate changes between tracks or stations don't restart
+// the I2S clocks.  Input at the output rate is passed straight through.
+//   QUALITY_LOW     linear interpolation
+//   QUALITY_MEDIUM  16 taps, 64 phases (2 KB of coefficients)
+//   QUALITY_HIGH    32 taps, 128 phases (8 KB of coefficients)
+// Both filters double their taps, and their coefficients, while the input
+// is faster than the output.
+class AudioOutputResample : public AudioOutput
+{
+  public:
+    enum { QUALITY_LOW = 0, QUALITY_MEDIUM = 1, QUALITY_HIGH = 2 };
+
+    AudioOutputResample(AudioOutput *dest, int outputRate = 44100, int quality = QUALITY_MEDIUM);
+    virtual ~AudioOutputResample() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int channels) override;
+    virtual bool SetGain(float f) override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual bool stop() override;
+    virtual bool loop() override;
+    virtual void getStats(AudioStats *st) override { sink->getStats(st); }
+
+    bool SetQuality(int quality);
+
+  protected:
+    enum { MAX_TAPS = 64, COEF_SHIFT = 14 };
+
+    void MakeFilter();
+    inline void Push(const int16_t sample[2]);
+    void Interpolate(int16_t out[2]);
+    void Reset();
+
+    AudioOutput *sink;
+    int outRate;
+    int quality;
+    int baseTaps;  // Per phase, for the quality
+    int taps;      // Per phase, doubled when decimating
+    int phaseBits; // log2 of the number of phases
+    int16_t *coef; // [phases][taps], Q14, each phase sums to 1.0
+    int16_t histL[MAX_TAPS * 2]; // Written twice so the window is always contiguous
+    int16_t histR[MAX_TAPS * 2];
+    int histPos;
+    uint32_t step; // Input samples per output sample, 16.16
+    uint32_t pos;  // Position of the next output past the centre of the window, 16.16
+    bool pending;  // An output sample the sink hasn't taken yet
+    int16_t pendingSample[2];
+};
+
+#endif
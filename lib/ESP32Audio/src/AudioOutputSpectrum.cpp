@@ -0,0 +1,190 @@
+/*
+  AudioOutputSpectrum
+  Pass-through output that taps the PCM stream for a spectrum display
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioOutputSpectrum.h"
+
+// Octave bands over bins 1..127, the DC bin is skipped
+static const uint8_t bandEdge[AudioOutputSpectrum::SPECTRUM_BANDS + 1] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+AudioOutputSpectrum::AudioOutputSpectrum(AudioOutput *dest)
+{
+  sink = dest;
+  tapPtr = 0;
+  memset(tap, 0, sizeof(tap));
+  memset(bars, 0, sizeof(bars));
+  memset(peakLvl, 0, sizeof(peakLvl));
+  memset(peakHold, 0, sizeof(peakHold));
+  // Tables are built once here so nothing but integer math runs per frame
+  for (int i = 0; i < FFT_SIZE; i++) {
+    window[i] = (int16_t)(16383.5f * (1.0f - cosf(2.0f * (float)M_PI * i / FFT_SIZE)));
+  }
+  for (int i = 0; i < FFT_SIZE/2; i++) {
+    cosTab[i] = (int16_t)(32767.0f * cosf(2.0f * (float)M_PI * i / FFT_SIZE));
+    sinTab[i] = (int16_t)(32767.0f * sinf(2.0f * (float)M_PI * i / FFT_SIZE));
+  }
+  bps = 16;
+  channels = 2;
+}
+
+AudioOutputSpectrum::~AudioOutputSpectrum()
+{
+}
+
+bool AudioOutputSpectrum::SetRate(int hz)
+{
+  hertz = hz;
+  return sink->SetRate(hz);
+}
+
+bool AudioOutputSpectrum::SetBitsPerSample(int bits)
+{
+  bps = bits;
+  return sink->SetBitsPerSample(bits);
+}
+
+bool AudioOutputSpectrum::SetChannels(int channels)
+{
+  this->channels = channels;
+  return sink->SetChannels(channels);
+}
+
+bool AudioOutputSpectrum::SetGain(float f)
+{
+  return sink->SetGain(f);
+}
+
+bool AudioOutputSpectrum::begin()
+{
+  return sink->begin();
+}
+
+bool AudioOutputSpectrum::ConsumeSample(int16_t sample[2])
+{
+  if (!sink->ConsumeSample(sample)) return false;
+
+  // Only samples the sink accepted are recorded, so the history matches what is playing
+  int16_t ms[2] = { sample[LEFTCHANNEL], sample[RIGHTCHANNEL] };
+  MakeSampleStereo16(ms);
+  tap[tapPtr] = (int16_t)(((int32_t)ms[LEFTCHANNEL] + ms[RIGHTCHANNEL]) >> 1);
+  tapPtr = (tapPtr + 1) & (FFT_SIZE - 1);
+  return true;
+}
+
+uint16_t AudioOutputSpectrum::ConsumeSamples(int16_t *samples, uint16_t count)
+{
+  // Keep the sink's block path, then record whatever it took
+  uint16_t done = sink->ConsumeSamples(samples, count);
+  for (uint16_t i = 0; i < done; i++) {
+    int16_t ms[2] = { samples[i*2 + LEFTCHANNEL], samples[i*2 + RIGHTCHANNEL] };
+    MakeSampleStereo16(ms);
+    tap[tapPtr] = (int16_t)(((int32_t)ms[LEFTCHANNEL] + ms[RIGHTCHANNEL]) >> 1);
+    tapPtr = (tapPtr + 1) & (FFT_SIZE - 1);
+  }
+  return done;
+}
+
+bool AudioOutputSpectrum::stop()
+{
+  memset(tap, 0, sizeof(tap));
+  return sink->stop();
+}
+
+bool AudioOutputSpectrum::loop()
+{
+  return sink->loop();
+}
+
+// In-place radix-2 decimation in time.  Each stage halves the values so the Q15
+// products can never overflow 32 bits, the full transform scales by 1/FFT_SIZE.
+void AudioOutputSpectrum::FFT()
+{
+  for (int i = 1, j = 0; i < FFT_SIZE; i++) {
+    int bit = FFT_SIZE >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      int32_t t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+
+  for (int len = 2, step = FFT_SIZE/2; len <= FFT_SIZE; len <<= 1, step >>= 1) {
+    int half = len >> 1;
+    for (int i = 0; i < FFT_SIZE; i += len) {
+      for (int k = 0; k < half; k++) {
+        int32_t wr = cosTab[k * step];
+        int32_t wi = -sinTab[k * step];
+        int a = i + k;
+        int b = a + half;
+        int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+        int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+        re[b] = (re[a] - tr) >> 1;
+        im[b] = (im[a] - ti) >> 1;
+        re[a] = (re[a] + tr) >> 1;
+        im[a] = (im[a] + ti) >> 1;
+      }
+    }
+  }
+}
+
+void AudioOutputSpectrum::GetBands(uint8_t *levels, uint8_t *peaks)
+{
+  // Oldest sample first
+  for (int i = 0; i < FFT_SIZE; i++) {
+    int16_t s = tap[(tapPtr + i) & (FFT_SIZE - 1)];
+    re[i] = ((int32_t)s * window[i]) >> 16; // One bit of headroom for the butterflies
+    im[i] = 0;
+  }
+  FFT();
+
+  for (int b = 0; b < SPECTRUM_BANDS; b++) {
+    uint32_t mag = 0;
+    for (int k = bandEdge[b]; k < bandEdge[b+1]; k++) {
+      // Alpha max plus beta min magnitude estimate, no square root needed
+      uint32_t x = abs(re[k]);
+      uint32_t y = abs(im[k]);
+      uint32_t m = (x > y) ? x + (y >> 1) : y + (x >> 1);
+      if (m > mag) mag = m;
+    }
+    // Log2 in 1/16ths, a full scale sine lands near 2^12
+    int lg = 0;
+    if (mag) {
+      int msb = 31 - __builtin_clz(mag);
+      int frac = (msb >= 4) ? ((mag >> (msb - 4)) & 15) : ((mag << (4 - msb)) & 15);
+      lg = msb * 16 + frac;
+    }
+    int lvl = ((lg - 2*16) * 100) / (10*16);
+    if (lvl < 0) lvl = 0;
+    if (lvl > 100) lvl = 100;
+
+    // Bars fall gradually, peaks hold for a while before falling
+    if (lvl >= bars[b]) bars[b] = lvl;
+    else bars[b] = (bars[b] > lvl + 8) ? bars[b] - 8 : lvl;
+    if (bars[b] >= peakLvl[b]) {
+      peakLvl[b] = bars[b];
+      peakHold[b] = 10;
+    } else if (peakHold[b]) {
+      peakHold[b]--;
+    } else {
+      peakLvl[b] = (peakLvl[b] > bars[b] + 3) ? peakLvl[b] - 3 : bars[b];
+    }
+    levels[b] = bars[b];
+    if (peaks) peaks[b] = peakLvl[b];
+  }
+}
@@ -0,0 +1,63 @@
+/*
+  AudioOutputSpectrum
+  Pass-through output that taps the PCM stream for a spectrum display
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOOUTPUTSPECTRUM_H
+#define _AUDIOOUTPUTSPECTRUM_H
+
+#include "AudioOutput.h"
+
+class AudioOutputSpectrum : public AudioOutput
+{
+  public:
+    AudioOutputSpectrum(AudioOutput *dest);
+    virtual ~AudioOutputSpectrum() override;
+    virtual bool SetRate(int hz) override;
+    virtual bool SetBitsPerSample(int bits) override;
+    virtual bool SetChannels(int channels) override;
+    virtual bool SetGain(float f) override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual uint16_t ConsumeSamples(int16_t *samples, uint16_t count) override;
+    virtual bool stop() override;
+    virtual bool loop() override;
+    virtual void getStats(AudioStats *st) override { sink->getStats(st); }
+
+    // Runs the FFT over the most recent FFT_SIZE samples.  Call from the UI, not the audio path.
+    // levels[] and peaks[] receive SPECTRUM_BANDS values in the range 0..100
+    void GetBands(uint8_t *levels, uint8_t *peaks);
+
+    enum { FFT_SIZE = 256, FFT_LOG2 = 8, SPECTRUM_BANDS = 7 };
+
+  protected:
+    void FFT();
+
+    AudioOutput *sink;
+    int16_t tap[FFT_SIZE]; // Mono history, written by ConsumeSample
+    uint16_t tapPtr;
+    int16_t window[FFT_SIZE]; // Hann, Q15
+    int16_t cosTab[FFT_SIZE/2]; // Q15
+    int16_t sinTab[FFT_SIZE/2];
+    int32_t re[FFT_SIZE];
+    int32_t im[FFT_SIZE];
+    uint8_t bars[SPECTRUM_BANDS];
+    uint8_t peakLvl[SPECTRUM_BANDS];
+    uint8_t peakHold[SPECTRUM_BANDS];
+};
+
+#endif
+
@@ -0,0 +1,346 @@
+/*
+  AudioSfxPlayer
+  Voice pool for short sound effects, pre-decoded into RAM
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "AudioSfxPlayer.h"
+
+#pragma GCC optimize ("O3")
+
+static inline uint32_t LE32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t LE16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+AudioSfxPlayer::AudioSfxPlayer(AudioOutputMixer *mixer, int rate)
+{
+  this->mixer = mixer;
+  hertz = rate;
+  clipCount = 0;
+  memset(clips, 0, sizeof(clips));
+  memset(voices, 0, sizeof(voices));
+  for (voiceCount = 0; voiceCount < MAX_VOICES; voiceCount++) {
+    voices[voiceCount].input = mixer->NewInput();
+    if (!voices[voiceCount].input) break;
+  }
+  if (!voiceCount) Serial.printf_P(PSTR("ERROR: No mixer input free for sound effects\n"));
+  activeMask = 0;
+  stealNext = 0;
+  queueWrite = 0;
+  queueRead = 0;
+  running = false;
+  taskDone = true;
+}
+
+AudioSfxPlayer::~AudioSfxPlayer()
+{
+  stop();
+  for (int v = 0; v < voiceCount; v++) mixer->RemoveInput(voices[v].input);
+  for (int i = 0; i < clipCount; i++) {
+    if (clips[i].owned) free((void*)clips[i].pcm);
+  }
+}
+
+int16_t *AudioSfxPlayer::AllocClip(uint32_t frames)
+{
+  size_t bytes = (frames + 1) * sizeof(int16_t);
+  int16_t *pcm = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!pcm) pcm = (int16_t*)malloc(bytes);
+  if (!pcm) Serial.printf_P(PSTR("ERROR: Out of memory for a %d frame clip\n"), frames);
+  return pcm;
+}
+
+int AudioSfxPlayer::NewClip(int16_t *pcm, uint32_t frames, int rate, bool owned)
+{
+  if (clipCount >= MAX_CLIPS || !frames || rate <= 0) {
+    if (owned) free(pcm);
+    return -1;
+  }
+  Clip *c = &clips[clipCount];
+  c->pcm = pcm;
+  c->frames = frames;
+  c->step = ((uint64_t)rate << 16) / hertz;
+  c->owned = owned;
+  return clipCount++;
+}
+
+int AudioSfxPlayer::LoadWAV(fs::FS &fs, const char *path)
+{
+  if (running || clipCount >= MAX_CLIPS) return -1;
+  File f = fs.open(path, FILE_READ);
+  if (!f) return -1;
+
+  uint8_t h[16];
+  int channels = 0;
+  int bits = 0;
+  int rate = 0;
+  uint32_t dataLen = 0;
+  if (f.read(h, 12) != 12 || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4)) {
+    f.close();
+    return -1;
+  }
+  while (!dataLen && f.read(h, 8) == 8) {
+    uint32_t len = LE32(h + 4);
+    uint32_t skip = len + (len & 1);
+    if (!memcmp(h, "fmt ", 4)) {
+      if (len < 16 || f.read(h, 16) != 16 || LE16(h) != 1) break; // PCM only
+      channels = LE16(h + 2);
+      rate = LE32(h + 4);
+      bits = LE16(h + 14);
+      skip -= 16;
+    } else if (!memcmp(h, "data", 4)) {
+      dataLen = len;
+      skip = 0;
+    }
+    if (skip && !f.seek(f.position() + skip)) break;
+  }
+  if (!dataLen || (channels != 1 && channels != 2) || (bits != 8 && bits != 16) || rate <= 0) {
+    Serial.printf_P(PSTR("ERROR: %s is not an 8 or 16 bit PCM WAV\n"), path);
+    f.close();
+    return -1;
+  }
+
+  uint32_t frameBytes = channels * bits / 8;
+  uint32_t frames = dataLen / frameBytes;
+  int16_t *pcm = AllocClip(frames);
+  if (!pcm) {
+    f.close();
+    return -1;
+  }
+
+  // Converted to mono a sector at a time, a short file just gives a shorter clip
+  uint8_t buf[512];
+  uint32_t done = 0;
+  while (done < frames) {
+    uint32_t n = frames - done;
+    if (n > sizeof(buf) / frameBytes) n = sizeof(buf) / frameBytes;
+    n = f.read(buf, n * frameBytes) / frameBytes;
+    if (!n) break;
+    const uint8_t *p = buf;
+    for (uint32_t i = 0; i < n; i++) {
+      int32_t s;
+      if (bits == 16) {
+        s = (int16_t)LE16(p);
+        if (channels == 2) s = (s + (int16_t)LE16(p + 2)) >> 1;
+      } else {
+        s = (p[0] - 128) << 8;
+        if (channels == 2) s = (s + ((p[1] - 128) << 8)) >> 1;
+      }
+      pcm[done + i] = s;
+      p += frameBytes;
+    }
+    done += n;
+  }
+  f.close();
+  pcm[done] = 0;
+  return NewClip(pcm, done, rate, true);
+}
+
+int AudioSfxPlayer::AddClip(const int16_t *pcm, uint32_t frames, int rate)
+{
+  if (running || !pcm || frames < 2) return -1;
+  // The last frame is only ever read as the right hand side of the interpolation
+  return NewClip((int16_t*)pcm, frames - 1, rate, false);
+}
+
+int AudioSfxPlayer::AddTone(int startHz, int endHz, int ms, bool noise)
+{
+  if (running || clipCount >= MAX_CLIPS || ms <= 0) return -1;
+  uint32_t frames = (uint32_t)hertz * ms / 1000;
+  int16_t *pcm = AllocClip(frames);
+  if (!pcm) return -1;
+
+  // Square wave or LFSR noise clocked at the swept frequency, fading out linearly
+  uint32_t phase = 0;
+  uint16_t lfsr = 0xace1;
+  for (uint32_t i = 0; i < frames; i++) {
+    int64_t hz = startHz + (int64_t)(endHz - startHz) * i / frames;
+    uint32_t last = phase;
+    phase += (uint32_t)((hz << 32) / hertz);
+    int32_t level = (int32_t)((int64_t)12000 * (frames - i) / frames);
+    if (noise) {
+      if (phase < last) lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xb400);
+      pcm[i] = (lfsr & 1) ? level : -level;
+    } else {
+      pcm[i] = (phase & 0x80000000) ? level : -level;
+    }
+  }
+  pcm[frames] = 0;
+  return NewClip(pcm, frames, hertz, true);
+}
+
+bool AudioSfxPlayer::begin(int core, int priority)
+{
+  if (running) return true;
+  if (!voiceCount) return false;
+  mixer->SetRate(hertz);
+  if (!mixer->begin()) return false;
+  queueRead = queueWrite.load();
+  activeMask = 0;
+  taskDone = false;
+  running = true;
+  if (xTaskCreatePinnedToCore(Task, "sfx", 2048, this, priority, NULL, core) != pdPASS) {
+    Serial.printf_P(PSTR("ERROR: Unable to start the sfx task\n"));
+    running = false;
+    taskDone = true;
+    return false;
+  }
+  return true;
+}
+
+bool AudioSfxPlayer::stop()
+{
+  if (!running) return true;
+  running = false;
+  while (!taskDone) vTaskDelay(1);
+  while (activeMask) StopVoice(__builtin_ctz(activeMask));
+  return true;
+}
+
+bool AudioSfxPlayer::play(int clip, float volume, float pitch)
+{
+  if (!running || clip < 0 || clip >= clipCount) return false;
+  uint32_t w = queueWrite.load(std::memory_order_relaxed);
+  if (w - queueRead.load(std::memory_order_acquire) >= QUEUE_SIZE) return false; // Dropped
+  if (pitch < 0.0625f) pitch = 0.0625f;
+  if (pitch > 8.0f) pitch = 8.0f;
+  float g = volume * 64.0f;
+  Trigger *t = &queue[w & (QUEUE_SIZE - 1)];
+  t->clip = clip;
+  t->gain = (g <= 0.0f) ? 0 : (g >= 255.0f) ? 255 : (uint8_t)g;
+  t->step = (uint32_t)(clips[clip].step * pitch);
+  queueWrite.store(w + 1, std::memory_order_release);
+  return true;
+}
+
+void AudioSfxPlayer::StopAll()
+{
+  uint32_t w = queueWrite.load(std::memory_order_relaxed);
+  if (w - queueRead.load(std::memory_order_acquire) >= QUEUE_SIZE) return;
+  queue[w & (QUEUE_SIZE - 1)].clip = -1;
+  queueWrite.store(w + 1, std::memory_order_release);
+}
+
+// Runs on the mixing task, which owns the voices
+void AudioSfxPlayer::TakeTriggers()
+{
+  uint32_t r = queueRead.load(std::memory_order_relaxed);
+  uint32_t w = queueWrite.load(std::memory_order_acquire);
+  for (; r != w; r++) {
+    const Trigger *t = &queue[r & (QUEUE_SIZE - 1)];
+    if (t->clip < 0) {
+      while (activeMask) StopVoice(__builtin_ctz(activeMask));
+      continue;
+    }
+    // A free voice if there is one, otherwise the voices are taken in turn
+    int v;
+    uint32_t idle = ~activeMask & ((1 << voiceCount) - 1);
+    if (idle) {
+      v = __builtin_ctz(idle);
+    } else {
+      v = stealNext;
+      stealNext = (stealNext + 1) % voiceCount;
+      StopVoice(v);
+    }
+    Voice *vo = &voices[v];
+    vo->clip = &clips[t->clip];
+    vo->pos = 0;
+    vo->frac = 0;
+    vo->step = t->step;
+    vo->blockPos = 0;
+    vo->blockLen = 0;
+    // Starting the input puts the voice at the mixer's next output frame
+    vo->input->SetGain(t->gain / 64.0f);
+    vo->input->begin();
+    activeMask |= 1 << v;
+  }
+  queueRead.store(r, std::memory_order_release);
+}
+
+// What a voice already gave the mixer still plays out
+void AudioSfxPlayer::StopVoice(int v)
+{
+  voices[v].input->stop();
+  activeMask &= ~(1 << v);
+}
+
+// The next block of a voice, at its pitch.  Its volume is the input's gain.
+void AudioSfxPlayer::Render(Voice *vo)
+{
+  const int16_t *p = vo->clip->pcm;
+  uint32_t frames = vo->clip->frames;
+  uint32_t pos = vo->pos;
+  uint32_t frac = vo->frac;
+  uint32_t step = vo->step;
+  uint16_t n = 0;
+  for (; n < BLOCK_FRAMES && pos < frames; n++) {
+    int16_t s = p[pos] + (((p[pos + 1] - p[pos]) * (int32_t)(frac >> 1)) >> 15);
+    vo->block[n * 2] = s;
+    vo->block[n * 2 + 1] = s;
+    frac += step;
+    pos += frac >> 16;
+    frac &= 0xffff;
+  }
+  vo->pos = pos;
+  vo->frac = frac;
+  vo->blockPos = 0;
+  vo->blockLen = n;
+}
+
+// Renders until the mixer has no more room for the voice or the clip ends,
+// false if the mixer is full
+bool AudioSfxPlayer::Feed(int v)
+{
+  Voice *vo = &voices[v];
+  while (true) {
+    if (vo->blockPos < vo->blockLen) {
+      vo->blockPos += vo->input->ConsumeSamples(&vo->block[vo->blockPos * 2], vo->blockLen - vo->blockPos);
+      if (vo->blockPos < vo->blockLen) return false;
+    }
+    if (vo->pos >= vo->clip->frames) {
+      StopVoice(v);
+      return true;
+    }
+    Render(vo);
+  }
+}
+
+// The mixer keeps the output fed with silence when no voice plays, so a
+// trigger always waits the same queue depth before it is heard
+void AudioSfxPlayer::Task(void *arg)
+{
+  AudioSfxPlayer *p = (AudioSfxPlayer*)arg;
+  while (p->running) {
+    p->TakeTriggers();
+    bool full = false;
+    uint32_t m = p->activeMask;
+    while (m) {
+      int v = __builtin_ctz(m);
+      m &= m - 1;
+      if (!p->Feed(v)) full = true;
+    }
+    p->mixer->loop();
+    if (full || !p->activeMask) vTaskDelay(1); // A DMA buffer frees up within a tick or two
+  }
+  p->taskDone = true;
+  vTaskDelete(NULL);
+}
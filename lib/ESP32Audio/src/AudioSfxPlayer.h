@@ -0,0 +1,103 @@
+/*
+  AudioSfxPlayer
+  Voice pool for short sound effects, pre-decoded into RAM
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOSFXPLAYER_H
+#define _AUDIOSFXPLAYER_H
+
+#include <atomic>
+#include <FS.h>
+#include "AudioOutputMixer.h"
+
+// Clips are loaded up front, WAV files are converted to 16 bit mono and kept
+// in PSRAM when there is some.  play() only posts a trigger to a small queue,
+// so it takes the same few cycles whatever is playing and never allocates.
+// Each voice is an input of the mixer, which does the mixing and the volume,
+// so music or UI sounds on other inputs share the one output.  The voices are
+// rendered on their own task and start at the mixer's next output frame, so
+// a trigger is heard after what the output has queued: give the
+// AudioOutputI2S two DMA buffers to keep that short.  rate is the mixer's,
+// begin() sets it.  stop() leaves the mixer running for its other inputs.
+// play() may be called from one task, the one that called begin().
+class AudioSfxPlayer
+{
+  public:
+    AudioSfxPlayer(AudioOutputMixer *mixer, int rate = 22050); // Takes MAX_VOICES of its inputs
+    ~AudioSfxPlayer();
+
+    // Clip loading, returns the clip id or -1.  Not while the player runs.
+    int LoadWAV(fs::FS &fs, const char *path); // 8 or 16 bit PCM, mono or stereo
+    int AddClip(const int16_t *pcm, uint32_t frames, int rate); // Not copied, must outlive the player
+    int AddTone(int startHz, int endHz, int ms, bool noise = false); // Square sweep or noise, decaying
+
+    bool begin(int core = 0, int priority = 2);
+    bool stop();
+    bool isRunning() { return running; }
+
+    // Pitch 1.0 plays the clip at its own rate, volume 1.0 at full scale
+    bool play(int clip, float volume = 1.0f, float pitch = 1.0f);
+    void StopAll();
+
+    enum { MAX_CLIPS = 16, MAX_VOICES = 6, QUEUE_SIZE = 16, BLOCK_FRAMES = 64 };
+
+  protected:
+    struct Clip {
+      const int16_t *pcm; // One extra zero frame at the end for the interpolation
+      uint32_t frames;
+      uint32_t step; // Clip frames per output frame at pitch 1.0, 16.16
+      bool owned;
+    };
+    struct Voice {
+      AudioOutputMixerStub *input;
+      const Clip *clip;
+      uint32_t pos;  // Whole frames
+      uint32_t frac; // 0.16
+      uint32_t step; // 16.16
+      int16_t block[BLOCK_FRAMES * 2]; // Rendered, the mixer hasn't taken all of it yet
+      uint16_t blockPos;
+      uint16_t blockLen;
+    };
+    struct Trigger {
+      int8_t clip;   // -1 stops every voice
+      uint8_t gain;  // Fixed point 2.6, as the mixer inputs take it
+      uint32_t step; // 16.16
+    };
+
+    int NewClip(int16_t *pcm, uint32_t frames, int rate, bool owned);
+    int16_t *AllocClip(uint32_t frames);
+    static void Task(void *arg);
+    void TakeTriggers();
+    void StopVoice(int v);
+    void Render(Voice *vo);
+    bool Feed(int v);
+
+    AudioOutputMixer *mixer;
+    int hertz;
+    Clip clips[MAX_CLIPS];
+    int clipCount;
+    Voice voices[MAX_VOICES];
+    int voiceCount; // As many inputs as the mixer had free
+    uint32_t activeMask;
+    int stealNext;
+    Trigger queue[QUEUE_SIZE];
+    std::atomic<uint32_t> queueWrite;
+    std::atomic<uint32_t> queueRead;
+    std::atomic<bool> running;
+    std::atomic<bool> taskDone;
+};
+
+#endif
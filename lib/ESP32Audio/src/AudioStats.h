@@ -0,0 +1,119 @@
+/*
+  AudioStats
+  Underrun, timing and latency counters collected along the audio chain
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOSTATS_H
+#define _AUDIOSTATS_H
+
+#include <Arduino.h>
+
+// Hand the same struct to the source, generator and output getStats(), each
+// fills in its own part and leaves the rest alone.  Zero means unknown.
+// When playback stutters: buffer underflows mean the network starved,
+// decode times near the frame budget mean the CPU did, DMA underruns with
+// neither mean the loop wasn't called often enough.
+struct AudioStats
+{
+  enum { HISTORY = 32, HISTORY_MS = 250 };
+
+  // Source buffer
+  uint32_t bufferSize;
+  uint32_t bufferFill;
+  uint32_t bufferMinFill; // Lowest fill since playback started
+  uint32_t bufferUnderflows;
+  uint8_t fillHistory[HISTORY]; // Percent full every HISTORY_MS, oldest first
+
+  // Decoder, microseconds per frame including synthesis
+  uint32_t frames;
+  uint32_t frameUs;
+  uint32_t frameUsAvg;
+  uint32_t frameUsMax;
+  uint32_t frameBudgetUs; // Play time of one frame
+  uint32_t bitRate;       // Of the stream, bits/s
+  uint32_t streamRate;
+
+  // Output
+  uint32_t outputRate;
+  uint32_t dmaQueued; // Frames written to the DMA and not played yet
+  uint32_t dmaSize;   // Frames the DMA can hold
+  uint32_t dmaUnderruns;
+  uint32_t eqCycles; // CPU cycles per frame in AudioOutputEQ
+
+  AudioStats() { memset(this, 0, sizeof(*this)); }
+
+  // Time from a byte entering the source buffer to its sound leaving the DAC
+  uint32_t latencyMs()
+  {
+    uint32_t ms = 0;
+    if (bitRate) ms += (uint64_t)bufferFill * 8000 / bitRate;
+    if (outputRate) ms += dmaQueued * 1000 / outputRate;
+    return ms;
+  }
+
+  void print()
+  {
+    Serial.printf_P(PSTR("buf %u/%u min %u uflow %u | frame %uus avg %u max %u of %u | dma %u/%u urun %u | eq %u cyc | %ums\n"),
+                    bufferFill, bufferSize, bufferMinFill, bufferUnderflows,
+                    frameUs, frameUsAvg, frameUsMax, frameBudgetUs,
+                    dmaQueued, dmaSize, dmaUnderruns, eqCycles, latencyMs());
+  }
+};
+
+// Kept by the buffering sources, sample() is cheap enough for every read
+class AudioFillStats
+{
+  public:
+    AudioFillStats() { reset(); }
+    void reset()
+    {
+      underflows = 0;
+      minFill = 0xffffffff;
+      memset(history, 0, sizeof(history));
+      historyPos = 0;
+      lastMs = millis();
+    }
+    inline void sample(uint32_t fill, uint32_t size)
+    {
+      if (fill < minFill) minFill = fill;
+      uint32_t now = millis();
+      if (now - lastMs >= AudioStats::HISTORY_MS) {
+        lastMs = now;
+        history[historyPos] = size ? (uint64_t)fill * 100 / size : 0;
+        historyPos = (historyPos + 1) % AudioStats::HISTORY;
+      }
+    }
+    void underflow() { underflows++; }
+    void get(AudioStats *st, uint32_t fill, uint32_t size)
+    {
+      st->bufferSize = size;
+      st->bufferFill = fill;
+      st->bufferMinFill = (minFill == 0xffffffff) ? fill : minFill;
+      st->bufferUnderflows = underflows;
+      for (int i = 0; i < AudioStats::HISTORY; i++) {
+        st->fillHistory[i] = history[(historyPos + i) % AudioStats::HISTORY];
+      }
+    }
+
+  private:
+    uint32_t underflows;
+    uint32_t minFill;
+    uint8_t history[AudioStats::HISTORY];
+    uint8_t historyPos;
+    uint32_t lastMs;
+};
+
+#endif
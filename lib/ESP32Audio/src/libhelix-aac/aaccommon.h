@@ -54,6 +54,15 @@
   #define AAC_ENABLE_SBR 1 
 #endif
 
+// The FFT twiddles are read in the innermost loop, keep them in internal RAM
+// on the ESP32 unless built with AUDIO_TABLES_IN_FLASH
+#if defined(ESP32) && !defined(AUDIO_TABLES_IN_FLASH)
+  #include <esp_attr.h>
+  #define HOT_TABLE DRAM_ATTR
+#else
+  #define HOT_TABLE PROGMEM
+#endif
+
 #pragma GCC optimize ("O3")
 
 #include "aacdec.h"
@@ -149,6 +158,7 @@ typedef struct _AACDecInfo {
 	int profile;
 	int format;
 	int sbrEnabled;
+	int sbrSkip;		/* core only, SBR data is ignored (see AACSetCoreOnly) */
 	int tnsUsed;
 	int pnsUsed;
 	int frameCount;
@@ -266,6 +266,46 @@ int AACFlushCodec(HAACDecoder hAACDecoder)
 	return ERR_AAC_NONE;
 }
 
+/**************************************************************************************
+ * Function:    AACSetCoreOnly
+ *
+ * Description: decode HE-AAC streams without SBR, or go back to decoding with it
+ *
+ * Inputs:      valid AAC decoder instance pointer (HAACDecoder)
+ *              nonzero to skip SBR, 0 to use it
+ *
+ * Outputs:     none
+ *
+ * Return:      0 if successful, error code (< 0) if error
+ *
+ * Notes:       without SBR only the AAC-LC core is decoded, which gives 1024 samples
+ *                per channel at the core (half) sample rate, see AACGetLastFrameInfo()
+ *              the change takes effect from the next frame, the core keeps its
+ *                overlap so there is no gap, only the change of rate
+ *              going back to SBR restarts it, it applies again from the next SBR
+ *                header in the stream
+ **************************************************************************************/
+int AACSetCoreOnly(HAACDecoder hAACDecoder, int coreOnly)
+{
+	AACDecInfo *aacDecInfo = (AACDecInfo *)hAACDecoder;
+
+	if (!aacDecInfo)
+		return ERR_AAC_NULL_POINTER;
+
+	coreOnly = coreOnly ? 1 : 0;
+	if (coreOnly == aacDecInfo->sbrSkip)
+		return ERR_AAC_NONE;
+
+	aacDecInfo->sbrSkip = coreOnly;
+	aacDecInfo->sbrEnabled = 0;
+#ifdef AAC_ENABLE_SBR
+	if (!coreOnly)
+		FlushCodecSBR(aacDecInfo);
+#endif
+
+	return ERR_AAC_NONE;
+}
+
 /**************************************************************************************
  * Function:    AACDecode
  *
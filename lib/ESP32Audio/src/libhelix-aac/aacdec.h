@@ -160,6 +160,7 @@ int AACFindSyncWord(unsigned char *buf, int nBytes);
 void AACGetLastFrameInfo(HAACDecoder hAACDecoder, AACFrameInfo *aacFrameInfo);
 int AACSetRawBlockParams(HAACDecoder hAACDecoder, int copyLast, AACFrameInfo *aacFrameInfo);
 int AACFlushCodec(HAACDecoder hAACDecoder);
+int AACSetCoreOnly(HAACDecoder hAACDecoder, int coreOnly);
 
 #ifdef HELIX_CONFIG_AAC_GENERATE_TRIGTABS_FLOAT
 int AACInitTrigtabsFloat(void);
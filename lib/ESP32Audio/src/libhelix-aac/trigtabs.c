@@ -625,7 +625,7 @@ const int kbdWindow[128 + 1024] PROGMEM = {
 
 const int bitrevtabOffset[NUM_IMDCT_SIZES] PROGMEM = {0, 17};
 
-const unsigned char bitrevtab[17 + 129] PROGMEM = {
+const unsigned char bitrevtab[17 + 129] HOT_TABLE = {
 /* nfft = 64 */
 0x01, 0x08, 0x02, 0x04, 0x03, 0x0c, 0x05, 0x0a, 0x07, 0x0e, 0x0b, 0x0d, 0x00, 0x06, 0x09, 0x0f,
 0x00,
@@ -685,7 +685,7 @@ const unsigned char uniqueIDTab[8] = {0x5f, 0x4b, 0x43, 0x5f, 0x5f, 0x4a, 0x52,
  *   }
  * }
  */
-const int twidTabOdd[8*6 + 32*6 + 128*6] PROGMEM = {
+const int twidTabOdd[8*6 + 32*6 + 128*6] HOT_TABLE = {
 	0x40000000, 0x00000000, 0x40000000, 0x00000000, 0x40000000, 0x00000000, 0x539eba45, 0xe7821d59, 
 	0x4b418bbe, 0xf383a3e2, 0x58c542c5, 0xdc71898d, 0x5a82799a, 0xd2bec333, 0x539eba45, 0xe7821d59, 
 	0x539eba45, 0xc4df2862, 0x539eba45, 0xc4df2862, 0x58c542c5, 0xdc71898d, 0x3248d382, 0xc13ad060, 
@@ -816,7 +816,7 @@ const int twidTabOdd[8*6 + 32*6 + 128*6] PROGMEM = {
 	0xbb771c81, 0x3fd39b5a, 0xc197049e, 0xfe6deaa1, 0x40c7d2bd, 0xc0013bd3, 0xbdb00d71, 0x3ff4e5e0, 
 };
 
-const int twidTabEven[4*6 + 16*6 + 64*6] PROGMEM = {
+const int twidTabEven[4*6 + 16*6 + 64*6] HOT_TABLE = {
 	0x40000000, 0x00000000, 0x40000000, 0x00000000, 0x40000000, 0x00000000, 0x5a82799a, 0xd2bec333, 
 	0x539eba45, 0xe7821d59, 0x539eba45, 0xc4df2862, 0x40000000, 0xc0000000, 0x5a82799a, 0xd2bec333, 
 	0x00000000, 0xd2bec333, 0x00000000, 0xd2bec333, 0x539eba45, 0xc4df2862, 0xac6145bb, 0x187de2a7, 
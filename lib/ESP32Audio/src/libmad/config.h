@@ -46,7 +46,24 @@ extern int stackfree();
 /* Define if your MIPS CPU supports a 2-operand MADD16 instruction. */
 /* #undef HAVE_MADD16_ASM */
 
-#define FPM_DEFAULT
+/* Tables read for every sample are kept in internal RAM on the ESP32, where
+   they don't compete with the stream buffers in PSRAM for the flash cache.
+   Build with AUDIO_TABLES_IN_FLASH to give the RAM back. */
+#if defined(ESP32) && !defined(AUDIO_TABLES_IN_FLASH)
+# include <esp_attr.h>
+# define HOT_TABLE DRAM_ATTR
+#else
+# define HOT_TABLE PROGMEM
+#endif
+
+/* ESP32 multiplies 32x32 to 64 bits in hardware, see fixed.h.  A host build
+   may pick its own variant, the host tests run FPM_XTENSA's C stand-ins. */
+#if defined(FPM_XTENSA) || defined(FPM_64BIT) || defined(FPM_DEFAULT)
+#elif defined(ESP32) && defined(__XTENSA__)
+# define FPM_XTENSA
+#else
+# define FPM_DEFAULT
+#endif
 
 /* Define if your MIPS CPU supports a 2-operand MADD instruction. */
 #define HAVE_MADD_ASM 1
@@ -335,6 +335,71 @@ mad_fixed_t mad_f_mul_inline(mad_fixed_t x, mad_fixed_t y)
 #  define MAD_F_SCALEBITS  MAD_F_FRACBITS
 # endif
 
+/* --- Xtensa ------------------------------------------------------------- */
+
+# elif defined(FPM_XTENSA)
+
+/*
+ * For the ESP32, whose LX6 core has the MUL32 and MUL32_HIGH options: mull
+ * and mulsh give the low and high words of the 64-bit product. There is no
+ * 32x32 multiply-accumulate (MAC16 is 16x16 only), so sums carry by hand.
+ *
+ * Without OPT_SPEED this is as accurate as FPM_64BIT, mad_f_mul() gives the
+ * same result bit for bit. With OPT_SPEED only the high word is kept, as
+ * FPM_MIPS does, which costs up to 4 of the 28 fraction bits of a product and
+ * saves the mull and the carry on every multiply.
+ *
+ * Elsewhere the two words come from a 64-bit product, so the rest of this
+ * section can be checked on a host, see test/host/fpm_test.c.
+ */
+#  if defined(__XTENSA__)
+#   define MAD_F_MULL(x, y)  \
+    ({ mad_fixed64lo_t __l;  \
+       asm ("mull	%0, %1, %2"  \
+	    : "=a" (__l)  \
+	    : "%a" (x), "a" (y));  \
+       __l;  \
+    })
+
+#   define MAD_F_MULSH(x, y)  \
+    ({ mad_fixed64hi_t __h;  \
+       asm ("mulsh	%0, %1, %2"  \
+	    : "=a" (__h)  \
+	    : "%a" (x), "a" (y));  \
+       __h;  \
+    })
+#  else
+#   define MAD_F_MULL(x, y)  \
+    ((mad_fixed64lo_t) ((mad_fixed64_t) (x) * (y)))
+#   define MAD_F_MULSH(x, y)  \
+    ((mad_fixed64hi_t) (((mad_fixed64_t) (x) * (y)) >> 32))
+#  endif
+
+#  define MAD_F_MLX(hi, lo, x, y)  \
+    ((lo) = MAD_F_MULL((x), (y)), (hi) = MAD_F_MULSH((x), (y)))
+
+#  if defined(OPT_SPEED)
+#   define mad_f_mul(x, y)  \
+    ((mad_fixed_t) (MAD_F_MULSH((x), (y)) << (32 - MAD_F_SCALEBITS)))
+#   define MAD_F_ML0(hi, lo, x, y)  \
+    ((void) (lo), (hi) = MAD_F_MULSH((x), (y)))
+#   define MAD_F_MLA(hi, lo, x, y)  \
+    ((hi) += MAD_F_MULSH((x), (y)))
+#   define MAD_F_MLN(hi, lo)  \
+    ((hi) = -(hi))
+#   define mad_f_scale64(hi, lo)  \
+    ((mad_fixed_t) ((hi) << (32 - MAD_F_SCALEBITS)))
+#  else
+#   define MAD_F_MLA(hi, lo, x, y)  \
+    ({ mad_fixed64lo_t __lo = MAD_F_MULL((x), (y));  \
+       mad_fixed64hi_t __hi = MAD_F_MULSH((x), (y));  \
+       (lo) += __lo;  \
+       (hi) += __hi + ((lo) < __lo);  \
+    })
+#  endif
+
+#  define MAD_F_SCALEBITS  MAD_F_FRACBITS
+
 /* --- SPARC --------------------------------------------------------------- */
 
 # elif defined(FPM_SPARC)
@@ -375,7 +375,7 @@ static inline mad_fixed_t root_table(int i)
 */
 static inline mad_fixed_t cs(int i)
 {
-  static mad_fixed_t const cs_val[8] PROGMEM = {
+  static mad_fixed_t const cs_val[8] HOT_TABLE = {
     +MAD_F(0x0db84a81) /* +0.857492926 */, +MAD_F(0x0e1b9d7f) /* +0.881741997 */,
     +MAD_F(0x0f31adcf) /* +0.949628649 */, +MAD_F(0x0fbba815) /* +0.983314592 */,
     +MAD_F(0x0feda417) /* +0.995517816 */, +MAD_F(0x0ffc8fc8) /* +0.999160558 */,
@@ -387,7 +387,7 @@ static inline mad_fixed_t cs(int i)
 
 static inline mad_fixed_t ca(int i)
 {
-  static mad_fixed_t const ca_val[8] PROGMEM = {
+  static mad_fixed_t const ca_val[8] HOT_TABLE = {
     -MAD_F(0x083b5fe7) /* -0.514495755 */, -MAD_F(0x078c36d2) /* -0.471731969 */,
     -MAD_F(0x05039814) /* -0.313377454 */, -MAD_F(0x02e91dd1) /* -0.181913200 */,
     -MAD_F(0x0183603a) /* -0.094574193 */, -MAD_F(0x00a7cb87) /* -0.040965583 */,
@@ -405,7 +405,7 @@ static inline mad_fixed_t ca(int i)
    imdct_s[i /odd][k] = cos((PI / 24) * (2 * (6 + (i-1)/2) + 7) * (2 * k + 1))
 */
 static
-mad_fixed_t const imdct_s[6][6] PROGMEM  = {
+mad_fixed_t const imdct_s[6][6] HOT_TABLE = {
 # include "imdct_s.dat.h"
 };
 
@@ -418,7 +418,7 @@ mad_fixed_t const imdct_s[6][6] PROGMEM  = {
 */
 static inline mad_fixed_t window_l(int i)
 {
-  static mad_fixed_t const window_l_val[36] PROGMEM = {
+  static mad_fixed_t const window_l_val[36] HOT_TABLE = {
     MAD_F(0x00b2aa3e) /* 0.043619387 */, MAD_F(0x0216a2a2) /* 0.130526192 */,
     MAD_F(0x03768962) /* 0.216439614 */, MAD_F(0x04cfb0e2) /* 0.300705800 */,
     MAD_F(0x061f78aa) /* 0.382683432 */, MAD_F(0x07635284) /* 0.461748613 */,
@@ -453,7 +453,7 @@ static inline mad_fixed_t window_l(int i)
 */
 static inline mad_fixed_t window_s(int i)
 {
-  static mad_fixed_t const window_s_val[12] PROGMEM = {
+  static mad_fixed_t const window_s_val[12] HOT_TABLE = {
     MAD_F(0x0216a2a2) /* 0.130526192 */, MAD_F(0x061f78aa) /* 0.382683432 */,
     MAD_F(0x09bd7ca0) /* 0.608761429 */, MAD_F(0x0cb19346) /* 0.793353340 */,
     MAD_F(0x0ec835e8) /* 0.923879533 */, MAD_F(0x0fdcf549) /* 0.991444861 */,
@@ -2421,7 +2421,7 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
   struct mad_header *header = &frame->header;
   mad_fixed_t *xr[2]; // Moved from stack to dynheap
 //  mad_fixed_t *xr_raw; // [2][576]
-  unsigned int sfreqi, ngr, gr;
+  unsigned int sfreqi, ngr, gr, chfirst, chlast;
 //  xr_raw = (mad_fixed_t*)malloc(sizeof(mad_fixed_t) * 2 * 576);
 //  if (!xr_raw)
 //    return MAD_ERROR_NOMEM;
@@ -2495,9 +2495,24 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
 
     /* reordering, alias reduction, IMDCT, overlap-add, frequency inversion */
 
-    for (ch = 0; ch < nch; ++ch) {
+    /* a single channel option leaves its output in sbsample[0], see below */
+
+    chfirst = 0;
+    chlast  = nch;
+    if (nch == 2) {
+      switch (frame->options & MAD_OPTION_SINGLECHANNEL) {
+      case MAD_OPTION_LEFTCHANNEL:
+        chlast = 1;
+        break;
+      case MAD_OPTION_RIGHTCHANNEL:
+        chfirst = 1;
+        break;
+      }
+    }
+
+    for (ch = chfirst; ch < chlast; ++ch) {
       struct channel const *channel = &granule->ch[ch];
-      mad_fixed_t (*sample)[32] = &frame->sbsample[ch][18 * gr];
+      mad_fixed_t (*sample)[32] = &frame->sbsample[ch - chfirst][18 * gr];
       unsigned int sb, l, i, sblimit;
       mad_fixed_t output[36];
 
@@ -2588,6 +2603,21 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
           III_freqinver(sample, sb);
       }
     }
+
+    /* combined channels are mixed here, as subband samples, so only one
+       channel goes through the polyphase synthesis */
+
+    if (nch == 2 &&
+        (frame->options & MAD_OPTION_SINGLECHANNEL) == MAD_OPTION_SINGLECHANNEL) {
+      mad_fixed_t (*left)[32]  = &frame->sbsample[0][18 * gr];
+      mad_fixed_t (*right)[32] = &frame->sbsample[1][18 * gr];
+      unsigned int s, sb;
+
+      for (s = 0; s < 18; ++s) {
+        for (sb = 0; sb < 32; ++sb)
+          left[s][sb] = (left[s][sb] >> 1) + (right[s][sb] >> 1);
+      }
+    }
   }
 
 //  free(xr_raw);
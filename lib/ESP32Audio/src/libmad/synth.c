@@ -563,7 +563,7 @@ void dct32(mad_fixed_t const in[32], unsigned int slot,
 # endif
 
 static
-mad_fixed_t const D[17][32] PROGMEM = {
+mad_fixed_t const D[17][32] HOT_TABLE = {
 # include "D.dat.h"
 };
 
@@ -879,6 +879,12 @@ enum mad_flow mad_synth_frame(struct mad_synth *synth, struct mad_frame const *f
   nch = MAD_NCHANNELS(&frame->header);
   ns  = MAD_NSBSAMPLES(&frame->header);
 
+  /* Layer III left the one channel wanted in sbsample[0], the other
+     layers decode both */
+  if ((frame->options & MAD_OPTION_SINGLECHANNEL) &&
+      frame->header.layer == MAD_LAYER_III)
+    nch = 1;
+
   synth->pcm.samplerate = frame->header.samplerate;
   synth->pcm.channels   = nch;
   synth->pcm.length     = 32;// * ns;
@@ -909,6 +915,12 @@ enum mad_flow mad_synth_frame_onens(struct mad_synth *synth, struct mad_frame co
   nch = MAD_NCHANNELS(&frame->header);
 //  ns  = MAD_NSBSAMPLES(&frame->header);
 
+  /* Layer III left the one channel wanted in sbsample[0], the other
+     layers decode both */
+  if ((frame->options & MAD_OPTION_SINGLECHANNEL) &&
+      frame->header.layer == MAD_LAYER_III)
+    nch = 1;
+
   synth->pcm.samplerate = frame->header.samplerate;
   synth->pcm.channels   = nch;
   synth->pcm.length     = 32;// * ns;
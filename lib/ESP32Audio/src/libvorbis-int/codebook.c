@@ -0,0 +1,313 @@
+/*
+  vorbisdec
+  Codebook setup, Huffman decoding and VQ lookup
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vorbis.h"
+
+static uint32_t Reverse32(uint32_t v)
+{
+	v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+	v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+	v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+	v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+/* Greatest r with r^dimensions <= entries */
+static int Lookup1Values(int entries, int dimensions)
+{
+	int r, i;
+	uint64_t p;
+	if (dimensions == 1)
+		return entries;
+	for (r = 1; ; r++) {
+		p = 1;
+		for (i = 0; i < dimensions && p <= (uint64_t)entries; i++)
+			p *= r + 1;
+		if (p > (uint64_t)entries)
+			return r;
+	}
+}
+
+/* m * 2^(e - 788) of a packed Vorbis float, in Q(VQ_FRACBITS) */
+static int64_t FloatToFixed(int64_t m, int e)
+{
+	int s = e - 788 + VQ_FRACBITS;
+	if (!m)
+		return 0;
+	if (s >= 0) {
+		if (s > 62 - 40)
+			return m < 0 ? -((int64_t)1 << 40) : ((int64_t)1 << 40);	/* saturated below */
+		return m << s;
+	}
+	if (s < -62)
+		return 0;
+	return (m + ((int64_t)1 << (-s - 1))) >> -s;
+}
+
+static int32_t VQValue(uint32_t mult, uint32_t delta, uint32_t minimum)
+{
+	int64_t dm = delta & 0x1fffff, mm = minimum & 0x1fffff, v;
+	if (delta & 0x80000000)
+		dm = -dm;
+	if (minimum & 0x80000000)
+		mm = -mm;
+	v = FloatToFixed(dm * mult, (delta >> 21) & 0x3ff) + FloatToFixed(mm, (minimum >> 21) & 0x3ff);
+	if (v > 0x7fffffff)
+		return 0x7fffffff;
+	if (v < -0x7fffffff)
+		return -0x7fffffff;
+	return (int32_t)v;
+}
+
+/* Codewords are handed out in entry order, each taking the lowest free
+ * branch of its length (spec 3.2.1).  The MSB aligned codes are built in
+ * the arena's free space, then spread into the fast table or kept sorted
+ * for the binary search of the long ones.
+ */
+static int BuildDecoder(VorbisDecInfo *vi, VorbisCodebook *book)
+{
+	uint32_t avail[33];
+	uint32_t *codes;
+	int i, j, k, z, y, used = 0;
+
+	book->maxLen = 0;
+	for (i = 0; i < book->entries; i++) {
+		if (book->lengths[i]) {
+			used++;
+			if (book->lengths[i] > book->maxLen)
+				book->maxLen = book->lengths[i];
+		}
+	}
+	book->fastBits = book->maxLen < FAST_BITS ? book->maxLen : FAST_BITS;
+	book->fast = (uint16_t *)ArenaAlloc(vi, (1 << book->fastBits) * sizeof(uint16_t));
+	if (!book->fast)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	memset(book->fast, 0xff, (1 << book->fastBits) * sizeof(uint16_t));
+	book->numLong = 0;
+	if (!used)
+		return ERR_VORBIS_NONE;
+
+	if (used == 1) {
+		/* A single entry is always decoded, whatever its bits */
+		for (i = 0; !book->lengths[i]; i++)
+			;
+		for (j = 0; j < (1 << book->fastBits); j++)
+			book->fast[j] = i;
+		if (book->maxLen > 24)
+			book->lengths[i] = 24;	/* The most one skip takes */
+		return ERR_VORBIS_NONE;
+	}
+
+	for (i = 0; i < book->entries; i++) {
+		if (book->lengths[i] > book->fastBits)
+			book->numLong++;
+	}
+	book->longCodes = (uint32_t *)ArenaAlloc(vi, book->numLong * sizeof(uint32_t));
+	book->longEntries = (uint16_t *)ArenaAlloc(vi, book->numLong * sizeof(uint16_t));
+	if (book->numLong && (!book->longCodes || !book->longEntries))
+		return ERR_VORBIS_OUT_OF_MEMORY;
+
+	/* Scratch, not kept */
+	if (vi->arenaSize - vi->arenaUsed < book->entries * (int)sizeof(uint32_t))
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	codes = (uint32_t *)(vi->arena + vi->arenaUsed);
+
+	memset(avail, 0, sizeof(avail));
+	for (k = 0; !book->lengths[k]; k++)
+		;
+	codes[k] = 0;
+	for (i = 1; i <= book->lengths[k]; i++)
+		avail[i] = 1U << (32 - i);
+	for (i = k + 1; i < book->entries; i++) {
+		z = book->lengths[i];
+		if (!z)
+			continue;
+		while (z > 0 && !avail[z])
+			z--;
+		if (!z)
+			return ERR_VORBIS_BAD_HEADER;	/* Overspecified, more codes than the tree has room for */
+		codes[i] = avail[z];
+		avail[z] = 0;
+		for (y = book->lengths[i]; y > z; y--)
+			avail[y] = codes[i] + (1U << (32 - y));
+	}
+
+	j = 0;
+	for (i = 0; i < book->entries; i++) {
+		int len = book->lengths[i];
+		if (!len)
+			continue;
+		if (len <= book->fastBits) {
+			for (z = Reverse32(codes[i]); z < (1 << book->fastBits); z += 1 << len)
+				book->fast[z] = i;
+		} else {
+			/* Insertion keeps them sorted, they mostly come in order already */
+			for (y = j; y > 0 && book->longCodes[y - 1] > codes[i]; y--) {
+				book->longCodes[y] = book->longCodes[y - 1];
+				book->longEntries[y] = book->longEntries[y - 1];
+			}
+			book->longCodes[y] = codes[i];
+			book->longEntries[y] = i;
+			j++;
+		}
+	}
+	return ERR_VORBIS_NONE;
+}
+
+int CodebookSetup(VorbisDecInfo *vi, VorbisCodebook *book, VorbisBits *bs)
+{
+	int i, err;
+
+	memset(book, 0, sizeof(*book));
+	if (BitsGet(bs, 24) != 0x564342)
+		return ERR_VORBIS_BAD_HEADER;
+	book->dimensions = BitsGet(bs, 16);
+	book->entries = BitsGet(bs, 24);
+	if (!book->dimensions || !book->entries)
+		return ERR_VORBIS_BAD_HEADER;
+	if (book->entries >= 0xffff)
+		return ERR_VORBIS_UNSUPPORTED;
+	book->lengths = (uint8_t *)ArenaAlloc(vi, book->entries);
+	if (!book->lengths)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+
+	if (!BitsGet(bs, 1)) {
+		int sparse = BitsGet(bs, 1);
+		for (i = 0; i < book->entries; i++) {
+			if (sparse && !BitsGet(bs, 1))
+				book->lengths[i] = 0;
+			else
+				book->lengths[i] = BitsGet(bs, 5) + 1;
+		}
+	} else {
+		int len = BitsGet(bs, 5) + 1;
+		for (i = 0; i < book->entries; len++) {
+			int num = BitsGet(bs, ilog(book->entries - i));
+			if (num > book->entries - i || len > 32 || BitsEOP(bs))
+				return ERR_VORBIS_BAD_HEADER;
+			memset(book->lengths + i, len, num);
+			i += num;
+		}
+	}
+	if (BitsEOP(bs))
+		return ERR_VORBIS_BAD_HEADER;
+	err = BuildDecoder(vi, book);
+	if (err)
+		return err;
+
+	book->lookupType = BitsGet(bs, 4);
+	if (book->lookupType == 1 || book->lookupType == 2) {
+		uint32_t minimum = BitsGet(bs, 32);
+		uint32_t delta = BitsGet(bs, 32);
+		int valueBits = BitsGet(bs, 4) + 1;
+		book->sequenceP = BitsGet(bs, 1);
+		if (book->lookupType == 1) {
+			book->lookupValues = Lookup1Values(book->entries, book->dimensions);
+		} else {
+			if ((int64_t)book->entries * book->dimensions > 0x100000)
+				return ERR_VORBIS_UNSUPPORTED;
+			book->lookupValues = book->entries * book->dimensions;
+		}
+		book->values = (int32_t *)ArenaAlloc(vi, book->lookupValues * sizeof(int32_t));
+		if (!book->values)
+			return ERR_VORBIS_OUT_OF_MEMORY;
+		for (i = 0; i < book->lookupValues; i++)
+			book->values[i] = VQValue(BitsGet(bs, valueBits), delta, minimum);
+	} else if (book->lookupType) {
+		return ERR_VORBIS_BAD_HEADER;
+	}
+	return BitsEOP(bs) ? ERR_VORBIS_BAD_HEADER : ERR_VORBIS_NONE;
+}
+
+/* Codewords longer than the fast table, found by a binary search over the
+ * next 32 bits.  A prefix no entry has means a corrupt packet.
+ */
+int CodebookDecodeSlow(const VorbisCodebook *book, VorbisBits *bs)
+{
+	uint32_t v, code;
+	int lo, hi, mid, e, len;
+
+	if (!book->numLong)
+		return -1;
+	BitsFill(bs);
+	v = bs->cache;
+	if (bs->avail < 32)
+		v |= (uint32_t)(bs->ptr < bs->end ? *bs->ptr : 0) << bs->avail;
+	code = Reverse32(v);
+
+	lo = 0;
+	hi = book->numLong;
+	while (hi - lo > 1) {
+		mid = (lo + hi) >> 1;
+		if (book->longCodes[mid] <= code)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	if (book->longCodes[lo] > code)
+		return -1;
+	e = book->longEntries[lo];
+	len = book->lengths[e];
+	if (len < 32 && ((code ^ book->longCodes[lo]) >> (32 - len)))
+		return -1;
+	if (len > 24) {
+		BitsSkip(bs, 16);
+		BitsFill(bs);
+		len -= 16;
+	}
+	BitsSkip(bs, len);
+	return e;
+}
+
+/* Adds the vector of the next codeword to dst[0], dst[stride], ...  Returns
+ * -1 at the end of the packet or on an invalid codeword.
+ */
+int CodebookDecodeAdd(const VorbisCodebook *book, VorbisBits *bs, int32_t *dst, int stride)
+{
+	int i, e = CodebookDecode(book, bs);
+	int32_t v, last = 0;
+
+	if (e < 0 || BitsEOP(bs))
+		return -1;
+	if (book->lookupType == 1) {
+		const int32_t *values = book->values;
+		int lv = book->lookupValues;
+		if (!book->sequenceP) {
+			for (i = 0; i < book->dimensions; i++, dst += stride) {
+				*dst += values[e % lv];
+				e /= lv;
+			}
+		} else {
+			for (i = 0; i < book->dimensions; i++, dst += stride) {
+				v = values[e % lv] + last;
+				e /= lv;
+				*dst += v;
+				last = v;
+			}
+		}
+	} else {
+		const int32_t *values = book->values + e * book->dimensions;
+		for (i = 0; i < book->dimensions; i++, dst += stride) {
+			v = values[i] + last;
+			*dst += v;
+			if (book->sequenceP)
+				last = v;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+  vorbisdec
+  Floor type 1, the piecewise linear spectral envelope
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vorbis.h"
+
+/* floor1_inverse_dB_table of the spec, 10^((7i - 1785) / 256) in Q31 */
+static const int32_t inverseDB[256] HOT_TABLE = {
+	0x000000e5, 0x000000f4, 0x00000103, 0x00000114, 0x00000126, 0x00000139,
+	0x0000014e, 0x00000163, 0x0000017a, 0x00000193, 0x000001ad, 0x000001c9,
+	0x000001e7, 0x00000206, 0x00000228, 0x0000024c, 0x00000272, 0x0000029b,
+	0x000002c6, 0x000002f4, 0x00000326, 0x0000035a, 0x00000392, 0x000003cd,
+	0x0000040c, 0x00000450, 0x00000497, 0x000004e4, 0x00000535, 0x0000058c,
+	0x000005e8, 0x0000064a, 0x000006b3, 0x00000722, 0x00000799, 0x00000818,
+	0x0000089e, 0x0000092e, 0x000009c6, 0x00000a69, 0x00000b16, 0x00000bcf,
+	0x00000c93, 0x00000d64, 0x00000e43, 0x00000f30, 0x0000102d, 0x0000113a,
+	0x00001258, 0x0000138a, 0x000014cf, 0x00001629, 0x0000179a, 0x00001922,
+	0x00001ac4, 0x00001c82, 0x00001e5c, 0x00002055, 0x0000226f, 0x000024ac,
+	0x0000270e, 0x00002997, 0x00002c4b, 0x00002f2c, 0x0000323d, 0x00003581,
+	0x000038fb, 0x00003caf, 0x000040a0, 0x000044d3, 0x0000494c, 0x00004e10,
+	0x00005323, 0x0000588a, 0x00005e4b, 0x0000646b, 0x00006af2, 0x000071e5,
+	0x0000794c, 0x0000812e, 0x00008993, 0x00009283, 0x00009c09, 0x0000a62d,
+	0x0000b0f9, 0x0000bc79, 0x0000c8b9, 0x0000d5c4, 0x0000e3a9, 0x0000f274,
+	0x00010235, 0x000112fd, 0x000124dc, 0x000137e4, 0x00014c29, 0x000161bf,
+	0x000178bc, 0x00019137, 0x0001ab4a, 0x0001c70e, 0x0001e4a1, 0x0002041f,
+	0x000225aa, 0x00024962, 0x00026f6d, 0x000297f0, 0x0002c316, 0x0002f109,
+	0x000321f9, 0x00035616, 0x00038d97, 0x0003c8b4, 0x000407a7, 0x00044ab2,
+	0x00049218, 0x0004de22, 0x00052f1e, 0x0005855c, 0x0005e135, 0x00064306,
+	0x0006ab32, 0x00071a24, 0x0007904b, 0x00080e20, 0x00089422, 0x000922da,
+	0x0009bad8, 0x000a5cb6, 0x000b0919, 0x000bc0b1, 0x000c8436, 0x000d5470,
+	0x000e3233, 0x000f1e5f, 0x001019e3, 0x001125c0, 0x00124306, 0x001372d5,
+	0x0014b662, 0x00160ef6, 0x00177def, 0x001904c1, 0x001aa4f8, 0x001c603c,
+	0x001e384e, 0x00202f0e, 0x0022467a, 0x002480b1, 0x0026dff6, 0x002966b2,
+	0x002c1775, 0x002ef4fb, 0x0032022c, 0x00354221, 0x0038b827, 0x003c67c1,
+	0x004054ad, 0x004482e7, 0x0048f6ae, 0x004db486, 0x0052c141, 0x005821fd,
+	0x005ddc32, 0x0063f5af, 0x006a74a5, 0x00715fad, 0x0078bdcc, 0x0080967d,
+	0x0088f1b8, 0x0091d7f7, 0x009b5245, 0x00a56a3f, 0x00b02a24, 0x00bb9ce0,
+	0x00c7ce0f, 0x00d4ca14, 0x00e29e1d, 0x00f15832, 0x01010748, 0x0111bb4a,
+	0x0123852d, 0x01367700, 0x014aa3ff, 0x016020a3, 0x017702bf, 0x018f618b,
+	0x01a955c7, 0x01c4f9ca, 0x01e269a3, 0x0201c336, 0x02232654, 0x0246b4e4,
+	0x026c92fc, 0x0294e70e, 0x02bfda0b, 0x02ed978c, 0x031e4e01, 0x03522edb,
+	0x03896ec7, 0x03c445d9, 0x0402efcd, 0x0445ac41, 0x048cbef2, 0x04d87009,
+	0x05290c5b, 0x057ee5be, 0x05da5357, 0x063bb1f8, 0x06a36478, 0x0711d41c,
+	0x07877100, 0x0804b28a, 0x088a17e0, 0x0918286d, 0x09af746a, 0x0a50956c,
+	0x0afc2f06, 0x0bb2ef6b, 0x0c759021, 0x0d44d6ba, 0x0e2195a2, 0x0f0cacf0,
+	0x10070b4a, 0x1111aedb, 0x122da650, 0x135c11ee, 0x149e24b6, 0x15f5259b,
+	0x176270d2, 0x18e7792e, 0x1a85c99c, 0x1c3f06b5, 0x1e14f064, 0x200963b3,
+	0x221e5ca9, 0x2455f853, 0x26b276e6, 0x29363e09, 0x2be3db45, 0x2ebe069b,
+	0x31c7a545, 0x3503ccac, 0x3875c582, 0x3c210f1d, 0x40096302, 0x4432b8ae,
+	0x48a1499a, 0x4d599589, 0x52606713, 0x57bad88c, 0x5d6e5927, 0x6380b283,
+	0x69f80e86, 0x70dafda1, 0x78307d79, 0x7fffffff,
+};
+
+static const int floorRange[4] = {256, 128, 86, 64};
+
+int Floor1Setup(VorbisDecInfo *vi, VorbisFloor1 *f, VorbisBits *bs)
+{
+	int i, j, k, maxClass = -1, rangeBits;
+
+	f->partitions = BitsGet(bs, 5);
+	for (i = 0; i < f->partitions; i++) {
+		f->partitionClass[i] = BitsGet(bs, 4);
+		if (f->partitionClass[i] > maxClass)
+			maxClass = f->partitionClass[i];
+	}
+	for (i = 0; i <= maxClass; i++) {
+		f->classDim[i] = BitsGet(bs, 3) + 1;
+		f->classSub[i] = BitsGet(bs, 2);
+		f->classMaster[i] = -1;
+		if (f->classSub[i]) {
+			f->classMaster[i] = BitsGet(bs, 8);
+			if (f->classMaster[i] >= vi->numBooks)
+				return ERR_VORBIS_BAD_HEADER;
+		}
+		for (j = 0; j < (1 << f->classSub[i]); j++) {
+			f->subBooks[i][j] = (int)BitsGet(bs, 8) - 1;
+			if (f->subBooks[i][j] >= vi->numBooks)
+				return ERR_VORBIS_BAD_HEADER;
+		}
+	}
+	f->multiplier = BitsGet(bs, 2) + 1;
+	rangeBits = BitsGet(bs, 4);
+	f->x[0] = 0;
+	f->x[1] = 1 << rangeBits;
+	f->values = 2;
+	for (i = 0; i < f->partitions; i++) {
+		for (j = 0; j < f->classDim[f->partitionClass[i]]; j++) {
+			if (f->values == FLOOR1_MAX_VALUES)
+				return ERR_VORBIS_UNSUPPORTED;
+			f->x[f->values++] = BitsGet(bs, rangeBits);
+		}
+	}
+	if (BitsEOP(bs))
+		return ERR_VORBIS_BAD_HEADER;
+
+	/* Drawing order, and the neighbours each point is predicted from */
+	for (i = 0; i < f->values; i++) {
+		for (j = i; j > 0 && f->x[f->sorted[j - 1]] > f->x[i]; j--)
+			f->sorted[j] = f->sorted[j - 1];
+		f->sorted[j] = i;
+	}
+	for (i = 1; i < f->values; i++) {
+		if (f->x[f->sorted[i]] == f->x[f->sorted[i - 1]])
+			return ERR_VORBIS_BAD_HEADER;
+	}
+	for (i = 2; i < f->values; i++) {
+		int lo = 0, hi = 1;
+		for (k = 0; k < i; k++) {
+			if (f->x[k] < f->x[i] && f->x[k] > f->x[lo])
+				lo = k;
+			if (f->x[k] > f->x[i] && f->x[k] < f->x[hi])
+				hi = k;
+		}
+		f->lowNeighbour[i] = lo;
+		f->highNeighbour[i] = hi;
+	}
+	return ERR_VORBIS_NONE;
+}
+
+static int RenderPoint(int x0, int y0, int x1, int y1, int x)
+{
+	int dy = y1 - y0;
+	int err = (dy < 0 ? -dy : dy) * (x - x0);
+	int off = err / (x1 - x0);
+	return dy < 0 ? y0 - off : y0 + off;
+}
+
+/* Reads the Y values and works out the final ones (spec 7.2.4 step 1) */
+void Floor1Decode(VorbisDecInfo *vi, const VorbisFloor1 *f, VorbisBits *bs, VorbisFloorState *fs)
+{
+	int i, j, off, range, bits;
+
+	fs->unused = 1;
+	if (!BitsGet(bs, 1))
+		return;
+	range = floorRange[f->multiplier - 1];
+	bits = ilog(range - 1);
+	fs->y[0] = BitsGet(bs, bits);
+	fs->y[1] = BitsGet(bs, bits);
+	off = 2;
+	for (i = 0; i < f->partitions; i++) {
+		int cls = f->partitionClass[i];
+		int cbits = f->classSub[cls];
+		int csub = (1 << cbits) - 1;
+		int cval = 0;
+		if (cbits) {
+			cval = CodebookDecode(&vi->books[f->classMaster[cls]], bs);
+			if (cval < 0)
+				return;
+		}
+		for (j = 0; j < f->classDim[cls]; j++) {
+			int book = f->subBooks[cls][cval & csub];
+			cval >>= cbits;
+			if (book >= 0) {
+				int v = CodebookDecode(&vi->books[book], bs);
+				if (v < 0)
+					return;
+				fs->y[off + j] = v;
+			} else {
+				fs->y[off + j] = 0;
+			}
+		}
+		off += f->classDim[cls];
+	}
+	if (BitsEOP(bs))
+		return;
+	fs->unused = 0;
+
+	fs->step2[0] = 1;
+	fs->step2[1] = 1;
+	for (i = 2; i < f->values; i++) {
+		int lo = f->lowNeighbour[i];
+		int hi = f->highNeighbour[i];
+		int predicted = RenderPoint(f->x[lo], fs->y[lo], f->x[hi], fs->y[hi], f->x[i]);
+		int val = fs->y[i];
+		int highroom = range - predicted;
+		int lowroom = predicted;
+		int room = (highroom < lowroom ? highroom : lowroom) * 2;
+		if (val) {
+			fs->step2[lo] = 1;
+			fs->step2[hi] = 1;
+			fs->step2[i] = 1;
+			if (val >= room) {
+				if (highroom > lowroom)
+					fs->y[i] = val - lowroom + predicted;
+				else
+					fs->y[i] = predicted - val + highroom - 1;
+			} else if (val & 1) {
+				fs->y[i] = predicted - ((val + 1) >> 1);
+			} else {
+				fs->y[i] = predicted + (val >> 1);
+			}
+		} else {
+			fs->step2[i] = 0;
+			fs->y[i] = predicted;
+		}
+	}
+}
+
+static inline int32_t FloorMul(int32_t v, int y)
+{
+	if ((unsigned)y > 255)
+		y = y < 0 ? 0 : 255;
+	return (int32_t)(((int64_t)v * inverseDB[y]) >> FLOOR_SHIFT);
+}
+
+/* Multiplies v[x0, x1) by the line from (x0, y0) to (x1, y1), stepped as
+ * the spec draws it so the rounding matches the encoder's
+ */
+static void RenderLine(int x0, int y0, int x1, int y1, int32_t *v, int n)
+{
+	int dy = y1 - y0;
+	int adx = x1 - x0;
+	int ady = dy < 0 ? -dy : dy;
+	int base = dy / adx;
+	int sy = dy < 0 ? base - 1 : base + 1;
+	int x = x0, y = y0, err = 0;
+
+	if (x1 > n)
+		x1 = n;
+	if (x >= x1)
+		return;
+	ady -= (base < 0 ? -base : base) * adx;
+	v[x] = FloorMul(v[x], y);
+	for (x++; x < x1; x++) {
+		err += ady;
+		if (err >= adx) {
+			err -= adx;
+			y += sy;
+		} else {
+			y += base;
+		}
+		v[x] = FloorMul(v[x], y);
+	}
+}
+
+/* Curve synthesis (spec 7.2.4 step 2) straight onto the residue */
+void Floor1Apply(const VorbisFloor1 *f, const VorbisFloorState *fs, int32_t *spectrum, int n)
+{
+	int i, lx = 0, ly = fs->y[0] * f->multiplier;
+
+	for (i = 1; i < f->values; i++) {
+		int j = f->sorted[i];
+		if (fs->step2[j]) {
+			int hx = f->x[j];
+			int hy = fs->y[j] * f->multiplier;
+			RenderLine(lx, ly, hx, hy, spectrum, n);
+			lx = hx;
+			ly = hy;
+		}
+	}
+	if (lx < n)
+		RenderLine(lx, ly, n, ly, spectrum, n);
+}
@@ -0,0 +1,172 @@
+/*
+  vorbisdec
+  Fixed point inverse MDCT and window tables
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include "vorbis.h"
+
+#define MDCT_PI 3.14159265358979f
+
+static int32_t ToQ31(float v)
+{
+	if (v >= 1.0f)
+		return 0x7fffffff;
+	if (v <= -1.0f)
+		return -0x7fffffff;
+	return (int32_t)lrintf(v * 2147483648.0f);
+}
+
+/* The block sizes are only known from the stream, so the tables are made
+ * once per stream, in the arena.  This is the one place floats are used,
+ * the ESP32 does them in hardware.
+ */
+int MDCTSetup(VorbisDecInfo *vi)
+{
+	int b, i, n = vi->blockSize[1];
+
+	vi->sinTab = (int32_t *)ArenaAlloc(vi, (n / 4 + 1) * sizeof(int32_t));
+	if (!vi->sinTab)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	for (i = 0; i <= n / 4; i++)
+		vi->sinTab[i] = ToQ31(sinf(2 * MDCT_PI * i / n));
+
+	for (b = 0; b < 2; b++) {
+		n = vi->blockSize[b];
+		if (b && n == vi->blockSize[0]) {
+			vi->preTwiddle[1] = vi->preTwiddle[0];
+			vi->slope[1] = vi->slope[0];
+			break;
+		}
+		vi->preTwiddle[b] = (int32_t *)ArenaAlloc(vi, n / 2 * sizeof(int32_t));
+		vi->slope[b] = (int32_t *)ArenaAlloc(vi, n / 2 * sizeof(int32_t));
+		if (!vi->preTwiddle[b] || !vi->slope[b])
+			return ERR_VORBIS_OUT_OF_MEMORY;
+		for (i = 0; i < n / 4; i++) {
+			float a = 2 * MDCT_PI * (i + 0.25f) / n;
+			vi->preTwiddle[b][2 * i] = ToQ31(cosf(a));
+			vi->preTwiddle[b][2 * i + 1] = ToQ31(sinf(a));
+		}
+		for (i = 0; i < n / 2; i++) {
+			float s = sinf((i + 0.5f) / (n / 2) * MDCT_PI / 2);
+			vi->slope[b][i] = ToQ31(sinf(MDCT_PI / 2 * s * s));
+		}
+	}
+	return ERR_VORBIS_NONE;
+}
+
+/* cos and sin of 2 pi j / N for j in [0, N/2), from the quarter wave of the long block */
+static inline void Twiddle(const int32_t *sinTab, int quarter, int j, int32_t *c, int32_t *s)
+{
+	if (j <= quarter) {
+		*c = sinTab[quarter - j];
+		*s = sinTab[j];
+	} else {
+		*c = -sinTab[j - quarter];
+		*s = sinTab[2 * quarter - j];
+	}
+}
+
+/* In-place forward FFT of l complex Q24 values, radix 2 */
+static void FFT(int32_t *x, int l, const int32_t *sinTab, int quarter, int scale)
+{
+	int i, j, k, size, half;
+
+	for (i = 0, j = 0; i < l - 1; i++) {
+		if (i < j) {
+			int32_t t0 = x[2 * i], t1 = x[2 * i + 1];
+			x[2 * i] = x[2 * j];
+			x[2 * i + 1] = x[2 * j + 1];
+			x[2 * j] = t0;
+			x[2 * j + 1] = t1;
+		}
+		for (k = l >> 1; k <= j; k >>= 1)
+			j -= k;
+		j += k;
+	}
+
+	for (i = 0; i < l; i += 2) {
+		int32_t ar = x[2 * i], ai = x[2 * i + 1];
+		int32_t br = x[2 * i + 2], bi = x[2 * i + 3];
+		x[2 * i] = ar + br;
+		x[2 * i + 1] = ai + bi;
+		x[2 * i + 2] = ar - br;
+		x[2 * i + 3] = ai - bi;
+	}
+
+	for (size = 4; size <= l; size <<= 1) {
+		half = size >> 1;
+		for (k = 0; k < half; k++) {
+			int32_t wr, wi;
+			Twiddle(sinTab, quarter, k * (scale * (l / size) * 4), &wr, &wi);
+			for (i = k; i < l; i += size) {
+				int32_t *a = x + 2 * i;
+				int32_t *b = x + 2 * (i + half);
+				int32_t tr = MULT31(b[0], wr) + MULT31(b[1], wi);
+				int32_t ti = MULT31(b[1], wr) - MULT31(b[0], wi);
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+}
+
+/* DCT-IV of the blockSize/2 spectral lines in buf, in place, by an FFT a
+ * quarter of the block long.  The inverse MDCT output is this mirrored
+ * around the quarter points, the windowing reads it from there.
+ */
+void IMDCT(VorbisDecInfo *vi, int32_t *buf, int blockFlag)
+{
+	int n = vi->blockSize[blockFlag];
+	int m = n >> 1, l = n >> 2;
+	int quarter = vi->blockSize[1] >> 2;
+	int scale = vi->blockSize[1] / n;
+	const int32_t *tw = vi->preTwiddle[blockFlag];
+	int a;
+
+	/* Lines 2a and m-1-2a make complex a, times e^(-i pi (a + 1/4) / m).
+	 * Pairing a with l-1-a reads and writes the same four slots. */
+	for (a = 0; a < l / 2; a++) {
+		int b = l - 1 - a;
+		int32_t ar = buf[2 * a], ai = buf[m - 1 - 2 * a];
+		int32_t br = buf[2 * b], bi = buf[m - 1 - 2 * b];
+		int32_t c = tw[2 * a], s = tw[2 * a + 1];
+		buf[2 * a] = MULT31(ar, c) + MULT31(ai, s);
+		buf[2 * a + 1] = MULT31(ai, c) - MULT31(ar, s);
+		c = tw[2 * b];
+		s = tw[2 * b + 1];
+		buf[2 * b] = MULT31(br, c) + MULT31(bi, s);
+		buf[2 * b + 1] = MULT31(bi, c) - MULT31(br, s);
+	}
+
+	FFT(buf, l, vi->sinTab, quarter, scale);
+
+	/* Times e^(-i pi a / m), real parts to the even lines, imaginary to the odd from the top */
+	for (a = 0; a < l / 2; a++) {
+		int b = l - 1 - a;
+		int32_t ar = buf[2 * a], ai = buf[2 * a + 1];
+		int32_t br = buf[2 * b], bi = buf[2 * b + 1];
+		int32_t c, s;
+		Twiddle(vi->sinTab, quarter, a * scale, &c, &s);
+		buf[2 * a] = MULT31(ar, c) + MULT31(ai, s);
+		buf[m - 1 - 2 * a] = MULT31(ar, s) - MULT31(ai, c);
+		Twiddle(vi->sinTab, quarter, b * scale, &c, &s);
+		buf[2 * b] = MULT31(br, c) + MULT31(bi, s);
+		buf[m - 1 - 2 * b] = MULT31(br, s) - MULT31(bi, c);
+	}
+}
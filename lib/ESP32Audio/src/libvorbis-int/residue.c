@@ -0,0 +1,181 @@
+/*
+  vorbisdec
+  Residue types 0, 1 and 2, the VQ coded fine structure of the spectrum
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vorbis.h"
+
+#define MAX_VQ_DIM	64
+
+int ResidueSetup(VorbisDecInfo *vi, VorbisResidue *r, VorbisBits *bs)
+{
+	uint8_t cascade[64];
+	int i, j;
+
+	r->begin = BitsGet(bs, 24);
+	r->end = BitsGet(bs, 24);
+	r->partSize = BitsGet(bs, 24) + 1;
+	r->classifications = BitsGet(bs, 6) + 1;
+	r->classbook = BitsGet(bs, 8);
+	if (r->classbook >= vi->numBooks)
+		return ERR_VORBIS_BAD_HEADER;
+	for (i = 0; i < r->classifications; i++) {
+		int low = BitsGet(bs, 3);
+		int high = BitsGet(bs, 1) ? BitsGet(bs, 5) : 0;
+		cascade[i] = high * 8 + low;
+	}
+	r->books = (int16_t (*)[8])ArenaAlloc(vi, r->classifications * sizeof(*r->books));
+	if (!r->books)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	for (i = 0; i < r->classifications; i++) {
+		for (j = 0; j < 8; j++) {
+			r->books[i][j] = -1;
+			if (cascade[i] & (1 << j)) {
+				int b = BitsGet(bs, 8);
+				const VorbisCodebook *book;
+				if (b >= vi->numBooks)
+					return ERR_VORBIS_BAD_HEADER;
+				book = &vi->books[b];
+				if (!book->lookupType)
+					return ERR_VORBIS_BAD_HEADER;
+				/* Partitions are read in whole vectors, the spec lets a
+				 * stray one spill into the next which nobody relies on */
+				if (book->dimensions > MAX_VQ_DIM || r->partSize % book->dimensions)
+					return ERR_VORBIS_UNSUPPORTED;
+				r->books[i][j] = b;
+			}
+		}
+	}
+	return BitsEOP(bs) ? ERR_VORBIS_BAD_HEADER : ERR_VORBIS_NONE;
+}
+
+/* Bytes of classifications a packet can need, per vector */
+int ResidueWorkSize(const VorbisResidue *r, const VorbisCodebook *books, int channels, int maxN)
+{
+	uint32_t size = (r->type == 2) ? maxN * channels : maxN;
+	uint32_t begin = r->begin < size ? r->begin : size;
+	uint32_t end = r->end < size ? r->end : size;
+	return (end - begin) / r->partSize + books[r->classbook].dimensions;
+}
+
+/* Type 2 runs over the channels interleaved, vector element p belongs to
+ * channel p % ch.  Decoded a vector at a time and dealt out.
+ */
+static int DecodeInterleaved(const VorbisCodebook *book, VorbisBits *bs, int32_t **v, int ch, uint32_t p, int len)
+{
+	int32_t tmp[MAX_VQ_DIM];
+	int c = p % ch;
+	uint32_t idx = p / ch;
+	int i, k;
+
+	for (i = 0; i < len; i += book->dimensions) {
+		memset(tmp, 0, book->dimensions * sizeof(int32_t));
+		if (CodebookDecodeAdd(book, bs, tmp, 1) < 0)
+			return -1;
+		for (k = 0; k < book->dimensions; k++) {
+			v[c][idx] += tmp[k];
+			if (++c == ch) {
+				c = 0;
+				idx++;
+			}
+		}
+	}
+	return 0;
+}
+
+static int DecodePartition(const VorbisResidue *r, const VorbisCodebook *book, VorbisBits *bs, int32_t *v, uint32_t offset)
+{
+	int i, len = r->partSize;
+
+	if (r->type == 0) {
+		int step = len / book->dimensions;
+		for (i = 0; i < step; i++) {
+			if (CodebookDecodeAdd(book, bs, v + offset + i, step) < 0)
+				return -1;
+		}
+	} else {
+		for (i = 0; i < len; i += book->dimensions) {
+			if (CodebookDecodeAdd(book, bs, v + offset + i, 1) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/* Adds the residue of the ch channels of a submap into vectors[], n lines
+ * each.  Stops quietly at the end of the packet, what was read stays.
+ */
+void ResidueDecode(VorbisDecInfo *vi, const VorbisResidue *r, VorbisBits *bs, int32_t **vectors, const uint8_t *doNotDecode, int ch, int n)
+{
+	const VorbisCodebook *classbook = &vi->books[r->classbook];
+	int cpc = classbook->dimensions;
+	int vecs = (r->type == 2) ? 1 : ch;
+	uint32_t size = (r->type == 2) ? (uint32_t)n * ch : (uint32_t)n;
+	uint32_t begin = r->begin < size ? r->begin : size;
+	uint32_t end = r->end < size ? r->end : size;
+	int parts = (end - begin) / r->partSize;
+	int stride = parts + cpc;
+	uint8_t *cls = vi->classWork;
+	uint8_t skip[VORBIS_MAX_NCHANS];
+	int pass, pc, i, j;
+
+	if (!parts)
+		return;
+	if (r->type == 2) {
+		/* One vector, decoded unless every channel in it is silent */
+		skip[0] = 1;
+		for (j = 0; j < ch; j++)
+			skip[0] &= doNotDecode[j];
+	} else {
+		memcpy(skip, doNotDecode, ch);
+	}
+
+	for (pass = 0; pass < 8; pass++) {
+		for (pc = 0; pc < parts; ) {
+			if (!pass) {
+				for (j = 0; j < vecs; j++) {
+					int temp;
+					if (skip[j])
+						continue;
+					temp = CodebookDecode(classbook, bs);
+					if (temp < 0 || BitsEOP(bs))
+						return;
+					for (i = cpc - 1; i >= 0; i--) {
+						cls[j * stride + pc + i] = temp % r->classifications;
+						temp /= r->classifications;
+					}
+				}
+			}
+			for (i = 0; i < cpc && pc < parts; i++, pc++) {
+				uint32_t offset = begin + pc * r->partSize;
+				for (j = 0; j < vecs; j++) {
+					int b;
+					if (skip[j])
+						continue;
+					b = r->books[cls[j * stride + pc]][pass];
+					if (b < 0)
+						continue;
+					if (r->type == 2) {
+						if (DecodeInterleaved(&vi->books[b], bs, vectors, ch, offset, r->partSize) < 0)
+							return;
+					} else if (DecodePartition(r, &vi->books[b], bs, vectors[j], offset) < 0) {
+						return;
+					}
+				}
+			}
+		}
+	}
+}
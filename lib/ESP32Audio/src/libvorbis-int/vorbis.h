@@ -0,0 +1,282 @@
+/*
+  vorbisdec
+  Integer-only Ogg Vorbis I audio decoder, internal definitions
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _VORBIS_H
+#define _VORBIS_H
+
+#include <stdint.h>
+#include <string.h>
+#include "vorbisdec.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <pgmspace.h>
+#else
+#define PROGMEM
+#endif
+
+// The floor lookup is read for every spectral line, keep it in internal RAM
+// on the ESP32 unless built with AUDIO_TABLES_IN_FLASH
+#if defined(ESP32) && !defined(AUDIO_TABLES_IN_FLASH)
+  #include <esp_attr.h>
+  #define HOT_TABLE DRAM_ATTR
+#else
+  #define HOT_TABLE PROGMEM
+#endif
+
+#pragma GCC optimize ("O3")
+
+/* Fixed point formats.  Spectral lines, the transform and the PCM before
+ * the final shift are Q24, so a full scale sample is 1 << 24 and there are
+ * 7 bits of headroom.  Codebook values are Q(VQ_FRACBITS), the floor curve
+ * and the trig tables Q31.
+ */
+#define PCM_FRACBITS		24
+#define VQ_FRACBITS			12
+#define FLOOR_SHIFT			(31 + VQ_FRACBITS - PCM_FRACBITS)
+
+#define MAX_BLOCKSIZE_LOG	13		/* 8192, the largest the spec allows */
+#define MIN_BLOCKSIZE_LOG	6
+#define FAST_BITS			8		/* Codewords up to this long take one table lookup */
+#define FLOOR1_MAX_VALUES	65
+#define MAX_SUBMAPS			16
+
+static inline int32_t MULT32(int32_t x, int32_t y)
+{
+	return (int32_t)(((int64_t)x * y) >> 32);
+}
+
+static inline int32_t MULT31(int32_t x, int32_t y)
+{
+	return MULT32(x, y) << 1;
+}
+
+static inline int ilog(uint32_t v)
+{
+	int n = 0;
+	while (v) {
+		n++;
+		v >>= 1;
+	}
+	return n;
+}
+
+/* Bit reader, Vorbis packs from the least significant bit of each byte.
+ * Reading past the end gives zeros and leaves left negative, which is how
+ * the spec's end-of-packet condition shows up.
+ */
+typedef struct _VorbisBits {
+	const unsigned char *ptr;
+	const unsigned char *end;
+	uint32_t cache;		/* Next bits, the first in bit 0, zero above avail */
+	int avail;
+	int left;			/* Bits of the packet not read yet */
+} VorbisBits;
+
+static inline void BitsInit(VorbisBits *bs, const unsigned char *buf, int len)
+{
+	bs->ptr = buf;
+	bs->end = buf + len;
+	bs->cache = 0;
+	bs->avail = 0;
+	bs->left = len * 8;
+}
+
+static inline void BitsFill(VorbisBits *bs)
+{
+	while (bs->avail <= 24) {
+		if (bs->ptr < bs->end)
+			bs->cache |= (uint32_t)*bs->ptr++ << bs->avail;
+		bs->avail += 8;
+	}
+}
+
+/* Up to 24 bits */
+static inline uint32_t BitsPeek(VorbisBits *bs, int n)
+{
+	BitsFill(bs);
+	return bs->cache & ((1U << n) - 1);
+}
+
+static inline void BitsSkip(VorbisBits *bs, int n)
+{
+	bs->cache >>= n;
+	bs->avail -= n;
+	bs->left -= n;
+}
+
+static inline uint32_t BitsGet(VorbisBits *bs, int n)
+{
+	uint32_t v;
+	if (n > 24) {
+		v = BitsPeek(bs, 16);
+		BitsSkip(bs, 16);
+		return v | (BitsGet(bs, n - 16) << 16);
+	}
+	v = BitsPeek(bs, n);
+	BitsSkip(bs, n);
+	return v;
+}
+
+static inline int BitsEOP(VorbisBits *bs)
+{
+	return bs->left < 0;
+}
+
+typedef struct _VorbisCodebook {
+	int dimensions;
+	int entries;
+	uint8_t *lengths;		/* Codeword length of each entry, 0 when unused */
+	uint16_t *fast;			/* Entry for the next fastBits bits, 0xffff for longer codes */
+	int fastBits;
+	uint32_t *longCodes;	/* Codewords longer than fastBits, MSB aligned and sorted */
+	uint16_t *longEntries;
+	int numLong;
+	int maxLen;
+
+	int lookupType;			/* 0 scalar only, 1 lattice, 2 one vector per entry */
+	int lookupValues;
+	int sequenceP;
+	int32_t *values;		/* Q(VQ_FRACBITS), multiplicand * delta + minimum */
+} VorbisCodebook;
+
+typedef struct _VorbisFloor1 {
+	int partitions;
+	uint8_t partitionClass[31];
+	uint8_t classDim[16];
+	uint8_t classSub[16];
+	int16_t classMaster[16];
+	int16_t subBooks[16][8];
+	int multiplier;
+	int values;
+	uint16_t x[FLOOR1_MAX_VALUES];
+	uint8_t sorted[FLOOR1_MAX_VALUES];	/* Indices of x in increasing order */
+	uint8_t lowNeighbour[FLOOR1_MAX_VALUES];
+	uint8_t highNeighbour[FLOOR1_MAX_VALUES];
+} VorbisFloor1;
+
+typedef struct _VorbisResidue {
+	int type;
+	uint32_t begin;
+	uint32_t end;
+	uint32_t partSize;
+	int classifications;
+	int classbook;
+	int16_t (*books)[8];	/* [classifications][pass], -1 unused */
+} VorbisResidue;
+
+typedef struct _VorbisMapping {
+	int submaps;
+	int couplingSteps;
+	uint8_t *magnitude;
+	uint8_t *angle;
+	uint8_t mux[VORBIS_MAX_NCHANS];
+	uint8_t floor[MAX_SUBMAPS];
+	uint8_t residue[MAX_SUBMAPS];
+} VorbisMapping;
+
+typedef struct _VorbisMode {
+	uint8_t blockFlag;
+	uint8_t mapping;
+} VorbisMode;
+
+/* Floor 1 as decoded from the packet, the curve is drawn after the residue */
+typedef struct _VorbisFloorState {
+	int unused;
+	int16_t y[FLOOR1_MAX_VALUES];
+	uint8_t step2[FLOOR1_MAX_VALUES];
+} VorbisFloorState;
+
+typedef struct _VorbisDecInfo {
+	/* Memory handed over at init, state and arena */
+	unsigned char *arena;
+	int arenaSize;
+	int arenaUsed;
+	int ownsMemory;
+
+	int headers;			/* Bit n set once header type 2n+1 was taken */
+
+	/* Identification header */
+	int channels;
+	int sampleRate;
+	int bitRateNominal;
+	int blockSize[2];
+
+	/* Setup header */
+	int numBooks;
+	VorbisCodebook *books;
+	int numFloors;
+	VorbisFloor1 **floors;
+	int numResidues;
+	VorbisResidue *residues;
+	int numMappings;
+	VorbisMapping *mappings;
+	int numModes;
+	int modeBits;
+	VorbisMode modes[64];
+
+	/* Transform and window tables, for the long size and where needed the short */
+	int32_t *sinTab;		/* sin(2 pi i / blockSize[1]) for i up to a quarter turn */
+	int32_t *preTwiddle[2];
+	int32_t *slope[2];		/* Rising half of each window */
+
+	/* Per channel */
+	int32_t *spectrum[VORBIS_MAX_NCHANS];	/* Residue, then spectral lines, then the transform output */
+	int32_t *overlap[VORBIS_MAX_NCHANS];	/* Windowed right half of the last block */
+	VorbisFloorState floorState[VORBIS_MAX_NCHANS];
+	uint8_t *classWork;		/* Residue classifications of a packet */
+	int classWorkSize;
+	short *pcm;
+
+	int prevBlockSize;		/* 0 before the first block of a run */
+} VorbisDecInfo;
+
+/* vorbisdec.c */
+void *ArenaAlloc(VorbisDecInfo *vi, int bytes);
+
+/* codebook.c */
+int CodebookSetup(VorbisDecInfo *vi, VorbisCodebook *book, VorbisBits *bs);
+int CodebookDecodeSlow(const VorbisCodebook *book, VorbisBits *bs);
+int CodebookDecodeAdd(const VorbisCodebook *book, VorbisBits *bs, int32_t *dst, int stride);
+
+/* floor1.c */
+int Floor1Setup(VorbisDecInfo *vi, VorbisFloor1 *f, VorbisBits *bs);
+void Floor1Decode(VorbisDecInfo *vi, const VorbisFloor1 *f, VorbisBits *bs, VorbisFloorState *fs);
+void Floor1Apply(const VorbisFloor1 *f, const VorbisFloorState *fs, int32_t *spectrum, int n);
+
+/* residue.c */
+int ResidueSetup(VorbisDecInfo *vi, VorbisResidue *r, VorbisBits *bs);
+int ResidueWorkSize(const VorbisResidue *r, const VorbisCodebook *books, int channels, int maxN);
+void ResidueDecode(VorbisDecInfo *vi, const VorbisResidue *r, VorbisBits *bs, int32_t **vectors, const uint8_t *doNotDecode, int ch, int n);
+
+/* mdct.c */
+int MDCTSetup(VorbisDecInfo *vi);
+void IMDCT(VorbisDecInfo *vi, int32_t *buf, int blockFlag);
+
+/* Scalar context, the entry number or -1 for no valid codeword */
+static inline int CodebookDecode(const VorbisCodebook *book, VorbisBits *bs)
+{
+	int e = book->fast[BitsPeek(bs, book->fastBits)];
+	if (e != 0xffff) {
+		BitsSkip(bs, book->lengths[e]);
+		return e;
+	}
+	return CodebookDecodeSlow(book, bs);
+}
+
+#endif	/* _VORBIS_H */
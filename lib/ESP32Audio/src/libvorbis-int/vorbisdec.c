@@ -0,0 +1,500 @@
+/*
+  vorbisdec
+  Headers, audio packet decoding, windowing and the public C API
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include "vorbis.h"
+
+#define HEADER_SIZE	((sizeof(VorbisDecInfo) + 7) & ~7)
+
+void *ArenaAlloc(VorbisDecInfo *vi, int bytes)
+{
+	void *p;
+	bytes = (bytes + 3) & ~3;
+	if (bytes < 0 || vi->arenaSize - vi->arenaUsed < bytes)
+		return NULL;
+	p = vi->arena + vi->arenaUsed;
+	vi->arenaUsed += bytes;
+	return p;
+}
+
+HVorbisDecoder VorbisInitDecoderPre(void *ptr, int sz)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)ptr;
+	if (!ptr || ((uintptr_t)ptr & 3) || sz < (int)HEADER_SIZE)
+		return NULL;
+	memset(vi, 0, sizeof(VorbisDecInfo));
+	vi->arena = (unsigned char *)ptr + HEADER_SIZE;
+	vi->arenaSize = sz - HEADER_SIZE;
+	return (HVorbisDecoder)vi;
+}
+
+HVorbisDecoder VorbisInitDecoder(void)
+{
+	void *p = malloc(VORBIS_DEFAULT_SPACE);
+	VorbisDecInfo *vi = (VorbisDecInfo *)VorbisInitDecoderPre(p, VORBIS_DEFAULT_SPACE);
+	if (!vi) {
+		free(p);
+		return NULL;
+	}
+	vi->ownsMemory = 1;
+	return (HVorbisDecoder)vi;
+}
+
+void VorbisFreeDecoder(HVorbisDecoder hVorbisDecoder)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)hVorbisDecoder;
+	if (vi && vi->ownsMemory)
+		free(vi);
+}
+
+void VorbisReset(HVorbisDecoder hVorbisDecoder)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)hVorbisDecoder;
+	unsigned char *arena;
+	int arenaSize, ownsMemory;
+	if (!vi)
+		return;
+	arena = vi->arena;
+	arenaSize = vi->arenaSize;
+	ownsMemory = vi->ownsMemory;
+	memset(vi, 0, sizeof(VorbisDecInfo));
+	vi->arena = arena;
+	vi->arenaSize = arenaSize;
+	vi->ownsMemory = ownsMemory;
+}
+
+void VorbisRestart(HVorbisDecoder hVorbisDecoder)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)hVorbisDecoder;
+	if (vi)
+		vi->prevBlockSize = 0;
+}
+
+int VorbisHeadersDone(HVorbisDecoder hVorbisDecoder)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)hVorbisDecoder;
+	return vi && vi->headers == 7;
+}
+
+void VorbisGetInfo(HVorbisDecoder hVorbisDecoder, VorbisInfo *vorbisInfo)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)hVorbisDecoder;
+	if (!vi || !vorbisInfo)
+		return;
+	vorbisInfo->nChans = vi->channels;
+	vorbisInfo->sampRate = vi->sampleRate;
+	vorbisInfo->bitRateNominal = vi->bitRateNominal;
+	vorbisInfo->blockSize[0] = vi->blockSize[0];
+	vorbisInfo->blockSize[1] = vi->blockSize[1];
+	vorbisInfo->maxOutSamps = vi->blockSize[1] / 2;
+	vorbisInfo->spaceUsed = HEADER_SIZE + vi->arenaUsed;
+}
+
+static int ParseIdentification(VorbisDecInfo *vi, VorbisBits *bs)
+{
+	int b0, b1;
+	int32_t nominal;
+
+	if (BitsGet(bs, 32) != 0)
+		return ERR_VORBIS_BAD_HEADER;
+	vi->channels = BitsGet(bs, 8);
+	vi->sampleRate = BitsGet(bs, 32);
+	BitsGet(bs, 32);
+	nominal = (int32_t)BitsGet(bs, 32);
+	BitsGet(bs, 32);
+	b0 = BitsGet(bs, 4);
+	b1 = BitsGet(bs, 4);
+	if (!BitsGet(bs, 1) || BitsEOP(bs))
+		return ERR_VORBIS_BAD_HEADER;
+	if (!vi->channels || vi->sampleRate <= 0 || b0 < MIN_BLOCKSIZE_LOG || b0 > b1 || b1 > MAX_BLOCKSIZE_LOG)
+		return ERR_VORBIS_BAD_HEADER;
+	if (vi->channels > VORBIS_MAX_NCHANS)
+		return ERR_VORBIS_UNSUPPORTED;
+	vi->bitRateNominal = nominal > 0 ? nominal : 0;
+	vi->blockSize[0] = 1 << b0;
+	vi->blockSize[1] = 1 << b1;
+	return ERR_VORBIS_NONE;
+}
+
+static int ParseMapping(VorbisDecInfo *vi, VorbisMapping *m, VorbisBits *bs)
+{
+	int i, ch = vi->channels, bits = ilog(vi->channels - 1);
+
+	if (BitsGet(bs, 16) != 0)
+		return ERR_VORBIS_BAD_HEADER;
+	m->submaps = BitsGet(bs, 1) ? BitsGet(bs, 4) + 1 : 1;
+	m->couplingSteps = 0;
+	if (BitsGet(bs, 1)) {
+		m->couplingSteps = BitsGet(bs, 8) + 1;
+		m->magnitude = (uint8_t *)ArenaAlloc(vi, m->couplingSteps);
+		m->angle = (uint8_t *)ArenaAlloc(vi, m->couplingSteps);
+		if (!m->magnitude || !m->angle)
+			return ERR_VORBIS_OUT_OF_MEMORY;
+		for (i = 0; i < m->couplingSteps; i++) {
+			m->magnitude[i] = BitsGet(bs, bits);
+			m->angle[i] = BitsGet(bs, bits);
+			if (m->magnitude[i] == m->angle[i] || m->magnitude[i] >= ch || m->angle[i] >= ch)
+				return ERR_VORBIS_BAD_HEADER;
+		}
+	}
+	if (BitsGet(bs, 2) != 0)
+		return ERR_VORBIS_BAD_HEADER;
+	for (i = 0; i < ch; i++) {
+		m->mux[i] = 0;
+		if (m->submaps > 1) {
+			m->mux[i] = BitsGet(bs, 4);
+			if (m->mux[i] >= m->submaps)
+				return ERR_VORBIS_BAD_HEADER;
+		}
+	}
+	for (i = 0; i < m->submaps; i++) {
+		BitsGet(bs, 8);
+		m->floor[i] = BitsGet(bs, 8);
+		m->residue[i] = BitsGet(bs, 8);
+		if (m->floor[i] >= vi->numFloors || m->residue[i] >= vi->numResidues)
+			return ERR_VORBIS_BAD_HEADER;
+	}
+	return ERR_VORBIS_NONE;
+}
+
+/* Buffers whose size only the setup decides */
+static int AllocRuntime(VorbisDecInfo *vi)
+{
+	int i, half = vi->blockSize[1] / 2;
+	int err = MDCTSetup(vi);
+	if (err)
+		return err;
+
+	vi->classWorkSize = 0;
+	for (i = 0; i < vi->numResidues; i++) {
+		const VorbisResidue *r = &vi->residues[i];
+		int sz = ResidueWorkSize(r, vi->books, vi->channels, half) * (r->type == 2 ? 1 : vi->channels);
+		if (sz > vi->classWorkSize)
+			vi->classWorkSize = sz;
+	}
+	vi->classWork = (uint8_t *)ArenaAlloc(vi, vi->classWorkSize);
+	vi->pcm = (short *)ArenaAlloc(vi, half * vi->channels * sizeof(short));
+	if (!vi->classWork || !vi->pcm)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	for (i = 0; i < vi->channels; i++) {
+		vi->spectrum[i] = (int32_t *)ArenaAlloc(vi, half * sizeof(int32_t));
+		vi->overlap[i] = (int32_t *)ArenaAlloc(vi, half * sizeof(int32_t));
+		if (!vi->spectrum[i] || !vi->overlap[i])
+			return ERR_VORBIS_OUT_OF_MEMORY;
+	}
+	return ERR_VORBIS_NONE;
+}
+
+static int ParseSetup(VorbisDecInfo *vi, VorbisBits *bs)
+{
+	int i, n, type, err;
+
+	vi->numBooks = BitsGet(bs, 8) + 1;
+	vi->books = (VorbisCodebook *)ArenaAlloc(vi, vi->numBooks * sizeof(VorbisCodebook));
+	if (!vi->books)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	for (i = 0; i < vi->numBooks; i++) {
+		err = CodebookSetup(vi, &vi->books[i], bs);
+		if (err)
+			return err;
+	}
+
+	/* Time domain transforms, placeholders that must be zero */
+	n = BitsGet(bs, 6) + 1;
+	for (i = 0; i < n; i++) {
+		if (BitsGet(bs, 16) != 0)
+			return ERR_VORBIS_BAD_HEADER;
+	}
+
+	vi->numFloors = BitsGet(bs, 6) + 1;
+	vi->floors = (VorbisFloor1 **)ArenaAlloc(vi, vi->numFloors * sizeof(VorbisFloor1 *));
+	if (!vi->floors)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	for (i = 0; i < vi->numFloors; i++) {
+		type = BitsGet(bs, 16);
+		if (type == 0)
+			return ERR_VORBIS_UNSUPPORTED;	/* LSP floor, no encoder has made it since 2001 */
+		if (type != 1)
+			return ERR_VORBIS_BAD_HEADER;
+		vi->floors[i] = (VorbisFloor1 *)ArenaAlloc(vi, sizeof(VorbisFloor1));
+		if (!vi->floors[i])
+			return ERR_VORBIS_OUT_OF_MEMORY;
+		err = Floor1Setup(vi, vi->floors[i], bs);
+		if (err)
+			return err;
+	}
+
+	vi->numResidues = BitsGet(bs, 6) + 1;
+	vi->residues = (VorbisResidue *)ArenaAlloc(vi, vi->numResidues * sizeof(VorbisResidue));
+	if (!vi->residues)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	for (i = 0; i < vi->numResidues; i++) {
+		vi->residues[i].type = BitsGet(bs, 16);
+		if (vi->residues[i].type > 2)
+			return ERR_VORBIS_BAD_HEADER;
+		err = ResidueSetup(vi, &vi->residues[i], bs);
+		if (err)
+			return err;
+	}
+
+	vi->numMappings = BitsGet(bs, 6) + 1;
+	vi->mappings = (VorbisMapping *)ArenaAlloc(vi, vi->numMappings * sizeof(VorbisMapping));
+	if (!vi->mappings)
+		return ERR_VORBIS_OUT_OF_MEMORY;
+	for (i = 0; i < vi->numMappings; i++) {
+		err = ParseMapping(vi, &vi->mappings[i], bs);
+		if (err)
+			return err;
+	}
+
+	vi->numModes = BitsGet(bs, 6) + 1;
+	for (i = 0; i < vi->numModes; i++) {
+		vi->modes[i].blockFlag = BitsGet(bs, 1);
+		if (BitsGet(bs, 16) != 0 || BitsGet(bs, 16) != 0)
+			return ERR_VORBIS_BAD_HEADER;
+		vi->modes[i].mapping = BitsGet(bs, 8);
+		if (vi->modes[i].mapping >= vi->numMappings)
+			return ERR_VORBIS_BAD_HEADER;
+	}
+	vi->modeBits = ilog(vi->numModes - 1);
+	if (!BitsGet(bs, 1) || BitsEOP(bs))
+		return ERR_VORBIS_BAD_HEADER;
+
+	return AllocRuntime(vi);
+}
+
+int VorbisDecodeHeader(HVorbisDecoder hVorbisDecoder, const unsigned char *packet, int len)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)hVorbisDecoder;
+	VorbisBits bs;
+	int err;
+
+	if (!vi || !packet)
+		return ERR_VORBIS_NULL_POINTER;
+	if (len < 7 || !(packet[0] & 1) || memcmp(packet + 1, "vorbis", 6))
+		return ERR_VORBIS_NOT_VORBIS;
+	BitsInit(&bs, packet + 7, len - 7);
+
+	switch (packet[0]) {
+	case 1:
+		/* Starts a stream, whatever came before */
+		VorbisReset(vi);
+		err = ParseIdentification(vi, &bs);
+		if (err)
+			return err;
+		vi->headers = 1;
+		return ERR_VORBIS_NONE;
+	case 3:
+		if (vi->headers != 1)
+			return ERR_VORBIS_BAD_HEADER;
+		vi->headers |= 2;
+		return ERR_VORBIS_NONE;
+	case 5:
+		/* A comment header with cover art may have been too big to keep */
+		if (!(vi->headers & 1) || (vi->headers & 4))
+			return ERR_VORBIS_BAD_HEADER;
+		err = ParseSetup(vi, &bs);
+		if (err) {
+			/* Leave nothing half set up, the identification stays */
+			vi->arenaUsed = 0;
+			return err;
+		}
+		vi->headers = 7;
+		return ERR_VORBIS_NONE;
+	}
+	return ERR_VORBIS_NOT_VORBIS;
+}
+
+/* Sample i of the inverse MDCT of an n block, from the DCT-IV in v */
+static inline int32_t MDCTOut(const int32_t *v, int i, int n)
+{
+	int n4 = n >> 2;
+	if (i < n4)
+		return v[n4 + i];
+	if (i < 3 * n4)
+		return -v[3 * n4 - 1 - i];
+	return -v[i - 3 * n4];
+}
+
+static inline short ClipToShort(int32_t s)
+{
+	s = (s + (1 << (PCM_FRACBITS - 16))) >> (PCM_FRACBITS - 15);
+	if (s > 32767)
+		return 32767;
+	if (s < -32768)
+		return -32768;
+	return (short)s;
+}
+
+/* Windows the block and adds its left half to what the last one left.  The
+ * samples between the two block centres are done (spec 4.3.8), the right
+ * half is kept for the next block.
+ */
+static int OverlapAdd(VorbisDecInfo *vi, int blockFlag, int prevWindow, int nextWindow)
+{
+	int n = vi->blockSize[blockFlag];
+	int pn = vi->prevBlockSize;
+	int n2 = n >> 1, n4 = n >> 2;
+	int short2 = vi->blockSize[0] >> 1, short4 = vi->blockSize[0] >> 2;
+	int leftN = n2, leftStart = 0;
+	int rightN = n2, rightStart = n2;
+	int nOut = pn ? (pn >> 2) + n4 : 0;
+	const int32_t *left, *right;
+	int ch, j;
+
+	/* A long block next to a short one uses the short slope, centred on its quarter */
+	if (blockFlag && !prevWindow) {
+		leftN = short2;
+		leftStart = n4 - short4;
+	}
+	if (blockFlag && !nextWindow) {
+		rightN = short2;
+		rightStart = 3 * n4 - short4;
+	}
+	left = vi->slope[leftN == short2 ? 0 : 1];
+	right = vi->slope[rightN == short2 ? 0 : 1];
+
+	for (ch = 0; ch < vi->channels; ch++) {
+		const int32_t *v = vi->spectrum[ch];
+		int32_t *ov = vi->overlap[ch];
+		short *out = vi->pcm + ch;
+		int shift = n4 - (pn >> 2);
+
+		for (j = 0; j < nOut; j++) {
+			int32_t s = (j < (pn >> 1)) ? ov[j] : 0;
+			int i = j + shift;
+			if (i >= leftStart) {
+				int32_t y = MDCTOut(v, i, n);
+				if (i < leftStart + leftN)
+					y = MULT31(y, left[i - leftStart]);
+				s += y;
+			}
+			out[j * vi->channels] = ClipToShort(s);
+		}
+
+		for (j = 0; j < n2; j++) {
+			int i = n2 + j;
+			if (i < rightStart)
+				ov[j] = MDCTOut(v, i, n);
+			else if (i < rightStart + rightN)
+				ov[j] = MULT31(MDCTOut(v, i, n), right[rightN - 1 - (i - rightStart)]);
+			else
+				ov[j] = 0;
+		}
+	}
+	vi->prevBlockSize = n;
+	return nOut;
+}
+
+int VorbisDecode(HVorbisDecoder hVorbisDecoder, const unsigned char *packet, int len, short **pcm)
+{
+	VorbisDecInfo *vi = (VorbisDecInfo *)hVorbisDecoder;
+	VorbisBits bs;
+	const VorbisMapping *map;
+	uint8_t noResidue[VORBIS_MAX_NCHANS];
+	int32_t *vectors[VORBIS_MAX_NCHANS];
+	uint8_t doNotDecode[VORBIS_MAX_NCHANS];
+	int mode, blockFlag, prevWindow = 0, nextWindow = 0;
+	int n2, ch, i, j, s, k;
+
+	if (!vi || !pcm)
+		return ERR_VORBIS_NULL_POINTER;
+	*pcm = vi->pcm;
+	if (vi->headers != 7)
+		return ERR_VORBIS_NO_HEADERS;
+	if (!len)
+		return 0;
+
+	BitsInit(&bs, packet, len);
+	if (BitsGet(&bs, 1) != 0)
+		return ERR_VORBIS_BAD_PACKET;
+	mode = BitsGet(&bs, vi->modeBits);
+	if (mode >= vi->numModes)
+		return ERR_VORBIS_BAD_PACKET;
+	blockFlag = vi->modes[mode].blockFlag;
+	if (blockFlag) {
+		prevWindow = BitsGet(&bs, 1);
+		nextWindow = BitsGet(&bs, 1);
+	}
+	if (BitsEOP(&bs))
+		return ERR_VORBIS_BAD_PACKET;
+	map = &vi->mappings[vi->modes[mode].mapping];
+	n2 = vi->blockSize[blockFlag] >> 1;
+
+	for (ch = 0; ch < vi->channels; ch++) {
+		const VorbisFloor1 *f = vi->floors[map->floor[map->mux[ch]]];
+		Floor1Decode(vi, f, &bs, &vi->floorState[ch]);
+		noResidue[ch] = vi->floorState[ch].unused;
+		memset(vi->spectrum[ch], 0, n2 * sizeof(int32_t));
+	}
+
+	/* A coupled pair is decoded if either half has a floor */
+	for (i = 0; i < map->couplingSteps; i++) {
+		if (!noResidue[map->magnitude[i]] || !noResidue[map->angle[i]]) {
+			noResidue[map->magnitude[i]] = 0;
+			noResidue[map->angle[i]] = 0;
+		}
+	}
+
+	for (s = 0; s < map->submaps; s++) {
+		k = 0;
+		for (ch = 0; ch < vi->channels; ch++) {
+			if (map->mux[ch] == s) {
+				vectors[k] = vi->spectrum[ch];
+				doNotDecode[k] = noResidue[ch];
+				k++;
+			}
+		}
+		ResidueDecode(vi, &vi->residues[map->residue[s]], &bs, vectors, doNotDecode, k, n2);
+	}
+
+	/* Square polar mapping back to the channels */
+	for (i = map->couplingSteps - 1; i >= 0; i--) {
+		int32_t *mag = vi->spectrum[map->magnitude[i]];
+		int32_t *ang = vi->spectrum[map->angle[i]];
+		for (j = 0; j < n2; j++) {
+			int32_t m = mag[j], a = ang[j];
+			if (m > 0) {
+				if (a > 0) {
+					ang[j] = m - a;
+				} else {
+					ang[j] = m;
+					mag[j] = m + a;
+				}
+			} else {
+				if (a > 0) {
+					ang[j] = m + a;
+				} else {
+					ang[j] = m;
+					mag[j] = m - a;
+				}
+			}
+		}
+	}
+
+	for (ch = 0; ch < vi->channels; ch++) {
+		if (vi->floorState[ch].unused) {
+			memset(vi->spectrum[ch], 0, n2 * sizeof(int32_t));
+			continue;
+		}
+		Floor1Apply(vi->floors[map->floor[map->mux[ch]]], &vi->floorState[ch], vi->spectrum[ch], n2);
+		IMDCT(vi, vi->spectrum[ch], blockFlag);
+	}
+
+	return OverlapAdd(vi, blockFlag, prevWindow, nextWindow);
+}
@@ -0,0 +1,88 @@
+/*
+  vorbisdec
+  Integer-only Ogg Vorbis I audio decoder, public interface
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _VORBISDEC_H
+#define _VORBISDEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VORBIS_MAX_NCHANS
+#define VORBIS_MAX_NCHANS		2		/* streams with more channels are refused */
+#endif
+
+/* Everything the decoder needs lives in one block: its state first, then
+ * what the setup header asks for (codebooks, floors, residues, transform
+ * tables, channel buffers).  A 44.1 kHz stereo stream from libvorbis needs
+ * 75-85 KB whatever its quality, mono at low rates 35-60 KB.
+ */
+#define VORBIS_DEFAULT_SPACE	(96 * 1024)
+
+enum {
+	ERR_VORBIS_NONE                 =   0,
+	ERR_VORBIS_NULL_POINTER         =  -1,
+	ERR_VORBIS_NOT_VORBIS           =  -2,	/* not a Vorbis header packet */
+	ERR_VORBIS_BAD_HEADER           =  -3,
+	ERR_VORBIS_UNSUPPORTED          =  -4,	/* valid, but floor 0, too many channels, ... */
+	ERR_VORBIS_OUT_OF_MEMORY        =  -5,	/* the setup doesn't fit the decoder's space */
+	ERR_VORBIS_NO_HEADERS           =  -6,	/* audio before the three headers */
+	ERR_VORBIS_BAD_PACKET           =  -7,
+
+	ERR_VORBIS_UNKNOWN              = -9999
+};
+
+typedef struct _VorbisInfo {
+	int nChans;
+	int sampRate;
+	int bitRateNominal;		/* 0 when the encoder didn't say */
+	int blockSize[2];
+	int maxOutSamps;		/* Per channel, the most one packet can return */
+	int spaceUsed;			/* Bytes of the decoder's block taken so far */
+} VorbisInfo;
+
+typedef void *HVorbisDecoder;
+
+/* public C API */
+HVorbisDecoder VorbisInitDecoder(void);
+HVorbisDecoder VorbisInitDecoderPre(void *ptr, int sz);
+void VorbisFreeDecoder(HVorbisDecoder hVorbisDecoder);
+
+/* The identification, comment and setup headers, in that order.  Returns
+ * ERR_VORBIS_NONE for each one taken, VorbisHeadersDone() says when the
+ * setup is in.  The comment header is only checked, not kept, and may be
+ * left out.
+ */
+int VorbisDecodeHeader(HVorbisDecoder hVorbisDecoder, const unsigned char *packet, int len);
+int VorbisHeadersDone(HVorbisDecoder hVorbisDecoder);
+
+/* One audio packet.  Returns the samples per channel now in *pcm (the first
+ * packet after the headers or a restart returns none), or a negative error.
+ * pcm points into the decoder and is interleaved, valid until the next call.
+ */
+int VorbisDecode(HVorbisDecoder hVorbisDecoder, const unsigned char *packet, int len, short **pcm);
+
+void VorbisGetInfo(HVorbisDecoder hVorbisDecoder, VorbisInfo *vorbisInfo);
+void VorbisRestart(HVorbisDecoder hVorbisDecoder);	/* Discontinuity, keeps the headers */
+void VorbisReset(HVorbisDecoder hVorbisDecoder);	/* New stream, headers expected again */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _VORBISDEC_H */
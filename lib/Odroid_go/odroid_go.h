@@ -29,9 +29,20 @@
 
 #include "AudioFileSourceSD.h"
 #include "AudioFileSourceICYStream.h"
+#include "AudioFileSourceTee.h"
+#include "AudioMetadataQueue.h"
+#include "AudioMemory.h"
 #include "AudioFileSourceBuffer.h"
+#include "AudioFileSourceRingBuffer.h"
+#include "AudioBufferPolicy.h"
 #include "AudioGeneratorMP3.h"
+#include "AudioGeneratorVorbis.h"
 #include "AudioOutputI2S.h"
+#include "AudioOutputResample.h"
+#include "AudioOutputEQ.h"
+#include "AudioOutputMixer.h"
+#include "AudioOutputSpectrum.h"
+#include "AudioSfxPlayer.h"
 
 #define My_SD SD
 
@@ -46,6 +46,7 @@ void FlappyBirdClass::game_loop()
                 if (bird.y > BIRDH2 * 0.5)
                 {
                     bird.vel_y = -JUMP_FORCE;
+                    sfx->play(sfxFlap);
                 }
                 // else zero velocity
                 else
@@ -151,6 +152,7 @@ void FlappyBirdClass::game_loop()
         // if the bird hit the ground game over
         if (bird.y > GAMEH - BIRDH)
         {
+            sfx->play(sfxHit);
             break;
         }
         // checking for bird collision with pipe
@@ -159,6 +161,7 @@ void FlappyBirdClass::game_loop()
             // bird entered a pipe, check for collision
             if (bird.y < pipes.gap_y || bird.y + BIRDH > pipes.gap_y + GAPHEIGHT)
             {
+                sfx->play(sfxHit);
                 break;
             }
             else
@@ -177,6 +180,8 @@ void FlappyBirdClass::game_loop()
             GO.Lcd.setTextColor(WHITE);
             // increase flappy_bird_score since we successfully passed a pipe
             flappy_bird_score++;
+            // every 10th pipe rings a bit higher
+            sfx->play(sfxPoint, 1.0f, (flappy_bird_score % 10) ? 1.0f : 1.5f);
         }
         // update flappy_bird_score
         // ---------------
@@ -300,10 +305,41 @@ void FlappyBirdClass::Run()
 
 FlappyBirdClass::FlappyBirdClass()
 {
+    preferences.begin("Volume", false);
+    float volume = preferences.getFloat("vol", 15.0f) / 195.7f;
+    preferences.end();
+    // two DMA buffers keep the sound close to the button press
+    out = new AudioOutputI2S(0, AudioOutputI2S::INTERNAL_DAC, 2);
+    out->SetOutputModeMono(true);
+    out->SetGain(volume);
+    // The effects are inputs of the mixer, the ones they leave free can play music
+    mixer = new AudioOutputMixer(256, out);
+    sfx = new AudioSfxPlayer(mixer);
+    // WAV files on the SD card replace the built in tones
+    sfxFlap = sfx->LoadWAV(My_SD, "/sfx/flappy_flap.wav");
+    if (sfxFlap < 0)
+    {
+        sfxFlap = sfx->AddTone(300, 900, 70);
+    }
+    sfxPoint = sfx->LoadWAV(My_SD, "/sfx/flappy_point.wav");
+    if (sfxPoint < 0)
+    {
+        sfxPoint = sfx->AddTone(1320, 1760, 120);
+    }
+    sfxHit = sfx->LoadWAV(My_SD, "/sfx/flappy_hit.wav");
+    if (sfxHit < 0)
+    {
+        sfxHit = sfx->AddTone(1500, 100, 300, true);
+    }
+    sfx->begin();
 }
 
 FlappyBirdClass::~FlappyBirdClass()
 {
+    delete sfx;
+    mixer->stop();
+    delete mixer;
+    delete out;
     GO.Lcd.fillScreen(0);
     GO.Lcd.setTextSize(1);
 	GO.Lcd.setTextFont(1);
@@ -88,6 +88,11 @@ class FlappyBirdClass
     int flappy_bird_score;
     // temporary x and y var
     short tmpx, tmpy;
+    // sound effects
+    AudioOutputI2S *out;
+    AudioOutputMixer *mixer;
+    AudioSfxPlayer *sfx;
+    int sfxFlap, sfxPoint, sfxHit;
 
     void game_over();
     void resetMaxflappy_bird_score();
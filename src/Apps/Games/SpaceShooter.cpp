@@ -174,6 +174,7 @@ void SpaceShooterClass::levelUp()
   }
   alien_shooter_score += 50;
   alien_shooter_scoreInc += 5;
+  sfx->play(sfxLevel);
   changeShipX = 0;
   changeShipY = 0;
   for (unsigned long i = millis(); millis() - i <= 1600;)
@@ -290,6 +291,7 @@ void SpaceShooterClass::fireDaLazer()
     fFireX[bulletNo] = shipX + 13;
     fFireY[bulletNo] = shipY - 4;
     GO.Lcd.fillRect(fFireX[bulletNo], fFireY[bulletNo], 4, 3, MAGENTA);
+    sfx->play(sfxLazer, 0.6f);
   }
   fire = false;
 }
@@ -498,9 +500,12 @@ void SpaceShooterClass::spaceShoot_run()
           alienLiveCount -= 1;
           alienLive[i] = false;
           alien_shooter_score += alien_shooter_scoreInc;
+          // the fewer aliens left, the higher they squeak
+          sfx->play(sfxAlien, 1.0f, 1.0f + alienLiveCount / 17.0f);
         }
         if (onPlayer(i) || exceedBoundary(i))
         {
+          sfx->play(sfxSplode);
           return;
         }
       }
@@ -533,10 +538,46 @@ void SpaceShooterClass::Run()
 
 SpaceShooterClass::SpaceShooterClass()
 {
+  preferences.begin("Volume", false);
+  float volume = preferences.getFloat("vol", 15.0f) / 195.7f;
+  preferences.end();
+  // two DMA buffers keep the sound close to the button press
+  out = new AudioOutputI2S(0, AudioOutputI2S::INTERNAL_DAC, 2);
+  out->SetOutputModeMono(true);
+  out->SetGain(volume);
+  // The effects are inputs of the mixer, the ones they leave free can play music
+  mixer = new AudioOutputMixer(256, out);
+  sfx = new AudioSfxPlayer(mixer);
+  // WAV files on the SD card replace the built in tones
+  sfxLazer = sfx->LoadWAV(My_SD, "/sfx/shooter_lazer.wav");
+  if (sfxLazer < 0)
+  {
+    sfxLazer = sfx->AddTone(2400, 600, 90);
+  }
+  sfxAlien = sfx->LoadWAV(My_SD, "/sfx/shooter_alien.wav");
+  if (sfxAlien < 0)
+  {
+    sfxAlien = sfx->AddTone(3000, 400, 150, true);
+  }
+  sfxSplode = sfx->LoadWAV(My_SD, "/sfx/shooter_splode.wav");
+  if (sfxSplode < 0)
+  {
+    sfxSplode = sfx->AddTone(800, 40, 700, true);
+  }
+  sfxLevel = sfx->LoadWAV(My_SD, "/sfx/shooter_level.wav");
+  if (sfxLevel < 0)
+  {
+    sfxLevel = sfx->AddTone(440, 1760, 600);
+  }
+  sfx->begin();
 }
 
 SpaceShooterClass::~SpaceShooterClass()
 {
+  delete sfx;
+  mixer->stop();
+  delete mixer;
+  delete out;
   GO.Lcd.fillScreen(0);
   GO.Lcd.setTextSize(1);
   GO.Lcd.setTextFont(1);
@@ -55,6 +55,14 @@ class SpaceShooterClass
     int aFireY[5];
     bool aFireAge[5];
     int chanceOfFire;
+    //--------------------------Sound---------------------------------
+    AudioOutputI2S *out;
+    AudioOutputMixer *mixer;
+    AudioSfxPlayer *sfx;
+    int sfxLazer;
+    int sfxAlien;
+    int sfxSplode;
+    int sfxLevel;
     //================================ bitmaps ========================
     //your starship
     const int shipImgW = 14;
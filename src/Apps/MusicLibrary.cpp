@@ -0,0 +1,145 @@
+#include "MusicLibrary.h"
+
+String MusicLibraryClass::label(unsigned int sorted)
+{
+    const MusicIndexClass::MusicTrack &t = library.track(sorted, order);
+    String s;
+    if (order == MusicIndexClass::BY_ARTIST)
+    {
+        s = String(library.str(t.artist)) + " - " + library.str(t.title);
+    }
+    else if (order == MusicIndexClass::BY_ALBUM)
+    {
+        s = String(library.str(t.album)) + " - " + library.str(t.title);
+    }
+    else
+    {
+        s = library.str(t.title);
+    }
+    if (s.length() > LIST_MAX_LABEL_SIZE)
+    {
+        s.remove(LIST_MAX_LABEL_SIZE);
+    }
+    return s;
+}
+
+// Same layout as GO.showList(), but only the page on screen is built, straight from the sorted view
+void MusicLibraryClass::drawList()
+{
+    static const char *const captions[] = {"BY ARTIST", "BY ALBUM", "BY TITLE"};
+    GO.windowClr();
+    GO.Lcd.drawCentreString(captions[order], GO.Lcd.width() / 2, 45, 2);
+    unsigned int first = selected - selected % LIST_PAGE_LABELS;
+    for (unsigned int i = first; i < library.count() && i < first + LIST_PAGE_LABELS; i++)
+    {
+        int y = 80 + (i - first) * 20;
+        if (i == selected)
+        {
+            GO.Lcd.drawString(">", 3, y, 2);
+        }
+        GO.Lcd.drawString(label(i), 15, y, 2);
+    }
+}
+
+void MusicLibraryClass::drawProgress()
+{
+    unsigned long now = millis();
+    if (now - lastProgress >= 500)
+    {
+        GO.Lcd.setTextColor(WHITE, BLACK);
+        GO.Lcd.drawCentreString("Indexing: " + String(library.scanned()) + " files", 160, 220, 1);
+        lastProgress = now;
+    }
+}
+
+void MusicLibraryClass::Run()
+{
+    // The saved index makes the list available at once, the rescan only catches up with changes
+    library.load();
+    drawList();
+    library.beginScan();
+
+    while (!GO.BtnB.wasPressed())
+    {
+        if (library.scanning())
+        {
+            if (!library.scanStep())
+            {
+                GO.Lcd.fillRect(0, 220, 320, 8, BLACK);
+                if (library.changed())
+                {
+                    if (selected >= library.count())
+                    {
+                        selected = 0;
+                    }
+                    drawList();
+                }
+            }
+            else
+            {
+                drawProgress();
+            }
+        }
+        if (GO.JOY_Y.wasAxisPressed() == 1 && library.count())
+        {
+            selected = (selected + 1) % library.count();
+            drawList();
+        }
+        if (GO.JOY_Y.wasAxisPressed() == 2 && library.count())
+        {
+            selected = (selected + library.count() - 1) % library.count();
+            drawList();
+        }
+        if (GO.JOY_X.wasAxisPressed() && !library.scanning())
+        {
+            order = (MusicIndexClass::SortOrder)((order + (GO.JOY_X.wasAxisPressed() == 1 ? 2 : 1)) % 3);
+            selected = 0;
+            drawList();
+        }
+        if (GO.BtnA.wasPressed() && library.count())
+        {
+            // The scan holds a directory open per level, the player needs those
+            // file handles for the track, the next one and its index
+            bool rescan = library.scanning();
+            if (rescan)
+            {
+                library.abortScan();
+                GO.Lcd.fillRect(0, 220, 320, 8, BLACK);
+            }
+            {
+                // Play the current view from the selected track on, MP3 only, other formats play on their own
+                String path = library.str(library.track(selected, order).path);
+                path.toLowerCase();
+                Mp3PlayerClass Mp3PlayerObj;
+                if (path.endsWith(".mp3"))
+                {
+                    MusicLibraryPlaylist playlist(library, order);
+                    Mp3PlayerObj.Play(playlist, selected);
+                }
+                else
+                {
+                    path = library.str(library.track(selected, order).path);
+                    Mp3PlayerObj.PlayFile(&path);
+                }
+            }
+            GO.drawAppMenu(F("MUSIC LIBRARY"), F("EXIT"), F("PLAY"), F("SORT"));
+            drawList();
+            if (rescan)
+            {
+                library.beginScan();
+            }
+        }
+        GO.update();
+    }
+}
+
+MusicLibraryClass::MusicLibraryClass()
+{
+    GO.update();
+    GO.drawAppMenu(F("MUSIC LIBRARY"), F("EXIT"), F("PLAY"), F("SORT"));
+}
+
+MusicLibraryClass::~MusicLibraryClass()
+{
+    GO.show();
+}
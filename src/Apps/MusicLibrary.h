@@ -0,0 +1,36 @@
+#pragma once
+#include "odroid_go.h"
+#include "Tools/Mp3Player.h"
+#include "Tools/MusicIndex.h"
+
+// One sort order of the index as a playlist, paths are read from the index as the player gets to them
+class MusicLibraryPlaylist : public Mp3Playlist
+{
+  public:
+    MusicLibraryPlaylist(MusicIndexClass &library, MusicIndexClass::SortOrder order) : library(library), order(order) {}
+    unsigned int size() override { return library.count(); }
+    String path(unsigned int track) override { return library.str(library.track(track, order).path); }
+
+  private:
+    MusicIndexClass &library;
+    MusicIndexClass::SortOrder order;
+};
+
+class MusicLibraryClass
+{
+  public:
+    MusicLibraryClass();
+    ~MusicLibraryClass();
+
+    void Run();
+
+  private:
+    MusicIndexClass library;
+    MusicIndexClass::SortOrder order = MusicIndexClass::BY_ARTIST;
+    unsigned int selected = 0;
+    unsigned long lastProgress = 0;
+
+    String label(unsigned int sorted);
+    void drawList();
+    void drawProgress();
+};
@@ -71,6 +71,56 @@ void SdBrowserClass::aSortFiles()
     } while (swapped);
 }
 
+// Every .mp3 in the same folder as the selected file, in browser order
+unsigned int SdBrowserClass::folderPlaylist(String fileName, std::vector<String> &playlist)
+{
+    unsigned int start = 0;
+    String dir = fileName.substring(0, fileName.lastIndexOf('/') + 1);
+    for (int i = 0; i < appsCount; i++)
+    {
+        String name = fileVector[i].fileName;
+        if (name.endsWith(".mp3") && name.startsWith(dir) && name.indexOf('/', dir.length()) < 0)
+        {
+            if (name == fileName)
+            {
+                start = playlist.size();
+            }
+            playlist.push_back(name);
+        }
+    }
+    return start;
+}
+
+// Plain or extended M3U, relative entries are taken from the playlist's folder
+void SdBrowserClass::m3uPlaylist(fs::FS &fs, String fileName, std::vector<String> &playlist)
+{
+    File m3u = fs.open(fileName);
+    if (!m3u)
+    {
+        return;
+    }
+    String dir = fileName.substring(0, fileName.lastIndexOf('/') + 1);
+    while (m3u.available())
+    {
+        String line = m3u.readStringUntil('\n');
+        line.trim();
+        line.replace("\\", "/");
+        if (line.length() == 0 || line.startsWith("#"))
+        {
+            continue;
+        }
+        if (!line.startsWith("/"))
+        {
+            line = dir + line;
+        }
+        if (line.endsWith(".mp3") || line.endsWith(".MP3"))
+        {
+            playlist.push_back(line);
+        }
+    }
+    m3u.close();
+}
+
 void SdBrowserClass::buildMyMenu()
 {
     GO.clearList();
@@ -141,9 +191,26 @@ void SdBrowserClass::Run()
                 GO.btnRestore();
             }
             else if (FileName.endsWith(".mp3"))
+            {
+                std::vector<String> playlist;
+                unsigned int track = folderPlaylist(FileName, playlist);
+                Mp3PlayerClass Mp3PlayerObj;
+                Mp3PlayerObj.Play(playlist, track);
+            }
+            else if (FileName.endsWith(".m3u"))
+            {
+                std::vector<String> playlist;
+                m3uPlaylist(My_SD, FileName, playlist);
+                if (playlist.size())
+                {
+                    Mp3PlayerClass Mp3PlayerObj;
+                    Mp3PlayerObj.Play(playlist, 0);
+                }
+            }
+            else if (FileName.endsWith(".wav") || FileName.endsWith(".m4a") || FileName.endsWith(".aac") || FileName.endsWith(".ogg"))
             {
                 Mp3PlayerClass Mp3PlayerObj;
-                Mp3PlayerObj.Play(&FileName);
+                Mp3PlayerObj.PlayFile(&FileName);
             }
             else if (FileName.endsWith(".mov"))
             {
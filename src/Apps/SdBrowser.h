@@ -29,4 +29,6 @@ class SdBrowserClass
     void listDir(fs::FS &fs, String dirName, int levels);
     void aSortFiles();
     void buildMyMenu();
+    unsigned int folderPlaylist(String fileName, std::vector<String> &playlist);
+    void m3uPlaylist(fs::FS &fs, String fileName, std::vector<String> &playlist);
 };
\ No newline at end of file
@@ -13,57 +13,69 @@ void Mp3PlayerClass::setVolume(int *v)
     out->SetGain(volume);
 }
 
-void Mp3PlayerClass::drawSpectrum(int a, int b, int c, int d, int e, int f, int g)
-{
-    aH = ((a * height) / 100);
-    aY = ys + (height - aH);
-    GO.Lcd.fillRect(xs, ys, widthS, height, 0);
-    GO.Lcd.fillRect(xs, aY, widthS, aH, LIGHTGREY); //0xe8e4
-
-    bH = ((b * height) / 100);
-    bY = ys + (height - bH);
-    bX = xs + widthS + padding;
-    GO.Lcd.fillRect(bX, ys, widthS, height, 0);
-    GO.Lcd.fillRect(bX, bY, widthS, bH, LIGHTGREY); //0xff80
-
-    cH = ((c * height) / 100);
-    cY = ys + (height - cH);
-    cX = bX + widthS + padding;
-    GO.Lcd.fillRect(cX, ys, widthS, height, 0);
-    GO.Lcd.fillRect(cX, cY, widthS, cH, LIGHTGREY); //0x2589
-
-    dH = ((d * height) / 100);
-    dY = ys + (height - dH);
-    dX = cX + widthS + padding;
-    GO.Lcd.fillRect(dX, ys, widthS, height, 0);
-    GO.Lcd.fillRect(dX, dY, widthS, dH, LIGHTGREY); //0x051d
-
-    eH = ((e * height) / 100);
-    eY = ys + (height - eH);
-    eX = dX + widthS + padding;
-    GO.Lcd.fillRect(eX, ys, widthS, height, 0);
-    GO.Lcd.fillRect(eX, eY, widthS, eH, LIGHTGREY); //0x051d
-
-    fH = ((f * height) / 100);
-    fY = ys + (height - fH);
-    fX = eX + widthS + padding;
-    GO.Lcd.fillRect(fX, ys, widthS, height, 0);
-    GO.Lcd.fillRect(fX, fY, widthS, fH, LIGHTGREY); //0x051d
-
-    gH = ((g * height) / 100);
-    gY = ys + (height - gH);
-    gX = fX + widthS + padding;
-    GO.Lcd.fillRect(gX, ys, widthS, height, 0);
-    GO.Lcd.fillRect(gX, gY, widthS, gH, LIGHTGREY); //0x051d
+void Mp3PlayerClass::updateVolume()
+{
+    if ((GO.JOY_Y.wasAxisPressed() == 1) && GO.vol > 0)
+    {
+        GO.vol -= 5;
+        setVolume(&GO.vol);
+    }
+    if ((GO.JOY_Y.wasAxisPressed() == 2) && GO.vol < 100)
+    {
+        GO.vol += 5;
+        setVolume(&GO.vol);
+    }
+    if (GO.vol != GO.old_vol)
+    {
+        GO.Lcd.setTextColor(ORANGE);
+        GO.Lcd.fillRect(120, 190, 80, 14, BLACK);
+        GO.Lcd.drawCentreString("Volume: " + String(GO.vol), 158, 190, 2);
+        GO.Lcd.setTextColor(WHITE);
+        GO.old_vol = GO.vol;
+    }
+}
+
+void Mp3PlayerClass::drawSpectrum()
+{
+    for (int i = 0; i < AudioOutputSpectrum::SPECTRUM_BANDS; i++)
+    {
+        int bX = xs + i * (widthS + padding);
+        int h = (levels[i] * height) / 100;
+        int pY = ys + height - 1 - ((peaks[i] * (height - 1)) / 100);
+        if (h == barH[i] && pY == peakY[i])
+        {
+            continue;
+        }
+        // Only the strip between the old and the new height is repainted
+        if (h > barH[i])
+        {
+            GO.Lcd.fillRect(bX, ys + height - h, widthS, h - barH[i], LIGHTGREY);
+        }
+        else if (h < barH[i])
+        {
+            GO.Lcd.fillRect(bX, ys + height - barH[i], widthS, barH[i] - h, 0);
+        }
+        if (pY != peakY[i] && peakY[i] < ys + height - h)
+        {
+            GO.Lcd.drawFastHLine(bX, peakY[i], widthS, 0);
+        }
+        if (pY < ys + height - h)
+        {
+            GO.Lcd.drawFastHLine(bX, pY, widthS, ORANGE);
+        }
+        barH[i] = h;
+        peakY[i] = pY;
+    }
 }
 
 void Mp3PlayerClass::genSpectrum()
 {
     currentMillis = millis();
-    if (currentMillis - genSpectrum_previousMillis > 100)
+    if (currentMillis - genSpectrum_previousMillis > 50)
     {
         genSpectrum_previousMillis = currentMillis;
-        drawSpectrum(random(0, 101), random(0, 101), random(0, 101), random(0, 101), random(0, 101), random(0, 101), random(0, 101));
+        spectrum->GetBands(levels, peaks);
+        drawSpectrum();
     }
 }
 
@@ -78,82 +90,363 @@ void Mp3PlayerClass::drawTimeline()
         drawTimeline_previousMillis = currentMillis;
         GO.Lcd.fillRect(x, yClear + 2, wClear, heightMark, 0);
         GO.Lcd.fillRect(x, y, width, heightLine, 31727);
-        size_ = file->getSize();
-        pos_ = file->getPos();
-        xPos = x + ((pos_ * (width - (widthMark / 2))) / size_);
+        size_ = mp3 ? mp3->getDurationMs() : 0;
+        pos_ = mp3 ? mp3->getPositionMs() : 0;
+        if (size_ <= 0)
+        {
+            // Length unknown, fall back to the byte position
+            size_ = file->getSize();
+            pos_ = file->getPos();
+        }
+        if (pos_ > size_)
+        {
+            pos_ = size_;
+        }
+        xPos = x + (int)(((int64_t)pos_ * (width - (widthMark / 2))) / (size_ ? size_ : 1));
         GO.Lcd.fillRect(xPos, yClear + 2, widthMark, heightMark, 59620);
-        GO.Lcd.setTextColor(BLACK);
-        GO.Lcd.drawNumber((oldpos_), width + 50, y - 7, 2);
-        GO.Lcd.setTextColor(WHITE);
-        GO.Lcd.drawNumber((pos_), width + 50, y - 7, 2);
-        oldpos_ = pos_;
+        String time = mp3 ? formatTime(mp3->getPositionMs()) + " / " + formatTime(mp3->getDurationMs()) : "";
+        if (time != oldTime_)
+        {
+            GO.Lcd.setTextColor(BLACK);
+            GO.Lcd.drawCentreString(oldTime_, 158, 156, 2);
+            GO.Lcd.setTextColor(WHITE);
+            GO.Lcd.drawCentreString(time, 158, 156, 2);
+            oldTime_ = time;
+        }
     }
 }
 
-void Mp3PlayerClass::Play(String *fileName)
+String Mp3PlayerClass::formatTime(uint32_t ms)
 {
-    GO.windowClr();
+    char buf[12];
+    uint32_t s = ms / 1000;
+    snprintf(buf, sizeof(buf), "%02u:%02u", (unsigned int)(s / 60), (unsigned int)(s % 60));
+    return String(buf);
+}
+
+// The seek index is cached next to the track as <file>.idx: magic, stride, file size, count, offsets
+void Mp3PlayerClass::loadIndex(String *fileName, AudioFileSourceSD *src, AudioGeneratorMP3 *gen)
+{
+    File idx = My_SD.open(*fileName + ".idx");
+    if (!idx)
+    {
+        return;
+    }
+    uint32_t hdr[4];
+    if (idx.read((uint8_t *)hdr, sizeof(hdr)) == sizeof(hdr) && hdr[0] == indexMagic && hdr[1] == AudioGeneratorMP3::INDEX_STRIDE &&
+        hdr[2] == src->getSize() && hdr[3] < (src->getSize() / 32))
+    {
+        uint32_t *entries = (uint32_t *)malloc(hdr[3] * sizeof(uint32_t));
+        if (entries && idx.read((uint8_t *)entries, hdr[3] * sizeof(uint32_t)) == hdr[3] * sizeof(uint32_t))
+        {
+            gen->setFrameIndex(entries, hdr[3]);
+        }
+        free(entries);
+    }
+    idx.close();
+}
+
+void Mp3PlayerClass::saveIndex(String *fileName, AudioFileSourceSD *src, AudioGeneratorMP3 *gen)
+{
+    const uint32_t *entries;
+    uint32_t count = gen->getFrameIndex(&entries);
+    if (count < 2)
+    {
+        return;
+    }
+    String idxName = *fileName + ".idx";
+    File idx = My_SD.open(idxName);
+    if (idx)
+    {
+        // Only rewrite it when this play got further than the cached copy
+        uint32_t hdr[4];
+        bool better = idx.read((uint8_t *)hdr, sizeof(hdr)) != sizeof(hdr) || hdr[0] != indexMagic || hdr[2] != src->getSize() || hdr[3] < count;
+        idx.close();
+        if (!better)
+        {
+            return;
+        }
+    }
+    idx = My_SD.open(idxName, FILE_WRITE);
+    if (!idx)
+    {
+        return;
+    }
+    uint32_t hdr[4] = {indexMagic, AudioGeneratorMP3::INDEX_STRIDE, src->getSize(), count};
+    idx.write((const uint8_t *)hdr, sizeof(hdr));
+    idx.write((const uint8_t *)entries, count * sizeof(uint32_t));
+    idx.close();
+}
+
+// Decodes on until the output has faded to silence, so stopping or seeking doesn't click
+void Mp3PlayerClass::fadeOut(AudioGenerator *gen)
+{
+    out->FadeOut();
+    unsigned long start = millis();
+    while (!out->isFadedOut() && gen->isRunning() && gen->loop() && (millis() - start < 250))
+    {
+    }
+}
+
+void Mp3PlayerClass::drawTitle(String *fileName)
+{
+    GO.Lcd.fillRect(0, 140, 320, 16, BLACK);
     GO.Lcd.setTextColor(CYAN);
     GO.Lcd.drawCentreString(*fileName, 158, 140, 2);
     GO.Lcd.setTextColor(WHITE);
+}
+
+bool Mp3PlayerClass::openTrack(String *fileName, AudioFileSourceSD **src, AudioGeneratorMP3 **gen)
+{
+    // Playlists can hold other formats, those only play on their own through PlayFile()
+    String lower = *fileName;
+    lower.toLowerCase();
+    if (!lower.endsWith(".mp3"))
+    {
+        return false;
+    }
+    *src = new AudioFileSourceSD((*fileName).c_str());
+    *gen = new AudioGeneratorMP3();
+    // The speaker is mono, mixing before the synthesis sounds the same for half the work
+    (*gen)->SetDecodeMode(AudioGeneratorMP3::DECODE_DOWNMIX);
+    // All tracks share one output, the I2S driver stays installed for the whole playlist
+    if ((*src)->isOpen() && (*gen)->begin(*src, spectrum))
+    {
+        loadIndex(fileName, *src, *gen);
+        if ((*gen)->prime())
+        {
+            return true;
+        }
+    }
+    if ((*gen)->isRunning())
+    {
+        (*gen)->release();
+    }
+    else
+    {
+        (*src)->close();
+    }
+    delete *gen;
+    delete *src;
+    *gen = NULL;
+    *src = NULL;
+    return false;
+}
+
+class VectorPlaylist : public Mp3Playlist
+{
+  public:
+    VectorPlaylist(std::vector<String> &paths) : paths(paths) {}
+    unsigned int size() override { return paths.size(); }
+    String path(unsigned int track) override { return paths[track]; }
+
+  private:
+    std::vector<String> &paths;
+};
+
+void Mp3PlayerClass::Play(String *fileName)
+{
+    std::vector<String> playlist;
+    playlist.push_back(*fileName);
+    Play(playlist, 0);
+}
+
+void Mp3PlayerClass::Play(std::vector<String> &playlist, unsigned int track)
+{
+    VectorPlaylist paths(playlist);
+    Play(paths, track);
+}
+
+void Mp3PlayerClass::Play(Mp3Playlist &playlist, unsigned int track)
+{
+    GO.windowClr();
+    for (int i = 0; i < AudioOutputSpectrum::SPECTRUM_BANDS; i++)
+    {
+        barH[i] = 0;
+        peakY[i] = ys + height - 1;
+    }
+    nextIndex = track;
     getvolume();
-    file = new AudioFileSourceSD((*fileName).c_str());
     out = new AudioOutputI2S(0, 1);
-    mp3 = new AudioGeneratorMP3();
+    resample = new AudioOutputResample(out);
+    spectrum = new AudioOutputSpectrum(resample);
     out->SetOutputModeMono(true);
-    mp3->begin(file, out);
+    // Only the paths of the playing and the preopened track are held
+    String trackPath, nextPath;
+    while (track < playlist.size() && !openTrack(&(trackPath = playlist.path(track)), &file, &mp3))
+    {
+        track++;
+    }
+    if (mp3)
+    {
+        drawTitle(&trackPath);
+    }
     setVolume(&GO.vol);
     GO.old_vol = GO.vol;
     GO.Lcd.setTextColor(ORANGE);
     GO.Lcd.drawCentreString("Volume: " + String(GO.vol), 158, 190, 2);
     GO.Lcd.setTextColor(WHITE);
 
-    while (!GO.BtnB.wasPressed())
+    while (mp3 && !GO.BtnB.wasPressed())
     {
-        if (mp3->isRunning())
+        // Open and prime the next track while this one still has about a second
+        // to play, or now if it already ended in a fade or a seek
+        if (nextIndex <= track && (!mp3->isRunning() || file->getSize() - file->getPos() < preopenBytes))
         {
-            if (!mp3->loop())
+            unsigned int nextTrack = track + 1;
+            while (nextTrack < playlist.size() && !openTrack(&(nextPath = playlist.path(nextTrack)), &nextFile, &nextMp3))
             {
-                mp3->stop();
-                break;
+                nextTrack++;
             }
-            genSpectrum();
-            drawTimeline();
-        }
-        if ((GO.JOY_Y.wasAxisPressed() == 1) && GO.vol > 0)
-        {
-            GO.vol -= 5;
-            setVolume(&GO.vol);
+            nextIndex = nextTrack;
         }
-        if ((GO.JOY_Y.wasAxisPressed() == 2) && GO.vol < 100)
+        if (!mp3->isRunning() || !mp3->loop())
         {
-            GO.vol += 5;
-            setVolume(&GO.vol);
+            // Hand over without stopping the output, so the DMA never drains between tracks
+            AudioGeneratorMP3 *doneMp3 = mp3;
+            AudioFileSourceSD *doneFile = file;
+            String donePath = trackPath;
+            mp3 = nextMp3;
+            file = nextFile;
+            track = nextIndex;
+            trackPath = nextPath;
+            nextMp3 = NULL;
+            nextFile = NULL;
+            if (mp3)
+            {
+                mp3->loop();
+            }
+            saveIndex(&donePath, doneFile, doneMp3);
+            doneMp3->release();
+            delete doneMp3;
+            delete doneFile;
+            if (!mp3)
+            {
+                break;
+            }
+            drawTitle(&trackPath);
         }
-        if (GO.vol != GO.old_vol)
+        genSpectrum();
+        drawTimeline();
+        if (mp3->isRunning() && GO.JOY_X.wasAxisPressed())
         {
-            GO.Lcd.setTextColor(ORANGE);
-            GO.Lcd.fillRect(120, 190, 80, 14, BLACK);
-            GO.Lcd.drawCentreString("Volume: " + String(GO.vol), 158, 190, 2);
-            GO.Lcd.setTextColor(WHITE);
-            GO.old_vol = GO.vol;
+            // Scrub in 10 second steps
+            int pos = mp3->getPositionMs();
+            pos += (GO.JOY_X.wasAxisPressed() == 1) ? -seekStepMs : seekStepMs;
+            fadeOut(mp3);
+            if (mp3->isRunning())
+            {
+                mp3->seekMs(pos < 0 ? 0 : pos);
+            }
+            out->FadeIn();
+            drawTimeline_previousMillis = 0;
         }
+        updateVolume();
         GO.update();
     }
     preferences.begin("Volume", false);
     preferences.putFloat("vol", GO.vol);
     preferences.end();
-    mp3->stop();
+    if (mp3)
+    {
+        fadeOut(mp3);
+        saveIndex(&trackPath, file, mp3);
+        mp3->stop();
+    }
+    if (nextMp3)
+    {
+        nextMp3->release();
+    }
     out->stop();
-    file->close();
+    delete mp3;
+    delete nextMp3;
+    delete spectrum;
+    delete resample;
+    delete out;
+    delete file;
+    delete nextFile;
     mp3 = NULL;
+    nextMp3 = NULL;
+    spectrum = NULL;
+    resample = NULL;
     out = NULL;
     file = NULL;
-    delete mp3;
+    nextFile = NULL;
+    GO.windowClr();
+}
+
+// WAV, ADTS .aac, MP4 .m4a and Ogg Vorbis files, single track and no seeking
+void Mp3PlayerClass::PlayFile(String *fileName)
+{
+    GO.windowClr();
+    for (int i = 0; i < AudioOutputSpectrum::SPECTRUM_BANDS; i++)
+    {
+        barH[i] = 0;
+        peakY[i] = ys + height - 1;
+    }
+    getvolume();
+    out = new AudioOutputI2S(0, 1);
+    resample = new AudioOutputResample(out);
+    spectrum = new AudioOutputSpectrum(resample);
+    out->SetOutputModeMono(true);
+    file = new AudioFileSourceSD((*fileName).c_str());
+    AudioGenerator *gen;
+    String lower = *fileName;
+    lower.toLowerCase();
+    if (lower.endsWith(".wav"))
+    {
+        gen = new AudioGeneratorWAV();
+    }
+    else if (lower.endsWith(".ogg"))
+    {
+        gen = new AudioGeneratorVorbis();
+    }
+    else
+    {
+        AudioGeneratorAAC *aac = new AudioGeneratorAAC();
+        // HE-AAC drops to its core rather than stutter, the speaker can't play the SBR band anyway
+        aac->SetCpuBudget(80);
+        gen = aac;
+    }
+    if (file->isOpen() && gen->begin(file, spectrum))
+    {
+        drawTitle(fileName);
+    }
+    setVolume(&GO.vol);
+    GO.old_vol = GO.vol;
+    GO.Lcd.setTextColor(ORANGE);
+    GO.Lcd.drawCentreString("Volume: " + String(GO.vol), 158, 190, 2);
+    GO.Lcd.setTextColor(WHITE);
+
+    while (gen->isRunning() && !GO.BtnB.wasPressed())
+    {
+        if (!gen->loop())
+        {
+            break;
+        }
+        genSpectrum();
+        drawTimeline();
+        updateVolume();
+        GO.update();
+    }
+    preferences.begin("Volume", false);
+    preferences.putFloat("vol", GO.vol);
+    preferences.end();
+    if (gen->isRunning())
+    {
+        fadeOut(gen);
+        gen->stop();
+    }
+    out->stop();
+    delete gen;
+    delete spectrum;
+    delete resample;
     delete out;
     delete file;
-    dacWrite(25, 0);
-    dacWrite(26, 0);
+    spectrum = NULL;
+    resample = NULL;
+    out = NULL;
+    file = NULL;
     GO.windowClr();
 }
 
@@ -1,5 +1,17 @@
 #pragma once
 #include "odroid_go.h"
+#include "AudioGeneratorAAC.h"
+#include "AudioGeneratorVorbis.h"
+#include "AudioGeneratorWAV.h"
+
+// Track paths for Play(), so a caller can hand over a view of its own list instead of a copy
+class Mp3Playlist
+{
+  public:
+    virtual ~Mp3Playlist() {}
+    virtual unsigned int size() = 0;
+    virtual String path(unsigned int track) = 0;
+};
 
 class Mp3PlayerClass
 {
@@ -8,6 +20,9 @@ class Mp3PlayerClass
     ~Mp3PlayerClass();
 
     void Play(String *fileName);
+    void Play(std::vector<String> &playlist, unsigned int track);
+    void Play(Mp3Playlist &playlist, unsigned int track);
+    void PlayFile(String *fileName);
 
   private:
     unsigned long currentMillis;
@@ -19,21 +34,41 @@ class Mp3PlayerClass
     int heightLine = 3;
     int heightMark = 20;
     int widthMark = 3;
-    int yClear, wClear, size_, pos_, oldpos_ = 0, xPos;
+    int yClear, wClear, size_, pos_, xPos;
+    String oldTime_;
     int xs = 12;
     int ys = 60;
     int padding = 20;
     int height = 70;
     int widthS = 25;
-    int aH, aY, bH, bY, bX, cH, cY, cX, dH, dY, dX, eH, eY, eX, fH, fY, fX, gH, gY, gX;
+    int barH[AudioOutputSpectrum::SPECTRUM_BANDS] = {0};
+    int peakY[AudioOutputSpectrum::SPECTRUM_BANDS] = {0};
+    uint8_t levels[AudioOutputSpectrum::SPECTRUM_BANDS];
+    uint8_t peaks[AudioOutputSpectrum::SPECTRUM_BANDS];
 
     void getvolume();
     void setVolume(int *v);
-    void drawSpectrum(int a, int b, int c, int d, int e, int f, int g);
+    void updateVolume();
+    void drawSpectrum();
     void genSpectrum();
     void drawTimeline();
+    void drawTitle(String *fileName);
+    void fadeOut(AudioGenerator *gen);
+    String formatTime(uint32_t ms);
+    void loadIndex(String *fileName, AudioFileSourceSD *src, AudioGeneratorMP3 *gen);
+    void saveIndex(String *fileName, AudioFileSourceSD *src, AudioGeneratorMP3 *gen);
+    bool openTrack(String *fileName, AudioFileSourceSD **src, AudioGeneratorMP3 **gen);
+
+    const uint32_t preopenBytes = 16384;
+    const uint32_t indexMagic = 0x4933504d; // "MP3I"
+    const int seekStepMs = 10000;
+    unsigned int nextIndex = 0;
 
-    AudioGeneratorMP3 *mp3;
-    AudioFileSourceSD *file;
+    AudioGeneratorMP3 *mp3 = NULL;
+    AudioFileSourceSD *file = NULL;
+    AudioGeneratorMP3 *nextMp3 = NULL;
+    AudioFileSourceSD *nextFile = NULL;
     AudioOutputI2S *out;
+    AudioOutputResample *resample;
+    AudioOutputSpectrum *spectrum;
 };
@@ -0,0 +1,402 @@
+#include "MusicIndex.h"
+
+struct TagInfo
+{
+    char title[64];
+    char artist[64];
+    char album[64];
+};
+
+static void TagCallback(void *cbData, const char *type, bool isUnicode, const char *string)
+{
+    TagInfo *tags = (TagInfo *)cbData;
+    char *dest = NULL;
+    if (!strcmp(type, "Title"))
+    {
+        dest = tags->title;
+    }
+    else if (!strcmp(type, "Performer"))
+    {
+        dest = tags->artist;
+    }
+    else if (!strcmp(type, "Album"))
+    {
+        dest = tags->album;
+    }
+    if (dest)
+    {
+        strncpy(dest, string, 63);
+        dest[63] = 0;
+    }
+}
+
+// The formats the player handles, everything but MP3 is indexed by file name only
+static bool isAudioFile(String &name)
+{
+    name.toLowerCase();
+    return name.endsWith(".mp3") || name.endsWith(".m4a") || name.endsWith(".aac") || name.endsWith(".ogg") || name.endsWith(".wav");
+}
+
+// ID3v1 fields are space or zero padded
+static void copyV1(char *dest, const uint8_t *src, int len)
+{
+    if (dest[0])
+    {
+        return;
+    }
+    memcpy(dest, src, len);
+    dest[len] = 0;
+    for (int i = len - 1; i >= 0 && (dest[i] == ' ' || dest[i] == 0); i--)
+    {
+        dest[i] = 0;
+    }
+}
+
+uint32_t MusicIndexClass::addString(std::vector<char> &to, const char *s)
+{
+    uint32_t offset = to.size();
+    to.insert(to.end(), s, s + strlen(s) + 1);
+    return offset;
+}
+
+int MusicIndexClass::findOld(const char *path)
+{
+    int lo = 0;
+    int hi = (int)byPath.size() - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int c = strcmp(str(tracks[byPath[mid]].path), path);
+        if (!c)
+        {
+            return byPath[mid];
+        }
+        if (c < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+// Tags through AudioFileSourceID3, then duration and bitrate from the first frame header (and its Xing/VBRI tag)
+void MusicIndexClass::readTags(const char *path, MusicTrack &t)
+{
+    static const uint16_t bitrates[2][16] = {
+        {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0}};
+    static const uint16_t rates[3] = {44100, 48000, 32000};
+
+    TagInfo tags;
+    memset(&tags, 0, sizeof(tags));
+    t.durationMs = 0;
+    t.bitrate = 0;
+    t.flags = 0;
+
+    AudioFileSourceSD src(path);
+    if (src.isOpen())
+    {
+        AudioFileSourceID3 id3(&src);
+        id3.RegisterMetadataCB(TagCallback, &tags);
+        uint8_t buf[512];
+        int len = id3.read(buf, sizeof(buf));
+        uint32_t bufPos = src.getPos() - len;
+
+        for (int i = 0; i + 4 < len; i++)
+        {
+            if (buf[i] != 0xff || (buf[i + 1] & 0xe0) != 0xe0)
+            {
+                continue;
+            }
+            int version = (buf[i + 1] >> 3) & 3; // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+            int layer = (buf[i + 1] >> 1) & 3;
+            int brIdx = buf[i + 2] >> 4;
+            int srIdx = (buf[i + 2] >> 2) & 3;
+            if (version == 1 || layer != 1 || brIdx == 0 || brIdx == 15 || srIdx == 3)
+            {
+                continue;
+            }
+            bool lsf = version != 3;
+            bool mono = (buf[i + 3] >> 6) == 3;
+            uint32_t rate = rates[srIdx] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+            uint32_t spf = lsf ? 576 : 1152;
+            t.bitrate = bitrates[lsf][brIdx];
+
+            uint32_t frames = 0;
+            int xing = i + 4 + (lsf ? (mono ? 9 : 17) : (mono ? 17 : 32));
+            if (xing + 12 <= len && (!memcmp(&buf[xing], "Xing", 4) || !memcmp(&buf[xing], "Info", 4)) && (buf[xing + 7] & 1))
+            {
+                frames = (buf[xing + 8] << 24) | (buf[xing + 9] << 16) | (buf[xing + 10] << 8) | buf[xing + 11];
+            }
+            else if (i + 36 + 18 <= len && !memcmp(&buf[i + 36], "VBRI", 4))
+            {
+                const uint8_t *v = &buf[i + 36 + 14];
+                frames = (v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3];
+            }
+            uint32_t audioBytes = t.size - (bufPos + i);
+            if (frames)
+            {
+                t.durationMs = ((uint64_t)frames * spf * 1000) / rate;
+                if (t.durationMs)
+                {
+                    t.bitrate = ((uint64_t)audioBytes * 8) / t.durationMs;
+                }
+            }
+            else
+            {
+                t.durationMs = ((uint64_t)audioBytes * 8) / t.bitrate;
+            }
+            break;
+        }
+
+        if (!tags.title[0] || !tags.artist[0] || !tags.album[0])
+        {
+            uint8_t v1[128];
+            if (src.seek(-128, SEEK_END) && src.read(v1, sizeof(v1)) == sizeof(v1) && !memcmp(v1, "TAG", 3))
+            {
+                copyV1(tags.title, &v1[3], 30);
+                copyV1(tags.artist, &v1[33], 30);
+                copyV1(tags.album, &v1[63], 30);
+            }
+        }
+        src.close();
+    }
+
+    if (!tags.title[0])
+    {
+        // Untagged, use the file name
+        const char *name = strrchr(path, '/');
+        strncpy(tags.title, name ? name + 1 : path, 63);
+        char *ext = strrchr(tags.title, '.');
+        if (ext)
+        {
+            *ext = 0;
+        }
+    }
+    t.title = addString(newPool, tags.title);
+    t.artist = addString(newPool, tags.artist[0] ? tags.artist : "Unknown Artist");
+    t.album = addString(newPool, tags.album[0] ? tags.album : "Unknown Album");
+}
+
+bool MusicIndexClass::load()
+{
+    File f = My_SD.open(indexPath);
+    if (!f)
+    {
+        return false;
+    }
+    IndexHeader hdr;
+    bool ok = f.read((uint8_t *)&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == indexMagic && hdr.version == indexVersion;
+    if (ok)
+    {
+        tracks.resize(hdr.count);
+        pool.resize(hdr.poolSize);
+        ok = f.read((uint8_t *)tracks.data(), hdr.count * sizeof(MusicTrack)) == hdr.count * sizeof(MusicTrack);
+        for (int v = 0; ok && v < 3; v++)
+        {
+            views[v].resize(hdr.count);
+            ok = f.read((uint8_t *)views[v].data(), hdr.count * sizeof(uint16_t)) == hdr.count * sizeof(uint16_t);
+        }
+        ok = ok && f.read((uint8_t *)pool.data(), hdr.poolSize) == hdr.poolSize;
+    }
+    f.close();
+    if (!ok)
+    {
+        tracks.clear();
+        pool.clear();
+        for (int v = 0; v < 3; v++)
+        {
+            views[v].clear();
+        }
+    }
+    return ok;
+}
+
+bool MusicIndexClass::save()
+{
+    File f = My_SD.open(tmpPath, FILE_WRITE);
+    if (!f)
+    {
+        return false;
+    }
+    IndexHeader hdr = {indexMagic, indexVersion, (uint16_t)tracks.size(), (uint32_t)pool.size()};
+    f.write((const uint8_t *)&hdr, sizeof(hdr));
+    f.write((const uint8_t *)tracks.data(), tracks.size() * sizeof(MusicTrack));
+    for (int v = 0; v < 3; v++)
+    {
+        f.write((const uint8_t *)views[v].data(), views[v].size() * sizeof(uint16_t));
+    }
+    f.write((const uint8_t *)pool.data(), pool.size());
+    f.close();
+    // Replace the old index only once the new one is complete
+    My_SD.remove(indexPath);
+    return My_SD.rename(tmpPath, indexPath);
+}
+
+void MusicIndexClass::sortViews()
+{
+    const char *p = pool.data();
+    std::vector<MusicTrack> &t = tracks;
+    for (int v = 0; v < 3; v++)
+    {
+        views[v].resize(t.size());
+        for (unsigned int i = 0; i < t.size(); i++)
+        {
+            views[v][i] = i;
+        }
+    }
+    std::sort(views[BY_ARTIST].begin(), views[BY_ARTIST].end(), [&](uint16_t a, uint16_t b) {
+        int c = strcasecmp(p + t[a].artist, p + t[b].artist);
+        if (!c)
+            c = strcasecmp(p + t[a].album, p + t[b].album);
+        if (!c)
+            c = strcasecmp(p + t[a].path, p + t[b].path);
+        return c < 0;
+    });
+    std::sort(views[BY_ALBUM].begin(), views[BY_ALBUM].end(), [&](uint16_t a, uint16_t b) {
+        int c = strcasecmp(p + t[a].album, p + t[b].album);
+        if (!c)
+            c = strcasecmp(p + t[a].path, p + t[b].path);
+        return c < 0;
+    });
+    std::sort(views[BY_TITLE].begin(), views[BY_TITLE].end(), [&](uint16_t a, uint16_t b) {
+        return strcasecmp(p + t[a].title, p + t[b].title) < 0;
+    });
+}
+
+void MusicIndexClass::beginScan()
+{
+    byPath.resize(tracks.size());
+    for (unsigned int i = 0; i < tracks.size(); i++)
+    {
+        byPath[i] = i;
+    }
+    const char *p = pool.data();
+    std::sort(byPath.begin(), byPath.end(), [&](uint16_t a, uint16_t b) {
+        return strcmp(p + tracks[a].path, p + tracks[b].path) < 0;
+    });
+    newTracks.clear();
+    newPool.clear();
+    dirs.clear();
+    modified = false;
+    File root = My_SD.open("/");
+    if (root && root.isDirectory())
+    {
+        dirs.push_back(root);
+        isScanning = true;
+    }
+}
+
+bool MusicIndexClass::scanStep()
+{
+    if (!isScanning)
+    {
+        return false;
+    }
+    while (!dirs.empty())
+    {
+        File entry = dirs.back().openNextFile();
+        if (!entry)
+        {
+            dirs.back().close();
+            dirs.pop_back();
+            continue;
+        }
+        String name = entry.name();
+        if (entry.isDirectory())
+        {
+            if (dirs.size() < (unsigned int)maxDepth && !strstr(name.c_str(), "System Volume Information"))
+            {
+                dirs.push_back(entry);
+            }
+            continue;
+        }
+        String lower = name;
+        if (!isAudioFile(lower) || newTracks.size() >= 0xffff)
+        {
+            continue;
+        }
+
+        MusicTrack t;
+        t.size = entry.size();
+        t.mtime = entry.getLastWrite();
+        entry.close();
+        int old = findOld(name.c_str());
+        if (old >= 0 && tracks[old].size == t.size && tracks[old].mtime == t.mtime)
+        {
+            // Unchanged since the last scan, no need to open it
+            MusicTrack &o = tracks[old];
+            t.durationMs = o.durationMs;
+            t.bitrate = o.bitrate;
+            t.flags = o.flags;
+            t.path = addString(newPool, str(o.path));
+            t.title = addString(newPool, str(o.title));
+            t.artist = addString(newPool, str(o.artist));
+            t.album = addString(newPool, str(o.album));
+        }
+        else
+        {
+            t.path = addString(newPool, name.c_str());
+            readTags(name.c_str(), t);
+            modified = true;
+        }
+        newTracks.push_back(t);
+        return true;
+    }
+    finishScan();
+    return false;
+}
+
+void MusicIndexClass::finishScan()
+{
+    isScanning = false;
+    if (newTracks.size() != tracks.size())
+    {
+        modified = true;
+    }
+    if (modified)
+    {
+        tracks.swap(newTracks);
+        pool.swap(newPool);
+        sortViews();
+        save();
+    }
+    newTracks.clear();
+    newTracks.shrink_to_fit();
+    newPool.clear();
+    newPool.shrink_to_fit();
+    byPath.clear();
+    byPath.shrink_to_fit();
+}
+
+void MusicIndexClass::abortScan()
+{
+    for (unsigned int i = 0; i < dirs.size(); i++)
+    {
+        dirs[i].close();
+    }
+    dirs.clear();
+    isScanning = false;
+    newTracks.clear();
+    newTracks.shrink_to_fit();
+    newPool.clear();
+    newPool.shrink_to_fit();
+    byPath.clear();
+    byPath.shrink_to_fit();
+}
+
+MusicIndexClass::MusicIndexClass()
+{
+}
+
+MusicIndexClass::~MusicIndexClass()
+{
+    for (unsigned int i = 0; i < dirs.size(); i++)
+    {
+        dirs[i].close();
+    }
+}
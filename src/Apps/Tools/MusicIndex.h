@@ -0,0 +1,82 @@
+#pragma once
+#include "odroid_go.h"
+#include "AudioFileSourceID3.h"
+
+// Binary index of the audio files on the SD card, kept in /MusicLibrary.idx
+//   header, MusicTrack[count], uint16_t byArtist[count], byAlbum[count], byTitle[count], string pool
+// The sorted views are stored with the index, so loading it is a single read.
+class MusicIndexClass
+{
+  public:
+    MusicIndexClass();
+    ~MusicIndexClass();
+
+    struct MusicTrack
+    {
+        uint32_t size;
+        uint32_t mtime;
+        uint32_t durationMs;
+        uint16_t bitrate; // kbps
+        uint16_t flags;
+        uint32_t path; // Offsets into the string pool
+        uint32_t title;
+        uint32_t artist;
+        uint32_t album;
+    };
+
+    enum SortOrder
+    {
+        BY_ARTIST = 0,
+        BY_ALBUM = 1,
+        BY_TITLE = 2
+    };
+
+    bool load();
+    unsigned int count() { return tracks.size(); }
+    const MusicTrack &track(unsigned int sorted, SortOrder order) { return tracks[views[order][sorted]]; }
+    const char *str(uint32_t offset) { return &pool[offset]; }
+
+    // Incremental rescan, one file per call so it can run from an app's idle loop.
+    // Unchanged files (same size and mtime) keep their entries without being opened.
+    // It shares the SD card with the player, so it runs on the UI task and stops while a
+    // track plays, and the views are only resorted once it is finished.
+    void beginScan();
+    bool scanStep(); // false once the scan is finished and the new index is saved
+    void abortScan(); // Closes the directories it holds open, the index stays as it was
+    bool scanning() { return isScanning; }
+    unsigned int scanned() { return newTracks.size(); }
+    bool changed() { return modified; } // The last scan found new, changed or removed files
+
+  private:
+    const char *indexPath = "/MusicLibrary.idx";
+    const char *tmpPath = "/MusicLibrary.tmp";
+    const uint32_t indexMagic = 0x42494c4d; // "MLIB"
+    const uint16_t indexVersion = 1;
+    const int maxDepth = 4;
+
+    struct IndexHeader
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t count;
+        uint32_t poolSize;
+    };
+
+    std::vector<MusicTrack> tracks;
+    std::vector<uint16_t> views[3];
+    std::vector<char> pool;
+
+    bool isScanning = false;
+    bool modified = false;
+    std::vector<File> dirs;
+    std::vector<uint16_t> byPath; // Old entries sorted by path, for lookups during a scan
+    std::vector<MusicTrack> newTracks;
+    std::vector<char> newPool;
+
+    uint32_t addString(std::vector<char> &to, const char *s);
+    int findOld(const char *path);
+    void readTags(const char *path, MusicTrack &t);
+    void finishScan();
+    void sortViews();
+    bool save();
+};
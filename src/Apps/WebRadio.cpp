@@ -13,33 +13,196 @@ void WebRadioClass::setVolume(int *v)
 	out->SetGain(volume);
 }
 
+// Ogg streams carry their titles inside the audio, so they come from the
+// player in the UI loop instead of from the stream task
+static char playerTitle[AudioMetadataQueue::TEXT_LEN];
+static bool playerTitleNew = false;
+
+void PlayerMetadataCallback(void *cbData, const char *type, bool isUnicode, const char *string)
+{
+	if (!strcmp(type, "StreamTitle"))
+	{
+		strncpy(playerTitle, string, sizeof(playerTitle) - 1);
+		playerTitle[sizeof(playerTitle) - 1] = 0;
+		playerTitleNew = true;
+	}
+}
+
 void WebRadioClass::StopPlaying()
 {
+	// The station fades out rather than stopping dead, decoding on for the
+	// few milliseconds that takes
+	if (player && player->isRunning() && !rebuffering)
+	{
+		out->FadeOut();
+		unsigned long start = millis();
+		while (!out->isFadedOut() && player->loop() && (millis() - start < 250))
+		{
+		}
+	}
+	// Closing reaches the stream, which the stream task may be in
+	xSemaphoreTake(streamLock, portMAX_DELAY);
 	if (player)
 	{
 		player->stop();
 		delete player;
 		player = NULL;
 	}
+	playerTitleNew = false;
 	if (buff)
 	{
 		buff->close();
 		delete buff;
 		buff = NULL;
 	}
+	if (tee)
+	{
+		// Writes out what is left of a recording
+		delete tee;
+		tee = NULL;
+	}
 	if (file)
 	{
 		file->close();
 		delete file;
 		file = NULL;
 	}
+	xSemaphoreGive(streamLock);
+}
+
+// Runs the connection state machine and moves what arrived into buff, so
+// the loop in Run() never waits on the network.  The one step that blocks is
+// the TLS handshake of an https station, inside file->loop() with streamLock
+// held, for up to CONNECT_TIMEOUT_MS.  The player goes on with what buff
+// holds, but changing station waits for the handshake to finish.
+void WebRadioClass::StreamTask(void *arg)
+{
+	WebRadioClass *radio = (WebRadioClass *)arg;
+	while (radio->streamRun)
+	{
+		uint32_t got = 0;
+		xSemaphoreTake(radio->streamLock, portMAX_DELAY);
+		if (radio->file)
+		{
+			radio->file->loop();
+			got = radio->buff->fill();
+			// A full buffer stops reading, that isn't the station stalling
+			radio->policy.arrival(got, radio->buff->getFillLevel() >= radio->buff->getBufferSize());
+		}
+		// Standby stations only get bandwidth the playing one doesn't need,
+		// and stop reading once their buffer is full.  One redirected to https
+		// is left unconnected, its handshake would hold up the fill above.
+		if (!radio->buff || (radio->buff->getFillLevel() >= radio->policy.getResumeLevel()))
+		{
+			for (int i = 0; i < 2; i++)
+			{
+				Standby *sb = &radio->standby[i];
+				if (sb->file && !sb->file->isSecure())
+				{
+					sb->file->loop();
+					got += sb->buff->fill();
+				}
+			}
+		}
+		xSemaphoreGive(radio->streamLock);
+		if (!got)
+		{
+			vTaskDelay(2);
+		}
+	}
+	radio->streamTask = NULL;
+	vTaskDelete(NULL);
+}
+
+void WebRadioClass::StartStream()
+{
+	streamLock = xSemaphoreCreateMutex();
+	streamRun = true;
+	// WiFiClientSecure's handshake runs on this stack, mbedTLS needs most of it
+	xTaskCreatePinnedToCore(StreamTask, "stream", streamStackSize, this, 2, &streamTask, 0);
+}
+
+void WebRadioClass::StopStream()
+{
+	streamRun = false;
+	while (streamTask)
+	{
+		delay(1);
+	}
+	vSemaphoreDelete(streamLock);
+	streamLock = NULL;
+}
+
+// Debug overlay, Select toggles it, the same numbers go to serial
+void WebRadioClass::drawStats()
+{
+	AudioStats st;
+	buff->getStats(&st);
+	player->getStats(&st);
+	resample->getStats(&st);
+	st.print();
+	Serial.printf_P(PSTR("Jitter %ums, start at %u, resume at %u bytes\n"),
+					policy.getJitterMs(), policy.getStartLevel(), policy.getResumeLevel());
+
+	char line[64];
+	GO.Lcd.setTextFont(1);
+	GO.Lcd.fillRect(0, 126, 320, 20, BLACK);
+	GO.Lcd.setTextColor(WHITE, BLACK);
+	snprintf(line, sizeof(line), "Buf min %u%% uf %u  DMA %u/%u ur %u",
+			 st.bufferSize ? st.bufferMinFill * 100 / st.bufferSize : 0, st.bufferUnderflows,
+			 st.dmaQueued, st.dmaSize, st.dmaUnderruns);
+	GO.Lcd.drawString(line, 5, 127, 1);
+	snprintf(line, sizeof(line), "Dec %u/%uus max %u  EQ %uc  Lat %ums",
+			 st.frameUsAvg, st.frameBudgetUs, st.frameUsMax, st.eqCycles, st.latencyMs());
+	GO.Lcd.drawString(line, 5, 137, 1);
+	// Fill history, newest on the right
+	for (int i = 0; i < AudioStats::HISTORY; i++)
+	{
+		int h = st.fillHistory[i] / 6 + 1;
+		GO.Lcd.fillRect(250 + i * 2, 144 - h, 2, h, (st.fillHistory[i] < 10) ? RED : GREEN);
+	}
+}
+
+// Connection progress, shown until the station plays.  Called in the
+// stream task, the UI loop draws what it leaves here.
+static portMUX_TYPE cbMux = portMUX_INITIALIZER_UNLOCKED;
+static char statusText[48];
+static volatile bool statusNew = false;
+
+void StatusCallback(void *cbData, int code, const char *string)
+{
+	portENTER_CRITICAL(&cbMux);
+	strncpy(statusText, string, sizeof(statusText) - 1);
+	statusText[sizeof(statusText) - 1] = 0;
+	statusNew = true;
+	portEXIT_CRITICAL(&cbMux);
 }
 
-// Called when a metadata event occurs (i.e. an ID3 tag, an ICY block, etc.
+// Titles come as "Artist - Title" or "Artist/Title", split over two lines
 String _s2, _s3;
-void MDCallback(void *cbData, const char *type, bool isUnicode, const char *string)
+void WebRadioClass::drawMetadata()
 {
-	String s1 = string;
+	AudioMetadataQueue::Event ev;
+	const char *title = NULL;
+	while (mdQueue.get(&ev))
+	{
+		if (!strcmp(ev.type, "StreamTitle"))
+		{
+			title = ev.text;
+			break;
+		}
+	}
+	if (!title && playerTitleNew)
+	{
+		title = playerTitle;
+		playerTitleNew = false;
+	}
+	if (!title)
+	{
+		return;
+	}
+
+	String s1 = title;
 	String s2 = strstr(s1.c_str(), "/");
 	String s3 = s1;
 	s3.replace(s2, "");
@@ -55,6 +218,187 @@ void MDCallback(void *cbData, const char *type, bool isUnicode, const char *stri
 	_s3 = s3;
 }
 
+void WebRadioClass::drawStatus()
+{
+	char text[sizeof(statusText)];
+	portENTER_CRITICAL(&cbMux);
+	strcpy(text, statusText);
+	statusNew = false;
+	portEXIT_CRITICAL(&cbMux);
+
+	GO.Lcd.setTextFont(1);
+	GO.Lcd.fillRect(0, 62, 320, 10, BLACK);
+	GO.Lcd.setTextColor(LIGHTGREY, BLACK);
+	GO.Lcd.drawCentreString(text, 160, 62, 1);
+}
+
+// Recording stops with the station, so this also clears it on a change
+void WebRadioClass::drawRecording()
+{
+	GO.Lcd.setTextFont(2);
+	GO.Lcd.fillRect(140, 5, 40, 16, BLACK);
+	if (tee && tee->isRecording())
+	{
+		GO.Lcd.setTextColor(RED, BLACK);
+		GO.Lcd.drawCentreString("REC", 160, 5, 2);
+	}
+}
+
+void WebRadioClass::OpenStandby(Standby *sb, unsigned int st)
+{
+	xSemaphoreTake(streamLock, portMAX_DELAY);
+	sb->file = new AudioFileSourceICYStream();
+	sb->file->SetReconnect(5, 500);
+	sb->file->open(Link[st].c_str());
+	sb->tee = new AudioFileSourceTee(sb->file, My_SD, "/Recordings");
+	sb->buff = new AudioFileSourceRingBuffer(sb->tee, sb->mem, preallocateBufferSize);
+	sb->buff->SetExternalProducer(true);
+	sb->station = st;
+	xSemaphoreGive(streamLock);
+}
+
+void WebRadioClass::CloseStandby(Standby *sb)
+{
+	xSemaphoreTake(streamLock, portMAX_DELAY);
+	if (sb->buff)
+	{
+		sb->buff->close();
+		delete sb->buff;
+		sb->buff = NULL;
+	}
+	if (sb->tee)
+	{
+		delete sb->tee;
+		sb->tee = NULL;
+	}
+	if (sb->file)
+	{
+		delete sb->file;
+		sb->file = NULL;
+	}
+	xSemaphoreGive(streamLock);
+}
+
+// Points the standby slots at the stations either side of the playing one
+void WebRadioClass::UpdateStandby()
+{
+	if (!prewarm)
+	{
+		return;
+	}
+	unsigned int count = Link.size();
+	unsigned int want[2];
+	want[0] = (Station > 0) ? Station - 1 : count - 1;
+	want[1] = (Station < count - 1) ? Station + 1 : 0;
+	for (int i = 0; i < 2; i++)
+	{
+		Standby *sb = &standby[i];
+		// https stations aren't pre-warmed, their TLS handshake blocks the
+		// stream task that fills the playing station's buffer
+		bool needed = (want[i] != Station) && ((i == 0) || (want[1] != want[0])) && !Link[want[i]].startsWith("https://");
+		if (sb->file && (!needed || (sb->station != want[i])))
+		{
+			CloseStandby(sb);
+		}
+		if (needed && !sb->file)
+		{
+			OpenStandby(sb, want[i]);
+		}
+	}
+}
+
+// Makes a pre-warmed station the playing one, its buffer memory trades
+// places with the one the player just let go of
+bool WebRadioClass::TakeStandby(unsigned int st)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		Standby *sb = &standby[i];
+		if (sb->file && (sb->station == st))
+		{
+			xSemaphoreTake(streamLock, portMAX_DELAY);
+			file = sb->file;
+			tee = sb->tee;
+			buff = sb->buff;
+			void *mem = sb->mem;
+			sb->mem = preallocateBuffer;
+			preallocateBuffer = mem;
+			sb->file = NULL;
+			sb->tee = NULL;
+			sb->buff = NULL;
+			mdQueue.clear();
+			file->SetMetadataQueue(&mdQueue);
+			file->RegisterStatusCB(StatusCallback, NULL);
+			tee->RegisterStatusCB(StatusCallback, NULL);
+			xSemaphoreGive(streamLock);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Only when there is PSRAM for two more buffers and room to spare
+void WebRadioClass::SetPrewarm(bool on)
+{
+	if (on && !prewarm)
+	{
+		if (!psramFound() || (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < (size_t)(2 * preallocateBufferSize + prewarmReserve)))
+		{
+			StatusCallback(NULL, 0, "Pre-warm: not enough PSRAM");
+			return;
+		}
+		for (int i = 0; i < 2; i++)
+		{
+			standby[i].mem = AudioMemory::alloc(preallocateBufferSize, AudioMemory::BULK, "standby buffer");
+		}
+		if (!standby[0].mem || !standby[1].mem)
+		{
+			AudioMemory::release(standby[0].mem);
+			AudioMemory::release(standby[1].mem);
+			standby[0].mem = NULL;
+			standby[1].mem = NULL;
+			return;
+		}
+		prewarm = true;
+		UpdateStandby();
+		StatusCallback(NULL, 0, "Pre-warm on");
+	}
+	else if (!on && prewarm)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			CloseStandby(&standby[i]);
+			AudioMemory::release(standby[i].mem);
+			standby[i].mem = NULL;
+		}
+		prewarm = false;
+		StatusCallback(NULL, 0, "Pre-warm off");
+	}
+}
+
+// Only starts connecting, the stream task takes it from here
+void WebRadioClass::OpenStation()
+{
+	if (!TakeStandby(Station))
+	{
+		xSemaphoreTake(streamLock, portMAX_DELAY);
+		file = new AudioFileSourceICYStream();
+		mdQueue.clear();
+		file->SetMetadataQueue(&mdQueue);
+		file->RegisterStatusCB(StatusCallback, NULL);
+		file->SetReconnect(5, 500);
+		file->open(Link[Station].c_str());
+		tee = new AudioFileSourceTee(file, My_SD, "/Recordings");
+		tee->RegisterStatusCB(StatusCallback, NULL);
+		buff = new AudioFileSourceRingBuffer(tee, preallocateBuffer, preallocateBufferSize);
+		buff->SetExternalProducer(true);
+		xSemaphoreGive(streamLock);
+	}
+	policy.reset();
+	rebuffering = false;
+	UpdateStandby();
+}
+
 bool WebRadioClass::GetStations(fs::FS &fs, const char *path)
 {
 	File sdfile = fs.open(path);
@@ -93,15 +437,45 @@ void WebRadioClass::Run()
 	GO.drawAppMenu(F("WebRadio"), F("Vol-"), F("Next"), F("Vol+"));
 	GO.Lcd.setTextColor(ORANGE);
 	GO.Lcd.drawCentreString("Press B to Exit", 158, 190, 2);
-	preallocateBuffer = malloc(preallocateBufferSize);
-	preallocateCodec = malloc(preallocateCodecSize);
-	out = new AudioOutputI2S(0, 1);
-	out->SetOutputModeMono(true);
-
 	if (GetStations(My_SD, "/RadioStations.txt"))
 	{
 		if (WiFi.isConnected())
 		{
+			// With PSRAM the buffer rides out seconds of stalling, if it can have
+			// that much and leave the rest of the system its reserve
+			if (psramFound() && (heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) >= (size_t)(bufferBudget + prewarmReserve)))
+			{
+				preallocateBufferSize = bufferBudget;
+			}
+			policy.begin(preallocateBufferSize);
+			// Decoder state is worked on for every sample, the stream buffer only passes data through
+			preallocateBuffer = AudioMemory::alloc(preallocateBufferSize, AudioMemory::BULK, "stream buffer");
+			// One block for whichever decoder the station turns out to need.  Vorbis
+			// takes over 100 KB, in internal RAM only if that leaves the reserve,
+			// else in PSRAM.  If neither has it, Ogg stations find their own memory.
+			preallocateCodecSize = max(mp3CodecSize, (int)AudioGeneratorVorbis::PREALLOCATE_SIZE);
+			bool fast = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) >= (size_t)(preallocateCodecSize + internalReserve);
+			if (fast || psramFound())
+			{
+				preallocateCodec = AudioMemory::alloc(preallocateCodecSize, fast ? AudioMemory::FAST : AudioMemory::BULK, "decoder");
+			}
+			if (!preallocateCodec)
+			{
+				preallocateCodecSize = mp3CodecSize;
+				preallocateCodec = AudioMemory::alloc(preallocateCodecSize, AudioMemory::FAST, "mp3 decoder");
+			}
+			out = new AudioOutputI2S(0, 1);
+			out->SetOutputModeMono(true);
+			// After the resampler, so the bands are only worked out for 44.1 kHz
+			eq = new AudioOutputEQ(out);
+			// Stations at other rates are converted, the I2S clock stays at 44.1 kHz
+			resample = new AudioOutputResample(eq);
+			StartStream();
+
+			preferences.begin("WebRadio", false);
+			SetPrewarm(preferences.getBool("prewarm", false));
+			eq->SetPreset(preferences.getInt("eq", AudioOutputEQ::PRESET_SPEAKER));
+			preferences.end();
 
 			while (play)
 			{
@@ -112,6 +486,19 @@ void WebRadioClass::Run()
 					GO.Lcd.drawString("Batt: " + String(GO.battery.getPercentage()) + " %", 10, 5, 2);
 					SignalStrength = map(100 + WiFi.RSSI(), 5, 90, 0, 100);
 					GO.Lcd.drawRightString("WiFi: " + String(SignalStrength) + " %", 310, 5, 2);
+					// At most one title redraw a second, however often the station sends one
+					drawMetadata();
+					drawRecording();
+					if (player)
+					{
+						AudioStats st;
+						player->getStats(&st);
+						policy.setBitRate(st.bitRate);
+						if (showStats)
+						{
+							drawStats();
+						}
+					}
 					lastcheck = now;
 				}
 				if ((GO.JOY_Y.wasAxisPressed() == 1) && GO.vol > 0)
@@ -155,6 +542,46 @@ void WebRadioClass::Run()
 				{
 					play = false;
 				}
+				if (GO.BtnA.wasPressed() && tee)
+				{
+					// Saved to /Recordings on the SD card, a file per title
+					if (tee->isRecording())
+					{
+						tee->stopRecording();
+					}
+					else
+					{
+						tee->startRecording(Name[Station].c_str());
+					}
+					drawRecording();
+				}
+				if (GO.BtnSelect.wasPressed())
+				{
+					showStats = !showStats;
+					GO.Lcd.fillRect(0, 126, 320, 20, BLACK);
+					if (showStats)
+					{
+						AudioMemory::report();
+					}
+				}
+				if (GO.BtnStart.wasPressed())
+				{
+					SetPrewarm(!prewarm);
+					preferences.begin("WebRadio", false);
+					preferences.putBool("prewarm", prewarm);
+					preferences.end();
+				}
+				if (GO.BtnMenu.wasPressed())
+				{
+					int preset = (eq->GetPreset() + 1) % AudioOutputEQ::PRESET_COUNT;
+					eq->SetPreset(preset);
+					preferences.begin("WebRadio", false);
+					preferences.putInt("eq", preset);
+					preferences.end();
+					char text[32];
+					snprintf(text, sizeof(text), "EQ: %s", AudioOutputEQ::PresetName(preset));
+					StatusCallback(NULL, 0, text);
+				}
 				if (GO.vol != GO.old_vol)
 				{
 					GO.Lcd.HprogressBar(80, 170, 200, 15, GREEN, GO.vol, true);
@@ -162,6 +589,11 @@ void WebRadioClass::Run()
 				}
 				GO.update();
 
+				if (statusNew)
+				{
+					drawStatus();
+				}
+
 				if (upd)
 				{
 					GO.Lcd.setTextColor(RED);
@@ -177,25 +609,74 @@ void WebRadioClass::Run()
 					GO.Lcd.setTextColor(PINK);
 					GO.Lcd.drawCentreString(Name[Station], 160, 35, 1);
 					old_Station = Name[Station];
-					file = new AudioFileSourceICYStream(Link[Station].c_str());
-					file->RegisterMetadataCB(MDCallback, (void *)"ICY");
-					buff = new AudioFileSourceBuffer(file, preallocateBuffer, preallocateBufferSize);
-					player = new AudioGeneratorMP3(preallocateCodec, preallocateCodecSize);
-					player->begin(buff, out);
-					setVolume(&GO.vol);
-					GO.old_vol = GO.vol;
+					OpenStation();
 					upd = false;
 				}
 				else
 				{
-					player->loop();
-					if (rawFillLvl != buff->getFillLevel())
+					uint32_t level = buff->getFillLevel();
+					if (player && !rebuffering && (level < policy.getLowLevel()) && file->isOpen())
+					{
+						// The decoder would wait on every read, it waits here instead
+						rebuffering = true;
+						rebufferStart = millis();
+						// Down to the idle level instead of the DMA going round
+						// what it last played, it fades back in on resuming
+						out->stop();
+						StatusCallback(NULL, 0, "Rebuffering");
+					}
+					else if (rebuffering && (level >= policy.getResumeLevel()))
+					{
+						rebuffering = false;
+						GO.Lcd.fillRect(0, 62, 320, 10, BLACK);
+					}
+					if (player && !rebuffering)
+					{
+						player->loop();
+					}
+					else if (!player && (level >= policy.getStartLevel()))
+					{
+						// What the station's jitter calls for, its first bytes also show what it sends
+						const uint8_t *head;
+						if ((buff->getReadSpan(&head) >= 4) && AudioDemuxOgg::IsOgg(head))
+						{
+							if (preallocateCodecSize >= AudioGeneratorVorbis::PREALLOCATE_SIZE)
+							{
+								player = new AudioGeneratorVorbis(preallocateCodec, preallocateCodecSize);
+							}
+							else
+							{
+								player = new AudioGeneratorVorbis();
+							}
+							player->RegisterMetadataCB(PlayerMetadataCallback, NULL);
+							// A file cut inside the stream wouldn't have the headers
+							tee->SetExtension(".ogg");
+							tee->SetSplitOnTitle(false);
+						}
+						else
+						{
+							AudioGeneratorMP3 *mp3 = new AudioGeneratorMP3(preallocateCodec, preallocateCodecSize);
+							// The output mixes to mono anyway, so only one channel is synthesised
+							mp3->SetDecodeMode(AudioGeneratorMP3::DECODE_DOWNMIX);
+							player = mp3;
+						}
+						player->begin(buff, resample);
+						setVolume(&GO.vol);
+						GO.old_vol = GO.vol;
+						GO.Lcd.fillRect(0, 62, 320, 10, BLACK);
+					}
+					if (rawFillLvl != level)
 					{
-						rawFillLvl = buff->getFillLevel();
-						fillLvl = map(rawFillLvl, 0, preallocateBufferSize, 0, 100);
+						// Full is enough to play on through the stalls seen so far
+						rawFillLvl = level;
+						fillLvl = map(rawFillLvl, 0, policy.getResumeLevel(), 0, 100);
+						if (fillLvl > 100)
+						{
+							fillLvl = 100;
+						}
 						GO.Lcd.HprogressBar(80, 150, 200, 15, RED, fillLvl, true);
 					}
-					if (!upd && !fillLvl)
+					if ((rebuffering && (millis() - rebufferStart >= rebufferTimeoutMs)) || !file->isOpen())
 					{
 						StopPlaying();
 						if (Station < (unsigned int)(Link.size() - 1))
@@ -214,16 +695,22 @@ void WebRadioClass::Run()
 			preferences.putFloat("vol", GO.vol);
 			preferences.end();
 			StopPlaying();
+			SetPrewarm(false);
+			StopStream();
 			if (out)
 			{
-				out->stop();
+				resample->stop();
+				delete resample;
+				resample = NULL;
+				delete eq;
+				eq = NULL;
 				delete out;
 				out = NULL;
 			}
-			free(preallocateBuffer);
-			free(preallocateCodec);
-			dacWrite(25, 0);
-			dacWrite(26, 0);
+			AudioMemory::release(preallocateBuffer);
+			AudioMemory::release(preallocateCodec);
+			preallocateBuffer = NULL;
+			preallocateCodec = NULL;
 		}
 		else
 		{
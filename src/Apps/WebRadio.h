@@ -14,11 +14,17 @@ public:
 private:
   AudioGenerator *player = NULL;
   AudioFileSourceICYStream *file = NULL;
-  AudioFileSourceBuffer *buff = NULL;
+  AudioFileSourceTee *tee = NULL; // Records what file reads, A starts and stops it
+  AudioFileSourceRingBuffer *buff = NULL;
   AudioOutputI2S *out = NULL;
+  AudioOutputResample *resample = NULL;
+  AudioOutputEQ *eq = NULL; // Menu picks the preset
 
-  const int preallocateBufferSize = 16384;
-  const int preallocateCodecSize = 524288;
+  int preallocateBufferSize = 16384; // Without PSRAM, Run() sizes it from bufferBudget
+  const int bufferBudget = 131072;    // 8 s at 128 kb/s, with PSRAM
+  const int mp3CodecSize = 32768; // libmad needs about 29 KB
+  int preallocateCodecSize = 0;   // Run() sizes it for Vorbis when it can, else for MP3 only
+  const int internalReserve = 65536; // Internal RAM left for WiFi and the task stacks
   void *preallocateBuffer = NULL;
   void *preallocateCodec = NULL;
 
@@ -32,9 +38,52 @@ private:
   unsigned long lastcheck;
   bool play = true;
   bool upd = true;
+  bool showStats = false;
+  AudioMetadataQueue mdQueue;
+
+  // Decoding starts, and after a stall goes on, once the buffer holds what
+  // the station's jitter calls for.  A stall longer than the timeout, or a
+  // connection that gave up, moves on to the next station.
+  AudioBufferPolicy policy;
+  bool rebuffering = false;
+  unsigned long rebufferStart;
+  const unsigned long rebufferTimeoutMs = 20000;
+
+  // The stream task connects and fills buff, the loop in Run() decodes and draws
+  TaskHandle_t streamTask = NULL;
+  SemaphoreHandle_t streamLock = NULL;
+  volatile bool streamRun = false;
+  const uint32_t streamStackSize = 10240;
+  static void StreamTask(void *arg);
+  void StartStream();
+  void StopStream();
+
+  // Pre-warm keeps the stations either side connected with a buffer of
+  // their own, so switching to one only swaps sources
+  struct Standby
+  {
+    AudioFileSourceICYStream *file = NULL;
+    AudioFileSourceTee *tee = NULL;
+    AudioFileSourceRingBuffer *buff = NULL;
+    void *mem = NULL;
+    unsigned int station = 0;
+  };
+  Standby standby[2]; // Previous and next station
+  bool prewarm = false;
+  const int prewarmReserve = 262144; // PSRAM left for everything else
+  void SetPrewarm(bool on);
+  void OpenStandby(Standby *sb, unsigned int st);
+  void CloseStandby(Standby *sb);
+  void UpdateStandby();
+  bool TakeStandby(unsigned int st);
+  void OpenStation();
 
   void getvolume();
   void setVolume(int *v);
   bool GetStations(fs::FS &fs, const char *path);
   void StopPlaying();
+  void drawStats();
+  void drawMetadata();
+  void drawStatus();
+  void drawRecording();
 };
@@ -30,6 +30,12 @@ void appSdBrowser()
     SdBrowserObj.Run();
 }
 
+void appMusicLibrary()
+{
+    MusicLibraryClass MusicLibraryObj;
+    MusicLibraryObj.Run();
+}
+
 void appSysInfo()
 {
     SysinfoClass SysinfoObj;
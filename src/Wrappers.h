@@ -3,6 +3,7 @@
 #include "Apps/CfgBrightness.h"
 #include "Apps/Oscilloscope.h"
 #include "Apps/SdBrowser.h"
+#include "Apps/MusicLibrary.h"
 #include "Apps/Sysinfo.h"
 #include "Apps/WiFiSettings.h"
 #include "Apps/MyWebServer.h"
@@ -20,6 +21,7 @@ void appAbout();
 void appCfgbrightness();
 void appOscilloscope();
 void appSdBrowser();
+void appMusicLibrary();
 void appSysInfo();
 void appWiFiSetup();
 void appWebServer();
@@ -30,6 +30,7 @@ void setup()
 	GO.addMenuItem(1, "WEATHER STATION", "<", "OK", ">", -1, WeatherStation, appWeatherStation);
 	GO.addMenuItem(1, "WEBSERVER", "<", "OK", ">", -1, Webserver, appWebServer);
 	GO.addMenuItem(1, "SD BROWSER", "<", "OK", ">", -1, Browser, appSdBrowser);
+	GO.addMenuItem(1, "MUSIC LIBRARY", "<", "OK", ">", -1, Browser, appMusicLibrary);
 	//GO.addMenuItem(1, "TOOLS", "<", "OK", ">", -1, Tools, appListTools);
 	GO.addMenuItem(1, "GAMES", "<", "OK", ">", -1, Games, appGamesList);
 
@@ -0,0 +1,572 @@
+/*
+  codec_test
+  Decodes the reference streams in corpus/ with libmad, Helix MP3 and AAC,
+  libFLAC and AudioGeneratorVorbis, checks the PCM against corpus/golden.txt
+  and reports speed, peak heap and stack use.  AudioGeneratorMP3's decode
+  modes and Helix's HE-AAC core-only mode get checksums of their own.
+
+  The heap and stack figures are host numbers (64 bit pointers, no register
+  windows), good for telling whether a change grew a decoder, not for the
+  budgets on the device.  Run with -g to print a new golden file.
+*/
+
+#include <pthread.h>
+#include <memory>
+#include <malloc.h>
+#include <string>
+#include <vector>
+#include "libmad/config.h"
+#include "libmad/mad.h"
+#include "libhelix-mp3/mp3dec.h"
+#include "libhelix-aac/aacdec.h"
+#include "FLAC/stream_decoder.h"
+#include "AudioGeneratorMP3.h"
+#include "AudioGeneratorVorbis.h"
+#include "host_test.h"
+
+// What a decoder made of a stream
+struct Pcm
+{
+  uint32_t frames;   // Codec frames
+  uint64_t samples;  // Per channel
+  int channels;
+  int rate;
+  uint64_t hash;     // FNV-1a over every sample as 32 bit little endian
+  void Add(int32_t s)
+  {
+    for (int i = 0; i < 4; i++) {
+      hash ^= (uint8_t)(s >> (i * 8));
+      hash *= 0x100000001b3ull;
+    }
+  }
+};
+
+typedef bool (*DecodeFn)(const uint8_t *data, size_t len, Pcm *pcm);
+
+// Heap, counted by the -Wl,--wrap'ed allocator while a decode runs
+static bool heapTrack;
+static long heapNow;
+static long heapPeak;
+
+extern "C" {
+  void *__real_malloc(size_t n);
+  void *__real_calloc(size_t n, size_t sz);
+  void *__real_realloc(void *p, size_t n);
+  void __real_free(void *p);
+
+  static void HeapAdd(void *p, long sign)
+  {
+    if (!heapTrack || !p) return;
+    heapNow += sign * (long)malloc_usable_size(p);
+    if (heapNow > heapPeak) heapPeak = heapNow;
+  }
+  void *__wrap_malloc(size_t n) { void *p = __real_malloc(n); HeapAdd(p, 1); return p; }
+  void *__wrap_calloc(size_t n, size_t sz) { void *p = __real_calloc(n, sz); HeapAdd(p, 1); return p; }
+  void *__wrap_realloc(void *p, size_t n)
+  {
+    HeapAdd(p, -1);
+    void *q = __real_realloc(p, n);
+    HeapAdd(q ? q : p, 1);
+    return q;
+  }
+  void __wrap_free(void *p) { HeapAdd(p, -1); __real_free(p); }
+}
+
+static bool DecodeMad(const uint8_t *data, size_t len, Pcm *pcm)
+{
+  // As AudioGeneratorMP3 has them, off the heap, and with the guard bytes
+  // libmad needs past the last frame
+  struct mad_stream *stream = (struct mad_stream *)malloc(sizeof(struct mad_stream));
+  struct mad_frame *frame = (struct mad_frame *)malloc(sizeof(struct mad_frame));
+  struct mad_synth *synth = (struct mad_synth *)malloc(sizeof(struct mad_synth));
+  uint8_t *buff = (uint8_t *)calloc(len + MAD_BUFFER_GUARD, 1);
+  if (!stream || !frame || !synth || !buff) return false;
+  memcpy(buff, data, len);
+  mad_stream_init(stream);
+  mad_frame_init(frame);
+  mad_synth_init(synth);
+  mad_stream_buffer(stream, buff, len + MAD_BUFFER_GUARD);
+  bool ok = true;
+  while (true) {
+    if (mad_frame_decode(frame, stream) == -1) {
+      if (stream->error == MAD_ERROR_BUFLEN) break;
+      if (MAD_RECOVERABLE(stream->error)) continue;
+      ok = false;
+      break;
+    }
+    pcm->frames++;
+    pcm->rate = frame->header.samplerate;
+    for (unsigned ns = 0; ns < MAD_NSBSAMPLES(&frame->header); ns++) {
+      mad_synth_frame_onens(synth, frame, ns);
+      pcm->channels = synth->pcm.channels;
+      for (int i = 0; i < synth->pcm.length; i++) {
+        for (int ch = 0; ch < synth->pcm.channels; ch++) pcm->Add(synth->pcm.samples[ch][i]);
+      }
+      pcm->samples += synth->pcm.length;
+    }
+  }
+  mad_synth_finish(synth);
+  mad_frame_finish(frame);
+  mad_stream_finish(stream);
+  free(buff);
+  free(synth);
+  free(frame);
+  free(stream);
+  return ok;
+}
+
+static bool DecodeHelixMP3(const uint8_t *data, size_t len, Pcm *pcm)
+{
+  HMP3Decoder dec = MP3InitDecoder();
+  short *out = (short *)malloc(MAX_NCHAN * MAX_NGRAN * MAX_NSAMP * sizeof(short));
+  if (!dec || !out) return false;
+  unsigned char *p = (unsigned char *)data;
+  int left = len;
+  bool ok = true;
+  while (left > 0) {
+    int sync = MP3FindSyncWord(p, left);
+    if (sync < 0) break;
+    p += sync;
+    left -= sync;
+    int err = MP3Decode(dec, &p, &left, out, 0);
+    if (err == ERR_MP3_INDATA_UNDERFLOW) break;
+    if (err == ERR_MP3_MAINDATA_UNDERFLOW) continue; // Bit reservoir filling up
+    if (err) {
+      // Corrupt frame, resync past its header
+      p++;
+      left--;
+      ok = false;
+      continue;
+    }
+    MP3FrameInfo fi;
+    MP3GetLastFrameInfo(dec, &fi);
+    pcm->frames++;
+    pcm->channels = fi.nChans;
+    pcm->rate = fi.samprate;
+    for (int i = 0; i < fi.outputSamps; i++) pcm->Add(out[i]);
+    pcm->samples += fi.outputSamps / fi.nChans;
+  }
+  free(out);
+  MP3FreeDecoder(dec);
+  return ok;
+}
+
+static bool DecodeAAC(const uint8_t *data, size_t len, Pcm *pcm, bool coreOnly)
+{
+  HAACDecoder dec = AACInitDecoder();
+  short *out = (short *)malloc(AAC_MAX_NCHANS * AAC_MAX_NSAMPS * 2 * sizeof(short));
+  if (!dec || !out) return false;
+  AACSetCoreOnly(dec, coreOnly);
+  unsigned char *p = (unsigned char *)data;
+  int left = len;
+  bool ok = true;
+  while (left > 0) {
+    int sync = AACFindSyncWord(p, left);
+    if (sync < 0) break;
+    p += sync;
+    left -= sync;
+    int err = AACDecode(dec, &p, &left, out);
+    if (err == ERR_AAC_INDATA_UNDERFLOW) break;
+    if (err) {
+      p++;
+      left--;
+      ok = false;
+      continue;
+    }
+    AACFrameInfo fi;
+    AACGetLastFrameInfo(dec, &fi);
+    pcm->frames++;
+    pcm->channels = fi.nChans;
+    pcm->rate = fi.sampRateOut;
+    for (int i = 0; i < fi.outputSamps; i++) pcm->Add(out[i]);
+    pcm->samples += fi.outputSamps / fi.nChans;
+  }
+  free(out);
+  AACFreeDecoder(dec);
+  return ok;
+}
+
+static bool DecodeHelixAAC(const uint8_t *data, size_t len, Pcm *pcm)
+{
+  return DecodeAAC(data, len, pcm, false);
+}
+
+// HE-AAC without the SBR, the core at half the rate
+static bool DecodeHelixAACCore(const uint8_t *data, size_t len, Pcm *pcm)
+{
+  return DecodeAAC(data, len, pcm, true);
+}
+
+// libFLAC reads the stream from memory, with its MD5 check on
+struct FlacSource
+{
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  Pcm *pcm;
+  bool error;
+};
+
+static FLAC__StreamDecoderReadStatus FlacRead(const FLAC__StreamDecoder *, FLAC__byte buffer[], size_t *bytes, void *cd)
+{
+  FlacSource *src = (FlacSource *)cd;
+  size_t n = std::min(*bytes, src->len - src->pos);
+  memcpy(buffer, src->data + src->pos, n);
+  src->pos += n;
+  *bytes = n;
+  return n ? FLAC__STREAM_DECODER_READ_STATUS_CONTINUE : FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+}
+
+static FLAC__StreamDecoderWriteStatus FlacWrite(const FLAC__StreamDecoder *, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *cd)
+{
+  Pcm *pcm = ((FlacSource *)cd)->pcm;
+  pcm->frames++;
+  pcm->channels = frame->header.channels;
+  pcm->rate = frame->header.sample_rate;
+  for (unsigned i = 0; i < frame->header.blocksize; i++) {
+    for (unsigned ch = 0; ch < frame->header.channels; ch++) pcm->Add(buffer[ch][i]);
+  }
+  pcm->samples += frame->header.blocksize;
+  return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void FlacError(const FLAC__StreamDecoder *, FLAC__StreamDecoderErrorStatus, void *cd)
+{
+  ((FlacSource *)cd)->error = true;
+}
+
+static bool DecodeFLAC(const uint8_t *data, size_t len, Pcm *pcm)
+{
+  FlacSource src = { data, len, 0, pcm, false };
+  FLAC__StreamDecoder *dec = FLAC__stream_decoder_new();
+  if (!dec) return false;
+  FLAC__stream_decoder_set_md5_checking(dec, true);
+  bool ok = FLAC__stream_decoder_init_stream(dec, FlacRead, NULL, NULL, NULL, NULL, FlacWrite, NULL, FlacError, &src) == FLAC__STREAM_DECODER_INIT_STATUS_OK;
+  ok = ok && FLAC__stream_decoder_process_until_end_of_stream(dec);
+  ok = FLAC__stream_decoder_finish(dec) && ok; // False on an MD5 mismatch
+  FLAC__stream_decoder_delete(dec);
+  return ok && !src.error;
+}
+
+// Vorbis as it plays, through AudioGeneratorVorbis with its Ogg demuxer and
+// the trimming of the last packet to the granule
+class MemorySource : public AudioFileSource
+{
+  public:
+    MemorySource(const uint8_t *data, size_t len) : data(data), len(len), pos(0) {}
+    virtual uint32_t read(void *dest, uint32_t n) override
+    {
+      n = std::min<size_t>(n, len - pos);
+      memcpy(dest, data + pos, n);
+      pos += n;
+      return n;
+    }
+    virtual bool seek(int32_t to, int dir) override
+    {
+      if (dir == SEEK_CUR) to += pos;
+      else if (dir == SEEK_END) to += len;
+      if ((to < 0) || ((size_t)to > len)) return false;
+      pos = to;
+      return true;
+    }
+    virtual bool isOpen() override { return true; }
+    virtual bool close() override { return true; }
+    virtual uint32_t getSize() override { return len; }
+    virtual uint32_t getPos() override { return pos; }
+
+  private:
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+};
+
+class PcmOutput : public AudioOutput
+{
+  public:
+    PcmOutput(Pcm *pcm) : pcm(pcm) {}
+    virtual bool begin() override { return true; }
+    virtual bool SetRate(int hz) override { pcm->rate = hz; return true; }
+    virtual bool SetChannels(int chan) override { pcm->channels = chan; return true; }
+    virtual bool ConsumeSample(int16_t sample[2]) override
+    {
+      for (int ch = 0; ch < pcm->channels; ch++) pcm->Add(sample[ch]);
+      pcm->samples++;
+      return true;
+    }
+    virtual bool stop() override { return true; }
+
+  private:
+    Pcm *pcm;
+};
+
+static void VorbisStatus(void *cbData, int code, const char *)
+{
+  if (code < 0) *(bool *)cbData = false;
+}
+
+// MP3 through AudioGeneratorMP3 in one of its decode modes, with the
+// gapless trimming
+template <int MODE>
+static bool DecodeMP3(const uint8_t *data, size_t len, Pcm *pcm)
+{
+  MemorySource src(data, len);
+  PcmOutput out(pcm);
+  AudioGeneratorMP3 mp3;
+  mp3.SetDecodeMode(MODE);
+  if (!mp3.begin(&src, &out)) return false;
+  while (mp3.loop()) {}
+  AudioStats st;
+  mp3.getStats(&st);
+  pcm->frames = st.frames;
+  return true;
+}
+
+// The preallocated one shares a block between streams, as WebRadio does
+static uint8_t vorbisBlock[AudioGeneratorVorbis::PREALLOCATE_SIZE];
+
+template <bool PREALLOCATED>
+static bool DecodeVorbis(const uint8_t *data, size_t len, Pcm *pcm)
+{
+  MemorySource src(data, len);
+  PcmOutput out(pcm);
+  std::unique_ptr<AudioGeneratorVorbis> gen(PREALLOCATED ? new AudioGeneratorVorbis(vorbisBlock, sizeof(vorbisBlock)) : new AudioGeneratorVorbis());
+  AudioGeneratorVorbis &vorbis = *gen;
+  bool ok = true;
+  vorbis.RegisterStatusCB(VorbisStatus, &ok);
+  if (!vorbis.begin(&src, &out)) return false;
+  while (vorbis.loop()) {}
+  AudioStats st;
+  vorbis.getStats(&st);
+  pcm->frames = st.frames;
+  return ok;
+}
+
+static bool DecodeNothing(const uint8_t *, size_t, Pcm *)
+{
+  return true;
+}
+
+// One decode on a thread of its own, its stack painted first so the deepest
+// point reached can be found afterwards
+enum { STACK_SIZE = 256 * 1024, STACK_PAINT = 0xa5 };
+
+struct Job
+{
+  DecodeFn fn;
+  const uint8_t *data;
+  size_t len;
+  Pcm pcm;
+  bool ok;
+  double ns;
+  long heap;
+  size_t stack;
+};
+
+static void *RunJob(void *arg)
+{
+  Job *job = (Job *)arg;
+  heapNow = heapPeak = 0;
+  heapTrack = true;
+  HostTimer t;
+  job->ok = job->fn(job->data, job->len, &job->pcm);
+  job->ns = t.ns();
+  heapTrack = false;
+  job->heap = heapPeak;
+  return NULL;
+}
+
+static void Run(Job *job)
+{
+  static uint8_t *stack;
+  if (!stack) stack = (uint8_t *)aligned_alloc(4096, STACK_SIZE);
+  memset(stack, STACK_PAINT, STACK_SIZE);
+  job->pcm = Pcm();
+  job->pcm.hash = 0xcbf29ce484222325ull;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, STACK_SIZE);
+  pthread_t th;
+  pthread_create(&th, &attr, RunJob, job);
+  pthread_join(th, NULL);
+  pthread_attr_destroy(&attr);
+  size_t untouched = 0;
+  while ((untouched < STACK_SIZE) && (stack[untouched] == STACK_PAINT)) untouched++;
+  job->stack = STACK_SIZE - untouched;
+}
+
+static bool Load(const std::string &path, std::vector<uint8_t> *data)
+{
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data->insert(data->end(), chunk, chunk + n);
+  fclose(f);
+  return true;
+}
+
+struct Golden
+{
+  std::string stream;
+  std::string decoder;
+  uint64_t samples;
+  uint64_t hash;
+};
+
+static std::vector<Golden> LoadGolden(const std::string &path)
+{
+  std::vector<Golden> golden;
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f) return golden;
+  char line[256], stream[128], decoder[32];
+  unsigned long long samples, hash;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%127s %31s %llu %llx", stream, decoder, &samples, &hash) == 4) {
+      golden.push_back({ stream, decoder, samples, hash });
+    }
+  }
+  fclose(f);
+  return golden;
+}
+
+// The VBRI header as AudioGeneratorMP3 reads it: the frame count gives the
+// duration, the TOC has to land near each percent's real frame
+class ProbeMP3 : public AudioGeneratorMP3
+{
+  public:
+    bool HasToc() { return xingHasToc; }
+    uint32_t TocPos(int percent) { return tocStart + ((uint64_t)xingToc[percent] * tocBytes) / 256; }
+    uint32_t TocStep() { return tocBytes / 256 + 1; }
+};
+
+static int CheckVbri(const std::string &path)
+{
+  std::vector<uint8_t> data;
+  if (!Load(path, &data)) {
+    printf("%s: can't read it FAIL\n", path.c_str());
+    return 1;
+  }
+  // Where the frames really are, the VBRI frame first
+  std::vector<uint32_t> offsets;
+  std::vector<uint8_t> guarded(data);
+  guarded.resize(data.size() + MAD_BUFFER_GUARD);
+  struct mad_stream stream;
+  struct mad_header header;
+  mad_stream_init(&stream);
+  mad_header_init(&header);
+  mad_stream_buffer(&stream, guarded.data(), guarded.size());
+  while (true) {
+    if (mad_header_decode(&header, &stream) == -1) {
+      if (MAD_RECOVERABLE(stream.error)) continue;
+      break;
+    }
+    offsets.push_back(stream.this_frame - guarded.data());
+  }
+  mad_stream_finish(&stream);
+  uint32_t frames = offsets.size() - 1;
+  uint32_t wantMs = ((uint64_t)frames * 576 * 1000) / header.samplerate;
+
+  Pcm pcm = Pcm();
+  MemorySource src(data.data(), data.size());
+  PcmOutput out(&pcm);
+  ProbeMP3 mp3;
+  bool ok = mp3.begin(&src, &out) && mp3.prime() && mp3.HasToc();
+  uint32_t ms = mp3.getDurationMs();
+  uint32_t worst = 0;
+  for (int i = 0; ok && (i < 100); i++) {
+    uint32_t real = offsets[1 + (i * frames) / 100];
+    uint32_t toc = mp3.TocPos(i);
+    worst = std::max(worst, (toc > real) ? toc - real : real - toc);
+  }
+  // A TOC step, and half a frame for the guess inside a run of two
+  uint32_t biggest = 0;
+  for (size_t i = 1; i < offsets.size(); i++) biggest = std::max(biggest, offsets[i] - offsets[i - 1]);
+  ok = ok && (ms == wantMs) && (worst <= mp3.TocStep() + biggest / 2);
+  // A seek lands on its frame, and every frame after it counts towards the position
+  uint32_t frameMs = (576 * 1000) / header.samplerate + 1;
+  ok = ok && mp3.seekMs(1000) && (mp3.getPositionMs() <= 1000) && (1000 - mp3.getPositionMs() < frameMs);
+  while (ok && mp3.loop()) {}
+  uint32_t endMs = mp3.getPositionMs();
+  ok = ok && (endMs == wantMs);
+  printf("%-16s VBRI: %u of %u ms, ended at %u ms, TOC off by up to %u bytes %s\n", path.substr(path.rfind('/') + 1).c_str(),
+         ms, wantMs, endMs, worst, ok ? "" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  static const struct {
+    const char *stream;
+    const char *decoder;
+    DecodeFn fn;
+  } cases[] = {
+    { "music44s.mp3",    "libmad",         DecodeMad },
+    { "music44s.mp3",    "helix-mp3",      DecodeHelixMP3 },
+    { "music44s.mp3",    "libmad-left",    DecodeMP3<AudioGeneratorMP3::DECODE_LEFT> },
+    { "music44s.mp3",    "libmad-downmix", DecodeMP3<AudioGeneratorMP3::DECODE_DOWNMIX> },
+    { "music44s.mp3",    "libmad-half",    DecodeMP3<AudioGeneratorMP3::DECODE_HALFRATE> },
+    { "voice22m.mp3",    "libmad",         DecodeMad },
+    { "voice22m.mp3",    "helix-mp3",      DecodeHelixMP3 },
+    { "noise44m.aac",    "helix-aac",      DecodeHelixAAC },
+    { "noise22he.aac",   "helix-aac",      DecodeHelixAAC },
+    { "noise22he.aac",   "helix-aac-core", DecodeHelixAACCore },
+    { "music44s.flac",   "libflac",        DecodeFLAC },
+    { "music48m24.flac", "libflac",        DecodeFLAC },
+    { "music44s.ogg",    "vorbis",         DecodeVorbis<false> },
+    { "music44s.ogg",    "vorbis-pre",     DecodeVorbis<true> },
+    { "voice22m.ogg",    "vorbis",         DecodeVorbis<false> },
+    { "voice22m.ogg",    "vorbis-pre",     DecodeVorbis<true> },
+  };
+  enum { PASSES = 5 }; // Fastest one counts
+
+  bool generate = (argc > 1) && !strcmp(argv[1], "-g");
+  std::string dir = (argc > 1 + generate) ? argv[1 + generate] : "corpus";
+  std::vector<Golden> golden = LoadGolden(dir + "/golden.txt");
+  if (!generate && golden.empty()) {
+    printf("No golden checksums in %s/golden.txt\n", dir.c_str());
+    return 1;
+  }
+  if (generate) printf("# stream decoder samples fnv1a64, written by codec_test -g\n");
+
+  // What the thread itself takes, to count only what the decoders add
+  Job base = { DecodeNothing, NULL, 0 };
+  Run(&base);
+
+  int failed = 0;
+  for (auto &c : cases) {
+    std::vector<uint8_t> data;
+    if (!Load(dir + "/" + c.stream, &data)) {
+      printf("%-16s %-14s: can't read it FAIL\n", c.stream, c.decoder);
+      failed++;
+      continue;
+    }
+    Job job = { c.fn, data.data(), data.size() };
+    Run(&job);
+    Job first = job;
+    for (int i = 1; i < PASSES; i++) {
+      Run(&job);
+      // The same stream again has to come out the same
+      if (job.pcm.hash != first.pcm.hash) first.ok = false;
+      first.ns = std::min(first.ns, job.ns);
+    }
+    const Pcm &pcm = first.pcm;
+    if (generate) {
+      printf("%s %s %llu %016llx\n", c.stream, c.decoder, (unsigned long long)pcm.samples, (unsigned long long)pcm.hash);
+      continue;
+    }
+    const Golden *g = NULL;
+    for (auto &e : golden) {
+      if ((e.stream == c.stream) && (e.decoder == c.decoder)) g = &e;
+    }
+    bool ok = first.ok && g && (g->samples == pcm.samples) && (g->hash == pcm.hash);
+    double secs = first.ns / 1e9;
+    printf("%-16s %-14s: %4u frames %d ch %5d Hz, %7.0f frames/s %6.1fx realtime, heap %6ld, stack %6zu %s\n",
+           c.stream, c.decoder, pcm.frames, pcm.channels, pcm.rate, pcm.frames / secs,
+           pcm.rate ? pcm.samples / (double)pcm.rate / secs : 0.0, first.heap, first.stack - base.stack,
+           ok ? "" : !first.ok ? "decode FAIL" : !g ? "no golden FAIL" : "checksum FAIL");
+    if (!ok) failed++;
+  }
+  if (!generate) failed += CheckVbri(dir + "/voice22m_vbri.mp3");
+  return failed ? 1 : 0;
+}
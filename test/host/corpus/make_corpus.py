@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Writes the reference streams for codec_test.  Needs numpy and soundfile.
+
+The streams are committed, this is only here to show how they were made and
+to add more.  After changing them run "make golden" and check the new
+checksums in."""
+
+import struct
+import numpy as np
+import soundfile as sf
+
+
+def music(rate, seconds, channels):
+    """Chords with vibrato, a sweep and a little noise, louder and softer"""
+    rng = np.random.default_rng(1)
+    t = np.arange(int(rate * seconds)) / rate
+    out = np.zeros((len(t), channels))
+    chords = [(220.0, 277.2, 329.6), (196.0, 246.9, 293.7), (174.6, 220.0, 261.6)]
+    for ch in range(channels):
+        sig = np.zeros(len(t))
+        for i, chord in enumerate(chords):
+            seg = (t >= i * seconds / 3) & (t < (i + 1) * seconds / 3)
+            for k, f in enumerate(chord):
+                vib = 1.0 + 0.003 * np.sin(2 * np.pi * 5.0 * t)
+                for h in range(1, 6):
+                    sig[seg] += np.sin(2 * np.pi * f * h * vib[seg] * t[seg] + ch * k) / (h * 3.0)
+        sweep = np.sin(2 * np.pi * (100.0 + (rate * 0.2) * t / seconds) * t)
+        sig += 0.3 * sweep + 0.05 * rng.standard_normal(len(t))
+        env = 0.6 + 0.4 * np.sin(2 * np.pi * 0.7 * t + ch)
+        out[:, ch] = sig * env
+    out /= np.max(np.abs(out)) * 1.12
+    return out if channels == 2 else out[:, 0]
+
+
+def vorbis(path, data, rate, quality):
+    with sf.SoundFile(path, 'w', rate, 1 if data.ndim == 1 else 2, format='OGG', subtype='VORBIS',
+                      compression_level=quality) as f:
+        f.title = path
+        f.write(data)
+
+
+def pns_sce(level):
+    """One SCE, long window, every band perceptual noise at one energy"""
+    bits = ''
+    bits += '000' + '0000'                  # SCE, tag 0
+    bits += format(100, '08b')              # global_gain
+    bits += '0' + '00' + '0'                # ics_info: long window, sine shape
+    bits += format(40, '06b') + '0'         # max_sfb, no prediction
+    bits += format(13, '04b')               # section: noise codebook
+    bits += format(31, '05b') + format(9, '05b')  # for 40 bands
+    bits += format(level, '09b') + '0' * 39 # first band energy, then deltas of 0
+    bits += '000'                           # no pulse, TNS or gain control
+    return bits
+
+
+def adts(raw_bits, rate_index):
+    """AAC-LC, mono, one raw data block behind an ADTS header"""
+    bits = raw_bits + '111'                 # END
+    bits += '0' * (-len(bits) % 8)
+    raw = int(bits, 2).to_bytes(len(bits) // 8, 'big')
+    length = 7 + len(raw)
+    hdr = (0xfff << 44) | (0 << 43) | (0 << 41) | (1 << 40) | (1 << 38) | (rate_index << 34) | (1 << 30)
+    hdr |= (length << 13) | (0x7ff << 2)
+    return hdr.to_bytes(7, 'big') + raw
+
+
+def adts_pns(path, frames):
+    """AAC-LC, mono, 44.1 kHz, every band perceptual noise, so the decoder's
+    own noise generator makes the sound.  No encoder needed."""
+    data = b''
+    for n in range(frames):
+        data += adts(pns_sce(256 + 50 + (n % 16)), 4)
+    open(path, 'wb').write(data)
+
+
+def adts_sbr(path, frames):
+    """HE-AAC with implicit signalling: the PNS core at 22.05 kHz and an SBR
+    fill element after it, so the decoder doubles the rate to 44.1 kHz.  The
+    header (start_freq 5, stop_freq 9) gives 8 low resolution envelope bands
+    and 3 noise floor bands, it's repeated every 8 frames.  Deltas of 0 are
+    '00' in f_huffman_env_1_5dB and '0' in f_huffman_env_3_0dB."""
+    data = b''
+    for n in range(frames):
+        sbr = '1101'                        # EXT_SBR_DATA
+        if n % 8 == 0:
+            sbr += '1' + '1' + '0101' + '1001' + '000' + '00' + '0' + '0'
+        else:
+            sbr += '0'
+        sbr += '0'                          # no extra data
+        sbr += '00' + '00' + '0'            # FIXFIX, one envelope, low resolution
+        sbr += '0' + '0'                    # both coded in frequency
+        sbr += '00' * 3                     # no inverse filtering
+        sbr += format(36 + 2 * (n % 6), '07b') + '00' * 7
+        sbr += format(8 + (n % 4), '05b') + '0' * 2
+        sbr += '0' + '0'                    # no sinusoids, no extended data
+        sbr += '0' * (-len(sbr) % 8)
+        fil = '110' + format(len(sbr) // 8, '04b') + sbr
+        data += adts(pns_sce(256 + 44 + (n % 16)) + fil, 7)
+    open(path, 'wb').write(data)
+
+
+
+def vbri(src, path, per_entry):
+    """The MPEG-2 Layer III stream with its Xing frame swapped for a VBRI one
+    as Fraunhofer's encoders write it, 32 bytes past the header.  The TOC has
+    the size of each run of per_entry frames."""
+    data = open(src, 'rb').read()
+    sizes, pos = [], 0
+    while pos + 4 <= len(data) and data[pos] == 0xff and (data[pos + 1] & 0xe0) == 0xe0:
+        bitrate = [0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160][data[pos + 2] >> 4]
+        rate = [22050, 24000, 16000][(data[pos + 2] >> 2) & 3]
+        sizes.append(72000 * bitrate // rate + ((data[pos + 2] >> 1) & 1))
+        pos += sizes[-1]
+    audio = sizes[1:]
+    runs = [sum(audio[i:i + per_entry]) for i in range(0, len(audio), per_entry)]
+    vbri = b'VBRI' + struct.pack('>HHHIIHHHH', 1, 576, 75, sum(audio), len(audio), len(runs), 1, 2, per_entry)
+    vbri += b''.join(struct.pack('>H', r) for r in runs)
+    frame = bytearray(sizes[0])
+    frame[:4] = data[:4]
+    frame[36:36 + len(vbri)] = vbri
+    open(path, 'wb').write(bytes(frame) + data[sizes[0]:])
+
+
+sf.write('music44s.mp3', music(44100, 2, 2), 44100, format='MP3', bitrate_mode='CONSTANT', compression_level=0.5)
+sf.write('voice22m.mp3', music(22050, 2, 1), 22050, format='MP3', bitrate_mode='VARIABLE', compression_level=0.9)
+sf.write('music44s.flac', music(44100, 0.4, 2), 44100, format='FLAC', subtype='PCM_16')
+sf.write('music48m24.flac', music(48000, 0.4, 1), 48000, format='FLAC', subtype='PCM_24')
+vbri('voice22m.mp3', 'voice22m_vbri.mp3', 2)
+adts_pns('noise44m.aac', 100)
+adts_sbr('noise22he.aac', 100)
+vorbis('music44s.ogg', music(44100, 2, 2), 44100, 0.8)
+vorbis('voice22m.ogg', music(22050, 2, 1), 22050, 1.0)
@@ -0,0 +1,191 @@
+/*
+  eq_test
+  Frequency response, limiting, idle behaviour and cost per frame of AudioOutputEQ
+*/
+
+#include <vector>
+#include <complex>
+#include "AudioOutputEQ.h"
+#include "host_test.h"
+
+// Takes both channels, up to room frames at a time when room is set
+class CaptureOutput : public AudioOutput
+{
+  public:
+    std::vector<int16_t> left, right;
+    int room = -1;
+    virtual bool begin() override { return true; }
+    virtual bool ConsumeSample(int16_t sample[2]) override
+    {
+      if (!room) return false;
+      if (room > 0) room--;
+      left.push_back(sample[0]);
+      right.push_back(sample[1]);
+      return true;
+    }
+    virtual bool stop() override { return true; }
+};
+
+// The response the quantised coefficients should give, preamp included
+class ProbeEQ : public AudioOutputEQ
+{
+  public:
+    ProbeEQ(AudioOutput *dest) : AudioOutputEQ(dest) {}
+    double ExpectedDb(double hz)
+    {
+      std::complex<double> z = std::polar(1.0, -2.0 * M_PI * hz / hertz); // z^-1
+      std::complex<double> h = preampQ15 / 32768.0;
+      for (int b = 0; b < MAX_BANDS; b++) {
+        if (bands[b].type == BAND_OFF) continue;
+        const Biquad *bq = &biquad[b];
+        double one = 1 << COEF_SHIFT;
+        double b0 = bq->b0 / one, b1 = bq->b1 / one, b2 = bq->b2 / one, a1 = bq->a1 / one, a2 = bq->a2 / one;
+        std::complex<double> num = (b0 + (b1 + b2 * z) * z) * (double)(1 << bq->shift);
+        std::complex<double> den = 1.0 + (a1 + a2 * z) * z;
+        h *= num / den;
+      }
+      return 20.0 * log10(std::abs(h));
+    }
+};
+
+static void Feed(AudioOutputEQ *eq, const std::vector<int16_t> &in)
+{
+  for (size_t done = 0; done < in.size() / 2; ) {
+    done += eq->ConsumeSamples(const_cast<int16_t *>(&in[done * 2]), std::min<size_t>(in.size() / 2 - done, 441));
+  }
+}
+
+int main()
+{
+  static const double freqs[] = { 50, 100, 150, 300, 350, 1000, 2800, 5000, 7000, 12000 };
+  // Tones the cascade takes down further than this are lost in the rounding
+  // of the 16 bit output and aren't compared
+  const double floorDb = -45.0;
+  const double tolDb = 0.1;
+  const int rate = 44100;
+  CaptureOutput out;
+  int failed = 0;
+
+  for (int p = 0; p < AudioOutputEQ::PRESET_COUNT; p++) {
+    // The tone goes in on the left only, anything on the right is crosstalk
+    double worst = 0;
+    bool crosstalk = false;
+    printf("%-8s", AudioOutputEQ::PresetName(p));
+    for (double f : freqs) {
+      ProbeEQ eq(&out);
+      eq.SetRate(rate);
+      eq.SetPreset(p);
+      eq.begin();
+      std::vector<int16_t> in(rate * 2);
+      for (int i = 0; i < rate; i++) {
+        in[i * 2] = (int16_t)lrint(TONE_AMPLITUDE * sin(2.0 * M_PI * f * i / rate));
+      }
+      out.left.clear();
+      out.right.clear();
+      Feed(&eq, in);
+      // Past the filters' settling
+      size_t from = rate / 4;
+      double db = LevelDb(&out.left[from], out.left.size() - from, f, rate);
+      double want = eq.ExpectedDb(f);
+      if ((want > floorDb) && (fabs(db - want) > fabs(worst))) worst = db - want;
+      for (int16_t r : out.right) {
+        if (r) crosstalk = true;
+      }
+      printf(" %g:%+.1f", f, db);
+    }
+    bool ok = (fabs(worst) <= tolDb) && !crosstalk;
+    printf(" dB, off by %+.3f dB%s %s\n", worst, crosstalk ? ", crosstalk" : "", ok ? "" : "FAIL");
+    if (!ok) failed++;
+  }
+
+  // After a loud burst the state has to decay to true silence, rounding
+  // mustn't leave a DC offset or a limit cycle behind
+  for (int p = 0; p < AudioOutputEQ::PRESET_COUNT; p++) {
+    AudioOutputEQ eq(&out);
+    eq.SetPreset(p);
+    eq.begin();
+    std::vector<int16_t> in(rate * 2 * 2);
+    for (int i = 0; i < rate / 10; i++) in[i * 2] = in[i * 2 + 1] = rand() % 60000 - 30000;
+    out.left.clear();
+    out.right.clear();
+    Feed(&eq, in);
+    int residue = 0;
+    for (size_t i = out.left.size() / 2; i < out.left.size(); i++) {
+      residue = std::max(residue, std::max(abs(out.left[i]), abs(out.right[i])));
+    }
+    printf("%-8s idle residue %d %s\n", AudioOutputEQ::PresetName(p), residue, residue ? "FAIL" : "");
+    if (residue) failed++;
+  }
+
+  // A loud tone boosted past full scale comes out at the limit as a clean
+  // tone, where clipping would have put its third harmonic at -14 dB
+  {
+    AudioOutputEQ eq(&out);
+    eq.SetBand(0, AudioOutputEQ::BAND_PEAK, 1000.0f, 6.0f, 1.0f);
+    eq.begin();
+    std::vector<int16_t> in(rate * 2);
+    for (int i = 0; i < rate; i++) {
+      in[i * 2] = in[i * 2 + 1] = (int16_t)lrint(30000 * sin(2.0 * M_PI * 1000 * i / rate));
+    }
+    out.left.clear();
+    out.right.clear();
+    Feed(&eq, in);
+    size_t from = rate / 4;
+    int peak = 0;
+    for (size_t i = from; i < out.left.size(); i++) peak = std::max(peak, abs(out.left[i]));
+    double tone = LevelDb(&out.left[from], out.left.size() - from, 1000, rate);
+    double harmonics = -200;
+    for (int h = 2; h <= 5; h++) {
+      harmonics = std::max(harmonics, LevelDb(&out.left[from], out.left.size() - from, 1000 * h, rate) - tone);
+    }
+    bool ok = (peak < 32767) && (harmonics < -40.0);
+    printf("limiter: peak %d, harmonics %.1f dB below the tone %s\n", peak, -harmonics, ok ? "" : "FAIL");
+    if (!ok) failed++;
+  }
+
+  // Sample by sample and in blocks against a sink that takes odd amounts
+  {
+    CaptureOutput a, b;
+    AudioOutputEQ one(&a), blocks(&b);
+    one.SetPreset(AudioOutputEQ::PRESET_SPEAKER);
+    blocks.SetPreset(AudioOutputEQ::PRESET_SPEAKER);
+    one.begin();
+    blocks.begin();
+    const int frames = 10000;
+    std::vector<int16_t> in(frames * 2);
+    for (auto &v : in) v = rand() % 20000 - 10000;
+    for (int i = 0; i < frames; i++) one.ConsumeSample(&in[i * 2]);
+    for (int done = 0; done < frames; ) {
+      b.room = rand() % 50;
+      done += blocks.ConsumeSamples(&in[done * 2], std::min(rand() % 200 + 1, frames - done));
+      blocks.loop();
+    }
+    b.room = -1;
+    blocks.loop();
+    bool ok = (a.left == b.left) && (a.right == b.right);
+    printf("blocks against single samples: %zu and %zu frames %s\n", a.left.size(), b.left.size(), ok ? "same" : "differ FAIL");
+    if (!ok) failed++;
+  }
+
+  // Cost, 44.1 kHz stereo.  The library's own eqCycles counts host cycles here.
+  for (int p = AudioOutputEQ::PRESET_SPEAKER; p < AudioOutputEQ::PRESET_COUNT; p++) {
+    AudioOutputEQ eq(&out);
+    eq.SetPreset(p);
+    eq.begin();
+    std::vector<int16_t> in(rate * 2);
+    for (auto &v : in) v = rand() % 20000 - 10000;
+    out.left.clear();
+    out.right.clear();
+    out.left.reserve(10 * rate);
+    out.right.reserve(10 * rate);
+    HostTimer t;
+    for (int s = 0; s < 10; s++) Feed(&eq, in);
+    double ns = t.ns() / out.left.size();
+    AudioStats st;
+    eq.getStats(&st);
+    printf("%-8s %.1f ns, %u host cycles per frame, %.2f%% of a core at 44.1 kHz\n",
+           AudioOutputEQ::PresetName(p), ns, st.eqCycles, ns * rate / 1e7);
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+/*
+  fpm_ops
+  libmad's fixed-point multiplies, built once per FPM variant by the Makefile
+  with FPM_SUFFIX naming the copy
+*/
+
+#define SIZEOF_INT 4
+#include "fixed.h"
+#include "fpm_ops.h"
+
+mad_fixed_t FPM_NAME(mul)(mad_fixed_t x, mad_fixed_t y)
+{
+  return mad_f_mul(x, y);
+}
+
+// A negated sum of products, as the IMDCT and the synthesis filter do them
+mad_fixed_t FPM_NAME(sum)(const mad_fixed_t *x, const mad_fixed_t *y, int n)
+{
+  mad_fixed64hi_t hi;
+  mad_fixed64lo_t lo;
+  int i;
+
+  MAD_F_ML0(hi, lo, x[0], y[0]);
+  for (i = 1; i < n; i++)
+    MAD_F_MLA(hi, lo, x[i], y[i]);
+  MAD_F_MLN(hi, lo);
+  return MAD_F_MLZ(hi, lo);
+}
@@ -0,0 +1,27 @@
+/*
+  fpm_ops
+  One copy of the multiplies per FPM variant, see fpm_ops.c
+*/
+
+#ifndef _FPM_OPS_H
+#define _FPM_OPS_H
+
+#define FPM_PASTE(a, b) a##b
+#define FPM_PASTE2(a, b) FPM_PASTE(a, b)
+#define FPM_NAME(n) FPM_PASTE2(n, FPM_SUFFIX)
+
+typedef int fpm_t;
+
+// FPM_64BIT, the reference
+fpm_t mul_ref(fpm_t x, fpm_t y);
+fpm_t sum_ref(const fpm_t *x, const fpm_t *y, int n);
+// FPM_XTENSA, exact
+fpm_t mul_xtensa(fpm_t x, fpm_t y);
+fpm_t sum_xtensa(const fpm_t *x, const fpm_t *y, int n);
+// FPM_XTENSA with OPT_SPEED
+fpm_t mul_xtensa_speed(fpm_t x, fpm_t y);
+fpm_t sum_xtensa_speed(const fpm_t *x, const fpm_t *y, int n);
+// FPM_DEFAULT, what the ESP32 build used before FPM_XTENSA
+fpm_t mul_default(fpm_t x, fpm_t y);
+
+#endif
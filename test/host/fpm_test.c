@@ -0,0 +1,75 @@
+/*
+  fpm_test
+  FPM_XTENSA against the reference FPM_64BIT and against exact sums
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "fpm_ops.h"
+
+enum { FRACBITS = 28, TAPS = 18, RUNS = 2000000 };
+
+static uint32_t seed = 1;
+
+// Full 32 bit values, every other one scaled down to the sizes the decoder sees
+static int32_t Random(int i)
+{
+  seed = seed * 1664525u + 1013904223u;
+  uint32_t a = seed;
+  seed = seed * 1664525u + 1013904223u;
+  int32_t v = (int32_t)((a & 0xffff0000u) | (seed >> 16));
+  return (i & 1) ? v >> (i % 9) : v;
+}
+
+static int64_t Abs64(int64_t v)
+{
+  return (v < 0) ? -v : v;
+}
+
+int main(void)
+{
+  long mulDiffs = 0;
+  long sumDiffs = 0;
+  int64_t speedMul = 0, speedSum = 0, defaultMul = 0;
+  int i, k;
+
+  for (i = 0; i < RUNS; i++) {
+    int32_t x = Random(i), y = Random(i + 1);
+    int32_t ref = mul_ref(x, y);
+    if (mul_xtensa(x, y) != ref) mulDiffs++;
+    if (Abs64((int64_t)mul_xtensa_speed(x, y) - ref) > speedMul) speedMul = Abs64((int64_t)mul_xtensa_speed(x, y) - ref);
+    // FPM_DEFAULT only ever sees values in the decoder's range
+    x >>= 3;
+    y >>= 3;
+    if (Abs64((int64_t)mul_default(x, y) - mul_ref(x, y)) > defaultMul) defaultMul = Abs64((int64_t)mul_default(x, y) - mul_ref(x, y));
+
+    if (i % 100 == 0) {
+      // Sums are compared with the exact 64 bit sum, FPM_64BIT truncates
+      // every product on its own and isn't the reference there
+      int32_t a[TAPS], b[TAPS];
+      int64_t acc = 0;
+      for (k = 0; k < TAPS; k++) {
+        a[k] = Random(i + k) >> 3;
+        b[k] = Random(i + k + 1) >> 3;
+        acc += (int64_t)a[k] * b[k];
+      }
+      int32_t exact = (int32_t)(-acc >> FRACBITS);
+      if (sum_xtensa(a, b, TAPS) != exact) sumDiffs++;
+      if (Abs64((int64_t)sum_xtensa_speed(a, b, TAPS) - exact) > speedSum) speedSum = Abs64((int64_t)sum_xtensa_speed(a, b, TAPS) - exact);
+    }
+  }
+
+  printf("FPM_XTENSA: %ld of %d products differ from FPM_64BIT, %ld of %d sums from exact\n",
+         mulDiffs, RUNS, sumDiffs, RUNS / 100);
+  printf("FPM_XTENSA with OPT_SPEED: %lld LSB worst product, %lld LSB worst %d term sum\n",
+         (long long)speedMul, (long long)speedSum, TAPS);
+  printf("FPM_DEFAULT: %lld LSB worst product\n", (long long)defaultMul);
+
+  // OPT_SPEED drops the low word: under 16 LSB a product, a sum adds them up
+  if (mulDiffs || sumDiffs || speedMul >= 16 || speedSum >= 16 * TAPS) {
+    printf("FAIL\n");
+    return 1;
+  }
+  return 0;
+}
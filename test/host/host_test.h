@@ -0,0 +1,40 @@
+/*
+  host_test
+  Shared helpers for the host tests
+*/
+
+#ifndef _HOST_TEST_H
+#define _HOST_TEST_H
+
+#include <Arduino.h>
+
+enum { TONE_AMPLITUDE = 16384 };
+
+// Level of the tone at hz in dB relative to TONE_AMPLITUDE, Hann windowed
+static inline double LevelDb(const int16_t *pcm, size_t n, double hz, int rate)
+{
+  double re = 0, im = 0, wsum = 0;
+  for (size_t i = 0; i < n; i++) {
+    double w = 0.5 - 0.5 * cos(2.0 * M_PI * i / n);
+    double a = 2.0 * M_PI * hz * i / rate;
+    re += w * pcm[i] * cos(a);
+    im += w * pcm[i] * sin(a);
+    wsum += w;
+  }
+  double amp = 2.0 * sqrt(re * re + im * im) / wsum;
+  return 20.0 * log10(amp / TONE_AMPLITUDE + 1e-12);
+}
+
+class HostTimer
+{
+  public:
+    HostTimer() { start = HostNanos(); startCycles = ESP.getCycleCount(); }
+    double ns() { return (double)(HostNanos() - start); }
+    uint32_t cycles() { return ESP.getCycleCount() - startCycles; }
+
+  private:
+    uint64_t start;
+    uint32_t startCycles;
+};
+
+#endif
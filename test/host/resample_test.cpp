@@ -0,0 +1,119 @@
+/*
+  resample_test
+  Frequency response and cost per output sample of AudioOutputResample
+*/
+
+#include <vector>
+#include "AudioOutputResample.h"
+#include "host_test.h"
+
+// Takes everything, left channel only
+class CaptureOutput : public AudioOutput
+{
+  public:
+    std::vector<int16_t> pcm;
+    virtual bool begin() override { return true; }
+    virtual bool ConsumeSample(int16_t sample[2]) override { pcm.push_back(sample[0]); return true; }
+    virtual bool stop() override { return true; }
+};
+
+// Level of a tone at hz in dB relative to the input amplitude
+static double Resample(int quality, int inRate, double hz, double atHz, CaptureOutput *out)
+{
+  AudioOutputResample rs(out, 44100, quality);
+  rs.SetRate(inRate);
+  rs.begin();
+  const int frames = inRate; // One second
+  std::vector<int16_t> in(frames * 2);
+  for (int i = 0; i < frames; i++) {
+    in[i * 2] = in[i * 2 + 1] = (int16_t)lrint(TONE_AMPLITUDE * sin(2.0 * M_PI * hz * i / inRate));
+  }
+  out->pcm.clear();
+  for (int done = 0; done < frames; ) {
+    done += rs.ConsumeSamples(&in[done * 2], (frames - done > 512) ? 512 : frames - done);
+  }
+  // Past the filter's start-up
+  return LevelDb(&out->pcm[1024], out->pcm.size() - 2048, atHz, 44100);
+}
+
+// The same tone through linear interpolation in double precision, at the
+// resampler's own output times, which is what QUALITY_LOW is meant to be
+static double LinearDb(int inRate, double hz, double atHz)
+{
+  std::vector<int16_t> pcm;
+  uint32_t step = ((uint64_t)inRate << 16) / 44100;
+  // Each output lies between the two inputs before the newest one
+  for (uint64_t pos = 0; (pos >> 16) < (uint64_t)inRate; pos += step) {
+    double n = (double)(pos >> 16) - 2;
+    double frac = (pos & 0xffff) / 65536.0;
+    double a = (n < 0) ? 0 : sin(2.0 * M_PI * hz * n / inRate);
+    double b = (n + 1 < 0) ? 0 : sin(2.0 * M_PI * hz * (n + 1) / inRate);
+    pcm.push_back((int16_t)lrint(TONE_AMPLITUDE * (a + (b - a) * frac)));
+  }
+  return LevelDb(&pcm[1024], pcm.size() - 2048, atHz, 44100);
+}
+
+int main()
+{
+  static const char *names[] = { "low", "medium", "high" };
+  // Flat to within passDb up to 80% of the lower Nyquist frequency, and at
+  // least rejectDb below the input for the images of upsampling and the tones
+  // that fold back when decimating.  Linear interpolation has neither, it has
+  // to match its own response to within linearDb.
+  static const double passDb[] = { 0, 1.0, 0.25 };
+  static const double rejectDb[] = { 0, 60.0, 90.0 };
+  const double linearDb = 0.1;
+  static const int rates[] = { 8000, 11025, 16000, 22050, 24000, 32000, 48000 };
+  CaptureOutput out;
+  int failed = 0;
+
+  for (int q = AudioOutputResample::QUALITY_LOW; q <= AudioOutputResample::QUALITY_HIGH; q++) {
+    for (int r : rates) {
+      double nyquist = ((r < 44100) ? r : 44100) / 2.0;
+      bool low = (q == AudioOutputResample::QUALITY_LOW);
+      // Passband up to 80% of the lower Nyquist frequency
+      double worst = 0;
+      double off = 0;
+      for (double f = 200; f <= nyquist * 0.8; f *= 1.5) {
+        double db = Resample(q, r, f, f, &out);
+        if (fabs(db) > fabs(worst)) worst = db;
+        if (low) off = std::max(off, fabs(db - LinearDb(r, f, f)));
+      }
+      // Upsampling: the image of a tone at 3/4 of the input Nyquist frequency.
+      // Downsampling: a tone just above the output Nyquist frequency, where it folds to.
+      double f = (r < 44100) ? r * 0.375 : 23500;
+      double at = (r < 44100) ? r - f : 44100 - f;
+      double image = Resample(q, r, f, at, &out);
+      bool ok;
+      if (low) {
+        off = std::max(off, fabs(image - LinearDb(r, f, at)));
+        ok = off <= linearDb;
+      } else {
+        ok = (fabs(worst) <= passDb[q]) && (image <= -rejectDb[q]);
+      }
+      printf("%-6s %5d Hz: passband %+6.2f dB, image %7.1f dB", names[q], r, worst, image);
+      if (low) printf(", off linear by %.2f dB", off);
+      printf(" %s\n", ok ? "" : "FAIL");
+      if (!ok) failed++;
+    }
+  }
+
+  // Cost, 48 kHz stereo in
+  for (int q = AudioOutputResample::QUALITY_LOW; q <= AudioOutputResample::QUALITY_HIGH; q++) {
+    AudioOutputResample rs(&out, 44100, q);
+    rs.SetRate(48000);
+    rs.begin();
+    std::vector<int16_t> in(48000 * 2);
+    for (size_t i = 0; i < in.size(); i++) in[i] = rand() % 20000 - 10000;
+    out.pcm.clear();
+    out.pcm.reserve(10 * 44100 + 64);
+    HostTimer t;
+    for (int s = 0; s < 10; s++) {
+      for (int done = 0; done < 48000; ) done += rs.ConsumeSamples(&in[done * 2], 480);
+    }
+    printf("%-6s 48000 Hz: %.1f ns, %.0f host cycles per output frame\n", names[q],
+           t.ns() / out.pcm.size(), t.cycles() / (double)out.pcm.size());
+  }
+
+  return failed ? 1 : 0;
+}
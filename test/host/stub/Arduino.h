@@ -0,0 +1,97 @@
+/*
+  Arduino.h for the host tests
+  Just enough of Arduino-ESP32 and FreeRTOS to build the library on Linux
+*/
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pgmspace.h>
+
+#define IRAM_ATTR
+#define F(x) (x)
+#define PI 3.1415926535897932384626433832795
+
+static inline uint64_t HostNanos()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// The codecs in C only need the types and the memory
+#ifdef __cplusplus
+#include <algorithm>
+
+// The library's log goes to stderr, apart from what the tests print
+class HostSerial
+{
+  public:
+    template<class... A> int printf(const char *f, A... a) { return ::fprintf(stderr, f, a...); }
+    template<class... A> int printf_P(const char *f, A... a) { return ::fprintf(stderr, f, a...); }
+    void print(const char *s) { fputs(s, stderr); }
+    void println(const char *s) { fprintf(stderr, "%s\n", s); }
+    void flush() { fflush(stderr); }
+};
+static HostSerial Serial __attribute__((unused));
+static inline unsigned long millis() { return HostNanos() / 1000000; }
+static inline unsigned long micros() { return HostNanos() / 1000; }
+static inline void delay(unsigned long) {}
+static inline void yield() {}
+
+// getCycleCount() counts host cycles where there is a cycle counter, so the
+// library's own cycle statistics work, in host units
+class HostESP
+{
+  public:
+    uint32_t getCycleCount()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      return (uint32_t)__builtin_ia32_rdtsc();
+#else
+      return (uint32_t)HostNanos();
+#endif
+    }
+};
+static HostESP ESP __attribute__((unused));
+#endif
+
+// Memory, there is no PSRAM on the host
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+static inline void *heap_caps_malloc(size_t n, uint32_t caps) { return (caps & MALLOC_CAP_SPIRAM) ? NULL : malloc(n); }
+static inline void heap_caps_free(void *p) { free(p); }
+static inline size_t heap_caps_get_free_size(uint32_t) { return 0; }
+static inline size_t heap_caps_get_largest_free_block(uint32_t) { return 0; }
+static inline int psramFound() { return 0; }
+
+// FreeRTOS, single threaded: a task runs to completion when it is created
+typedef void *TaskHandle_t;
+typedef void *QueueHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+#define pdPASS 1
+#define pdTRUE 1
+#define portMAX_DELAY 0xffffffff
+#define portTICK_PERIOD_MS 1
+static inline void vTaskDelay(TickType_t) {}
+static inline void vTaskDelete(TaskHandle_t) {}
+static inline int xQueueReceive(QueueHandle_t, void *, TickType_t) { return 0; }
+static inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+static inline int xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+static inline int xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+static inline void vSemaphoreDelete(SemaphoreHandle_t) {}
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#endif
@@ -0,0 +1,16 @@
+/*
+  esp_attr.h for the host tests
+*/
+
+#ifndef _HOST_ESP_ATTR_H
+#define _HOST_ESP_ATTR_H
+
+// As in ESP-IDF, each DRAM_ATTR object gets a section of its own under
+// .dram1, so a table placed there is linked apart from .rodata like on the
+// device, and clashing section flags fail the build the same way
+#define _HOST_ATTR_STR2(x) #x
+#define _HOST_ATTR_STR(x) _HOST_ATTR_STR2(x)
+#define DRAM_ATTR __attribute__((section(".dram1." _HOST_ATTR_STR(__COUNTER__))))
+#define IRAM_ATTR
+
+#endif
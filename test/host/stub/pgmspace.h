@@ -0,0 +1,22 @@
+/*
+  pgmspace.h for the host tests, flash and RAM are the same thing here
+*/
+
+#ifndef _HOST_PGMSPACE_H
+#define _HOST_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+
+#endif